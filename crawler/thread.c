@@ -31,6 +31,7 @@ static void *thread_handler_(void *arg);
 static int thread_prefetch_(CRAWL *crawl, URI *uri, const char *uristr, void *userdata);
 
 static char *cache, *username, *password, *endpoint; 
+static CRAWLSHARE *share;
 static SPIDER **spiders;
 static int activethreads;
 static pthread_once_t thread_once_control = PTHREAD_ONCE_INIT;
@@ -48,11 +49,12 @@ thread_create(int offset)
 	SPIDERCALLBACKS callbacks;
 	CRAWL *crawl;
 	pthread_t thread;
-	int oneshot, r;
+	int oneshot, concurrency, r;
 	char *t;
 
 	pthread_once(&thread_once_control, thread_init_);
 	oneshot = config_get_bool("crawler:oneshot", 0);
+	concurrency = config_get_int("crawler:concurrency", 1);
 	memset(&callbacks, 0, sizeof(callbacks));
 	callbacks.version = SPIDER_CALLBACKS_VERSION;
 	callbacks.logger = log_vprintf;
@@ -95,6 +97,20 @@ thread_create(int offset)
 			r = -1;
 		}
 	}
+	if(concurrency > 1)
+	{
+		if(crawl_set_concurrency(crawl, concurrency))
+		{
+			r = -1;
+		}
+	}
+	if(share)
+	{
+		if(crawl_set_share(crawl, share))
+		{
+			r = -1;
+		}
+	}
 	if(oneshot)
 	{
 		spider->api->set_oneshot(spider);
@@ -249,6 +265,14 @@ thread_init_(void)
 	username = config_geta("cache:username", NULL);
 	password = config_geta("cache:password", NULL);
 	endpoint = config_geta("cache:endpoint", NULL);
+	if(config_get_bool("crawler:share-connections", 1))
+	{
+		share = crawl_share_create();
+		if(!share)
+		{
+			log_printf(LOG_WARNING, "[thread] failed to create share object; DNS look-ups and TLS sessions will not be shared between threads\n");
+		}
+	}
 	pthread_mutex_init(&lock, NULL);
 	pthread_cond_init(&createcond, NULL);
 	pthread_mutex_init(&createlock, NULL);
@@ -266,6 +290,7 @@ thread_cleanup_(void)
 	crawl_free(NULL, username);
 	crawl_free(NULL, password);
 	crawl_free(NULL, endpoint);
+	crawl_share_destroy(share);
 }
 
 /* The body of a single crawl thread */
@@ -275,6 +300,7 @@ thread_handler_(void *arg)
 	SPIDER *spider;
 	CLUSTER *cluster;
 	CRAWL *crawler;
+	CRAWLSTATS stats;
 	int threadid;
 	const char *env;
 	int r;
@@ -340,6 +366,8 @@ thread_handler_(void *arg)
 			sleep(1);
 		}
 	}
+	crawl_stats(crawler, &stats);
+	log_printf(LOG_NOTICE, MSG_N_CRAWL_REVALIDATION " [%s] crawler thread #%d: %lu requests, %lu conditional (%lu with ETag), %lu not modified, %lu identical\n", env, threadid + 1, stats.fetches, stats.conditional, stats.etag, stats.not_modified, stats.identical);
 	log_printf(LOG_NOTICE, MSG_N_CRAWL_TERMINATING " [%s] crawler thread #%d\n", env, threadid + 1);
 	/* 	log_printf(LOG_NOTICE, MSG_N_CRAWL_TERMINATING " [%s] crawler %d/%d (thread %d/%d)\n", env, instid + threadid + 1, crawlercount, threadid + 1, threadcount); */
 	spider->api->terminate(spider);
@@ -154,6 +154,19 @@ cache_open_payload_write_(CRAWL *crawl, const CACHEKEY key)
 	return crawl->cache.impl->payload_open_write(&(crawl->cache), key);
 }
 
+/* Pass the headers of a payload being written on to the cache, if it
+ * wants them
+ */
+int
+cache_payload_headers_(CRAWL *crawl, const CACHEKEY key, FILE *f, CRAWLOBJ *obj)
+{
+	if(!crawl->cache.impl || !crawl->cache.impl->payload_headers)
+	{
+		return 0;
+	}
+	return crawl->cache.impl->payload_headers(&(crawl->cache), key, f, crawl_obj_type(obj), crawl_obj_content_location(obj));
+}
+
 int
 cache_close_payload_rollback_(CRAWL *crawl, const CACHEKEY key, FILE *f)
 {
@@ -224,6 +237,27 @@ crawl_cache_scheme(CRAWL *crawl, const char *scheme)
 	{
 		return s3cache;
 	}
+	if(!strcasecmp(scheme, "pack"))
+	{
+		return packcache;
+	}
+	if(!strcasecmp(scheme, "tiered"))
+	{
+		return tieredcache;
+	}
 	errno = EINVAL;
 	return NULL;
 }
+
+/* Wait until all of the objects committed to the cache have been stored
+ * durably; returns -1 if any of them could not be
+ */
+int
+crawl_cache_sync(CRAWL *crawl)
+{
+	if(!crawl->cache.impl || !crawl->cache.impl->sync)
+	{
+		return 0;
+	}
+	return crawl->cache.impl->sync(&(crawl->cache));
+}
@@ -25,6 +25,9 @@
 
 #include "p_libcrawl.h"
 
+#include <dirent.h>
+#include <sys/mman.h>
+
 static size_t diskcache_filename_(CRAWL *crawl, const CACHEKEY key, const char *type, char *buf, size_t bufsize, int temporary);
 static int diskcache_create_dirs_(CRAWL *crawl, const char *path);
 static int diskcache_copy_filename_(CRAWL *crawl, const CACHEKEY key, const char *type, int temporary);
@@ -43,8 +46,16 @@ static char *diskcache_uri_(CRAWLCACHE *cache, const CACHEKEY key);
 static int diskcache_set_username_(CRAWLCACHE *cache, const char *username);
 static int diskcache_set_password_(CRAWLCACHE *cache, const char *password);
 static int diskcache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint);
+static const void *diskcache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len);
+static int diskcache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len);
 static int diskcache_close_info_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f);
 static int diskcache_close_info_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f);
+static int diskcache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+static int diskcache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len);
+static int diskcache_payload_stat_(CRAWLCACHE *cache, const CACHEKEY key, uint64_t *size);
+static int diskcache_remove_(CRAWLCACHE *cache, const CACHEKEY key);
+static int diskcache_payload_list_(CRAWLCACHE *cache, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg);
+static int diskcache_list_dir_(CRAWLCACHE *cache, const char *path, int depth, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg);
 
 static const CRAWLCACHEIMPL diskcache_impl = {
 	NULL,
@@ -59,7 +70,16 @@ static const CRAWLCACHEIMPL diskcache_impl = {
 	diskcache_uri_,
 	diskcache_set_username_,
 	diskcache_set_password_,
-	diskcache_set_endpoint_
+	diskcache_set_endpoint_,
+	diskcache_payload_map_,
+	diskcache_payload_unmap_,
+	diskcache_info_read_buf_,
+	diskcache_info_write_buf_,
+	NULL,
+	diskcache_payload_stat_,
+	diskcache_remove_,
+	NULL,
+	diskcache_payload_list_
 };
 
 const CRAWLCACHEIMPL *diskcache = &diskcache_impl;
@@ -169,19 +189,20 @@ diskcache_close_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, CRAWLOBJ
 	return 0;
 }
 
+/* Read a sidecar, in either format, as a JSON dictionary */
 static int
 diskcache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **dict)
 {
-	FILE *f;
+	char *buf;
+	size_t len;
 	json_t *json;
 
-	f = diskcache_open_info_read_(cache, key);
-	if(!f)
+	if(diskcache_info_read_buf_(cache, key, &buf, &len))
 	{
 		return -1;
 	}
-	json = json_loadf(f, 0, NULL);
-	fclose(f);
+	json = crawl_sidecar_json_(cache->crawl, buf, len);
+	crawl_free(cache->crawl, buf);
 	if(!json)
 	{
 		return -1;
@@ -194,6 +215,64 @@ diskcache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **dict)
 	return 0;
 }
 
+static int
+diskcache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len)
+{
+	FILE *f;
+	struct stat sbuf;
+	char *p;
+	size_t n;
+
+	*buf = NULL;
+	*len = 0;
+	f = diskcache_open_info_read_(cache, key);
+	if(!f)
+	{
+		return -1;
+	}
+	if(fstat(fileno(f), &sbuf))
+	{
+		fclose(f);
+		return -1;
+	}
+	p = (char *) crawl_alloc(cache->crawl, sbuf.st_size + 1);
+	if(!p)
+	{
+		fclose(f);
+		return -1;
+	}
+	n = fread(p, 1, sbuf.st_size, f);
+	if(ferror(f))
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_DISK_INFOREAD ": %s: %s\n", cache->crawl->cachefile, strerror(errno));
+		crawl_free(cache->crawl, p);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	*buf = p;
+	*len = n;
+	return 0;
+}
+
+static int
+diskcache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len)
+{
+	FILE *f;
+
+	f = diskcache_open_info_write_(cache, key);
+	if(!f)
+	{
+		return -1;
+	}
+	if(fwrite(buf, 1, len, f) != len || fflush(f))
+	{
+		diskcache_close_info_rollback_(cache, key, f);
+		return -1;
+	}
+	return diskcache_close_info_commit_(cache, key, f);
+}
+
 static int
 diskcache_info_write_(CRAWLCACHE *cache, const CACHEKEY key, const json_t *dict)
 {
@@ -346,6 +425,178 @@ diskcache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint)
 	return 0;
 }
 
+/* Map a payload file into memory */
+static const void *
+diskcache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len)
+{
+	int fd;
+	struct stat sbuf;
+	void *p;
+
+	if(diskcache_copy_filename_(cache->crawl, key, CACHE_PAYLOAD_SUFFIX, 0))
+	{
+		return NULL;
+	}
+	fd = open(cache->crawl->cachefile, O_RDONLY);
+	if(fd == -1 || fstat(fd, &sbuf))
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_DISK_PAYLOADREAD ": %s: %s\n", cache->crawl->cachefile, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		return NULL;
+	}
+	if(!sbuf.st_size)
+	{
+		/* mmap() won't map an empty file */
+		close(fd);
+		*len = 0;
+		return "";
+	}
+	p = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_DISK_PAYLOADREAD ": %s: %s\n", cache->crawl->cachefile, strerror(errno));
+		return NULL;
+	}
+	posix_madvise(p, sbuf.st_size, POSIX_MADV_SEQUENTIAL);
+	*len = sbuf.st_size;
+	return p;
+}
+
+static int
+diskcache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len)
+{
+	(void) cache;
+
+	if(!len)
+	{
+		return 0;
+	}
+	return munmap((void *) ptr, len);
+}
+
+/* Determine whether a payload file exists, and its size */
+static int
+diskcache_payload_stat_(CRAWLCACHE *cache, const CACHEKEY key, uint64_t *size)
+{
+	struct stat sbuf;
+
+	if(diskcache_copy_filename_(cache->crawl, key, CACHE_PAYLOAD_SUFFIX, 0))
+	{
+		return -1;
+	}
+	if(stat(cache->crawl->cachefile, &sbuf))
+	{
+		return -1;
+	}
+	*size = sbuf.st_size;
+	return 0;
+}
+
+/* Remove a payload and its sidecar, either of which may not exist */
+static int
+diskcache_remove_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	int r;
+
+	r = 0;
+	if(diskcache_copy_filename_(cache->crawl, key, CACHE_PAYLOAD_SUFFIX, 0))
+	{
+		return -1;
+	}
+	if(unlink(cache->crawl->cachefile) && errno != ENOENT)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_DISK_REMOVE ": %s: %s\n", cache->crawl->cachefile, strerror(errno));
+		r = -1;
+	}
+	if(diskcache_copy_filename_(cache->crawl, key, CACHE_INFO_SUFFIX, 0))
+	{
+		return -1;
+	}
+	if(unlink(cache->crawl->cachefile) && errno != ENOENT)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_DISK_REMOVE ": %s: %s\n", cache->crawl->cachefile, strerror(errno));
+		r = -1;
+	}
+	return r;
+}
+
+/* List the payloads in the cache, which are the files named by their keys
+ * two levels below its root (see diskcache_filename_())
+ */
+static int
+diskcache_payload_list_(CRAWLCACHE *cache, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg)
+{
+	return (diskcache_list_dir_(cache, cache->crawl->cachepath, 0, fn, arg) < 0 ? -1 : 0);
+}
+
+/* List a directory within the cache; returns 1 if fn asked for the listing
+ * to stop
+ */
+static int
+diskcache_list_dir_(CRAWLCACHE *cache, const char *path, int depth, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat sbuf;
+	CACHEKEY key;
+	char *p;
+	int r;
+
+	dir = opendir(path);
+	if(!dir)
+	{
+		/* The cache (or part of it) may not have been written yet */
+		if(errno == ENOENT)
+		{
+			return 0;
+		}
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_DISK_LIST ": %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	p = (char *) crawl_alloc(cache->crawl, strlen(path) + 1 + CACHE_KEY_LEN + 1);
+	if(!p)
+	{
+		closedir(dir);
+		return -1;
+	}
+	r = 0;
+	while(!r && (de = readdir(dir)))
+	{
+		/* Skip anything other than the two-character directories and the
+		 * payload files, such as sidecars and temporary files
+		 */
+		if(strlen(de->d_name) != (depth < 2 ? 2 : CACHE_KEY_LEN) || strchr(de->d_name, '.'))
+		{
+			continue;
+		}
+		sprintf(p, "%s/%s", path, de->d_name);
+		if(depth < 2)
+		{
+			r = diskcache_list_dir_(cache, p, depth + 1, fn, arg);
+			continue;
+		}
+		if(stat(p, &sbuf) || !S_ISREG(sbuf.st_mode))
+		{
+			continue;
+		}
+		strcpy(key, de->d_name);
+		/* Payloads are only accessed (not modified) by reads, although
+		 * access times may not be kept up to date
+		 */
+		if(fn(key, (uint64_t) sbuf.st_size, (uint64_t) (sbuf.st_atime > sbuf.st_mtime ? sbuf.st_atime : sbuf.st_mtime), arg))
+		{
+			r = 1;
+		}
+	}
+	crawl_free(cache->crawl, p);
+	closedir(dir);
+	return r;
+}
+
 static size_t
 diskcache_filename_(CRAWL *crawl, const CACHEKEY key, const char *type, char *buf, size_t bufsize, int temporary)
 {
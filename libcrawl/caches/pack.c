@@ -0,0 +1,2066 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* The packed cache ('pack:/path/to/cache') stores objects as records
+ * appended to a small number of large segment files (NNNNNNNN.pack), rather
+ * than as a pair of files per object.
+ *
+ * Each record consists of a fixed-size header, followed by the payload
+ * (if any) and then the JSON sidecar. The header contains the same
+ * location information as an index entry: if a record carries only a new
+ * sidecar (because the payload didn't change), it refers to the payload
+ * stored by an earlier record.
+ *
+ * The index file ('index') is a fixed header followed by an append-only
+ * sequence of index entries; the last entry for any given key wins, and
+ * may record that the object has been removed (in which case the space
+ * it occupied is reclaimed when its segment is next compacted). At
+ * start-up, the index is loaded into an in-memory hash table, and any
+ * records at the end of the newest segment which were written but not
+ * indexed before an unclean shutdown are recovered. A partially-written
+ * record at the end of a segment is discarded.
+ *
+ * A payload is written to a temporary file and the complete record is
+ * only appended to the active segment on commit, so rollback simply
+ * discards the temporary file; if appending the record or its index entry
+ * fails, the segment and the index are truncated back to where they were.
+ *
+ * Whenever the active segment fills and a new one is started, a background
+ * thread compacts the segments whose live (non-superseded) content has
+ * fallen below PACK_COMPACT_LIVE percent of their size: the live records
+ * are re-appended to the active segment, one at a time so that commits can
+ * proceed in the meantime, and the old segments are removed, after which
+ * the index is rewritten.
+ *
+ * Payloads are read lazily from their segments, without holding the lock
+ * while they're read.
+ *
+ * All contexts within a process which use the same cache path share a
+ * single set of segments and a single index; an exclusive lock on the
+ * 'lock' file prevents other processes from using the cache at the same
+ * time.
+ *
+ * Options may be supplied as query parameters in the cache URI:
+ *
+ *   segment-size=<MB>   maximum size of a segment file (default 1024)
+ *   sync=1              fdatasync() segments and the index on each commit
+ *   sidecar=binary      write sidecars in the compact binary format
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#if defined(HAVE_FOPENCOOKIE) && !defined(_GNU_SOURCE)
+/* fopencookie() is a GNU extension */
+# define _GNU_SOURCE                   1
+#endif
+
+#include "p_libcrawl.h"
+
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+# define PACK_CUSTOM_STREAMS           1
+#endif
+
+#define PACK_RECORD_MAGIC              0x4b504e41
+#define PACK_INDEX_MAGIC               "ANPKIDX1"
+#define PACK_INDEX_HEADER              8
+#define PACK_SEGMENT_SUFFIX            ".pack"
+#define PACK_SEGMENT_MAX               1024
+#define PACK_COMPACT_LIVE              50
+#define PACK_COPY_BLOCK                65536
+#define PACK_TABLE_MIN                 1024
+
+/* The record carries a payload (otherwise it carries only a sidecar) */
+#define PACK_REC_PAYLOAD               (1<<0)
+
+/* An index entry with an isegment of zero and this psegment records the
+ * removal of its key
+ */
+#define PACK_ENTRY_REMOVED             0xffffffff
+
+/* An index entry; an isegment of zero marks an unused hash table slot */
+struct packcache_entry_struct
+{
+	unsigned char key[CACHE_KEY_LEN / 2];
+	uint32_t psegment;
+	uint32_t isegment;
+	uint64_t poffset;
+	uint64_t plen;
+	uint64_t ioffset;
+	uint64_t ilen;
+};
+
+/* The header written to a segment file before each record */
+struct packcache_record_struct
+{
+	uint32_t magic;
+	uint32_t flags;
+	struct packcache_entry_struct entry;
+};
+
+struct packcache_segment_struct
+{
+	int fd;
+	uint64_t size;
+	uint64_t live;
+	int compact;
+};
+
+/* A process-wide set of segments and index, shared by every cache object
+ * using the same path
+ */
+struct packcache_pack_struct
+{
+	struct packcache_pack_struct *next;
+	char *path;
+	unsigned long refcount;
+	pthread_mutex_t lock;
+	int lockfd;
+	int indexfd;
+	uint64_t indexcount;
+	struct packcache_segment_struct *segs;
+	uint32_t nsegs;
+	uint32_t active;
+	struct packcache_entry_struct *table;
+	size_t tablesize;
+	size_t count;
+	uint64_t segmax;
+	int sync;
+	char *buf;
+	long pagesize;
+	/* The background compactor, started when it's first needed */
+	void (*logger)(int priority, const char *format, va_list ap);
+	pthread_t compactor;
+	pthread_cond_t cond;
+	int started;
+	int wanted;
+	int shutdown;
+};
+
+/* A payload being read from a segment */
+struct packcache_stream_struct
+{
+	int fd;
+	uint64_t base;
+	uint64_t len;
+	uint64_t pos;
+};
+
+/* A payload which has been opened for writing but not yet committed */
+struct packcache_pending_struct
+{
+	struct packcache_pending_struct *next;
+	CACHEKEY key;
+	FILE *f;
+	char *info;
+	size_t infolen;
+};
+
+struct packcache_data_struct
+{
+	struct packcache_pack_struct *pack;
+	struct packcache_pending_struct *pending;
+};
+
+static unsigned long packcache_init_(CRAWLCACHE *cache);
+static unsigned long packcache_done_(CRAWLCACHE *cache);
+static FILE *packcache_open_write_(CRAWLCACHE *cache, const CACHEKEY key);
+static FILE *packcache_open_read_(CRAWLCACHE *cache, const CACHEKEY key);
+static int packcache_close_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f);
+static int packcache_close_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, CRAWLOBJ *obj);
+static int packcache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **info);
+static int packcache_info_write_(CRAWLCACHE *cache, const CACHEKEY key, const json_t *info);
+static char *packcache_uri_(CRAWLCACHE *cache, const CACHEKEY key);
+static int packcache_set_username_(CRAWLCACHE *cache, const char *username);
+static int packcache_set_password_(CRAWLCACHE *cache, const char *password);
+static int packcache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint);
+static const void *packcache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len);
+static int packcache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len);
+static int packcache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+static int packcache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len);
+static int packcache_payload_stat_(CRAWLCACHE *cache, const CACHEKEY key, uint64_t *size);
+static int packcache_remove_(CRAWLCACHE *cache, const CACHEKEY key);
+static int packcache_payload_list_(CRAWLCACHE *cache, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg);
+
+static struct packcache_pack_struct *packcache_pack_open_(CRAWL *crawl, const char *path);
+static void packcache_pack_close_(CRAWL *crawl, struct packcache_pack_struct *pack);
+static void packcache_pack_free_(struct packcache_pack_struct *pack);
+static void packcache_options_(CRAWL *crawl, struct packcache_pack_struct *pack);
+static int packcache_load_segments_(CRAWL *crawl, struct packcache_pack_struct *pack);
+static int packcache_load_index_(CRAWL *crawl, struct packcache_pack_struct *pack, uint64_t *hwm);
+static int packcache_recover_(CRAWL *crawl, struct packcache_pack_struct *pack, uint64_t hwm);
+static int packcache_segment_open_(CRAWL *crawl, struct packcache_pack_struct *pack, uint32_t id, int create);
+static int packcache_roll_(CRAWL *crawl, struct packcache_pack_struct *pack);
+static int packcache_append_(CRAWL *crawl, struct packcache_pack_struct *pack, const unsigned char *key, int srcfd, uint64_t srcoff, uint64_t plen, const struct packcache_entry_struct *prev, const char *info, size_t ilen);
+static int packcache_index_append_(CRAWL *crawl, struct packcache_pack_struct *pack, const struct packcache_entry_struct *entry);
+static int packcache_index_rewrite_(CRAWL *crawl, struct packcache_pack_struct *pack);
+static int packcache_compact_(CRAWL *crawl, struct packcache_pack_struct *pack);
+static void *packcache_compactor_(void *arg);
+static int packcache_copy_(struct packcache_pack_struct *pack, int dstfd, uint64_t dstoff, int srcfd, uint64_t srcoff, uint64_t len);
+static struct packcache_entry_struct *packcache_lookup_(struct packcache_pack_struct *pack, const unsigned char *key);
+static int packcache_table_set_(struct packcache_pack_struct *pack, const struct packcache_entry_struct *entry);
+static void packcache_table_remove_(struct packcache_pack_struct *pack, const unsigned char *key);
+static void packcache_account_(struct packcache_pack_struct *pack, const struct packcache_entry_struct *entry, int add);
+static int packcache_key_(const CACHEKEY key, unsigned char *bin);
+static char *packcache_path_(const char *dir, const char *name);
+static char *packcache_segment_path_(struct packcache_pack_struct *pack, uint32_t id);
+static struct packcache_pending_struct *packcache_pending_(struct packcache_data_struct *data, const CACHEKEY key, FILE *f, int detach);
+static void packcache_pending_free_(CRAWL *crawl, struct packcache_pending_struct *p);
+#ifdef PACK_CUSTOM_STREAMS
+static ssize_t packcache_stream_read_(void *cookie, char *buf, size_t size);
+static int packcache_stream_seek_(void *cookie, off_t *offset, int whence);
+static int packcache_stream_close_(void *cookie);
+#endif
+
+static const CRAWLCACHEIMPL packcache_impl = {
+	NULL,
+	packcache_init_,
+	packcache_done_,
+	packcache_open_write_,
+	packcache_open_read_,
+	packcache_close_rollback_,
+	packcache_close_commit_,
+	packcache_info_read_,
+	packcache_info_write_,
+	packcache_uri_,
+	packcache_set_username_,
+	packcache_set_password_,
+	packcache_set_endpoint_,
+	packcache_payload_map_,
+	packcache_payload_unmap_,
+	packcache_info_read_buf_,
+	packcache_info_write_buf_,
+	NULL,
+	packcache_payload_stat_,
+	packcache_remove_,
+	NULL,
+	packcache_payload_list_
+};
+
+const CRAWLCACHEIMPL *packcache = &packcache_impl;
+
+static pthread_mutex_t packcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct packcache_pack_struct *packcache_packs;
+
+static unsigned long
+packcache_init_(CRAWLCACHE *cache)
+{
+	struct packcache_data_struct *data;
+
+	crawl_log_(cache->crawl, LOG_DEBUG, "pack: initialising cache at <%s>\n", cache->crawl->cachepath);
+	data = (struct packcache_data_struct *) crawl_alloc(cache->crawl, sizeof(struct packcache_data_struct));
+	if(!data)
+	{
+		return 0;
+	}
+	data->pack = packcache_pack_open_(cache->crawl, cache->crawl->cachepath);
+	if(!data->pack)
+	{
+		crawl_free(cache->crawl, data);
+		return 0;
+	}
+	cache->data = data;
+	return 1;
+}
+
+static unsigned long
+packcache_done_(CRAWLCACHE *cache)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pending_struct *p;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(data)
+	{
+		while(data->pending)
+		{
+			p = data->pending;
+			data->pending = p->next;
+			packcache_pending_free_(cache->crawl, p);
+		}
+		packcache_pack_close_(cache->crawl, data->pack);
+		crawl_free(cache->crawl, data);
+		cache->data = NULL;
+	}
+	return 0;
+}
+
+static FILE *
+packcache_open_write_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pending_struct *p;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	p = (struct packcache_pending_struct *) crawl_alloc(cache->crawl, sizeof(struct packcache_pending_struct));
+	if(!p)
+	{
+		return NULL;
+	}
+	p->f = tmpfile();
+	if(!p->f)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_TMPFILE ": %s\n", strerror(errno));
+		crawl_free(cache->crawl, p);
+		return NULL;
+	}
+	strcpy(p->key, key);
+	p->next = data->pending;
+	data->pending = p;
+	return p->f;
+}
+
+#ifdef PACK_CUSTOM_STREAMS
+# ifdef HAVE_FOPENCOOKIE
+static ssize_t
+packcache_cookie_read_(void *cookie, char *buf, size_t size)
+{
+	return packcache_stream_read_(cookie, buf, size);
+}
+
+static int
+packcache_cookie_seek_(void *cookie, off64_t *offset, int whence)
+{
+	off_t o;
+	int r;
+
+	o = (off_t) *offset;
+	r = packcache_stream_seek_(cookie, &o, whence);
+	*offset = (off64_t) o;
+	return r;
+}
+# else
+static int
+packcache_cookie_read_(void *cookie, char *buf, int size)
+{
+	return (int) packcache_stream_read_(cookie, buf, (size_t) size);
+}
+
+static fpos_t
+packcache_cookie_seek_(void *cookie, fpos_t offset, int whence)
+{
+	off_t o;
+
+	o = (off_t) offset;
+	if(packcache_stream_seek_(cookie, &o, whence))
+	{
+		return -1;
+	}
+	return (fpos_t) o;
+}
+# endif
+#endif /*PACK_CUSTOM_STREAMS*/
+
+/* Open a payload for reading; the segment's descriptor is duplicated, so
+ * that the payload remains readable even if its segment is compacted and
+ * removed, and the payload is read from it without the pack being locked
+ */
+static FILE *
+packcache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_entry_struct *entry;
+	struct packcache_stream_struct *s;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+	FILE *f;
+#ifdef PACK_CUSTOM_STREAMS
+# ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t io;
+# endif
+#else
+	char *buf;
+	uint64_t pos;
+	ssize_t r;
+	size_t n;
+#endif
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	s = (struct packcache_stream_struct *) crawl_alloc(cache->crawl, sizeof(struct packcache_stream_struct));
+	if(!s)
+	{
+		return NULL;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	entry = packcache_lookup_(pack, bin);
+	if(!entry)
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		crawl_free(cache->crawl, s);
+		errno = ENOENT;
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_PAYLOADREAD ": %s: %s\n", key, strerror(errno));
+		return NULL;
+	}
+	s->base = entry->poffset;
+	s->len = entry->plen;
+	s->fd = dup(pack->segs[entry->psegment].fd);
+	pthread_mutex_unlock(&(pack->lock));
+	if(s->fd == -1)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_PAYLOADREAD ": %s: %s\n", key, strerror(errno));
+		crawl_free(cache->crawl, s);
+		return NULL;
+	}
+#ifdef PACK_CUSTOM_STREAMS
+# ifdef HAVE_FOPENCOOKIE
+	io.read = packcache_cookie_read_;
+	io.write = NULL;
+	io.seek = packcache_cookie_seek_;
+	io.close = packcache_stream_close_;
+	f = fopencookie((void *) s, "r", io);
+# else
+	f = funopen((void *) s, packcache_cookie_read_, NULL, packcache_cookie_seek_, packcache_stream_close_);
+# endif
+	if(!f)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_PAYLOADREAD ": %s: %s\n", key, strerror(errno));
+		packcache_stream_close_(s);
+		return NULL;
+	}
+#else
+	/* Without custom streams, the payload is copied into memory; allow room
+	 * for the terminating NUL that fmemopen() writes
+	 */
+	f = fmemopen(NULL, s->len + 1, "w+");
+	buf = (char *) crawl_alloc(cache->crawl, PACK_COPY_BLOCK);
+	for(pos = 0; f && buf && pos < s->len; pos += r)
+	{
+		n = (s->len - pos > PACK_COPY_BLOCK ? PACK_COPY_BLOCK : s->len - pos);
+		r = pread(s->fd, buf, n, s->base + pos);
+		if(r <= 0 || fwrite(buf, r, 1, f) != 1)
+		{
+			if(!r)
+			{
+				errno = EIO;
+			}
+			fclose(f);
+			f = NULL;
+		}
+	}
+	if(!f || !buf)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_PAYLOADREAD ": %s: %s\n", key, strerror(errno));
+		if(f)
+		{
+			fclose(f);
+			f = NULL;
+		}
+	}
+	else
+	{
+		rewind(f);
+	}
+	crawl_free(cache->crawl, buf);
+	close(s->fd);
+	crawl_free(cache->crawl, s);
+#endif
+	return f;
+}
+
+static int
+packcache_close_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pending_struct *p;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	p = packcache_pending_(data, key, f, 1);
+	if(!p)
+	{
+		if(f)
+		{
+			fclose(f);
+		}
+		errno = ENOENT;
+		return -1;
+	}
+	packcache_pending_free_(cache->crawl, p);
+	return 0;
+}
+
+static int
+packcache_close_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, CRAWLOBJ *obj)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_pending_struct *p;
+	struct packcache_entry_struct *prev, prevbuf;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+	struct stat sbuf;
+	int r;
+
+	(void) obj;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || !f || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	p = packcache_pending_(data, key, f, 1);
+	if(!p)
+	{
+		fclose(f);
+		errno = ENOENT;
+		return -1;
+	}
+	if(fflush(p->f) || fstat(fileno(p->f), &sbuf))
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_COMMIT ": %s: %s\n", key, strerror(errno));
+		packcache_pending_free_(cache->crawl, p);
+		return -1;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	prev = NULL;
+	if(!p->info)
+	{
+		/* No sidecar was written along with this payload, so keep the
+		 * existing one, if any
+		 */
+		prev = packcache_lookup_(pack, bin);
+		if(prev)
+		{
+			prevbuf = *prev;
+			prev = &prevbuf;
+		}
+	}
+	r = packcache_append_(cache->crawl, pack, bin, fileno(p->f), 0, sbuf.st_size, prev, p->info, p->infolen);
+	pthread_mutex_unlock(&(pack->lock));
+	packcache_pending_free_(cache->crawl, p);
+	return r;
+}
+
+/* Read a sidecar, in either format, as a JSON dictionary */
+static int
+packcache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **dict)
+{
+	char *buf;
+	size_t len;
+	json_t *json;
+
+	if(packcache_info_read_buf_(cache, key, &buf, &len))
+	{
+		return -1;
+	}
+	json = crawl_sidecar_json_(cache->crawl, buf, len);
+	crawl_free(cache->crawl, buf);
+	if(!json)
+	{
+		return -1;
+	}
+	if(*dict)
+	{
+		json_decref(*dict);
+	}
+	*dict = json;
+	return 0;
+}
+
+static int
+packcache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_entry_struct *entry;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+	char *p;
+	size_t l;
+	ssize_t r;
+
+	*buf = NULL;
+	*len = 0;
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	entry = packcache_lookup_(pack, bin);
+	if(!entry || !entry->ilen)
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		errno = ENOENT;
+		return -1;
+	}
+	l = entry->ilen;
+	p = (char *) crawl_alloc(cache->crawl, l);
+	if(!p)
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		return -1;
+	}
+	r = pread(pack->segs[entry->isegment].fd, p, l, entry->ioffset);
+	pthread_mutex_unlock(&(pack->lock));
+	if(r < 0 || (size_t) r != l)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_INFOREAD ": %s: %s\n", key, strerror(r < 0 ? errno : EIO));
+		crawl_free(cache->crawl, p);
+		return -1;
+	}
+	*buf = p;
+	*len = l;
+	return 0;
+}
+
+static int
+packcache_info_write_(CRAWLCACHE *cache, const CACHEKEY key, const json_t *dict)
+{
+	char *s;
+	int r;
+
+	s = json_dumps(dict, JSON_PRESERVE_ORDER);
+	if(!s)
+	{
+		return -1;
+	}
+	r = packcache_info_write_buf_(cache, key, s, strlen(s));
+	free(s);
+	return r;
+}
+
+/* Write a sidecar: if a payload for the same key is in the process of being
+ * written, the sidecar is held until the payload is committed (and discarded
+ * if it's rolled back); otherwise, a record containing just the new sidecar
+ * is appended immediately.
+ */
+static int
+packcache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_pending_struct *p;
+	struct packcache_entry_struct *prev, prevbuf;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+	char *info;
+	int r;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	p = packcache_pending_(data, key, NULL, 0);
+	if(p)
+	{
+		info = (char *) crawl_alloc(cache->crawl, len + 1);
+		if(!info)
+		{
+			return -1;
+		}
+		memcpy(info, buf, len);
+		crawl_free(cache->crawl, p->info);
+		p->info = info;
+		p->infolen = len;
+		return 0;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	prev = packcache_lookup_(pack, bin);
+	if(prev)
+	{
+		prevbuf = *prev;
+		prev = &prevbuf;
+	}
+	r = packcache_append_(cache->crawl, pack, bin, -1, 0, 0, prev, buf, len);
+	pthread_mutex_unlock(&(pack->lock));
+	return r;
+}
+
+static char *
+packcache_uri_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	char *p;
+
+	/* pack:// + path + / + key */
+	p = (char *) crawl_alloc(cache->crawl, 7 + strlen(cache->crawl->cachepath) + 1 + strlen(key) + 1);
+	if(!p)
+	{
+		return NULL;
+	}
+	sprintf(p, "pack://%s/%s", cache->crawl->cachepath, key);
+	return p;
+}
+
+static int
+packcache_set_username_(CRAWLCACHE *cache, const char *username)
+{
+	(void) cache;
+	(void) username;
+
+	return 0;
+}
+
+static int
+packcache_set_password_(CRAWLCACHE *cache, const char *password)
+{
+	(void) cache;
+	(void) password;
+
+	return 0;
+}
+
+static int
+packcache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint)
+{
+	(void) cache;
+	(void) endpoint;
+
+	return 0;
+}
+
+/* Map a payload directly from its segment; because records are never
+ * modified once written, the mapping remains valid even if the segment
+ * is subsequently compacted and removed.
+ */
+static const void *
+packcache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_entry_struct *entry;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+	uint64_t base, delta;
+	char *p;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	entry = packcache_lookup_(pack, bin);
+	if(!entry)
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		errno = ENOENT;
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_PAYLOADREAD ": %s: %s\n", key, strerror(errno));
+		return NULL;
+	}
+	if(!entry->plen)
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		*len = 0;
+		return "";
+	}
+	/* The mapping must begin on a page boundary */
+	delta = entry->poffset % pack->pagesize;
+	base = entry->poffset - delta;
+	p = (char *) mmap(NULL, entry->plen + delta, PROT_READ, MAP_SHARED, pack->segs[entry->psegment].fd, base);
+	*len = entry->plen;
+	pthread_mutex_unlock(&(pack->lock));
+	if(p == MAP_FAILED)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_PACK_PAYLOADREAD ": %s: %s\n", key, strerror(errno));
+		return NULL;
+	}
+	return p + delta;
+}
+
+static int
+packcache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len)
+{
+	struct packcache_data_struct *data;
+	size_t delta;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!len || !data)
+	{
+		return 0;
+	}
+	delta = (uintptr_t) ptr % data->pack->pagesize;
+	return munmap((char *) ptr - delta, len + delta);
+}
+
+static int
+packcache_payload_stat_(CRAWLCACHE *cache, const CACHEKEY key, uint64_t *size)
+{
+	struct packcache_data_struct *data;
+	struct packcache_entry_struct *entry;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&(data->pack->lock));
+	entry = packcache_lookup_(data->pack, bin);
+	if(entry)
+	{
+		*size = entry->plen;
+	}
+	pthread_mutex_unlock(&(data->pack->lock));
+	if(!entry)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+/* Remove an object by appending an index entry recording its removal */
+static int
+packcache_remove_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_entry_struct entry;
+	unsigned char bin[CACHE_KEY_LEN / 2];
+	int r;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data || packcache_key_(key, bin))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	if(!packcache_lookup_(pack, bin))
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		return 0;
+	}
+	memset(&entry, 0, sizeof(entry));
+	memcpy(entry.key, bin, sizeof(entry.key));
+	entry.psegment = PACK_ENTRY_REMOVED;
+	r = packcache_index_append_(cache->crawl, pack, &entry);
+	if(!r)
+	{
+		packcache_table_remove_(pack, bin);
+	}
+	pthread_mutex_unlock(&(pack->lock));
+	return r;
+}
+
+/* List the payloads in the index; the records were appended in the order
+ * in which they were stored (or compacted), which is what seq reflects
+ */
+static int
+packcache_payload_list_(CRAWLCACHE *cache, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg)
+{
+	struct packcache_data_struct *data;
+	struct packcache_pack_struct *pack;
+	struct packcache_entry_struct *entry;
+	CACHEKEY key;
+	size_t c, n;
+
+	data = (struct packcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pack = data->pack;
+	pthread_mutex_lock(&(pack->lock));
+	for(c = 0; c < pack->tablesize; c++)
+	{
+		entry = &(pack->table[c]);
+		if(!entry->isegment)
+		{
+			continue;
+		}
+		for(n = 0; n < sizeof(entry->key); n++)
+		{
+			sprintf(&(key[n * 2]), "%02x", entry->key[n]);
+		}
+		if(fn(key, entry->plen, ((uint64_t) entry->isegment << 40) | entry->ioffset, arg))
+		{
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(pack->lock));
+	return 0;
+}
+
+/* Obtain a reference to the shared pack for a path, opening it if needed */
+static struct packcache_pack_struct *
+packcache_pack_open_(CRAWL *crawl, const char *path)
+{
+	struct packcache_pack_struct *p;
+	char *lockpath;
+	uint64_t hwm;
+
+	pthread_mutex_lock(&packcache_lock);
+	for(p = packcache_packs; p; p = p->next)
+	{
+		if(!strcmp(p->path, path))
+		{
+			p->refcount++;
+			pthread_mutex_unlock(&packcache_lock);
+			return p;
+		}
+	}
+	p = (struct packcache_pack_struct *) crawl_alloc(NULL, sizeof(struct packcache_pack_struct));
+	if(!p)
+	{
+		pthread_mutex_unlock(&packcache_lock);
+		return NULL;
+	}
+	pthread_mutex_init(&(p->lock), NULL);
+	pthread_cond_init(&(p->cond), NULL);
+	p->logger = crawl->logger;
+	p->lockfd = -1;
+	p->indexfd = -1;
+	p->refcount = 1;
+	p->segmax = (uint64_t) PACK_SEGMENT_MAX * 1024 * 1024;
+	p->pagesize = sysconf(_SC_PAGESIZE);
+	p->path = crawl_strdup(NULL, path);
+	p->buf = (char *) crawl_alloc(NULL, PACK_COPY_BLOCK);
+	if(!p->path || !p->buf)
+	{
+		packcache_pack_free_(p);
+		pthread_mutex_unlock(&packcache_lock);
+		return NULL;
+	}
+	packcache_options_(crawl, p);
+	if(mkdir(path, 0777) && errno != EEXIST)
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_MKDIR ": %s: %s\n", path, strerror(errno));
+		packcache_pack_free_(p);
+		pthread_mutex_unlock(&packcache_lock);
+		return NULL;
+	}
+	lockpath = packcache_path_(path, "lock");
+	if(lockpath)
+	{
+		p->lockfd = open(lockpath, O_RDWR|O_CREAT, 0666);
+	}
+	if(p->lockfd == -1 || flock(p->lockfd, LOCK_EX|LOCK_NB))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_LOCK ": %s: %s\n", lockpath ? lockpath : path, strerror(errno));
+		crawl_free(NULL, lockpath);
+		packcache_pack_free_(p);
+		pthread_mutex_unlock(&packcache_lock);
+		return NULL;
+	}
+	crawl_free(NULL, lockpath);
+	if(packcache_load_segments_(crawl, p) ||
+	   packcache_load_index_(crawl, p, &hwm) ||
+	   packcache_recover_(crawl, p, hwm))
+	{
+		packcache_pack_free_(p);
+		pthread_mutex_unlock(&packcache_lock);
+		return NULL;
+	}
+	crawl_log_(crawl, LOG_DEBUG, "pack: %lu objects in %lu segment(s) at <%s>\n", (unsigned long) p->count, (unsigned long) p->active, path);
+	p->next = packcache_packs;
+	packcache_packs = p;
+	pthread_mutex_unlock(&packcache_lock);
+	return p;
+}
+
+static void
+packcache_pack_close_(CRAWL *crawl, struct packcache_pack_struct *pack)
+{
+	struct packcache_pack_struct *p, *prev;
+
+	pthread_mutex_lock(&packcache_lock);
+	pack->refcount--;
+	if(pack->refcount)
+	{
+		pthread_mutex_unlock(&packcache_lock);
+		return;
+	}
+	prev = NULL;
+	for(p = packcache_packs; p; p = p->next)
+	{
+		if(p == pack)
+		{
+			if(prev)
+			{
+				prev->next = p->next;
+			}
+			else
+			{
+				packcache_packs = p->next;
+			}
+			break;
+		}
+		prev = p;
+	}
+	pthread_mutex_unlock(&packcache_lock);
+	crawl_log_(crawl, LOG_DEBUG, "pack: closing cache at <%s>\n", pack->path);
+	packcache_pack_free_(pack);
+}
+
+static void
+packcache_pack_free_(struct packcache_pack_struct *pack)
+{
+	uint32_t c;
+
+	if(pack->started)
+	{
+		/* Stop the compactor, abandoning any compaction in progress */
+		pthread_mutex_lock(&(pack->lock));
+		pack->shutdown = 1;
+		pthread_cond_signal(&(pack->cond));
+		pthread_mutex_unlock(&(pack->lock));
+		pthread_join(pack->compactor, NULL);
+	}
+	for(c = 0; c < pack->nsegs; c++)
+	{
+		if(pack->segs[c].fd != -1)
+		{
+			close(pack->segs[c].fd);
+		}
+	}
+	if(pack->indexfd != -1)
+	{
+		close(pack->indexfd);
+	}
+	if(pack->lockfd != -1)
+	{
+		close(pack->lockfd);
+	}
+	pthread_cond_destroy(&(pack->cond));
+	pthread_mutex_destroy(&(pack->lock));
+	crawl_free(NULL, pack->segs);
+	crawl_free(NULL, pack->table);
+	crawl_free(NULL, pack->buf);
+	crawl_free(NULL, pack->path);
+	crawl_free(NULL, pack);
+}
+
+/* Apply any options supplied in the query string of the cache URI */
+static void
+packcache_options_(CRAWL *crawl, struct packcache_pack_struct *pack)
+{
+	const char *s, *t, *v;
+	size_t len;
+	unsigned long n;
+
+	if(!crawl->uri || !crawl->uri->query)
+	{
+		return;
+	}
+	for(s = crawl->uri->query; *s; s = (*t ? t + 1 : t))
+	{
+		t = strchr(s, '&');
+		if(!t)
+		{
+			t = s + strlen(s);
+		}
+		v = memchr(s, '=', t - s);
+		if(!v)
+		{
+			continue;
+		}
+		len = v - s;
+		v++;
+		n = strtoul(v, NULL, 10);
+		if(len == 12 && !strncmp(s, "segment-size", len) && n)
+		{
+			pack->segmax = (uint64_t) n * 1024 * 1024;
+		}
+		else if(len == 4 && !strncmp(s, "sync", len))
+		{
+			pack->sync = (n ? 1 : 0);
+		}
+	}
+}
+
+/* Open all of the existing segment files; the newest becomes the active
+ * segment, unless there are none, in which case one is created.
+ */
+static int
+packcache_load_segments_(CRAWL *crawl, struct packcache_pack_struct *pack)
+{
+	DIR *dir;
+	struct dirent *de;
+	unsigned long id, max;
+	char *t;
+
+	dir = opendir(pack->path);
+	if(!dir)
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_SEGMENT ": %s: %s\n", pack->path, strerror(errno));
+		return -1;
+	}
+	max = 0;
+	while((de = readdir(dir)))
+	{
+		id = strtoul(de->d_name, &t, 16);
+		if(id && id > max && t != de->d_name && !strcmp(t, PACK_SEGMENT_SUFFIX))
+		{
+			max = id;
+		}
+	}
+	pack->nsegs = max + 1;
+	pack->segs = (struct packcache_segment_struct *) crawl_alloc(NULL, sizeof(struct packcache_segment_struct) * pack->nsegs);
+	if(!pack->segs)
+	{
+		closedir(dir);
+		return -1;
+	}
+	for(id = 0; id < pack->nsegs; id++)
+	{
+		pack->segs[id].fd = -1;
+	}
+	rewinddir(dir);
+	while((de = readdir(dir)))
+	{
+		id = strtoul(de->d_name, &t, 16);
+		if(id && id <= max && t != de->d_name && !strcmp(t, PACK_SEGMENT_SUFFIX))
+		{
+			if(packcache_segment_open_(crawl, pack, id, 0))
+			{
+				closedir(dir);
+				return -1;
+			}
+		}
+	}
+	closedir(dir);
+	if(!max)
+	{
+		return packcache_roll_(crawl, pack);
+	}
+	pack->active = max;
+	return 0;
+}
+
+/* Load the index into the hash table, determining the offset within the
+ * active segment up to which records have been indexed
+ */
+static int
+packcache_load_index_(CRAWL *crawl, struct packcache_pack_struct *pack, uint64_t *hwm)
+{
+	char *path;
+	char header[PACK_INDEX_HEADER];
+	struct packcache_entry_struct *entries;
+	struct stat sbuf;
+	size_t n, c, i, count;
+	ssize_t r;
+	uint64_t pos;
+
+	*hwm = 0;
+	path = packcache_path_(pack->path, "index");
+	if(!path)
+	{
+		return -1;
+	}
+	pack->indexfd = open(path, O_RDWR|O_CREAT, 0666);
+	if(pack->indexfd == -1 || fstat(pack->indexfd, &sbuf))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s: %s\n", path, strerror(errno));
+		crawl_free(NULL, path);
+		return -1;
+	}
+	if(!sbuf.st_size)
+	{
+		crawl_free(NULL, path);
+		if(pwrite(pack->indexfd, PACK_INDEX_MAGIC, PACK_INDEX_HEADER, 0) != PACK_INDEX_HEADER)
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s\n", strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+	if(pread(pack->indexfd, header, PACK_INDEX_HEADER, 0) != PACK_INDEX_HEADER ||
+	   memcmp(header, PACK_INDEX_MAGIC, PACK_INDEX_HEADER))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s: not a valid index\n", path);
+		crawl_free(NULL, path);
+		return -1;
+	}
+	count = (sbuf.st_size - PACK_INDEX_HEADER) / sizeof(struct packcache_entry_struct);
+	if(PACK_INDEX_HEADER + count * sizeof(struct packcache_entry_struct) != (uint64_t) sbuf.st_size)
+	{
+		crawl_log_(crawl, LOG_WARNING, "pack: %s: discarding partially-written index entry\n", path);
+		if(ftruncate(pack->indexfd, PACK_INDEX_HEADER + count * sizeof(struct packcache_entry_struct)))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s: %s\n", path, strerror(errno));
+			crawl_free(NULL, path);
+			return -1;
+		}
+	}
+	crawl_free(NULL, path);
+	entries = (struct packcache_entry_struct *) pack->buf;
+	pos = PACK_INDEX_HEADER;
+	for(n = 0; n < count; n += c)
+	{
+		c = count - n;
+		if(c > PACK_COPY_BLOCK / sizeof(struct packcache_entry_struct))
+		{
+			c = PACK_COPY_BLOCK / sizeof(struct packcache_entry_struct);
+		}
+		r = pread(pack->indexfd, entries, c * sizeof(struct packcache_entry_struct), pos);
+		if(r < 0 || (size_t) r != c * sizeof(struct packcache_entry_struct))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s\n", strerror(r < 0 ? errno : EIO));
+			return -1;
+		}
+		pos += r;
+		for(i = 0; i < c; i++)
+		{
+			if(!entries[i].isegment && entries[i].psegment == PACK_ENTRY_REMOVED)
+			{
+				packcache_table_remove_(pack, entries[i].key);
+				continue;
+			}
+			if(!entries[i].isegment || entries[i].isegment >= pack->nsegs ||
+			   pack->segs[entries[i].isegment].fd == -1 ||
+			   (entries[i].plen && (entries[i].psegment >= pack->nsegs || pack->segs[entries[i].psegment].fd == -1)))
+			{
+				/* Refers to a segment which no longer exists */
+				continue;
+			}
+			if(entries[i].isegment == pack->active && entries[i].ioffset + entries[i].ilen > *hwm)
+			{
+				*hwm = entries[i].ioffset + entries[i].ilen;
+			}
+			if(packcache_table_set_(pack, &(entries[i])))
+			{
+				return -1;
+			}
+		}
+	}
+	pack->indexcount = count;
+	return 0;
+}
+
+/* Index any complete records in the active segment beyond the high-water
+ * mark, and discard anything following them
+ */
+static int
+packcache_recover_(CRAWL *crawl, struct packcache_pack_struct *pack, uint64_t hwm)
+{
+	struct packcache_segment_struct *seg;
+	struct packcache_record_struct rec;
+	uint64_t pos, end;
+	unsigned long recovered;
+
+	seg = &(pack->segs[pack->active]);
+	recovered = 0;
+	for(pos = hwm; pos + sizeof(rec) <= seg->size; pos = end)
+	{
+		if(pread(seg->fd, &rec, sizeof(rec), pos) != sizeof(rec) ||
+		   rec.magic != PACK_RECORD_MAGIC ||
+		   rec.entry.isegment != pack->active ||
+		   rec.entry.ioffset != pos + sizeof(rec) + ((rec.flags & PACK_REC_PAYLOAD) ? rec.entry.plen : 0) ||
+		   ((rec.flags & PACK_REC_PAYLOAD) && (rec.entry.psegment != pack->active || rec.entry.poffset != pos + sizeof(rec))))
+		{
+			break;
+		}
+		end = rec.entry.ioffset + rec.entry.ilen;
+		if(end > seg->size)
+		{
+			break;
+		}
+		if(packcache_index_append_(crawl, pack, &(rec.entry)) ||
+		   packcache_table_set_(pack, &(rec.entry)))
+		{
+			return -1;
+		}
+		recovered++;
+	}
+	if(recovered)
+	{
+		crawl_log_(crawl, LOG_NOTICE, "pack: recovered %lu unindexed record(s) in segment %08lx\n", recovered, (unsigned long) pack->active);
+	}
+	if(pos < seg->size)
+	{
+		crawl_log_(crawl, LOG_WARNING, "pack: discarding %lu bytes of incomplete record(s) from segment %08lx\n", (unsigned long) (seg->size - pos), (unsigned long) pack->active);
+		if(ftruncate(seg->fd, pos))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_SEGMENT ": %s\n", strerror(errno));
+			return -1;
+		}
+		seg->size = pos;
+	}
+	return 0;
+}
+
+static int
+packcache_segment_open_(CRAWL *crawl, struct packcache_pack_struct *pack, uint32_t id, int create)
+{
+	char *path;
+	struct stat sbuf;
+	int fd;
+
+	path = packcache_segment_path_(pack, id);
+	if(!path)
+	{
+		return -1;
+	}
+	fd = open(path, O_RDWR|(create ? O_CREAT|O_EXCL : 0), 0666);
+	if(fd == -1 || fstat(fd, &sbuf))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_SEGMENT ": %s: %s\n", path, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		crawl_free(NULL, path);
+		return -1;
+	}
+	crawl_free(NULL, path);
+	pack->segs[id].fd = fd;
+	pack->segs[id].size = sbuf.st_size;
+	pack->segs[id].live = 0;
+	pack->segs[id].compact = 0;
+	return 0;
+}
+
+/* Start a new active segment, and then wake the compactor (starting it if
+ * needed) to compact the older segments; must be called with the pack locked
+ */
+static int
+packcache_roll_(CRAWL *crawl, struct packcache_pack_struct *pack)
+{
+	struct packcache_segment_struct *p;
+	uint32_t id;
+	int e;
+
+	id = (pack->nsegs ? pack->nsegs : 1);
+	p = (struct packcache_segment_struct *) crawl_realloc(NULL, pack->segs, sizeof(struct packcache_segment_struct) * (id + 1));
+	if(!p)
+	{
+		return -1;
+	}
+	pack->segs = p;
+	for(; pack->nsegs <= id; pack->nsegs++)
+	{
+		pack->segs[pack->nsegs].fd = -1;
+		pack->segs[pack->nsegs].size = 0;
+		pack->segs[pack->nsegs].live = 0;
+		pack->segs[pack->nsegs].compact = 0;
+	}
+	if(packcache_segment_open_(crawl, pack, id, 1))
+	{
+		return -1;
+	}
+	pack->active = id;
+	crawl_log_(crawl, LOG_DEBUG, "pack: started new segment %08lx\n", (unsigned long) id);
+	if(!pack->table)
+	{
+		/* Still loading */
+		return 0;
+	}
+	if(!pack->started)
+	{
+		if((e = pthread_create(&(pack->compactor), NULL, packcache_compactor_, (void *) pack)))
+		{
+			/* Compaction will be attempted again when the next segment is started */
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_COMPACTOR ": %s\n", strerror(e));
+			return 0;
+		}
+		pack->started = 1;
+	}
+	pack->wanted = 1;
+	pthread_cond_signal(&(pack->cond));
+	return 0;
+}
+
+/* Append a record to the active segment and index it. If plen is nonzero,
+ * the payload is copied from srcfd; otherwise, the record refers to the
+ * payload described by prev (if any). If info is NULL, the sidecar
+ * described by prev is retained instead.
+ *
+ * Must be called with the pack locked.
+ */
+static int
+packcache_append_(CRAWL *crawl, struct packcache_pack_struct *pack, const unsigned char *key, int srcfd, uint64_t srcoff, uint64_t plen, const struct packcache_entry_struct *prev, const char *info, size_t ilen)
+{
+	struct packcache_record_struct rec;
+	struct packcache_segment_struct *seg, *iseg;
+	char *infobuf;
+	uint64_t off;
+	ssize_t r;
+
+	infobuf = NULL;
+	if(!info && prev && prev->ilen)
+	{
+		/* Copy the existing sidecar into the new record */
+		ilen = prev->ilen;
+		infobuf = (char *) crawl_alloc(crawl, ilen);
+		if(!infobuf)
+		{
+			return -1;
+		}
+		iseg = &(pack->segs[prev->isegment]);
+		r = pread(iseg->fd, infobuf, ilen, prev->ioffset);
+		if(r < 0 || (size_t) r != ilen)
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INFOREAD ": %s\n", strerror(r < 0 ? errno : EIO));
+			crawl_free(crawl, infobuf);
+			return -1;
+		}
+		info = infobuf;
+	}
+	else if(!info)
+	{
+		ilen = 0;
+	}
+	seg = &(pack->segs[pack->active]);
+	if(seg->size && seg->size + sizeof(rec) + plen + ilen > pack->segmax)
+	{
+		if(packcache_roll_(crawl, pack))
+		{
+			crawl_free(crawl, infobuf);
+			return -1;
+		}
+		seg = &(pack->segs[pack->active]);
+	}
+	off = seg->size;
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = PACK_RECORD_MAGIC;
+	memcpy(rec.entry.key, key, sizeof(rec.entry.key));
+	if(plen)
+	{
+		rec.flags |= PACK_REC_PAYLOAD;
+		rec.entry.psegment = pack->active;
+		rec.entry.poffset = off + sizeof(rec);
+		rec.entry.plen = plen;
+	}
+	else if(prev)
+	{
+		rec.entry.psegment = prev->psegment;
+		rec.entry.poffset = prev->poffset;
+		rec.entry.plen = prev->plen;
+	}
+	rec.entry.isegment = pack->active;
+	rec.entry.ioffset = off + sizeof(rec) + plen;
+	rec.entry.ilen = ilen;
+	if(pwrite(seg->fd, &rec, sizeof(rec), off) != sizeof(rec) ||
+	   (plen && packcache_copy_(pack, seg->fd, rec.entry.poffset, srcfd, srcoff, plen)) ||
+	   (ilen && pwrite(seg->fd, info, ilen, rec.entry.ioffset) != (ssize_t) ilen) ||
+	   (pack->sync && fdatasync(seg->fd)))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_COMMIT ": %s\n", strerror(errno));
+		crawl_free(crawl, infobuf);
+		if(ftruncate(seg->fd, off))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_SEGMENT ": %s\n", strerror(errno));
+		}
+		return -1;
+	}
+	crawl_free(crawl, infobuf);
+	if(packcache_index_append_(crawl, pack, &(rec.entry)))
+	{
+		if(ftruncate(seg->fd, off))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_SEGMENT ": %s\n", strerror(errno));
+		}
+		return -1;
+	}
+	seg->size = rec.entry.ioffset + ilen;
+	return packcache_table_set_(pack, &(rec.entry));
+}
+
+static int
+packcache_index_append_(CRAWL *crawl, struct packcache_pack_struct *pack, const struct packcache_entry_struct *entry)
+{
+	uint64_t off;
+
+	off = PACK_INDEX_HEADER + pack->indexcount * sizeof(struct packcache_entry_struct);
+	if(pwrite(pack->indexfd, entry, sizeof(struct packcache_entry_struct), off) != sizeof(struct packcache_entry_struct) ||
+	   (pack->sync && fdatasync(pack->indexfd)))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s\n", strerror(errno));
+		if(ftruncate(pack->indexfd, off))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s\n", strerror(errno));
+		}
+		return -1;
+	}
+	pack->indexcount++;
+	return 0;
+}
+
+/* Replace the index with one containing only the live entries */
+static int
+packcache_index_rewrite_(CRAWL *crawl, struct packcache_pack_struct *pack)
+{
+	char *path, *tmppath;
+	int fd;
+	size_t c;
+	uint64_t off, count;
+
+	path = packcache_path_(pack->path, "index");
+	tmppath = packcache_path_(pack->path, "index.tmp");
+	if(!path || !tmppath)
+	{
+		crawl_free(NULL, path);
+		crawl_free(NULL, tmppath);
+		return -1;
+	}
+	fd = open(tmppath, O_RDWR|O_CREAT|O_TRUNC, 0666);
+	if(fd == -1)
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s: %s\n", tmppath, strerror(errno));
+		crawl_free(NULL, path);
+		crawl_free(NULL, tmppath);
+		return -1;
+	}
+	off = 0;
+	count = 0;
+	if(pwrite(fd, PACK_INDEX_MAGIC, PACK_INDEX_HEADER, 0) != PACK_INDEX_HEADER)
+	{
+		off = (uint64_t) -1;
+	}
+	else
+	{
+		off = PACK_INDEX_HEADER;
+	}
+	for(c = 0; off != (uint64_t) -1 && c < pack->tablesize; c++)
+	{
+		if(!pack->table[c].isegment)
+		{
+			continue;
+		}
+		if(pwrite(fd, &(pack->table[c]), sizeof(struct packcache_entry_struct), off) != sizeof(struct packcache_entry_struct))
+		{
+			off = (uint64_t) -1;
+			break;
+		}
+		off += sizeof(struct packcache_entry_struct);
+		count++;
+	}
+	if(off == (uint64_t) -1 || fsync(fd) || rename(tmppath, path))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_PACK_INDEX ": %s: %s\n", tmppath, strerror(errno));
+		close(fd);
+		unlink(tmppath);
+		crawl_free(NULL, path);
+		crawl_free(NULL, tmppath);
+		return -1;
+	}
+	close(pack->indexfd);
+	pack->indexfd = fd;
+	pack->indexcount = count;
+	crawl_free(NULL, path);
+	crawl_free(NULL, tmppath);
+	return 0;
+}
+
+/* Re-append the live records from any sparsely-populated segments to the
+ * active segment, then remove those segments and rewrite the index. The
+ * pack is locked for each record in turn, rather than for the whole
+ * operation, so that commits can proceed while it's under way; anything
+ * which is committed in the meantime and refers to a segment being
+ * compacted keeps that segment alive until the next compaction.
+ *
+ * Called by the compactor thread, with the pack unlocked.
+ */
+static int
+packcache_compact_(CRAWL *crawl, struct packcache_pack_struct *pack)
+{
+	struct packcache_segment_struct *seg;
+	struct packcache_entry_struct *cur, entry;
+	unsigned char *keys;
+	char *path;
+	size_t c, nkeys;
+	uint32_t id;
+	unsigned long nsegs, nrecs;
+	uint64_t reclaimed;
+	int r;
+
+	pthread_mutex_lock(&(pack->lock));
+	nsegs = 0;
+	for(id = 1; id < pack->nsegs; id++)
+	{
+		seg = &(pack->segs[id]);
+		if(seg->fd == -1 || id == pack->active)
+		{
+			continue;
+		}
+		if(seg->live * 100 < seg->size * PACK_COMPACT_LIVE)
+		{
+			seg->compact = 1;
+			nsegs++;
+		}
+	}
+	if(!nsegs)
+	{
+		pthread_mutex_unlock(&(pack->lock));
+		return 0;
+	}
+	/* Take a copy of the keys of the records to be moved, because the table
+	 * may be resized while the pack is unlocked
+	 */
+	nkeys = 0;
+	keys = (unsigned char *) crawl_alloc(crawl, sizeof(entry.key) * (pack->count + 1));
+	for(c = 0; keys && c < pack->tablesize; c++)
+	{
+		cur = &(pack->table[c]);
+		if(cur->isegment &&
+		   (pack->segs[cur->isegment].compact || (cur->plen && pack->segs[cur->psegment].compact)))
+		{
+			memcpy(keys + nkeys * sizeof(entry.key), cur->key, sizeof(entry.key));
+			nkeys++;
+		}
+	}
+	pthread_mutex_unlock(&(pack->lock));
+	r = (keys ? 0 : -1);
+	nrecs = 0;
+	for(c = 0; !r && c < nkeys; c++)
+	{
+		pthread_mutex_lock(&(pack->lock));
+		if(pack->shutdown)
+		{
+			r = -1;
+		}
+		else if((cur = packcache_lookup_(pack, keys + c * sizeof(entry.key))) &&
+				(pack->segs[cur->isegment].compact || (cur->plen && pack->segs[cur->psegment].compact)))
+		{
+			/* The copy of the entry is needed because packcache_append_()
+			 * replaces it in the table
+			 */
+			entry = *cur;
+			if(entry.plen)
+			{
+				r = packcache_append_(crawl, pack, entry.key, pack->segs[entry.psegment].fd, entry.poffset, entry.plen, &entry, NULL, 0);
+			}
+			else
+			{
+				r = packcache_append_(crawl, pack, entry.key, -1, 0, 0, &entry, NULL, 0);
+			}
+			if(!r)
+			{
+				nrecs++;
+			}
+		}
+		pthread_mutex_unlock(&(pack->lock));
+	}
+	crawl_free(crawl, keys);
+	pthread_mutex_lock(&(pack->lock));
+	reclaimed = 0;
+	for(id = 1; id < pack->nsegs; id++)
+	{
+		seg = &(pack->segs[id]);
+		if(!seg->compact)
+		{
+			continue;
+		}
+		seg->compact = 0;
+		if(r || seg->live)
+		{
+			continue;
+		}
+		path = packcache_segment_path_(pack, id);
+		if(!path)
+		{
+			continue;
+		}
+		if(unlink(path))
+		{
+			crawl_log_(crawl, LOG_ERR, MSG_E_PACK_SEGMENT ": %s: %s\n", path, strerror(errno));
+		}
+		else
+		{
+			reclaimed += seg->size;
+			close(seg->fd);
+			seg->fd = -1;
+			seg->size = 0;
+		}
+		crawl_free(NULL, path);
+	}
+	crawl_log_(crawl, LOG_INFO, "pack: compacted %lu segment(s), moving %lu record(s) and reclaiming %llu bytes\n", nsegs, nrecs, (unsigned long long) reclaimed);
+	if(packcache_index_rewrite_(crawl, pack))
+	{
+		r = -1;
+	}
+	pthread_mutex_unlock(&(pack->lock));
+	return r;
+}
+
+/* The body of the compactor thread, which compacts the pack whenever a new
+ * segment is started, using a context of its own for logging
+ */
+static void *
+packcache_compactor_(void *arg)
+{
+	struct packcache_pack_struct *pack;
+	CRAWL *crawl;
+
+	pack = (struct packcache_pack_struct *) arg;
+	crawl = crawl_create();
+	if(crawl)
+	{
+		crawl_set_logger(crawl, pack->logger);
+	}
+	pthread_mutex_lock(&(pack->lock));
+	for(;;)
+	{
+		while(!pack->wanted && !pack->shutdown)
+		{
+			pthread_cond_wait(&(pack->cond), &(pack->lock));
+		}
+		if(pack->shutdown)
+		{
+			break;
+		}
+		pack->wanted = 0;
+		pthread_mutex_unlock(&(pack->lock));
+		packcache_compact_(crawl, pack);
+		pthread_mutex_lock(&(pack->lock));
+	}
+	pthread_mutex_unlock(&(pack->lock));
+	crawl_destroy(crawl);
+	return NULL;
+}
+
+static int
+packcache_copy_(struct packcache_pack_struct *pack, int dstfd, uint64_t dstoff, int srcfd, uint64_t srcoff, uint64_t len)
+{
+	uint64_t pos;
+	size_t n;
+	ssize_t r;
+
+	for(pos = 0; pos < len; pos += r)
+	{
+		n = (len - pos > PACK_COPY_BLOCK ? PACK_COPY_BLOCK : len - pos);
+		r = pread(srcfd, pack->buf, n, srcoff + pos);
+		if(r <= 0)
+		{
+			if(!r)
+			{
+				errno = EIO;
+			}
+			return -1;
+		}
+		if(pwrite(dstfd, pack->buf, r, dstoff + pos) != r)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static struct packcache_entry_struct *
+packcache_lookup_(struct packcache_pack_struct *pack, const unsigned char *key)
+{
+	size_t c, mask;
+
+	if(!pack->tablesize)
+	{
+		return NULL;
+	}
+	mask = pack->tablesize - 1;
+	/* The key is already a hash, so use its leading bytes directly */
+	memcpy(&c, key, sizeof(c));
+	for(c &= mask; pack->table[c].isegment; c = (c + 1) & mask)
+	{
+		if(!memcmp(pack->table[c].key, key, sizeof(pack->table[c].key)))
+		{
+			return &(pack->table[c]);
+		}
+	}
+	return NULL;
+}
+
+/* Insert or replace the table entry for a key, maintaining the live-byte
+ * counts of the segments involved
+ */
+static int
+packcache_table_set_(struct packcache_pack_struct *pack, const struct packcache_entry_struct *entry)
+{
+	struct packcache_entry_struct *p, *old;
+	size_t c, n, size, mask;
+
+	p = packcache_lookup_(pack, entry->key);
+	if(p)
+	{
+		packcache_account_(pack, p, 0);
+		*p = *entry;
+		packcache_account_(pack, p, 1);
+		return 0;
+	}
+	if((pack->count + 1) * 4 > pack->tablesize * 3)
+	{
+		size = (pack->tablesize ? pack->tablesize * 2 : PACK_TABLE_MIN);
+		p = (struct packcache_entry_struct *) crawl_alloc(NULL, sizeof(struct packcache_entry_struct) * size);
+		if(!p)
+		{
+			return -1;
+		}
+		mask = size - 1;
+		old = pack->table;
+		for(n = 0; n < pack->tablesize; n++)
+		{
+			if(!old[n].isegment)
+			{
+				continue;
+			}
+			memcpy(&c, old[n].key, sizeof(c));
+			for(c &= mask; p[c].isegment; c = (c + 1) & mask);
+			p[c] = old[n];
+		}
+		crawl_free(NULL, old);
+		pack->table = p;
+		pack->tablesize = size;
+	}
+	mask = pack->tablesize - 1;
+	memcpy(&c, entry->key, sizeof(c));
+	for(c &= mask; pack->table[c].isegment; c = (c + 1) & mask);
+	pack->table[c] = *entry;
+	pack->count++;
+	packcache_account_(pack, entry, 1);
+	return 0;
+}
+
+/* Remove the table entry for a key, if there is one, re-inserting the
+ * entries which follow it in the same run so that lookups of them don't
+ * stop short at the vacated slot
+ */
+static void
+packcache_table_remove_(struct packcache_pack_struct *pack, const unsigned char *key)
+{
+	struct packcache_entry_struct *p, entry;
+	size_t c, n, mask;
+
+	p = packcache_lookup_(pack, key);
+	if(!p)
+	{
+		return;
+	}
+	packcache_account_(pack, p, 0);
+	memset(p, 0, sizeof(struct packcache_entry_struct));
+	pack->count--;
+	mask = pack->tablesize - 1;
+	for(n = ((p - pack->table) + 1) & mask; pack->table[n].isegment; n = (n + 1) & mask)
+	{
+		entry = pack->table[n];
+		memset(&(pack->table[n]), 0, sizeof(struct packcache_entry_struct));
+		memcpy(&c, entry.key, sizeof(c));
+		for(c &= mask; pack->table[c].isegment; c = (c + 1) & mask);
+		pack->table[c] = entry;
+	}
+}
+
+/* A record header and sidecar count towards the segment containing the
+ * sidecar, and the payload towards the segment containing the payload
+ */
+static void
+packcache_account_(struct packcache_pack_struct *pack, const struct packcache_entry_struct *entry, int add)
+{
+	uint64_t n;
+
+	if(entry->isegment < pack->nsegs)
+	{
+		n = sizeof(struct packcache_record_struct) + entry->ilen;
+		if(add)
+		{
+			pack->segs[entry->isegment].live += n;
+		}
+		else if(pack->segs[entry->isegment].live >= n)
+		{
+			pack->segs[entry->isegment].live -= n;
+		}
+	}
+	if(entry->plen && entry->psegment < pack->nsegs)
+	{
+		n = entry->plen;
+		if(add)
+		{
+			pack->segs[entry->psegment].live += n;
+		}
+		else if(pack->segs[entry->psegment].live >= n)
+		{
+			pack->segs[entry->psegment].live -= n;
+		}
+	}
+}
+
+/* Convert a hex cache key to its binary form */
+static int
+packcache_key_(const CACHEKEY key, unsigned char *bin)
+{
+	size_t c;
+	int hi, lo;
+
+	for(c = 0; c < CACHE_KEY_LEN / 2; c++)
+	{
+		hi = key[c * 2];
+		lo = key[c * 2 + 1];
+		if(!isxdigit(hi) || !isxdigit(lo))
+		{
+			return -1;
+		}
+		hi = (isdigit(hi) ? hi - '0' : tolower(hi) - 'a' + 10);
+		lo = (isdigit(lo) ? lo - '0' : tolower(lo) - 'a' + 10);
+		bin[c] = (unsigned char) ((hi << 4) | lo);
+	}
+	return 0;
+}
+
+static char *
+packcache_path_(const char *dir, const char *name)
+{
+	char *p;
+
+	p = (char *) crawl_alloc(NULL, strlen(dir) + 1 + strlen(name) + 1);
+	if(!p)
+	{
+		return NULL;
+	}
+	sprintf(p, "%s/%s", dir, name);
+	return p;
+}
+
+static char *
+packcache_segment_path_(struct packcache_pack_struct *pack, uint32_t id)
+{
+	char name[32];
+
+	sprintf(name, "%08lx" PACK_SEGMENT_SUFFIX, (unsigned long) id);
+	return packcache_path_(pack->path, name);
+}
+
+/* Locate a pending payload by key (and, if supplied, file pointer),
+ * optionally removing it from the list
+ */
+static struct packcache_pending_struct *
+packcache_pending_(struct packcache_data_struct *data, const CACHEKEY key, FILE *f, int detach)
+{
+	struct packcache_pending_struct *p, *prev;
+
+	prev = NULL;
+	for(p = data->pending; p; p = p->next)
+	{
+		if((!f || p->f == f) && !strcmp(p->key, key))
+		{
+			if(detach)
+			{
+				if(prev)
+				{
+					prev->next = p->next;
+				}
+				else
+				{
+					data->pending = p->next;
+				}
+				p->next = NULL;
+			}
+			return p;
+		}
+		prev = p;
+	}
+	return NULL;
+}
+
+static void
+packcache_pending_free_(CRAWL *crawl, struct packcache_pending_struct *p)
+{
+	if(p->f)
+	{
+		fclose(p->f);
+	}
+	crawl_free(crawl, p->info);
+	crawl_free(crawl, p);
+}
+
+#ifdef PACK_CUSTOM_STREAMS
+
+static ssize_t
+packcache_stream_read_(void *cookie, char *buf, size_t size)
+{
+	struct packcache_stream_struct *s;
+	ssize_t r;
+
+	s = (struct packcache_stream_struct *) cookie;
+	if(size > s->len - s->pos)
+	{
+		size = s->len - s->pos;
+	}
+	if(!size)
+	{
+		return 0;
+	}
+	r = pread(s->fd, buf, size, s->base + s->pos);
+	if(r < 0)
+	{
+		return -1;
+	}
+	s->pos += r;
+	return r;
+}
+
+static int
+packcache_stream_seek_(void *cookie, off_t *offset, int whence)
+{
+	struct packcache_stream_struct *s;
+	off_t pos;
+
+	s = (struct packcache_stream_struct *) cookie;
+	switch(whence)
+	{
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = (off_t) s->pos + *offset;
+		break;
+	case SEEK_END:
+		pos = (off_t) s->len + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if(pos < 0 || (uint64_t) pos > s->len)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	s->pos = pos;
+	*offset = pos;
+	return 0;
+}
+
+static int
+packcache_stream_close_(void *cookie)
+{
+	struct packcache_stream_struct *s;
+
+	s = (struct packcache_stream_struct *) cookie;
+	close(s->fd);
+	crawl_free(NULL, s);
+	return 0;
+}
+
+#endif /*PACK_CUSTOM_STREAMS*/
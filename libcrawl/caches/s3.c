@@ -15,24 +15,284 @@
  *  limitations under the License.
  */
 
+/* The S3 cache stores each payload and its sidecar as a pair of objects in
+ * a bucket.
+ *
+ * By default, payloads and sidecars are uploaded synchronously as they are
+ * committed. If background uploaders are enabled, committing an object
+ * instead hands the temporary payload file and the serialised sidecar off
+ * to a bounded queue, which is drained by a pool of threads (each with its
+ * own bucket handle); the sidecar is held until the payload is committed,
+ * and the two are uploaded together, payload first, so that a sidecar
+ * never refers to a payload which doesn't yet exist. A failed upload is
+ * retried, with an increasing delay between attempts. If the queue is
+ * full, the committing thread blocks until there's space in it.
+ *
+ * Reads of an object which is queued or being uploaded wait for the upload
+ * to complete, and crawl_cache_sync() waits for all of the uploads queued
+ * so far, reporting whether any of them failed.
+ *
+ * If the 'metadata=headers' option is given, the sidecar is instead stored
+ * (base64-encoded) in an x-amz-meta-anansi header on the payload object,
+ * so that committing an object requires a single PUT, and its sidecar can
+ * be read with a HEAD request. A sidecar which is updated without a new
+ * payload is stored by copying the payload object onto itself with the
+ * replacement metadata. Sidecars which are too large to be stored as object
+ * metadata, and objects written without this option, use a separate
+ * sidecar object as before, and are read from it if the payload object
+ * has no sidecar header. Sidecars may be in either format (see
+ * crawl_sidecar_convert()), although binary sidecars are much more likely
+ * to fit.
+ *
+ * If multipart uploads are enabled, a payload is written through a stream
+ * which counts the bytes written to the temporary file: once the payload
+ * grows beyond the threshold, a multipart upload is started, and each part
+ * is handed to a pool of part uploaders (each with its own bucket handle)
+ * as soon as it has been written, so that the parts are uploaded while the
+ * fetch is still in progress. Each part is retried independently. When the
+ * payload is committed, the final part is uploaded, and the upload is
+ * completed once all of the parts have been; if any part can't be
+ * uploaded, the multipart upload is abandoned and the payload is uploaded
+ * in one piece instead. If the bucket refuses to start a multipart upload
+ * at all (as it will if the AWS client library doesn't sign the multipart
+ * sub-resources), multipart uploads are disabled for the rest of the
+ * cache's lifetime. Because object metadata must be supplied when a
+ * multipart upload is started, the Content-Type and Content-Location are
+ * passed to the cache (see payload_headers) once the response headers have
+ * been received; the sidecar hasn't been written at that point, and so the
+ * sidecar of a payload uploaded in parts is stored separately (or, if
+ * sidecars are stored as object metadata, added by copying the payload
+ * object onto itself).
+ *
+ * Where the C library allows a stream to be created with custom I/O
+ * functions, payloads are read directly from the bucket in a sequence of
+ * HTTP range requests, each of which is received into a memory buffer by
+ * the cURL write callback; otherwise, the whole payload is downloaded to a
+ * temporary file before it's read.
+ *
+ * Options may be supplied as query parameters in the cache URI:
+ *
+ *   writers=<N>     number of background uploader threads (default 0,
+ *                   meaning that uploads are synchronous)
+ *   queue=<N>       maximum number of uploads queued (default 64)
+ *   retries=<N>     number of times a failed upload is retried (default 3)
+ *   read-size=<KB>  size of each range requested when a payload is read
+ *                   (default 4096)
+ *   metadata=headers  store sidecars as object metadata where possible
+ *   multipart=<MB>  payloads larger than this are uploaded in parts
+ *                   (default 0, meaning that multipart uploads are not used)
+ *   part-size=<MB>  the size of each part of a multipart upload (default 16,
+ *                   minimum 5)
+ *   parts=<N>       number of parts uploaded in parallel (default 4)
+ */
+
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
 
+#if defined(HAVE_FOPENCOOKIE) && !defined(_GNU_SOURCE)
+/* fopencookie() is a GNU extension */
+# define _GNU_SOURCE                   1
+#endif
+
 #include "p_libcrawl.h"
 
+#include <stdint.h>
+#include <strings.h>
+
 #include "libawsclient.h"
 
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+# define S3_CUSTOM_STREAMS             1
+#endif
+
+#define S3_DEFAULT_QUEUE               64
+#define S3_DEFAULT_RETRIES             3
+#define S3_DEFAULT_READ_SIZE           4096
+#define S3_DEFAULT_PART_SIZE           16
+#define S3_DEFAULT_PARTS               4
+/* S3 requires parts other than the last to be at least 5MB, and allows at
+ * most 10,000 parts
+ */
+#define S3_MIN_PART_SIZE               5
+#define S3_MAX_PARTS                   10000
+#define S3_MAX_WRITERS                 64
+#define S3_MAX_RETRY_DELAY             30
+/* S3 limits user-defined metadata to 2KB per object */
+#define S3_MAX_META                    2000
+#define S3_META_HEADER                 "x-amz-meta-anansi"
+
+/* Whether a sidecar written while its payload is open is held until the
+ * payload is committed, so that the two can be uploaded together
+ */
+#define S3_HOLD_INFO(data)             ((data)->writers || (data)->headermeta)
+/* Whether payloads which are open for writing are tracked */
+#define S3_TRACK_PENDING(data)         (S3_HOLD_INFO(data) || (data)->mpthreshold)
+
+/* An upload handed off to the background uploaders */
+struct s3cache_job_struct
+{
+	struct s3cache_job_struct *next;
+	CACHEKEY key;
+	/* The payload, if any, and the headers to upload it with */
+	FILE *f;
+	off_t len;
+	char *type;
+	char *location;
+	/* The serialised sidecar, if any */
+	char *info;
+	size_t infolen;
+	/* The multipart upload of the payload, if one was started */
+	struct s3cache_multipart_struct *mp;
+};
+
+/* A multipart upload of a payload */
+struct s3cache_multipart_struct
+{
+	CACHEKEY key;
+	char *uploadid;
+	/* The temporary file the payload is being written to */
+	int fd;
+	/* The number of parts started so far, and the offset of the next */
+	unsigned long nparts;
+	off_t next;
+	/* The ETag returned when each part was uploaded */
+	char **etags;
+	/* The number of parts queued or being uploaded */
+	unsigned long active;
+	int failed;
+};
+
+/* A part of a multipart upload, queued for the part uploaders */
+struct s3cache_part_struct
+{
+	struct s3cache_part_struct *next;
+	struct s3cache_multipart_struct *mp;
+	unsigned long number;
+	off_t offset;
+	off_t len;
+	/* The read position, while the part is being uploaded */
+	off_t pos;
+};
+
+/* A response header to be captured */
+struct s3cache_head_struct
+{
+	CRAWL *crawl;
+	const char *name;
+	char *value;
+};
+
+/* A response body to be captured */
+struct s3cache_body_struct
+{
+	CRAWL *crawl;
+	char *buf;
+	size_t len;
+};
+
+/* A payload which has been opened for writing but not yet committed */
+struct s3cache_pending_struct
+{
+	struct s3cache_pending_struct *next;
+	struct s3cache_data_struct *data;
+	CACHEKEY key;
+	FILE *f;
+	char *info;
+	size_t infolen;
+	/* If the payload is being written through a stream which uploads it in
+	 * parts, the underlying temporary file, the number of bytes written to
+	 * it, and the multipart upload, once it's been started
+	 */
+	FILE *tmp;
+	off_t size;
+	struct s3cache_multipart_struct *mp;
+	int mpfailed;
+	/* The Content-Type and Content-Location of the payload, which must be
+	 * supplied when a multipart upload is started
+	 */
+	char *type;
+	char *location;
+};
+
+#ifdef S3_CUSTOM_STREAMS
+/* A payload being read from the bucket one range at a time */
+struct s3cache_stream_struct
+{
+	CRAWL *crawl;
+	AWSS3BUCKET *bucket;
+	char *path;
+	/* The most recently-received range, and the read position within it */
+	char *buf;
+	size_t size;
+	size_t len;
+	size_t pos;
+	/* The offset of the next range to be requested */
+	uint64_t offset;
+	/* The size of the whole payload, once it's known */
+	uint64_t total;
+	int have_total;
+	/* The ETag of the payload, from the first range; subsequent ranges
+	 * are requested only if it still matches, so that a payload which is
+	 * replaced part of the way through isn't read as a mixture of the two
+	 */
+	char *etag;
+	int eof;
+	size_t rangesize;
+};
+#endif
+
 struct s3cache_data_struct
 {
 	AWSS3BUCKET *bucket;
 	CRAWL *crawl;
+	/* Credentials and endpoint, retained so that the uploaders can create
+	 * their own bucket handles
+	 */
+	char *access;
+	char *secret;
+	char *endpoint;
 	/* Temporary state */
 	char *path;
 	size_t pathsize;
 	char *buf;
 	size_t size;
 	size_t pos;
+	/* The size of each range requested when reading a payload */
+	size_t readsize;
+	/* Whether sidecars are stored as object metadata */
+	int headermeta;
+	/* Background uploads (only used if writers is nonzero) */
+	int writers;
+	int retries;
+	size_t queuemax;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t space;
+	pthread_cond_t done;
+	pthread_t *threads;
+	int nthreads;
+	int shutdown;
+	struct s3cache_pending_struct *pending;
+	struct s3cache_job_struct *head;
+	struct s3cache_job_struct *tail;
+	struct s3cache_job_struct *active;
+	size_t queued;
+	unsigned long failed;
+	/* Multipart uploads (only used if mpthreshold is nonzero) */
+	off_t mpthreshold;
+	off_t partsize;
+	int partwriters;
+	pthread_mutex_t mplock;
+	pthread_cond_t mpwork;
+	pthread_cond_t mpdone;
+	pthread_t *mpthreads;
+	int nmpthreads;
+	int mpshutdown;
+	/* Set if the bucket refused to start a multipart upload */
+	int mpdisabled;
+	struct s3cache_part_struct *parts;
+	struct s3cache_part_struct *partstail;
 };
 
 static int urldecode(char *dest, const char *src, size_t len);
@@ -40,6 +300,62 @@ static int urldecode(char *dest, const char *src, size_t len);
 static size_t s3cache_write_buf_(char *ptr, size_t size, size_t nmemb, void *userdata);
 static size_t s3cache_write_null_(char *ptr, size_t size, size_t nmemb, void *userdata);
 static int s3cache_copy_path_(CRAWLCACHE *cache, const CACHEKEY key, const char *suffix);
+static void s3cache_buf_discard_(struct s3cache_data_struct *data);
+static void s3cache_key_path_(char *dest, const CACHEKEY key, const char *type);
+static void s3cache_options_(CRAWL *crawl, struct s3cache_data_struct *data);
+static AWSS3BUCKET *s3cache_bucket_(CRAWL *crawl, struct s3cache_data_struct *data);
+static int s3cache_set_config_(struct s3cache_data_struct *data, char **dest, const char *value);
+static struct curl_slist *s3cache_add_header_(CRAWL *crawl, struct curl_slist *headers, const char *name, const char *value);
+static int s3cache_put_file_(CRAWL *crawl, AWSS3BUCKET *bucket, const char *path, FILE *f, off_t len, const char *type, const char *location, const char *meta);
+static int s3cache_put_meta_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job, const char *meta);
+static int s3cache_put_info_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job, const char *meta);
+static char *s3cache_meta_encode_(struct s3cache_data_struct *data, struct s3cache_job_struct *job);
+static int s3cache_head_meta_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+static size_t s3cache_head_header_(char *ptr, size_t size, size_t nmemb, void *userdata);
+static int s3cache_store_info_(CRAWLCACHE *cache, const CACHEKEY key, char *buf, size_t len);
+static char *s3cache_base64_encode_(CRAWL *crawl, const char *src, size_t len);
+static char *s3cache_base64_decode_(CRAWL *crawl, const char *src, size_t *len);
+static int s3cache_put_buf_(CRAWL *crawl, AWSS3BUCKET *bucket, const char *path, const char *buf, size_t len, const char *type);
+static int s3cache_job_run_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job, int attempts);
+static void s3cache_job_free_(CRAWL *crawl, struct s3cache_job_struct *job);
+static int s3cache_submit_(struct s3cache_data_struct *data, struct s3cache_job_struct *job);
+static int s3cache_start_(struct s3cache_data_struct *data);
+static void *s3cache_uploader_(void *arg);
+static void s3cache_wait_key_(struct s3cache_data_struct *data, const CACHEKEY key);
+static struct s3cache_pending_struct *s3cache_pending_(struct s3cache_data_struct *data, const CACHEKEY key, FILE *f, int detach);
+static void s3cache_pending_free_(struct s3cache_data_struct *data, struct s3cache_pending_struct *p);
+static size_t s3cache_write_body_(char *ptr, size_t size, size_t nmemb, void *userdata);
+static void s3cache_multipart_part_(struct s3cache_data_struct *data, struct s3cache_multipart_struct *mp, off_t len);
+static int s3cache_multipart_finish_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job);
+static int s3cache_multipart_wait_(struct s3cache_data_struct *data, struct s3cache_multipart_struct *mp);
+static int s3cache_multipart_complete_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_multipart_struct *mp);
+static void s3cache_multipart_abort_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_multipart_struct *mp);
+static void s3cache_multipart_free_(CRAWL *crawl, struct s3cache_multipart_struct *mp);
+#ifdef S3_CUSTOM_STREAMS
+static FILE *s3cache_multipart_stream_(struct s3cache_pending_struct *p);
+static ssize_t s3cache_multipart_write_(void *cookie, const char *buf, size_t size);
+static int s3cache_multipart_close_(void *cookie);
+static struct s3cache_multipart_struct *s3cache_multipart_begin_(struct s3cache_data_struct *data, struct s3cache_pending_struct *p);
+# ifdef HAVE_FOPENCOOKIE
+static ssize_t s3cache_cookie_write_(void *cookie, const char *buf, size_t size);
+# else
+static int s3cache_cookie_write_(void *cookie, const char *buf, int size);
+# endif
+static int s3cache_part_start_(struct s3cache_data_struct *data);
+static void *s3cache_part_uploader_(void *arg);
+static int s3cache_put_part_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_part_struct *part, char **etag);
+static size_t s3cache_part_read_(char *ptr, size_t size, size_t nmemb, void *userdata);
+#endif
+#ifdef S3_CUSTOM_STREAMS
+static FILE *s3cache_stream_open_(CRAWLCACHE *cache, const CACHEKEY key);
+static int s3cache_stream_fetch_(struct s3cache_stream_struct *s);
+static void s3cache_stream_free_(struct s3cache_stream_struct *s);
+static size_t s3cache_stream_write_(char *ptr, size_t size, size_t nmemb, void *userdata);
+static size_t s3cache_stream_header_(char *ptr, size_t size, size_t nmemb, void *userdata);
+static ssize_t s3cache_stream_read_(void *cookie, char *buf, size_t size);
+static int s3cache_stream_seek_(void *cookie, off_t *offset, int whence);
+static int s3cache_stream_close_(void *cookie);
+#endif
 
 static unsigned long s3cache_init_(CRAWLCACHE *cache);
 static unsigned long s3cache_done_(CRAWLCACHE *cache);
@@ -53,6 +369,12 @@ static char *s3cache_uri_(CRAWLCACHE *cache, const CACHEKEY key);
 static int s3cache_set_username_(CRAWLCACHE *cache, const char *username);
 static int s3cache_set_password_(CRAWLCACHE *cache, const char *password);
 static int s3cache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint);
+static const void *s3cache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len);
+static int s3cache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len);
+static int s3cache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+static int s3cache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len);
+static int s3cache_sync_(CRAWLCACHE *cache);
+static int s3cache_payload_headers_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, const char *type, const char *location);
 
 static const CRAWLCACHEIMPL s3cache_impl = {
 	NULL,
@@ -68,6 +390,15 @@ static const CRAWLCACHEIMPL s3cache_impl = {
 	s3cache_set_username_,
 	s3cache_set_password_,
 	s3cache_set_endpoint_,
+	s3cache_payload_map_,
+	s3cache_payload_unmap_,
+	s3cache_info_read_buf_,
+	s3cache_info_write_buf_,
+	s3cache_sync_,
+	NULL,
+	NULL,
+	s3cache_payload_headers_,
+	NULL
 };
 
 const CRAWLCACHEIMPL *s3cache = &s3cache_impl;
@@ -77,7 +408,6 @@ s3cache_init_(CRAWLCACHE *cache)
 {
 	struct s3cache_data_struct *data;
 	const char *t;
-	char *p;
 
 	data = (struct s3cache_data_struct *) crawl_alloc(cache->crawl, sizeof(struct s3cache_data_struct));
 	if(!data)
@@ -86,52 +416,63 @@ s3cache_init_(CRAWLCACHE *cache)
 	}
 	data->crawl = cache->crawl;
 	if(!cache->crawl->uri->host)
-	{
-		return 0;
-	}
-	crawl_log_(cache->crawl, LOG_DEBUG, "S3: initialising cache at <s3://%s>\n", cache->crawl->uri->host);
-	data->bucket = aws_s3_create(cache->crawl->uri->host);
-	if(!data->bucket)
 	{
 		crawl_free(cache->crawl, data);
 		return 0;
 	}
+	crawl_log_(cache->crawl, LOG_DEBUG, "S3: initialising cache at <s3://%s>\n", cache->crawl->uri->host);
 	if(cache->crawl->uri->auth)
 	{		
 		t = strchr(cache->crawl->uri->auth, ':');
 		if(t)
 		{
-			p = (char *) crawl_alloc(cache->crawl, t - cache->crawl->uri->auth + 1);
-			if(!p)
-			{
-				aws_s3_destroy(data->bucket);
-				crawl_free(cache->crawl, data);
-				return 0;
-			}
-			urldecode(p, cache->crawl->uri->auth, t - cache->crawl->uri->auth);
-			p[t - cache->crawl->uri->auth] = 0;
-			aws_s3_set_access(data->bucket, p);
-			crawl_free(cache->crawl, p);
+			data->access = (char *) crawl_alloc(cache->crawl, t - cache->crawl->uri->auth + 1);
+			urldecode(data->access, cache->crawl->uri->auth, t - cache->crawl->uri->auth);
 			t++;
-			p = (char *) crawl_alloc(cache->crawl, strlen(t) + 1);
-			if(!p)
-			{
-				aws_s3_destroy(data->bucket);
-				crawl_free(cache->crawl, data);
-				return 0;
-			}
-			urldecode(p, t, strlen(t));
-			aws_s3_set_secret(data->bucket, p);
-			crawl_free(cache->crawl, p);
+			data->secret = (char *) crawl_alloc(cache->crawl, strlen(t) + 1);
+			urldecode(data->secret, t, strlen(t));
 		}
 		else
 		{
-			aws_s3_set_access(data->bucket, cache->crawl->uri->auth);
+			data->access = crawl_strdup(cache->crawl, cache->crawl->uri->auth);
 		}
 	}
-	if(cache->crawl->uri->path)
+	data->bucket = s3cache_bucket_(cache->crawl, data);
+	if(!data->bucket)
+	{
+		crawl_free(cache->crawl, data->access);
+		crawl_free(cache->crawl, data->secret);
+		crawl_free(cache->crawl, data);
+		return 0;
+	}
+	data->queuemax = S3_DEFAULT_QUEUE;
+	data->retries = S3_DEFAULT_RETRIES;
+	data->readsize = S3_DEFAULT_READ_SIZE * 1024;
+	data->partsize = (off_t) S3_DEFAULT_PART_SIZE * 1048576;
+	data->partwriters = S3_DEFAULT_PARTS;
+	s3cache_options_(cache->crawl, data);
+	if(data->writers)
+	{
+		/* The uploader threads are started when the first upload is queued,
+		 * so that they pick up any credentials supplied after the cache has
+		 * been initialised
+		 */
+		crawl_log_(cache->crawl, LOG_DEBUG, "S3: using %d background uploaders with a queue of %lu\n", data->writers, (unsigned long) data->queuemax);
+		pthread_mutex_init(&(data->lock), NULL);
+		pthread_cond_init(&(data->work), NULL);
+		pthread_cond_init(&(data->space), NULL);
+		pthread_cond_init(&(data->done), NULL);
+	}
+	if(data->mpthreshold)
 	{
-		aws_s3_set_basepath(data->bucket, cache->crawl->uri->path);
+		if(data->mpthreshold < data->partsize)
+		{
+			data->mpthreshold = data->partsize;
+		}
+		crawl_log_(cache->crawl, LOG_DEBUG, "S3: uploading payloads larger than %lluMB in %lluMB parts, %d at a time\n", (unsigned long long) data->mpthreshold / 1048576, (unsigned long long) data->partsize / 1048576, data->partwriters);
+		pthread_mutex_init(&(data->mplock), NULL);
+		pthread_cond_init(&(data->mpwork), NULL);
+		pthread_cond_init(&(data->mpdone), NULL);
 	}
 	cache->data = data;
 	return 1;
@@ -141,14 +482,65 @@ unsigned long
 s3cache_done_(CRAWLCACHE *cache)
 {
 	struct s3cache_data_struct *data;
+	struct s3cache_pending_struct *p;
+	int c;
 
 	data = (struct s3cache_data_struct *) cache->data;
 	if(data)
 	{
+		if(data->writers)
+		{
+			/* Wait for the uploaders to drain the queue and exit */
+			pthread_mutex_lock(&(data->lock));
+			data->shutdown = 1;
+			pthread_cond_broadcast(&(data->work));
+			pthread_mutex_unlock(&(data->lock));
+			for(c = 0; c < data->nthreads; c++)
+			{
+				pthread_join(data->threads[c], NULL);
+			}
+			if(data->failed)
+			{
+				crawl_log_(cache->crawl, LOG_ERR, MSG_E_S3_UPLOAD ": %lu uploads failed\n", data->failed);
+			}
+			crawl_free(cache->crawl, data->threads);
+			pthread_cond_destroy(&(data->done));
+			pthread_cond_destroy(&(data->space));
+			pthread_cond_destroy(&(data->work));
+			pthread_mutex_destroy(&(data->lock));
+		}
+		while(data->pending)
+		{
+			p = data->pending;
+			data->pending = p->next;
+			fclose(p->f);
+			s3cache_pending_free_(data, p);
+		}
+		if(data->mpthreshold)
+		{
+			/* The part uploaders are stopped last, because the uploaders
+			 * may have been waiting for them to finish
+			 */
+			pthread_mutex_lock(&(data->mplock));
+			data->mpshutdown = 1;
+			pthread_cond_broadcast(&(data->mpwork));
+			pthread_mutex_unlock(&(data->mplock));
+			for(c = 0; c < data->nmpthreads; c++)
+			{
+				pthread_join(data->mpthreads[c], NULL);
+			}
+			crawl_free(cache->crawl, data->mpthreads);
+			pthread_cond_destroy(&(data->mpdone));
+			pthread_cond_destroy(&(data->mpwork));
+			pthread_mutex_destroy(&(data->mplock));
+		}
 		if(data->bucket)
 		{
 			aws_s3_destroy(data->bucket);
 		}
+		crawl_free(cache->crawl, data->access);
+		crawl_free(cache->crawl, data->secret);
+		crawl_free(cache->crawl, data->endpoint);
 		crawl_free(cache->crawl, data->path);
 		crawl_free(cache->crawl, data->buf);
 		crawl_free(cache->crawl, data);
@@ -160,12 +552,56 @@ s3cache_done_(CRAWLCACHE *cache)
 static FILE *
 s3cache_open_write_(CRAWLCACHE *cache, const CACHEKEY key)
 {
-	(void) cache;
-	(void) key;
+	struct s3cache_data_struct *data;
+	struct s3cache_pending_struct *p;
+	FILE *f;
 
-	return tmpfile();
+	data = (struct s3cache_data_struct *) cache->data;
+	f = tmpfile();
+	if(!f)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_S3_TMPFILE ": %s\n", strerror(errno));
+		return NULL;
+	}
+	if(S3_TRACK_PENDING(data))
+	{
+		/* Track the payload so that its sidecar can be held until it's
+		 * committed, or so that it can be uploaded in parts
+		 */
+		p = (struct s3cache_pending_struct *) crawl_alloc(cache->crawl, sizeof(struct s3cache_pending_struct));
+		p->data = data;
+		strcpy(p->key, key);
+		p->f = f;
+#ifdef S3_CUSTOM_STREAMS
+		if(data->mpthreshold)
+		{
+			p->tmp = f;
+			p->f = s3cache_multipart_stream_(p);
+			if(!p->f)
+			{
+				crawl_log_(cache->crawl, LOG_ERR, MSG_E_S3_TMPFILE ": %s\n", strerror(errno));
+				fclose(f);
+				crawl_free(cache->crawl, p);
+				return NULL;
+			}
+			f = p->f;
+		}
+#endif
+		p->next = data->pending;
+		data->pending = p;
+	}
+	return f;
 }
 
+#ifdef S3_CUSTOM_STREAMS
+static FILE *
+s3cache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	s3cache_wait_key_((struct s3cache_data_struct *) cache->data, key);
+	return s3cache_stream_open_(cache, key);
+}
+#else
+/* Download a payload to a temporary file */
 static FILE *
 s3cache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
 {
@@ -175,7 +611,9 @@ s3cache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
 	int e;
 	CURL *ch;
 	long status;
-	
+
+	data = (struct s3cache_data_struct *) cache->data;
+	s3cache_wait_key_(data, key);
 	f = tmpfile();
 	if(!f)
 	{
@@ -183,7 +621,6 @@ s3cache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
 		return NULL;
 	}
 	e = 0;
-	data = (struct s3cache_data_struct *) cache->data;
 	status = 0;
 	s3cache_copy_path_(cache, key, CACHE_PAYLOAD_SUFFIX);
 	req = aws_s3_request_create(data->bucket, data->path, "GET");
@@ -216,13 +653,109 @@ s3cache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
 	rewind(f);
 	return f;
 }
+#endif /*S3_CUSTOM_STREAMS*/
+
+/* Fetch a payload directly into memory, handing the buffer over to the
+ * caller rather than spooling it through a temporary file
+ */
+static const void *
+s3cache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len)
+{
+	AWSREQUEST *req;
+	struct s3cache_data_struct *data;
+	CURL *ch;
+	long status;
+	char *p;
+
+	data = (struct s3cache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	s3cache_wait_key_(data, key);
+	status = 0;
+	data->pos = 0;
+	if(s3cache_copy_path_(cache, key, CACHE_PAYLOAD_SUFFIX))
+	{
+		return NULL;
+	}
+	req = aws_s3_request_create(data->bucket, data->path, "GET");
+	crawl_log_(cache->crawl, LOG_DEBUG, "S3: fetching <%s>\n", data->path);
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_buf_);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) data);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, cache->crawl->verbose);
+	if(aws_request_perform(req))
+	{
+		aws_request_destroy(req);
+		s3cache_buf_discard_(data);
+		return NULL;
+	}
+	curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+	aws_request_destroy(req);
+	if(status != 200)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_S3_HTTP ": <%s>: HTTP status %d\n", data->path, status);
+		/* Don't retain the body of the error response */
+		s3cache_buf_discard_(data);
+		return NULL;
+	}
+	if(!data->pos)
+	{
+		*len = 0;
+		return "";
+	}
+	/* The buffer now belongs to the caller */
+	p = data->buf;
+	*len = data->pos;
+	data->buf = NULL;
+	data->size = 0;
+	data->pos = 0;
+	return p;
+}
+
+static int
+s3cache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len)
+{
+	if(len)
+	{
+		crawl_free(cache->crawl, (void *) ptr);
+	}
+	return 0;
+}
 
 static int
 s3cache_close_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f)
 {
-	(void) cache;
-	(void) key;
-	
+	struct s3cache_data_struct *data;
+	struct s3cache_pending_struct *p;
+	struct s3cache_job_struct *job;
+
+	data = (struct s3cache_data_struct *) cache->data;
+	if(S3_TRACK_PENDING(data) && (p = s3cache_pending_(data, key, f, 1)))
+	{
+		if(p->info)
+		{
+			/* A sidecar written while the payload was open is still
+			 * uploaded, just as it would have been had it not been held
+			 */
+			job = (struct s3cache_job_struct *) crawl_alloc(cache->crawl, sizeof(struct s3cache_job_struct));
+			strcpy(job->key, key);
+			job->info = p->info;
+			job->infolen = p->infolen;
+			p->info = NULL;
+			s3cache_submit_(data, job);
+		}
+		/* Don't start any more parts while the stream is flushed; closing
+		 * the pending payload then abandons the multipart upload
+		 */
+		p->mpfailed = 1;
+		fclose(f);
+		s3cache_pending_free_(data, p);
+		return 0;
+	}
 	fclose(f);
 	return 0;
 }
@@ -230,165 +763,241 @@ s3cache_close_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f)
 static int
 s3cache_close_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, CRAWLOBJ *obj)
 {
-	AWSREQUEST *req;
 	struct s3cache_data_struct *data;
-	int e;
-	CURL *ch;
-	long status;
-	off_t offset;
-	struct curl_slist *headers;
+	struct s3cache_pending_struct *p;
+	struct s3cache_job_struct *job;
 	const char *t;
-	char *buf;
 
 	if(!f)
 	{
 		errno = EINVAL;
 		return -1;
-	}	
-	offset = ftello(f);
-	rewind(f);
-	e = 0;
+	}
 	data = (struct s3cache_data_struct *) cache->data;
-	status = 0;
-	s3cache_copy_path_(cache, key, CACHE_PAYLOAD_SUFFIX);
-	req = aws_s3_request_create(data->bucket, data->path, "PUT");
-	crawl_log_(cache->crawl, LOG_DEBUG, "Uploading payload to <%s>\n", data->path);
-	ch = aws_request_curl(req);
-	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(ch, CURLOPT_READDATA, f);
-	curl_easy_setopt(ch, CURLOPT_INFILESIZE_LARGE, (curl_off_t) offset);
-	curl_easy_setopt(ch, CURLOPT_VERBOSE, cache->crawl->verbose);
-	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
-	curl_easy_setopt(ch, CURLOPT_UPLOAD, 1);
-    headers = curl_slist_append(aws_request_headers(req), "Expect: 100-continue");
-	t = crawl_obj_type(obj);
-	if(t)
+	job = (struct s3cache_job_struct *) crawl_alloc(cache->crawl, sizeof(struct s3cache_job_struct));
+	strcpy(job->key, key);
+	job->f = f;
+	if((t = crawl_obj_type(obj)))
 	{
-		buf = (char *) crawl_alloc(cache->crawl, strlen(t) + 15);
-		strcpy(buf, "Content-Type: ");
-		strcpy(&(buf[14]), t);
-		headers = curl_slist_append(headers, buf);
-		crawl_free(cache->crawl, buf);
+		job->type = crawl_strdup(cache->crawl, t);
 	}
-	t = crawl_obj_content_location(obj);
-	if(t)
+	if((t = crawl_obj_content_location(obj)))
 	{
-		buf = (char *) crawl_alloc(cache->crawl, strlen(t) + 19);
-		strcpy(buf, "Content-Location: ");
-		strcpy(&(buf[18]), t);
-		headers = curl_slist_append(headers, buf);
-		crawl_free(cache->crawl, buf);
+		job->location = crawl_strdup(cache->crawl, t);
 	}
-	aws_request_set_headers(req, headers);
-	if(!aws_request_perform(req))
+	if(S3_TRACK_PENDING(data) && (p = s3cache_pending_(data, key, f, 1)))
 	{
-		status = 0;
-		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
-		if(status != 200)
+		/* Upload the sidecar (if it's been written) along with the payload */
+		job->info = p->info;
+		job->infolen = p->infolen;
+		p->info = NULL;
+		if(p->tmp)
 		{
-			e = -1;
+			/* Flush the stream (which may start more parts uploading),
+			 * and take over the underlying file and the multipart upload
+			 */
+			if(fclose(f))
+			{
+				job->f = NULL;
+				s3cache_job_free_(cache->crawl, job);
+				s3cache_pending_free_(data, p);
+				return -1;
+			}
+			job->f = p->tmp;
+			job->len = p->size;
+			job->mp = p->mp;
+			p->tmp = NULL;
+			p->mp = NULL;
+			s3cache_pending_free_(data, p);
+			return s3cache_submit_(data, job);
 		}
+		s3cache_pending_free_(data, p);
 	}
-	else
+	job->len = ftello(f);
+	return s3cache_submit_(data, job);
+}
+
+/* Retain the headers of a payload which may be uploaded in parts, so that
+ * they can be supplied when the multipart upload is started
+ */
+static int
+s3cache_payload_headers_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, const char *type, const char *location)
+{
+	struct s3cache_data_struct *data;
+	struct s3cache_pending_struct *p;
+
+	data = (struct s3cache_data_struct *) cache->data;
+	if(!data->mpthreshold || !(p = s3cache_pending_(data, key, f, 0)))
 	{
-		e = -1;
+		return 0;
 	}
-	aws_request_destroy(req);
-	fclose(f);
-	return e;
+	crawl_free(cache->crawl, p->type);
+	crawl_free(cache->crawl, p->location);
+	p->type = (type ? crawl_strdup(cache->crawl, type) : NULL);
+	p->location = (location ? crawl_strdup(cache->crawl, location) : NULL);
+	return 0;
 }
 
 static int
 s3cache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **dict)
+{
+	char *buf;
+	size_t len;
+	json_t *json;
+
+	if(s3cache_info_read_buf_(cache, key, &buf, &len))
+	{
+		return -1;
+	}
+	json = crawl_sidecar_json_(cache->crawl, buf, len);
+	crawl_free(cache->crawl, buf);
+	if(!json)
+	{
+		return -1;
+	}
+	if(*dict)
+	{
+		json_decref(*dict);
+	}
+	*dict = json;
+	return 0;
+}
+
+static int
+s3cache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len)
 {
 	AWSREQUEST *req;
 	struct s3cache_data_struct *data;
 	CURL *ch;
 	long status;
-	json_t *json;
+	int r;
 
+	*buf = NULL;
+	*len = 0;
 	data = (struct s3cache_data_struct *) cache->data;
+	s3cache_wait_key_(data, key);
+	if(data->headermeta)
+	{
+		/* Fall back to the sidecar object only if the payload exists but
+		 * has no sidecar header
+		 */
+		r = s3cache_head_meta_(cache, key, buf, len);
+		if(r <= 0)
+		{
+			return r;
+		}
+	}
 	status = 0;
 	data->pos = 0;
-	s3cache_copy_path_(cache, key, CACHE_INFO_SUFFIX);
+	if(s3cache_copy_path_(cache, key, CACHE_INFO_SUFFIX))
+	{
+		return -1;
+	}
 	req = aws_s3_request_create(data->bucket, data->path, "GET");
 	ch = aws_request_curl(req);
 	curl_easy_setopt(ch, CURLOPT_VERBOSE, cache->crawl->verbose);
 	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
 	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_buf_);
 	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) data);
-	if(aws_request_perform(req) || !data->buf)
+	if(aws_request_perform(req))
 	{
 		aws_request_destroy(req);
+		s3cache_buf_discard_(data);
+		errno = EIO;
 		return -1;
 	}
 	curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
 	aws_request_destroy(req);
-	if(status != 200)
-	{
-		return -1;
-	}
-	json = json_loads(data->buf, 0, NULL);
-	if(!json)
+	if(status != 200 || !data->buf)
 	{
+		s3cache_buf_discard_(data);
+		/* Callers such as the tiered cache distinguish an object which
+		 * doesn't exist from one which couldn't be read
+		 */
+		errno = (status == 404 ? ENOENT : EIO);
 		return -1;
 	}
-	if(*dict)
-	{
-		json_decref(*dict);
-	}
-	*dict = json;
+	/* The buffer now belongs to the caller */
+	*buf = data->buf;
+	*len = data->pos;
+	data->buf = NULL;
+	data->size = 0;
+	data->pos = 0;
 	return 0;
 }
 
 static int
 s3cache_info_write_(CRAWLCACHE *cache, const CACHEKEY key, const json_t *dict)
 {
-	AWSREQUEST *req;
+	char *buf;
+
+	buf = json_dumps(dict, JSON_PRESERVE_ORDER);
+	if(!buf)
+	{
+		return -1;
+	}
+	return s3cache_store_info_(cache, key, buf, strlen(buf));
+}
+
+static int
+s3cache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len)
+{
 	char *p;
-	size_t len;
-	volatile int e;
-	long status;
-	CURL *ch;
-	struct curl_slist *headers;
+
+	p = (char *) crawl_alloc(cache->crawl, len + 1);
+	memcpy(p, buf, len);
+	return s3cache_store_info_(cache, key, p, len);
+}
+
+/* Store a serialised sidecar, taking ownership of the buffer: if a payload
+ * for the same key is in the process of being written, the sidecar is
+ * held until the payload is committed; otherwise, it's uploaded by itself
+ */
+static int
+s3cache_store_info_(CRAWLCACHE *cache, const CACHEKEY key, char *buf, size_t len)
+{
 	struct s3cache_data_struct *data;
+	struct s3cache_pending_struct *p;
+	struct s3cache_job_struct *job;
 
-	e = 0;
 	data = (struct s3cache_data_struct *) cache->data;
-	s3cache_copy_path_(cache, key, CACHE_INFO_SUFFIX);
-	
-	p = json_dumps(dict, JSON_PRESERVE_ORDER);
-	if(!p)
+	if(S3_HOLD_INFO(data) && (p = s3cache_pending_(data, key, NULL, 0)))
 	{
-		return -1;
+		free(p->info);
+		p->info = buf;
+		p->infolen = len;
+		return 0;
 	}
-	len = strlen(p);
-	req = aws_s3_request_create(data->bucket, data->path, "PUT");
-	ch = aws_request_curl(req);
-	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(ch, CURLOPT_POSTFIELDS, p);
-	curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, len);
-	curl_easy_setopt(ch, CURLOPT_VERBOSE, cache->crawl->verbose);
-	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
-	headers = aws_request_headers(req);
-	headers = curl_slist_append(headers, "Content-Type: application/json");
-	aws_request_set_headers(req, headers);
-	if(!aws_request_perform(req))
+	job = (struct s3cache_job_struct *) crawl_alloc(cache->crawl, sizeof(struct s3cache_job_struct));
+	strcpy(job->key, key);
+	job->info = buf;
+	job->infolen = len;
+	return s3cache_submit_(data, job);
+}
+
+/* Wait until every upload queued so far has completed; returns -1 if any
+ * of them failed since the last time this was called
+ */
+static int
+s3cache_sync_(CRAWLCACHE *cache)
+{
+	struct s3cache_data_struct *data;
+	int r;
+
+	data = (struct s3cache_data_struct *) cache->data;
+	if(!data || !data->writers)
 	{
-		status = 0;
-		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
-		if(status != 200)
-		{
-			e = -1;
-		}			
+		return 0;
 	}
-	else
+	pthread_mutex_lock(&(data->lock));
+	while(data->head || data->active)
 	{
-		e = -1;
+		pthread_cond_wait(&(data->done), &(data->lock));
 	}
-	crawl_free(cache->crawl, p);
-	aws_request_destroy(req);
-	return e;
+	r = (data->failed ? -1 : 0);
+	data->failed = 0;
+	pthread_mutex_unlock(&(data->lock));
+	return r;
 }
 
 static char *s3cache_uri_(CRAWLCACHE *cache, const CACHEKEY key)
@@ -396,9 +1005,7 @@ static char *s3cache_uri_(CRAWLCACHE *cache, const CACHEKEY key)
 	const char *bucket, *path;
 	char *uri, *p;
 	size_t needed;
-	struct s3cache_data_struct *data;
 
-	data = (struct s3cache_data_struct *) cache->data;
 	bucket = cache->crawl->uri->host;
 	path = cache->crawl->uri->path;
 	if(path)
@@ -452,6 +1059,7 @@ s3cache_set_username_(CRAWLCACHE *cache, const char *username)
 		errno = EPERM;
 		return -1;
 	}
+	s3cache_set_config_(data, &(data->access), username);
 	return aws_s3_set_access(data->bucket, username);
 }
 
@@ -466,6 +1074,7 @@ s3cache_set_password_(CRAWLCACHE *cache, const char *password)
 		errno = EPERM;
 		return -1;
 	}
+	s3cache_set_config_(data, &(data->secret), password);
 	return aws_s3_set_secret(data->bucket, password);
 }
 
@@ -480,71 +1089,1847 @@ s3cache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint)
 		errno = EPERM;
 		return -1;
 	}
+	s3cache_set_config_(data, &(data->endpoint), endpoint);
 	return aws_s3_set_endpoint(data->bucket, endpoint);
 }
 
-/* Callback invoked by cURL when data is received */
-static size_t
-s3cache_write_buf_(char *ptr, size_t size, size_t nmemb, void *userdata)
+/* Apply any options supplied in the query string of the cache URI */
+static void
+s3cache_options_(CRAWL *crawl, struct s3cache_data_struct *data)
 {
-	struct s3cache_data_struct *data;
-	char *p;
+	const char *s, *t, *v;
+	size_t len;
+	unsigned long n;
 
-	data = (struct s3cache_data_struct *) userdata;
-	size *= nmemb;
-	if(data->pos + size >= data->size)
+	if(!crawl->uri || !crawl->uri->query)
 	{
-		p = (char *) crawl_realloc(data->crawl, data->buf, data->pos + size + 1);
-		if(!p)
+		return;
+	}
+	for(s = crawl->uri->query; *s; s = (*t ? t + 1 : t))
+	{
+		t = strchr(s, '&');
+		if(!t)
 		{
-			return 0;
+			t = s + strlen(s);
+		}
+		v = memchr(s, '=', t - s);
+		if(!v)
+		{
+			continue;
+		}
+		len = v - s;
+		v++;
+		n = strtoul(v, NULL, 10);
+		if(len == 7 && !strncmp(s, "writers", len))
+		{
+			data->writers = (n > S3_MAX_WRITERS ? S3_MAX_WRITERS : (int) n);
+		}
+		else if(len == 5 && !strncmp(s, "queue", len) && n)
+		{
+			data->queuemax = n;
+		}
+		else if(len == 7 && !strncmp(s, "retries", len))
+		{
+			data->retries = (int) n;
+		}
+		else if(len == 9 && !strncmp(s, "read-size", len) && n)
+		{
+			data->readsize = n * 1024;
+		}
+#ifdef S3_CUSTOM_STREAMS
+		else if(len == 9 && !strncmp(s, "multipart", len))
+		{
+			data->mpthreshold = (off_t) n * 1048576;
+		}
+		else if(len == 9 && !strncmp(s, "part-size", len))
+		{
+			data->partsize = (off_t) (n < S3_MIN_PART_SIZE ? S3_MIN_PART_SIZE : n) * 1048576;
+		}
+		else if(len == 5 && !strncmp(s, "parts", len) && n)
+		{
+			data->partwriters = (n > S3_MAX_WRITERS ? S3_MAX_WRITERS : (int) n);
+		}
+#endif
+		else if(len == 8 && !strncmp(s, "metadata", len))
+		{
+			data->headermeta = ((size_t) (t - v) == 7 && !strncmp(v, "headers", 7));
 		}
-		data->buf = p;
-		data->size = data->pos + size + 1;
 	}
-	memcpy(&(data->buf[data->pos]), ptr, size);
-	data->pos += size;
-	data->buf[data->pos] = 0;
-	return size;
 }
 
-/* Generate the URL and resource path for a given key and type */
+/* Create a bucket handle using the cache configuration */
+static AWSS3BUCKET *
+s3cache_bucket_(CRAWL *crawl, struct s3cache_data_struct *data)
+{
+	AWSS3BUCKET *bucket;
+
+	bucket = aws_s3_create(crawl->uri->host);
+	if(!bucket)
+	{
+		return NULL;
+	}
+	if(data->access)
+	{
+		aws_s3_set_access(bucket, data->access);
+	}
+	if(data->secret)
+	{
+		aws_s3_set_secret(bucket, data->secret);
+	}
+	if(data->endpoint)
+	{
+		aws_s3_set_endpoint(bucket, data->endpoint);
+	}
+	if(crawl->uri->path)
+	{
+		aws_s3_set_basepath(bucket, crawl->uri->path);
+	}
+	return bucket;
+}
+
+/* Replace one of the retained configuration strings; the uploaders only
+ * read these while holding the lock
+ */
 static int
-s3cache_copy_path_(CRAWLCACHE *cache, const CACHEKEY key, const char *type)
+s3cache_set_config_(struct s3cache_data_struct *data, char **dest, const char *value)
 {
-	struct s3cache_data_struct *data;
-	size_t needed;
 	char *p;
 
-	data = (struct s3cache_data_struct *) cache->data;
-	
-	/* /key.type */
-	needed = 1 + strlen(key) + 1 + strlen(type) + 1;
-	if(data->pathsize < needed)
+	p = (value ? crawl_strdup(data->crawl, value) : NULL);
+	if(data->writers)
 	{
-		p = (char *) crawl_realloc(data->crawl, data->path, needed);
-		if(!p)
+		pthread_mutex_lock(&(data->lock));
+	}
+	if(data->mpthreshold)
+	{
+		pthread_mutex_lock(&(data->mplock));
+	}
+	crawl_free(data->crawl, *dest);
+	*dest = p;
+	if(data->mpthreshold)
+	{
+		pthread_mutex_unlock(&(data->mplock));
+	}
+	if(data->writers)
+	{
+		pthread_mutex_unlock(&(data->lock));
+	}
+	return 0;
+}
+
+/* Append a header to a list of request headers */
+static struct curl_slist *
+s3cache_add_header_(CRAWL *crawl, struct curl_slist *headers, const char *name, const char *value)
+{
+	char *buf;
+
+	buf = (char *) crawl_alloc(crawl, strlen(name) + strlen(value) + 3);
+	sprintf(buf, "%s: %s", name, value);
+	headers = curl_slist_append(headers, buf);
+	crawl_free(crawl, buf);
+	return headers;
+}
+
+/* Upload a payload from a file, along with its sidecar header, if any */
+static int
+s3cache_put_file_(CRAWL *crawl, AWSS3BUCKET *bucket, const char *path, FILE *f, off_t len, const char *type, const char *location, const char *meta)
+{
+	AWSREQUEST *req;
+	int e;
+	CURL *ch;
+	long status;
+	struct curl_slist *headers;
+
+	rewind(f);
+	e = 0;
+	req = aws_s3_request_create(bucket, path, "PUT");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_READDATA, f);
+	curl_easy_setopt(ch, CURLOPT_INFILESIZE_LARGE, (curl_off_t) len);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
+	curl_easy_setopt(ch, CURLOPT_UPLOAD, 1);
+	headers = curl_slist_append(aws_request_headers(req), "Expect: 100-continue");
+	if(type)
+	{
+		headers = s3cache_add_header_(crawl, headers, "Content-Type", type);
+	}
+	if(location)
+	{
+		headers = s3cache_add_header_(crawl, headers, "Content-Location", location);
+	}
+	if(meta)
+	{
+		headers = s3cache_add_header_(crawl, headers, S3_META_HEADER, meta);
+	}
+	aws_request_set_headers(req, headers);
+	if(!aws_request_perform(req))
+	{
+		status = 0;
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+		if(status != 200)
 		{
-			return -1;
+			e = -1;
 		}
-		data->pathsize = needed;
-		data->path = p;
 	}
 	else
 	{
-		p = data->path;
+		e = -1;
 	}
-	*p = '/';
-	p++;
-	strcpy(p, key);
-	if(type && *type)
+	aws_request_destroy(req);
+	return e;
+}
+
+/* Upload an object from a buffer */
+static int
+s3cache_put_buf_(CRAWL *crawl, AWSS3BUCKET *bucket, const char *path, const char *buf, size_t len, const char *type)
+{
+	AWSREQUEST *req;
+	int e;
+	long status;
+	CURL *ch;
+	struct curl_slist *headers;
+
+	e = 0;
+	req = aws_s3_request_create(bucket, path, "PUT");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDS, buf);
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, (long) len);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
+	headers = s3cache_add_header_(crawl, aws_request_headers(req), "Content-Type", type);
+	aws_request_set_headers(req, headers);
+	if(!aws_request_perform(req))
 	{
-		p = strchr(p, 0);
-		*p = '.';
-		p++;
-		strcpy(p, type);
+		status = 0;
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+		if(status != 200)
+		{
+			e = -1;
+		}			
+	}
+	else
+	{
+		e = -1;
+	}
+	aws_request_destroy(req);
+	return e;
+}
+
+/* Replace the sidecar header of an existing payload object by copying it
+ * onto itself; returns 1 if the payload doesn't exist, or if it can't be
+ * copied (S3 won't copy an object larger than 5GB in a single request, and
+ * so a payload that large, which can only have been uploaded in parts and
+ * so never has a sidecar header, is refused with a 400)
+ */
+static int
+s3cache_put_meta_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job, const char *meta)
+{
+	struct crawl_obj_meta_struct info;
+	AWSREQUEST *req;
+	CURL *ch;
+	long status;
+	struct curl_slist *headers;
+	char path[CACHE_KEY_LEN + 16];
+	const char *prefix;
+	char *source;
+	size_t plen;
+	int e;
+
+	/* The replacement metadata includes the Content-Type and
+	 * Content-Location, which are obtained from the sidecar
+	 */
+	memset(&info, 0, sizeof(info));
+	if(crawl_sidecar_decode_(data->crawl, &info, job->info, job->infolen))
+	{
+		return -1;
+	}
+	s3cache_key_path_(path, job->key, CACHE_PAYLOAD_SUFFIX);
+	/* /bucket/basepath/key */
+	prefix = data->crawl->uri->path;
+	if(!prefix)
+	{
+		prefix = "";
+	}
+	while(*prefix == '/')
+	{
+		prefix++;
+	}
+	plen = strlen(prefix);
+	while(plen && prefix[plen - 1] == '/')
+	{
+		plen--;
+	}
+	source = (char *) crawl_alloc(data->crawl, strlen(data->crawl->uri->host) + plen + strlen(path) + 3);
+	sprintf(source, "/%s%s%.*s%s", data->crawl->uri->host, (plen ? "/" : ""), (int) plen, prefix, path);
+	e = 0;
+	req = aws_s3_request_create(bucket, path, "PUT");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDS, "");
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, 0L);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, data->crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
+	headers = s3cache_add_header_(data->crawl, aws_request_headers(req), "x-amz-copy-source", source);
+	headers = curl_slist_append(headers, "x-amz-metadata-directive: REPLACE");
+	if(info.type)
+	{
+		headers = s3cache_add_header_(data->crawl, headers, "Content-Type", info.type);
+	}
+	if(info.content_location)
+	{
+		headers = s3cache_add_header_(data->crawl, headers, "Content-Location", info.content_location);
+	}
+	if(meta)
+	{
+		headers = s3cache_add_header_(data->crawl, headers, S3_META_HEADER, meta);
+	}
+	aws_request_set_headers(req, headers);
+	if(!aws_request_perform(req))
+	{
+		status = 0;
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+		if(status == 404)
+		{
+			e = 1;
+		}
+		else if(status >= 400 && status < 500)
+		{
+			crawl_log_(data->crawl, LOG_DEBUG, "S3: <%s> can't be copied (HTTP status %ld); storing its sidecar separately\n", path, status);
+			e = 1;
+		}
+		else if(status != 200)
+		{
+			e = -1;
+		}
+	}
+	else
+	{
+		e = -1;
+	}
+	aws_request_destroy(req);
+	crawl_free(data->crawl, source);
+	crawl_obj_meta_release_(data->crawl, &info);
+	return e;
+}
+
+/* Upload a sidecar by itself: as object metadata if possible, otherwise as
+ * a separate sidecar object
+ */
+static int
+s3cache_put_info_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job, const char *meta)
+{
+	char path[CACHE_KEY_LEN + 16];
+	int r;
+
+	if(data->headermeta && (!job->f || job->mp))
+	{
+		/* Even if the sidecar is too large to be stored as metadata, any
+		 * existing sidecar header must be removed, because it would
+		 * otherwise take precedence over the sidecar object (if the
+		 * payload has just been uploaded in one piece, it has no sidecar
+		 * header)
+		 */
+		r = s3cache_put_meta_(data, bucket, job, meta);
+		if(r < 0)
+		{
+			return -1;
+		}
+		if(!r && meta)
+		{
+			return 0;
+		}
+	}
+	s3cache_key_path_(path, job->key, CACHE_INFO_SUFFIX);
+	return s3cache_put_buf_(data->crawl, bucket, path, job->info, job->infolen, (crawl_sidecar_binary_(job->info, job->infolen) ? "application/octet-stream" : "application/json"));
+}
+
+/* Encode a sidecar for storage as object metadata, if it's enabled and the
+ * encoded sidecar is small enough
+ */
+static char *
+s3cache_meta_encode_(struct s3cache_data_struct *data, struct s3cache_job_struct *job)
+{
+	if(!data->headermeta || !job->info || (job->infolen + 2) / 3 * 4 > S3_MAX_META)
+	{
+		return NULL;
+	}
+	return s3cache_base64_encode_(data->crawl, job->info, job->infolen);
+}
+
+/* Perform an upload, making up to the specified number of attempts; the
+ * payload (if any) is always uploaded before the sidecar
+ */
+static int
+s3cache_job_run_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job, int attempts)
+{
+	char path[CACHE_KEY_LEN + 16];
+	char *meta;
+	int n, delay, payload, info;
+
+	s3cache_key_path_(path, job->key, CACHE_PAYLOAD_SUFFIX);
+	meta = s3cache_meta_encode_(data, job);
+	payload = (job->f ? 0 : 1);
+	info = (job->info ? 0 : 1);
+	for(n = 0; n < attempts; n++)
+	{
+		if(n)
+		{
+			delay = (n > 5 ? S3_MAX_RETRY_DELAY : (1 << (n - 1)));
+			crawl_log_(data->crawl, LOG_WARNING, MSG_W_S3_RETRY ": <%s>: retrying in %d seconds\n", path, delay);
+			sleep(delay);
+		}
+		if(!payload && job->mp && !s3cache_multipart_finish_(data, bucket, job))
+		{
+			payload = 1;
+		}
+		/* If the multipart upload failed, it's been abandoned, and the
+		 * payload is uploaded in one piece instead
+		 */
+		if(!payload)
+		{
+			crawl_log_(data->crawl, LOG_DEBUG, "S3: uploading payload to <%s>\n", path);
+			if(s3cache_put_file_(data->crawl, bucket, path, job->f, job->len, job->type, job->location, meta))
+			{
+				continue;
+			}
+			payload = 1;
+			if(meta)
+			{
+				info = 1;
+			}
+		}
+		if(!info)
+		{
+			if(s3cache_put_info_(data, bucket, job, meta))
+			{
+				continue;
+			}
+			info = 1;
+		}
+		crawl_free(data->crawl, meta);
+		return 0;
+	}
+	crawl_log_(data->crawl, LOG_ERR, MSG_E_S3_UPLOAD ": <%s>\n", path);
+	crawl_free(data->crawl, meta);
+	return -1;
+}
+
+static void
+s3cache_job_free_(CRAWL *crawl, struct s3cache_job_struct *job)
+{
+	if(job->mp)
+	{
+		s3cache_multipart_free_(crawl, job->mp);
+	}
+	if(job->f)
+	{
+		fclose(job->f);
+	}
+	crawl_free(crawl, job->type);
+	crawl_free(crawl, job->location);
+	/* The sidecar may have been allocated by json_dumps() */
+	free(job->info);
+	crawl_free(crawl, job);
+}
+
+/* Hand an upload off to the uploaders, blocking while the queue is full;
+ * if background uploads are disabled (or no uploader could be started),
+ * the upload is performed immediately. The job is freed once the upload
+ * has completed.
+ */
+static int
+s3cache_submit_(struct s3cache_data_struct *data, struct s3cache_job_struct *job)
+{
+	int r;
+
+	if(data->writers)
+	{
+		pthread_mutex_lock(&(data->lock));
+		if(!s3cache_start_(data))
+		{
+			while(data->queued >= data->queuemax)
+			{
+				pthread_cond_wait(&(data->space), &(data->lock));
+			}
+			if(data->tail)
+			{
+				data->tail->next = job;
+			}
+			else
+			{
+				data->head = job;
+			}
+			data->tail = job;
+			data->queued++;
+			pthread_cond_signal(&(data->work));
+			pthread_mutex_unlock(&(data->lock));
+			return 0;
+		}
+		pthread_mutex_unlock(&(data->lock));
+	}
+	r = s3cache_job_run_(data, data->bucket, job, 1);
+	s3cache_job_free_(data->crawl, job);
+	return r;
+}
+
+/* Start the uploader threads if they haven't been already; must be called
+ * with the lock held. Returns -1 if none could be started.
+ */
+static int
+s3cache_start_(struct s3cache_data_struct *data)
+{
+	int c, e;
+
+	if(data->nthreads)
+	{
+		return (data->nthreads > 0 ? 0 : -1);
+	}
+	data->threads = (pthread_t *) crawl_alloc(data->crawl, sizeof(pthread_t) * data->writers);
+	for(c = 0; c < data->writers; c++)
+	{
+		if((e = pthread_create(&(data->threads[c]), NULL, s3cache_uploader_, (void *) data)))
+		{
+			crawl_log_(data->crawl, LOG_ERR, MSG_E_S3_UPLOADER ": %s\n", strerror(e));
+			break;
+		}
+	}
+	if(!c)
+	{
+		/* Fall back to synchronous uploads */
+		data->nthreads = -1;
+		return -1;
+	}
+	data->nthreads = c;
+	return 0;
+}
+
+/* The body of an uploader thread */
+static void *
+s3cache_uploader_(void *arg)
+{
+	struct s3cache_data_struct *data;
+	struct s3cache_job_struct *job, **jp;
+	AWSS3BUCKET *bucket;
+	int r;
+
+	data = (struct s3cache_data_struct *) arg;
+	bucket = NULL;
+	pthread_mutex_lock(&(data->lock));
+	for(;;)
+	{
+		while(!data->head && !data->shutdown)
+		{
+			pthread_cond_wait(&(data->work), &(data->lock));
+		}
+		if(!data->head)
+		{
+			/* Shutting down and the queue has been drained */
+			break;
+		}
+		job = data->head;
+		data->head = job->next;
+		if(!data->head)
+		{
+			data->tail = NULL;
+		}
+		data->queued--;
+		job->next = data->active;
+		data->active = job;
+		pthread_cond_signal(&(data->space));
+		if(!bucket)
+		{
+			bucket = s3cache_bucket_(data->crawl, data);
+		}
+		pthread_mutex_unlock(&(data->lock));
+		r = (bucket ? s3cache_job_run_(data, bucket, job, data->retries + 1) : -1);
+		pthread_mutex_lock(&(data->lock));
+		for(jp = &(data->active); *jp; jp = &((*jp)->next))
+		{
+			if(*jp == job)
+			{
+				*jp = job->next;
+				break;
+			}
+		}
+		if(r)
+		{
+			data->failed++;
+		}
+		s3cache_job_free_(data->crawl, job);
+		pthread_cond_broadcast(&(data->done));
+	}
+	pthread_mutex_unlock(&(data->lock));
+	if(bucket)
+	{
+		aws_s3_destroy(bucket);
+	}
+	return NULL;
+}
+
+/* Wait until there are no queued or in-progress uploads of an object */
+static void
+s3cache_wait_key_(struct s3cache_data_struct *data, const CACHEKEY key)
+{
+	struct s3cache_job_struct *job;
+
+	if(!data->writers)
+	{
+		return;
+	}
+	pthread_mutex_lock(&(data->lock));
+	for(;;)
+	{
+		for(job = data->active; job; job = job->next)
+		{
+			if(!strcmp(job->key, key))
+			{
+				break;
+			}
+		}
+		if(!job)
+		{
+			for(job = data->head; job; job = job->next)
+			{
+				if(!strcmp(job->key, key))
+				{
+					break;
+				}
+			}
+		}
+		if(!job)
+		{
+			break;
+		}
+		pthread_cond_wait(&(data->done), &(data->lock));
+	}
+	pthread_mutex_unlock(&(data->lock));
+}
+
+/* Locate a pending payload by key (and, if supplied, file pointer),
+ * optionally removing it from the list
+ */
+static struct s3cache_pending_struct *
+s3cache_pending_(struct s3cache_data_struct *data, const CACHEKEY key, FILE *f, int detach)
+{
+	struct s3cache_pending_struct *p, *prev;
+
+	prev = NULL;
+	for(p = data->pending; p; p = p->next)
+	{
+		if(!strcmp(p->key, key) && (!f || p->f == f))
+		{
+			if(detach)
+			{
+				if(prev)
+				{
+					prev->next = p->next;
+				}
+				else
+				{
+					data->pending = p->next;
+				}
+				p->next = NULL;
+			}
+			return p;
+		}
+		prev = p;
+	}
+	return NULL;
+}
+
+/* Release a pending payload once it's been removed from the list; if it
+ * was being uploaded in parts, the multipart upload is abandoned. The
+ * caller is responsible for closing the stream it was written to.
+ */
+static void
+s3cache_pending_free_(struct s3cache_data_struct *data, struct s3cache_pending_struct *p)
+{
+	if(p->mp)
+	{
+		s3cache_multipart_abort_(data, data->bucket, p->mp);
+		s3cache_multipart_free_(data->crawl, p->mp);
+	}
+	if(p->tmp)
+	{
+		fclose(p->tmp);
+	}
+	/* The sidecar may have been allocated by json_dumps() */
+	free(p->info);
+	crawl_free(data->crawl, p->type);
+	crawl_free(data->crawl, p->location);
+	crawl_free(data->crawl, p);
+}
+
+/* Queue a part of a multipart upload, consisting of the next len bytes of
+ * the temporary file, for the part uploaders; the file must have been
+ * flushed. Nothing is queued once a part has failed.
+ */
+static void
+s3cache_multipart_part_(struct s3cache_data_struct *data, struct s3cache_multipart_struct *mp, off_t len)
+{
+	struct s3cache_part_struct *part;
+	char **p;
+
+	pthread_mutex_lock(&(data->mplock));
+	if(mp->failed)
+	{
+		pthread_mutex_unlock(&(data->mplock));
+		return;
+	}
+	p = (char **) crawl_realloc(data->crawl, mp->etags, sizeof(char *) * (mp->nparts + 1));
+	mp->etags = p;
+	mp->etags[mp->nparts] = NULL;
+	part = (struct s3cache_part_struct *) crawl_alloc(data->crawl, sizeof(struct s3cache_part_struct));
+	part->mp = mp;
+	part->offset = mp->next;
+	part->len = len;
+	mp->nparts++;
+	part->number = mp->nparts;
+	mp->next += len;
+	mp->active++;
+	if(data->partstail)
+	{
+		data->partstail->next = part;
+	}
+	else
+	{
+		data->parts = part;
+	}
+	data->partstail = part;
+	pthread_cond_signal(&(data->mpwork));
+	pthread_mutex_unlock(&(data->mplock));
+}
+
+/* Upload the remainder of a payload which is being uploaded in parts, wait
+ * for all of the parts, and complete the multipart upload; if that fails,
+ * the multipart upload is abandoned, and job->mp is reset so that the
+ * payload can be uploaded in one piece
+ */
+static int
+s3cache_multipart_finish_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_job_struct *job)
+{
+	struct s3cache_multipart_struct *mp;
+	char path[CACHE_KEY_LEN + 16];
+
+	mp = job->mp;
+	s3cache_key_path_(path, job->key, CACHE_PAYLOAD_SUFFIX);
+	crawl_log_(data->crawl, LOG_DEBUG, "S3: completing multipart upload of <%s>\n", path);
+	if(!fflush(job->f))
+	{
+		if(job->len > mp->next || !mp->nparts)
+		{
+			s3cache_multipart_part_(data, mp, job->len - mp->next);
+		}
+		if(!s3cache_multipart_wait_(data, mp) && !s3cache_multipart_complete_(data, bucket, mp))
+		{
+			return 0;
+		}
+	}
+	crawl_log_(data->crawl, LOG_WARNING, MSG_W_S3_MULTIPART ": <%s>\n", path);
+	s3cache_multipart_abort_(data, bucket, mp);
+	s3cache_multipart_free_(data->crawl, mp);
+	job->mp = NULL;
+	return -1;
+}
+
+/* Wait until none of the parts of a multipart upload are queued or being
+ * uploaded; returns -1 if any of them failed
+ */
+static int
+s3cache_multipart_wait_(struct s3cache_data_struct *data, struct s3cache_multipart_struct *mp)
+{
+	int r;
+
+	pthread_mutex_lock(&(data->mplock));
+	while(mp->active)
+	{
+		pthread_cond_wait(&(data->mpdone), &(data->mplock));
+	}
+	r = (mp->failed ? -1 : 0);
+	pthread_mutex_unlock(&(data->mplock));
+	return r;
+}
+
+/* Complete a multipart upload, once all of its parts have been uploaded */
+static int
+s3cache_multipart_complete_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_multipart_struct *mp)
+{
+	AWSREQUEST *req;
+	CURL *ch;
+	long status;
+	struct s3cache_body_struct body;
+	char *resource, *xml, *p;
+	size_t len;
+	unsigned long c;
+	int e;
+
+	/* <CompleteMultipartUpload><Part><PartNumber>N</PartNumber><ETag>E</ETag></Part>...</CompleteMultipartUpload> */
+	len = 64;
+	for(c = 0; c < mp->nparts; c++)
+	{
+		len += 64 + strlen(mp->etags[c]);
+	}
+	xml = (char *) crawl_alloc(data->crawl, len);
+	p = xml;
+	p += sprintf(p, "<CompleteMultipartUpload>");
+	for(c = 0; c < mp->nparts; c++)
+	{
+		p += sprintf(p, "<Part><PartNumber>%lu</PartNumber><ETag>%s</ETag></Part>", c + 1, mp->etags[c]);
+	}
+	strcpy(p, "</CompleteMultipartUpload>");
+	resource = (char *) crawl_alloc(data->crawl, CACHE_KEY_LEN + 32 + strlen(mp->uploadid));
+	s3cache_key_path_(resource, mp->key, CACHE_PAYLOAD_SUFFIX);
+	sprintf(strchr(resource, 0), "?uploadId=%s", mp->uploadid);
+	memset(&body, 0, sizeof(body));
+	body.crawl = data->crawl;
+	e = 0;
+	req = aws_s3_request_create(bucket, resource, "POST");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDS, xml);
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, (long) strlen(xml));
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, data->crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_body_);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) &body);
+	if(!aws_request_perform(req))
+	{
+		status = 0;
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+		/* S3 may report a failure after it has sent a 200 status */
+		if(status != 200 || !body.buf || strstr(body.buf, "<Error>"))
+		{
+			e = -1;
+		}
+	}
+	else
+	{
+		e = -1;
+	}
+	aws_request_destroy(req);
+	crawl_free(data->crawl, body.buf);
+	crawl_free(data->crawl, resource);
+	crawl_free(data->crawl, xml);
+	return e;
+}
+
+/* Abandon a multipart upload, once any parts queued or being uploaded have
+ * finished, so that S3 discards the parts which were uploaded
+ */
+static void
+s3cache_multipart_abort_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_multipart_struct *mp)
+{
+	AWSREQUEST *req;
+	CURL *ch;
+	char *resource;
+
+	pthread_mutex_lock(&(data->mplock));
+	mp->failed = 1;
+	pthread_mutex_unlock(&(data->mplock));
+	s3cache_multipart_wait_(data, mp);
+	resource = (char *) crawl_alloc(data->crawl, CACHE_KEY_LEN + 32 + strlen(mp->uploadid));
+	s3cache_key_path_(resource, mp->key, CACHE_PAYLOAD_SUFFIX);
+	sprintf(strchr(resource, 0), "?uploadId=%s", mp->uploadid);
+	crawl_log_(data->crawl, LOG_DEBUG, "S3: abandoning multipart upload of <%s>\n", resource);
+	req = aws_s3_request_create(bucket, resource, "DELETE");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, data->crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
+	aws_request_perform(req);
+	aws_request_destroy(req);
+	crawl_free(data->crawl, resource);
+}
+
+static void
+s3cache_multipart_free_(CRAWL *crawl, struct s3cache_multipart_struct *mp)
+{
+	unsigned long c;
+
+	for(c = 0; c < mp->nparts; c++)
+	{
+		crawl_free(crawl, mp->etags[c]);
+	}
+	crawl_free(crawl, mp->etags);
+	crawl_free(crawl, mp->uploadid);
+	crawl_free(crawl, mp);
+}
+
+/* Callback invoked by cURL to capture a (small) response body */
+static size_t
+s3cache_write_body_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct s3cache_body_struct *body;
+	char *p;
+
+	body = (struct s3cache_body_struct *) userdata;
+	size *= nmemb;
+	p = (char *) crawl_realloc(body->crawl, body->buf, body->len + size + 1);
+	if(!p)
+	{
+		return 0;
+	}
+	body->buf = p;
+	memcpy(&(body->buf[body->len]), ptr, size);
+	body->len += size;
+	body->buf[body->len] = 0;
+	return size;
+}
+
+#ifdef S3_CUSTOM_STREAMS
+
+/* Open the stream through which a payload which may be uploaded in parts
+ * is written
+ */
+static FILE *
+s3cache_multipart_stream_(struct s3cache_pending_struct *p)
+{
+# ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t io;
+
+	io.read = NULL;
+	io.write = s3cache_cookie_write_;
+	io.seek = NULL;
+	io.close = s3cache_multipart_close_;
+	return fopencookie((void *) p, "w", io);
+# else
+	return funopen((void *) p, NULL, s3cache_cookie_write_, NULL, s3cache_multipart_close_);
+# endif
+}
+
+/* Write to the temporary file underlying a payload stream, starting a
+ * multipart upload once the payload has grown beyond the threshold, and
+ * queueing each part as soon as it's complete; returns the number of bytes
+ * written, which is zero on error
+ */
+static ssize_t
+s3cache_multipart_write_(void *cookie, const char *buf, size_t size)
+{
+	struct s3cache_pending_struct *p;
+	struct s3cache_data_struct *data;
+	size_t n;
+
+	p = (struct s3cache_pending_struct *) cookie;
+	data = p->data;
+	n = fwrite(buf, 1, size, p->tmp);
+	p->size += n;
+	if(n < size)
+	{
+		return n;
+	}
+	if(p->mpfailed || data->mpdisabled || p->size <= data->mpthreshold)
+	{
+		return n;
+	}
+	if(!p->mp)
+	{
+		p->mp = s3cache_multipart_begin_(data, p);
+		if(!p->mp)
+		{
+			/* The payload will be uploaded in one piece */
+			p->mpfailed = 1;
+			return n;
+		}
+	}
+	/* The last part is queued when the payload is committed, and so may be
+	 * larger than the others if the payload is very large
+	 */
+	while(p->size - p->mp->next >= data->partsize && p->mp->nparts < S3_MAX_PARTS - 1)
+	{
+		if(fflush(p->tmp))
+		{
+			return 0;
+		}
+		s3cache_multipart_part_(data, p->mp, data->partsize);
+	}
+	return n;
+}
+
+/* The temporary file and the multipart upload outlive the stream, and are
+ * released by the commit or rollback
+ */
+static int
+s3cache_multipart_close_(void *cookie)
+{
+	(void) cookie;
+
+	return 0;
+}
+
+/* Start a multipart upload of a payload, with the headers it was received
+ * with
+ */
+static struct s3cache_multipart_struct *
+s3cache_multipart_begin_(struct s3cache_data_struct *data, struct s3cache_pending_struct *p)
+{
+	AWSREQUEST *req;
+	CURL *ch;
+	long status;
+	struct curl_slist *headers;
+	struct s3cache_body_struct body;
+	struct s3cache_multipart_struct *mp;
+	char resource[CACHE_KEY_LEN + 32];
+	char *start, *end;
+	int r;
+
+	pthread_mutex_lock(&(data->mplock));
+	r = s3cache_part_start_(data);
+	pthread_mutex_unlock(&(data->mplock));
+	if(r)
+	{
+		return NULL;
+	}
+	s3cache_key_path_(resource, p->key, CACHE_PAYLOAD_SUFFIX);
+	crawl_log_(data->crawl, LOG_DEBUG, "S3: starting multipart upload of <%s>\n", resource);
+	strcat(resource, "?uploads");
+	memset(&body, 0, sizeof(body));
+	body.crawl = data->crawl;
+	mp = NULL;
+	status = 0;
+	req = aws_s3_request_create(data->bucket, resource, "POST");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDS, "");
+	curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, 0L);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, data->crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_body_);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) &body);
+	headers = aws_request_headers(req);
+	if(p->type)
+	{
+		headers = s3cache_add_header_(data->crawl, headers, "Content-Type", p->type);
+	}
+	if(p->location)
+	{
+		headers = s3cache_add_header_(data->crawl, headers, "Content-Location", p->location);
+	}
+	aws_request_set_headers(req, headers);
+	if(!aws_request_perform(req))
+	{
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+	}
+	aws_request_destroy(req);
+	/* Strip the sub-resource again for the benefit of log messages */
+	*strchr(resource, '?') = 0;
+	if(status == 200 && body.buf &&
+	   (start = strstr(body.buf, "<UploadId>")) &&
+	   (end = strstr(start, "</UploadId>")))
+	{
+		start += strlen("<UploadId>");
+		mp = (struct s3cache_multipart_struct *) crawl_alloc(data->crawl, sizeof(struct s3cache_multipart_struct));
+		strcpy(mp->key, p->key);
+		mp->fd = fileno(p->tmp);
+		mp->uploadid = (char *) crawl_alloc(data->crawl, end - start + 1);
+		memcpy(mp->uploadid, start, end - start);
+	}
+	else if(status == 403)
+	{
+		/* The requests which make up a multipart upload are signed with
+		 * their sub-resources (?uploads, ?partNumber and ?uploadId), which
+		 * not every version of libawsclient includes; if the request is
+		 * refused, don't try again
+		 */
+		crawl_log_(data->crawl, LOG_WARNING, MSG_W_S3_NOMULTIPART ": <%s>\n", resource);
+		data->mpdisabled = 1;
+	}
+	else
+	{
+		crawl_log_(data->crawl, LOG_WARNING, MSG_W_S3_MULTIPART ": <%s>: HTTP status %ld\n", resource, status);
+	}
+	crawl_free(data->crawl, body.buf);
+	return mp;
+}
+
+/* Start the part uploader threads if they haven't been already; must be
+ * called with the multipart lock held. Returns -1 if none could be started.
+ */
+static int
+s3cache_part_start_(struct s3cache_data_struct *data)
+{
+	int c, e;
+
+	if(data->nmpthreads)
+	{
+		return (data->nmpthreads > 0 ? 0 : -1);
+	}
+	data->mpthreads = (pthread_t *) crawl_alloc(data->crawl, sizeof(pthread_t) * data->partwriters);
+	for(c = 0; c < data->partwriters; c++)
+	{
+		if((e = pthread_create(&(data->mpthreads[c]), NULL, s3cache_part_uploader_, (void *) data)))
+		{
+			crawl_log_(data->crawl, LOG_ERR, MSG_E_S3_UPLOADER ": %s\n", strerror(e));
+			break;
+		}
+	}
+	if(!c)
+	{
+		/* Payloads will be uploaded in one piece */
+		data->nmpthreads = -1;
+		return -1;
+	}
+	data->nmpthreads = c;
+	return 0;
+}
+
+/* The body of a part uploader thread */
+static void *
+s3cache_part_uploader_(void *arg)
+{
+	struct s3cache_data_struct *data;
+	struct s3cache_part_struct *part;
+	AWSS3BUCKET *bucket;
+	char *etag;
+	int r, n, delay;
+
+	data = (struct s3cache_data_struct *) arg;
+	bucket = NULL;
+	pthread_mutex_lock(&(data->mplock));
+	for(;;)
+	{
+		while(!data->parts && !data->mpshutdown)
+		{
+			pthread_cond_wait(&(data->mpwork), &(data->mplock));
+		}
+		if(!data->parts)
+		{
+			break;
+		}
+		part = data->parts;
+		data->parts = part->next;
+		if(!data->parts)
+		{
+			data->partstail = NULL;
+		}
+		if(!bucket)
+		{
+			bucket = s3cache_bucket_(data->crawl, data);
+		}
+		etag = NULL;
+		r = -1;
+		for(n = 0; bucket && !part->mp->failed && n <= data->retries; n++)
+		{
+			pthread_mutex_unlock(&(data->mplock));
+			if(n)
+			{
+				delay = (n > 5 ? S3_MAX_RETRY_DELAY : (1 << (n - 1)));
+				crawl_log_(data->crawl, LOG_WARNING, MSG_W_S3_RETRY ": </%s>: part %lu: retrying in %d seconds\n", part->mp->key, part->number, delay);
+				sleep(delay);
+			}
+			r = s3cache_put_part_(data, bucket, part, &etag);
+			pthread_mutex_lock(&(data->mplock));
+			if(!r)
+			{
+				break;
+			}
+		}
+		if(r)
+		{
+			part->mp->failed = 1;
+			crawl_free(data->crawl, etag);
+		}
+		else
+		{
+			part->mp->etags[part->number - 1] = etag;
+		}
+		part->mp->active--;
+		crawl_free(data->crawl, part);
+		pthread_cond_broadcast(&(data->mpdone));
+	}
+	pthread_mutex_unlock(&(data->mplock));
+	if(bucket)
+	{
+		aws_s3_destroy(bucket);
+	}
+	return NULL;
+}
+
+/* Upload a single part of a multipart upload, capturing its ETag */
+static int
+s3cache_put_part_(struct s3cache_data_struct *data, AWSS3BUCKET *bucket, struct s3cache_part_struct *part, char **etag)
+{
+	AWSREQUEST *req;
+	CURL *ch;
+	long status;
+	struct curl_slist *headers;
+	struct s3cache_head_struct head;
+	char *resource;
+	int e;
+
+	resource = (char *) crawl_alloc(data->crawl, CACHE_KEY_LEN + 64 + strlen(part->mp->uploadid));
+	s3cache_key_path_(resource, part->mp->key, CACHE_PAYLOAD_SUFFIX);
+	sprintf(strchr(resource, 0), "?partNumber=%lu&uploadId=%s", part->number, part->mp->uploadid);
+	memset(&head, 0, sizeof(head));
+	head.crawl = data->crawl;
+	head.name = "ETag";
+	part->pos = 0;
+	e = 0;
+	req = aws_s3_request_create(bucket, resource, "PUT");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_READFUNCTION, s3cache_part_read_);
+	curl_easy_setopt(ch, CURLOPT_READDATA, (void *) part);
+	curl_easy_setopt(ch, CURLOPT_INFILESIZE_LARGE, (curl_off_t) part->len);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, data->crawl->verbose);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_write_null_);
+	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, s3cache_head_header_);
+	curl_easy_setopt(ch, CURLOPT_HEADERDATA, (void *) &head);
+	curl_easy_setopt(ch, CURLOPT_UPLOAD, 1);
+	headers = curl_slist_append(aws_request_headers(req), "Expect: 100-continue");
+	aws_request_set_headers(req, headers);
+	if(!aws_request_perform(req))
+	{
+		status = 0;
+		curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+		if(status != 200 || !head.value)
+		{
+			e = -1;
+		}
+	}
+	else
+	{
+		e = -1;
+	}
+	aws_request_destroy(req);
+	crawl_free(data->crawl, resource);
+	if(e)
+	{
+		crawl_free(data->crawl, head.value);
+		return -1;
+	}
+	crawl_free(data->crawl, *etag);
+	*etag = head.value;
+	return 0;
+}
+
+/* Callback invoked by cURL to read the body of a part from the temporary
+ * file; pread() is used so that several parts can be read at once
+ */
+static size_t
+s3cache_part_read_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct s3cache_part_struct *part;
+	ssize_t r;
+
+	part = (struct s3cache_part_struct *) userdata;
+	size *= nmemb;
+	if((off_t) size > part->len - part->pos)
+	{
+		size = (size_t) (part->len - part->pos);
+	}
+	if(!size)
+	{
+		return 0;
+	}
+	r = pread(part->mp->fd, ptr, size, part->offset + part->pos);
+	if(r < 0)
+	{
+		return CURL_READFUNC_ABORT;
+	}
+	part->pos += r;
+	return (size_t) r;
+}
+
+#endif /*S3_CUSTOM_STREAMS*/
+
+#ifdef S3_CUSTOM_STREAMS
+
+# ifdef HAVE_FOPENCOOKIE
+static ssize_t
+s3cache_cookie_read_(void *cookie, char *buf, size_t size)
+{
+	return s3cache_stream_read_(cookie, buf, size);
+}
+
+static int
+s3cache_cookie_seek_(void *cookie, off64_t *offset, int whence)
+{
+	off_t o;
+	int r;
+
+	o = (off_t) *offset;
+	r = s3cache_stream_seek_(cookie, &o, whence);
+	*offset = (off64_t) o;
+	return r;
+}
+
+static ssize_t
+s3cache_cookie_write_(void *cookie, const char *buf, size_t size)
+{
+	return s3cache_multipart_write_(cookie, buf, size);
+}
+# else
+static int
+s3cache_cookie_read_(void *cookie, char *buf, int size)
+{
+	return (int) s3cache_stream_read_(cookie, buf, (size_t) size);
+}
+
+static fpos_t
+s3cache_cookie_seek_(void *cookie, fpos_t offset, int whence)
+{
+	off_t o;
+
+	o = (off_t) offset;
+	if(s3cache_stream_seek_(cookie, &o, whence))
+	{
+		return -1;
+	}
+	return (fpos_t) o;
+}
+
+static int
+s3cache_cookie_write_(void *cookie, const char *buf, int size)
+{
+	ssize_t r;
+
+	r = s3cache_multipart_write_(cookie, buf, (size_t) size);
+	return (r || !size ? (int) r : -1);
+}
+# endif
+
+/* Open a stream which reads a payload from the bucket; the first range is
+ * requested immediately, so that a missing object is reported here rather
+ * than by the first read
+ */
+static FILE *
+s3cache_stream_open_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct s3cache_data_struct *data;
+	struct s3cache_stream_struct *s;
+	FILE *f;
+# ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t io;
+# endif
+
+	data = (struct s3cache_data_struct *) cache->data;
+	s = (struct s3cache_stream_struct *) crawl_alloc(cache->crawl, sizeof(struct s3cache_stream_struct));
+	s->crawl = cache->crawl;
+	s->bucket = data->bucket;
+	s->rangesize = data->readsize;
+	s->path = (char *) crawl_alloc(cache->crawl, CACHE_KEY_LEN + 16);
+	s3cache_key_path_(s->path, key, CACHE_PAYLOAD_SUFFIX);
+	if(s3cache_stream_fetch_(s))
+	{
+		s3cache_stream_free_(s);
+		return NULL;
+	}
+# ifdef HAVE_FOPENCOOKIE
+	io.read = s3cache_cookie_read_;
+	io.write = NULL;
+	io.seek = s3cache_cookie_seek_;
+	io.close = s3cache_stream_close_;
+	f = fopencookie((void *) s, "r", io);
+# else
+	f = funopen((void *) s, s3cache_cookie_read_, NULL, s3cache_cookie_seek_, s3cache_stream_close_);
+# endif
+	if(!f)
+	{
+		s3cache_stream_free_(s);
+		return NULL;
+	}
+	return f;
+}
+
+/* Request the next range of the payload, replacing the buffer contents */
+static int
+s3cache_stream_fetch_(struct s3cache_stream_struct *s)
+{
+	AWSREQUEST *req;
+	CURL *ch;
+	struct curl_slist *headers;
+	char range[64], *match;
+	long status;
+
+	s->len = 0;
+	s->pos = 0;
+	if(s->eof)
+	{
+		return 0;
+	}
+	req = aws_s3_request_create(s->bucket, s->path, "GET");
+	crawl_log_(s->crawl, LOG_DEBUG, "S3: fetching <%s> from offset %llu\n", s->path, (unsigned long long) s->offset);
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, s3cache_stream_write_);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) s);
+	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, s3cache_stream_header_);
+	curl_easy_setopt(ch, CURLOPT_HEADERDATA, (void *) s);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, s->crawl->verbose);
+	sprintf(range, "Range: bytes=%llu-%llu", (unsigned long long) s->offset, (unsigned long long) (s->offset + s->rangesize - 1));
+	headers = curl_slist_append(aws_request_headers(req), range);
+	match = NULL;
+	if(s->etag)
+	{
+		match = (char *) crawl_alloc(s->crawl, strlen(s->etag) + 16);
+		sprintf(match, "If-Match: %s", s->etag);
+		headers = curl_slist_append(headers, match);
+	}
+	aws_request_set_headers(req, headers);
+	if(aws_request_perform(req))
+	{
+		aws_request_destroy(req);
+		crawl_free(s->crawl, match);
+		return -1;
+	}
+	status = 0;
+	curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+	aws_request_destroy(req);
+	crawl_free(s->crawl, match);
+	if(status == 412)
+	{
+		crawl_log_(s->crawl, LOG_ERR, MSG_E_S3_CHANGED ": <%s>\n", s->path);
+		s->len = 0;
+		errno = EIO;
+		return -1;
+	}
+	if(status == 206)
+	{
+		s->offset += s->len;
+		if(!s->len || (s->have_total && s->offset >= s->total))
+		{
+			s->eof = 1;
+		}
+		return 0;
+	}
+	if(status == 200 && !s->offset)
+	{
+		/* The whole payload was returned */
+		s->offset = s->len;
+		s->eof = 1;
+		return 0;
+	}
+	if(status == 416)
+	{
+		/* The range starts beyond the end of the payload (which may be
+		 * empty)
+		 */
+		s->len = 0;
+		s->eof = 1;
+		return 0;
+	}
+	crawl_log_(s->crawl, LOG_ERR, MSG_E_S3_HTTP ": <%s>: HTTP status %ld\n", s->path, status);
+	s->len = 0;
+	return -1;
+}
+
+static void
+s3cache_stream_free_(struct s3cache_stream_struct *s)
+{
+	crawl_free(s->crawl, s->buf);
+	crawl_free(s->crawl, s->path);
+	crawl_free(s->crawl, s->etag);
+	crawl_free(s->crawl, s);
+}
+
+/* Callback invoked by cURL when part of a range is received */
+static size_t
+s3cache_stream_write_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct s3cache_stream_struct *s;
+	char *p;
+
+	s = (struct s3cache_stream_struct *) userdata;
+	size *= nmemb;
+	if(s->len + size > s->size)
+	{
+		p = (char *) crawl_realloc(s->crawl, s->buf, (s->len + size > s->rangesize ? s->len + size : s->rangesize));
+		if(!p)
+		{
+			return 0;
+		}
+		s->buf = p;
+		s->size = (s->len + size > s->rangesize ? s->len + size : s->rangesize);
+	}
+	memcpy(&(s->buf[s->len]), ptr, size);
+	s->len += size;
+	return size;
+}
+
+/* Callback invoked by cURL for each response header, used to obtain the
+ * size of the payload from the Content-Range header, and the ETag of the
+ * payload from the first range
+ */
+static size_t
+s3cache_stream_header_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct s3cache_stream_struct *s;
+	const char *p, *end;
+
+	s = (struct s3cache_stream_struct *) userdata;
+	size *= nmemb;
+	end = ptr + size;
+	if(size > 14 && !strncasecmp(ptr, "Content-Range:", 14))
+	{
+		for(p = ptr + 14; p < end && *p != '/'; p++);
+		if(p + 1 < end && isdigit(p[1]))
+		{
+			s->total = strtoull(p + 1, NULL, 10);
+			s->have_total = 1;
+		}
+	}
+	else if(size > 5 && !s->etag && !strncasecmp(ptr, "ETag:", 5))
+	{
+		for(p = ptr + 5; p < end && isspace((unsigned char) *p); p++);
+		while(end > p && isspace((unsigned char) end[-1]))
+		{
+			end--;
+		}
+		if(end > p)
+		{
+			s->etag = (char *) crawl_alloc(s->crawl, end - p + 1);
+			memcpy(s->etag, p, end - p);
+		}
+	}
+	return size;
+}
+
+static ssize_t
+s3cache_stream_read_(void *cookie, char *buf, size_t size)
+{
+	struct s3cache_stream_struct *s;
+	size_t n, c;
+
+	s = (struct s3cache_stream_struct *) cookie;
+	n = 0;
+	while(n < size)
+	{
+		if(s->pos == s->len)
+		{
+			if(s->eof)
+			{
+				break;
+			}
+			if(s3cache_stream_fetch_(s))
+			{
+				if(n)
+				{
+					break;
+				}
+				errno = EIO;
+				return -1;
+			}
+			if(!s->len)
+			{
+				break;
+			}
+		}
+		c = s->len - s->pos;
+		if(c > size - n)
+		{
+			c = size - n;
+		}
+		memcpy(&(buf[n]), &(s->buf[s->pos]), c);
+		s->pos += c;
+		n += c;
+	}
+	return (ssize_t) n;
+}
+
+/* Reposition the stream; a position within the current range is reached
+ * without another request
+ */
+static int
+s3cache_stream_seek_(void *cookie, off_t *offset, int whence)
+{
+	struct s3cache_stream_struct *s;
+	uint64_t start;
+	off_t pos;
+
+	s = (struct s3cache_stream_struct *) cookie;
+	start = s->offset - s->len;
+	switch(whence)
+	{
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = (off_t) (start + s->pos) + *offset;
+		break;
+	case SEEK_END:
+		if(!s->have_total && !s->eof)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		pos = (off_t) (s->have_total ? s->total : s->offset) + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if(pos < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if((uint64_t) pos >= start && (uint64_t) pos <= s->offset)
+	{
+		s->pos = (size_t) (pos - start);
+	}
+	else
+	{
+		s->offset = (uint64_t) pos;
+		s->len = 0;
+		s->pos = 0;
+		s->eof = (s->have_total && s->offset >= s->total);
+	}
+	*offset = pos;
+	return 0;
+}
+
+static int
+s3cache_stream_close_(void *cookie)
+{
+	s3cache_stream_free_((struct s3cache_stream_struct *) cookie);
+	return 0;
+}
+
+#endif /*S3_CUSTOM_STREAMS*/
+
+/* Read a sidecar from the header of a payload object; returns 1 if the
+ * payload exists but has no sidecar header, or -1 with errno set to ENOENT
+ * if it doesn't exist
+ */
+static int
+s3cache_head_meta_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len)
+{
+	struct s3cache_data_struct *data;
+	struct s3cache_head_struct head;
+	AWSREQUEST *req;
+	CURL *ch;
+	long status;
+
+	data = (struct s3cache_data_struct *) cache->data;
+	memset(&head, 0, sizeof(head));
+	head.crawl = cache->crawl;
+	head.name = S3_META_HEADER;
+	s3cache_copy_path_(cache, key, CACHE_PAYLOAD_SUFFIX);
+	req = aws_s3_request_create(data->bucket, data->path, "HEAD");
+	ch = aws_request_curl(req);
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(ch, CURLOPT_NOBODY, 1);
+	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, s3cache_head_header_);
+	curl_easy_setopt(ch, CURLOPT_HEADERDATA, (void *) &head);
+	curl_easy_setopt(ch, CURLOPT_VERBOSE, cache->crawl->verbose);
+	if(aws_request_perform(req))
+	{
+		aws_request_destroy(req);
+		crawl_free(cache->crawl, head.value);
+		errno = EIO;
+		return -1;
+	}
+	status = 0;
+	curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &status);
+	aws_request_destroy(req);
+	if(status != 200)
+	{
+		if(status != 404)
+		{
+			crawl_log_(cache->crawl, LOG_ERR, MSG_E_S3_HTTP ": <%s>: HTTP status %ld\n", data->path, status);
+		}
+		crawl_free(cache->crawl, head.value);
+		errno = (status == 404 ? ENOENT : EIO);
+		return -1;
+	}
+	if(!head.value)
+	{
+		return 1;
+	}
+	*buf = s3cache_base64_decode_(cache->crawl, head.value, len);
+	crawl_free(cache->crawl, head.value);
+	if(!*buf)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_S3_META ": <%s>\n", data->path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Callback invoked by cURL for each response header, capturing the value
+ * of one of them
+ */
+static size_t
+s3cache_head_header_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct s3cache_head_struct *head;
+	size_t len, namelen;
+
+	head = (struct s3cache_head_struct *) userdata;
+	len = size * nmemb;
+	namelen = strlen(head->name);
+	if(len > namelen && ptr[namelen] == ':' && !strncasecmp(ptr, head->name, namelen))
+	{
+		ptr += namelen + 1;
+		size = len - namelen - 1;
+		while(size && isspace((unsigned char) *ptr))
+		{
+			ptr++;
+			size--;
+		}
+		while(size && isspace((unsigned char) ptr[size - 1]))
+		{
+			size--;
+		}
+		crawl_free(head->crawl, head->value);
+		head->value = (char *) crawl_alloc(head->crawl, size + 1);
+		memcpy(head->value, ptr, size);
+	}
+	return len;
+}
+
+static const char s3cache_base64_[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char *
+s3cache_base64_encode_(CRAWL *crawl, const char *src, size_t len)
+{
+	const unsigned char *s;
+	unsigned long v;
+	char *buf, *p;
+	size_t c;
+
+	s = (const unsigned char *) src;
+	buf = (char *) crawl_alloc(crawl, (len + 2) / 3 * 4 + 1);
+	p = buf;
+	for(c = 0; c + 2 < len; c += 3)
+	{
+		v = ((unsigned long) s[c] << 16) | ((unsigned long) s[c + 1] << 8) | s[c + 2];
+		*p++ = s3cache_base64_[(v >> 18) & 63];
+		*p++ = s3cache_base64_[(v >> 12) & 63];
+		*p++ = s3cache_base64_[(v >> 6) & 63];
+		*p++ = s3cache_base64_[v & 63];
+	}
+	if(c < len)
+	{
+		v = (unsigned long) s[c] << 16;
+		if(c + 1 < len)
+		{
+			v |= (unsigned long) s[c + 1] << 8;
+		}
+		*p++ = s3cache_base64_[(v >> 18) & 63];
+		*p++ = s3cache_base64_[(v >> 12) & 63];
+		*p++ = (c + 1 < len ? s3cache_base64_[(v >> 6) & 63] : '=');
+		*p++ = '=';
+	}
+	*p = 0;
+	return buf;
+}
+
+/* Decode a base64 string; returns NULL if it isn't valid */
+static char *
+s3cache_base64_decode_(CRAWL *crawl, const char *src, size_t *len)
+{
+	const char *t;
+	unsigned long v;
+	char *buf;
+	size_t n;
+	int bits;
+
+	buf = (char *) crawl_alloc(crawl, strlen(src) / 4 * 3 + 3);
+	n = 0;
+	v = 0;
+	bits = 0;
+	for(; *src && *src != '='; src++)
+	{
+		t = strchr(s3cache_base64_, *src);
+		if(!t)
+		{
+			crawl_free(crawl, buf);
+			return NULL;
+		}
+		v = (v << 6) | (unsigned long) (t - s3cache_base64_);
+		bits += 6;
+		if(bits >= 8)
+		{
+			bits -= 8;
+			buf[n++] = (char) ((v >> bits) & 0xff);
+		}
+	}
+	*len = n;
+	return buf;
+}
+
+/* Callback invoked by cURL when data is received */
+static size_t
+s3cache_write_buf_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct s3cache_data_struct *data;
+	char *p;
+
+	data = (struct s3cache_data_struct *) userdata;
+	size *= nmemb;
+	if(data->pos + size >= data->size)
+	{
+		p = (char *) crawl_realloc(data->crawl, data->buf, data->pos + size + 1);
+		if(!p)
+		{
+			return 0;
+		}
+		data->buf = p;
+		data->size = data->pos + size + 1;
+	}
+	memcpy(&(data->buf[data->pos]), ptr, size);
+	data->pos += size;
+	data->buf[data->pos] = 0;
+	return size;
+}
+
+/* Release whatever a failed request left in the response buffer */
+static void
+s3cache_buf_discard_(struct s3cache_data_struct *data)
+{
+	crawl_free(data->crawl, data->buf);
+	data->buf = NULL;
+	data->size = 0;
+	data->pos = 0;
+}
+
+/* Generate the URL and resource path for a given key and type */
+static int
+s3cache_copy_path_(CRAWLCACHE *cache, const CACHEKEY key, const char *type)
+{
+	struct s3cache_data_struct *data;
+	size_t needed;
+	char *p;
+
+	data = (struct s3cache_data_struct *) cache->data;
+	
+	/* /key.type */
+	needed = 1 + strlen(key) + 1 + strlen(type) + 1;
+	if(data->pathsize < needed)
+	{
+		p = (char *) crawl_realloc(data->crawl, data->path, needed);
+		if(!p)
+		{
+			return -1;
+		}
+		data->pathsize = needed;
+		data->path = p;
+	}
+	s3cache_key_path_(data->path, key, type);
+	return 0;
+}
+
+/* Write the resource path for a given key and type into a buffer which is
+ * large enough to hold it
+ */
+static void
+s3cache_key_path_(char *dest, const CACHEKEY key, const char *type)
+{
+	char *p;
+
+	p = dest;
+	*p = '/';
+	p++;
+	strcpy(p, key);
+	if(type && *type)
+	{
+		p = strchr(p, 0);
+		*p = '.';
+		p++;
+		strcpy(p, type);
 	}
-	return 0;
 }
 
 static size_t 
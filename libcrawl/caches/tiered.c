@@ -0,0 +1,1940 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* The tiered cache ('tiered:/path/to/cache?remote=s3://bucket/') layers a
+ * local disk or packed cache (the local tier) over another cache, usually
+ * S3 (the remote tier), so that objects which are read repeatedly are
+ * served from local storage while the remote tier remains the durable
+ * store. Each tier is a cache of its own, with its own context.
+ *
+ * Objects are always written to the local tier first. In write-through
+ * mode (the default), committing an object also stores it in the remote
+ * tier before the commit returns, and crawl_cache_sync() is passed on to
+ * the remote tier. In write-behind mode, a commit returns as soon as the
+ * object is in the local tier, and a background writer (with a context of
+ * its own) copies it to the remote tier afterwards, in the order in which
+ * objects were committed. crawl_cache_sync() waits until the writer has
+ * stored everything committed so far (and the remote tier has synced it),
+ * and fails if any of it couldn't be stored. An object is kept in the
+ * local tier, regardless of its size limit, until it's been stored in the
+ * remote tier; if storing it fails, it's retried (and the objects queued
+ * after it wait), and crawl_cache_sync() fails rather than waiting for the
+ * retries. When the cache is closed, an object which still can't be stored
+ * after a few more attempts is given up on and logged. Either way, a sidecar written while its payload is open
+ * is held until the payload is committed (and discarded if the payload is
+ * rolled back), and is stored in the remote tier along with it.
+ *
+ * An object which isn't in the local tier is read through: its payload
+ * and sidecar are copied from the remote tier into the local tier, and
+ * then read from there. If that fails, it's read directly from the remote
+ * tier. A sidecar written on its own for an object which isn't in the
+ * local tier is only stored in the remote tier.
+ *
+ * The total size of the payloads in the local tier may be bounded, in
+ * which case the least-recently used objects are removed from it as others
+ * are added. The size and recency of the objects in the local tier are
+ * tracked in memory, and shared by all of the contexts in the process which
+ * use the same local tier. If the size is bounded, the objects left in the
+ * local tier by a previous process are listed when it's first opened
+ * (oldest first, so far as the local tier can tell) and the limit is
+ * enforced straight away; the local tier should be dedicated to the tiered
+ * cache.
+ *
+ * Options may be supplied as query parameters in the cache URI:
+ *
+ *   remote=<URI>      the URI of the remote tier, with any '&' or '%'
+ *                     characters percent-encoded (required)
+ *   local=disk|pack   the kind of cache used for the local tier (default
+ *                     disk)
+ *   local-size=<MB>   the maximum total size of the payloads in the local
+ *                     tier (default 0, meaning that it's unbounded)
+ *   write=through|behind  whether objects are written to the remote tier
+ *                     as they're committed, or in the background (default
+ *                     through)
+ *   queue=<N>         maximum number of objects waiting to be written to
+ *                     the remote tier in write-behind mode (default 64)
+ *
+ * Any other options (such as sidecar or segment-size) apply to the local
+ * tier; the username, password and endpoint apply to the remote tier.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_libcrawl.h"
+
+#include <stdint.h>
+#include <strings.h>
+
+#define TIERED_DEFAULT_QUEUE           64
+#define TIERED_TABLE_MIN               1024
+#define TIERED_COPY_BLOCK              65536
+#define TIERED_MAX_RETRY_DELAY         30
+#define TIERED_SHUTDOWN_ATTEMPTS       3
+
+/* An object known to be in the local tier */
+struct tieredcache_entry_struct
+{
+	/* The next entry in the same hash bucket */
+	struct tieredcache_entry_struct *next;
+	/* The adjacent entries in order of use */
+	struct tieredcache_entry_struct *newer;
+	struct tieredcache_entry_struct *older;
+	CACHEKEY key;
+	uint64_t size;
+};
+
+/* An object found in the local tier when it was opened */
+struct tieredcache_scanned_struct
+{
+	CACHEKEY key;
+	uint64_t size;
+	uint64_t seq;
+};
+
+struct tieredcache_scan_struct
+{
+	CRAWL *crawl;
+	struct tieredcache_scanned_struct *list;
+	size_t count;
+	size_t size;
+};
+
+/* A payload being written to the local tier, which mustn't be evicted
+ * until it's been committed or rolled back
+ */
+struct tieredcache_writing_struct
+{
+	struct tieredcache_writing_struct *next;
+	CACHEKEY key;
+};
+
+/* The objects in a local tier, shared by every tiered cache in the process
+ * which uses the same local tier
+ */
+struct tieredcache_tier_struct
+{
+	struct tieredcache_tier_struct *next;
+	char *uri;
+	unsigned long refcount;
+	pthread_mutex_t lock;
+	struct tieredcache_entry_struct **table;
+	size_t tablesize;
+	size_t count;
+	struct tieredcache_entry_struct *newest;
+	struct tieredcache_entry_struct *oldest;
+	struct tieredcache_writing_struct *writing;
+	uint64_t size;
+	uint64_t limit;
+};
+
+/* An object to be stored in the remote tier */
+struct tieredcache_job_struct
+{
+	struct tieredcache_job_struct *next;
+	CACHEKEY key;
+	/* The payload, open for reading from the local tier, if any */
+	FILE *f;
+	char *type;
+	char *location;
+	/* The serialised sidecar, if any */
+	char *info;
+	size_t infolen;
+};
+
+/* A payload which has been opened for writing but not yet committed */
+struct tieredcache_pending_struct
+{
+	struct tieredcache_pending_struct *next;
+	CACHEKEY key;
+	FILE *f;
+	char *info;
+	size_t infolen;
+};
+
+/* A payload view which was obtained from the remote tier */
+struct tieredcache_map_struct
+{
+	struct tieredcache_map_struct *next;
+	const void *ptr;
+	size_t len;
+};
+
+struct tieredcache_data_struct
+{
+	CRAWL *crawl;
+	/* The contexts of the local and remote tiers */
+	CRAWL *local;
+	CRAWL *remote;
+	struct tieredcache_tier_struct *tier;
+	char *remoteuri;
+	struct tieredcache_pending_struct *pending;
+	struct tieredcache_map_struct *maps;
+	/* Copies of the remote tier's configuration, for the background
+	 * writer's context
+	 */
+	char *username;
+	char *password;
+	char *endpoint;
+	/* Write-behind (only used if behind is nonzero) */
+	int behind;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t space;
+	pthread_cond_t done;
+	pthread_t thread;
+	/* 1 if the writer is running, -1 if it couldn't be started */
+	int started;
+	int shutdown;
+	struct tieredcache_job_struct *head;
+	struct tieredcache_job_struct *tail;
+	struct tieredcache_job_struct *active;
+	size_t queued;
+	size_t queuemax;
+	/* Nonzero while the active job is being retried */
+	int retrying;
+	/* Nonzero while the writer's remote tier is being synced */
+	int flushing;
+	/* Failed attempts since the last sync, and objects given up on */
+	unsigned long errors;
+	unsigned long failed;
+};
+
+static unsigned long tieredcache_init_(CRAWLCACHE *cache);
+static unsigned long tieredcache_done_(CRAWLCACHE *cache);
+static FILE *tieredcache_open_write_(CRAWLCACHE *cache, const CACHEKEY key);
+static FILE *tieredcache_open_read_(CRAWLCACHE *cache, const CACHEKEY key);
+static int tieredcache_close_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f);
+static int tieredcache_close_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, CRAWLOBJ *obj);
+static int tieredcache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **dict);
+static int tieredcache_info_write_(CRAWLCACHE *cache, const CACHEKEY key, const json_t *dict);
+static char *tieredcache_uri_(CRAWLCACHE *cache, const CACHEKEY key);
+static int tieredcache_set_username_(CRAWLCACHE *cache, const char *username);
+static int tieredcache_set_password_(CRAWLCACHE *cache, const char *password);
+static int tieredcache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint);
+static const void *tieredcache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len);
+static int tieredcache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len);
+static int tieredcache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+static int tieredcache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len);
+static int tieredcache_sync_(CRAWLCACHE *cache);
+
+static void tieredcache_options_(CRAWL *crawl, struct tieredcache_data_struct *data, int *pack, uint64_t *limit);
+static char *tieredcache_local_uri_(CRAWL *crawl, int pack);
+static CRAWL *tieredcache_context_(CRAWL *crawl, const char *uri);
+static void tieredcache_context_destroy_(CRAWL *context);
+static int tieredcache_set_config_(struct tieredcache_data_struct *data, char **dest, const char *value);
+static struct tieredcache_tier_struct *tieredcache_tier_open_(CRAWL *crawl, const char *uri, uint64_t limit, CRAWLCACHE *local);
+static void tieredcache_tier_scan_(CRAWL *crawl, struct tieredcache_tier_struct *tier, CRAWLCACHE *local);
+static int tieredcache_scanned_(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg);
+static int tieredcache_scanned_cmp_(const void *a, const void *b);
+static void tieredcache_tier_close_(CRAWL *crawl, struct tieredcache_tier_struct *tier);
+static struct tieredcache_entry_struct *tieredcache_lookup_(struct tieredcache_tier_struct *tier, const CACHEKEY key);
+static struct tieredcache_entry_struct *tieredcache_insert_(CRAWL *crawl, struct tieredcache_tier_struct *tier, const CACHEKEY key);
+static void tieredcache_unlink_(CRAWL *crawl, struct tieredcache_tier_struct *tier, struct tieredcache_entry_struct *entry);
+static void tieredcache_use_(struct tieredcache_tier_struct *tier, struct tieredcache_entry_struct *entry);
+static size_t tieredcache_hash_(const CACHEKEY key, size_t size);
+static int tieredcache_present_(struct tieredcache_data_struct *data, const CACHEKEY key);
+static void tieredcache_stored_(struct tieredcache_data_struct *data, const CACHEKEY key);
+static void tieredcache_forget_(struct tieredcache_data_struct *data, const CACHEKEY key);
+static void tieredcache_evict_(struct tieredcache_data_struct *data, struct tieredcache_entry_struct *keep);
+static void tieredcache_writing_(struct tieredcache_data_struct *data, const CACHEKEY key, int writing);
+static int tieredcache_populate_(struct tieredcache_data_struct *data, const CACHEKEY key);
+static int tieredcache_copy_(FILE *dest, FILE *src);
+static int tieredcache_read_info_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+static int tieredcache_write_info_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len);
+static int tieredcache_job_run_(struct tieredcache_data_struct *data, CRAWL *remote, struct tieredcache_job_struct *job, CRAWLOBJ *obj);
+static void tieredcache_job_free_(CRAWL *crawl, struct tieredcache_job_struct *job);
+static int tieredcache_submit_(struct tieredcache_data_struct *data, struct tieredcache_job_struct *job, CRAWLOBJ *obj);
+static int tieredcache_start_(struct tieredcache_data_struct *data);
+static void *tieredcache_writer_(void *arg);
+static CRAWL *tieredcache_writer_context_(struct tieredcache_data_struct *data);
+static void tieredcache_wait_key_(struct tieredcache_data_struct *data, const CACHEKEY key);
+static struct tieredcache_pending_struct *tieredcache_pending_(struct tieredcache_data_struct *data, const CACHEKEY key, FILE *f, int detach);
+static void tieredcache_pending_free_(struct tieredcache_data_struct *data, struct tieredcache_pending_struct *p);
+
+static const CRAWLCACHEIMPL tieredcache_impl = {
+	NULL,
+	tieredcache_init_,
+	tieredcache_done_,
+	tieredcache_open_write_,
+	tieredcache_open_read_,
+	tieredcache_close_rollback_,
+	tieredcache_close_commit_,
+	tieredcache_info_read_,
+	tieredcache_info_write_,
+	tieredcache_uri_,
+	tieredcache_set_username_,
+	tieredcache_set_password_,
+	tieredcache_set_endpoint_,
+	tieredcache_payload_map_,
+	tieredcache_payload_unmap_,
+	tieredcache_info_read_buf_,
+	tieredcache_info_write_buf_,
+	tieredcache_sync_,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+const CRAWLCACHEIMPL *tieredcache = &tieredcache_impl;
+
+static pthread_mutex_t tieredcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tieredcache_tier_struct *tieredcache_tiers;
+
+static unsigned long
+tieredcache_init_(CRAWLCACHE *cache)
+{
+	struct tieredcache_data_struct *data;
+	char *localuri;
+	uint64_t limit;
+	int pack;
+
+	data = (struct tieredcache_data_struct *) crawl_alloc(cache->crawl, sizeof(struct tieredcache_data_struct));
+	data->crawl = cache->crawl;
+	data->queuemax = TIERED_DEFAULT_QUEUE;
+	pack = 0;
+	limit = 0;
+	tieredcache_options_(cache->crawl, data, &pack, &limit);
+	if(!data->remoteuri || !strncasecmp(data->remoteuri, "tiered:", 7))
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_TIERED_CONFIG ": a remote tier which is not itself tiered must be specified\n");
+		crawl_free(cache->crawl, data->remoteuri);
+		crawl_free(cache->crawl, data);
+		return 0;
+	}
+	localuri = tieredcache_local_uri_(cache->crawl, pack);
+	data->local = tieredcache_context_(cache->crawl, localuri);
+	data->remote = tieredcache_context_(cache->crawl, data->remoteuri);
+	if(data->local && (!data->local->cache.impl->payload_stat || !data->local->cache.impl->remove))
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_TIERED_CONFIG ": <%s> can't be used as a local tier\n", localuri);
+		tieredcache_context_destroy_(data->local);
+		data->local = NULL;
+	}
+	if(!data->local || !data->remote)
+	{
+		tieredcache_context_destroy_(data->local);
+		tieredcache_context_destroy_(data->remote);
+		crawl_free(cache->crawl, localuri);
+		crawl_free(cache->crawl, data->remoteuri);
+		crawl_free(cache->crawl, data);
+		return 0;
+	}
+	data->tier = tieredcache_tier_open_(cache->crawl, localuri, limit, &(data->local->cache));
+	/* Objects left by a previous process may have taken the local tier
+	 * over its limit
+	 */
+	pthread_mutex_lock(&(data->tier->lock));
+	tieredcache_evict_(data, NULL);
+	pthread_mutex_unlock(&(data->tier->lock));
+	crawl_log_(cache->crawl, LOG_DEBUG, "tiered: initialising cache with local tier <%s> and remote tier <%s> (write-%s)\n", localuri, data->remoteuri, (data->behind ? "behind" : "through"));
+	crawl_free(cache->crawl, localuri);
+	if(data->behind)
+	{
+		pthread_mutex_init(&(data->lock), NULL);
+		pthread_cond_init(&(data->work), NULL);
+		pthread_cond_init(&(data->space), NULL);
+		pthread_cond_init(&(data->done), NULL);
+	}
+	cache->data = data;
+	return 1;
+}
+
+static unsigned long
+tieredcache_done_(CRAWLCACHE *cache)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_pending_struct *p;
+	struct tieredcache_map_struct *m;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		return 0;
+	}
+	if(data->behind)
+	{
+		/* Wait for the writer to drain the queue and exit */
+		pthread_mutex_lock(&(data->lock));
+		data->shutdown = 1;
+		pthread_cond_broadcast(&(data->work));
+		pthread_mutex_unlock(&(data->lock));
+		if(data->started > 0)
+		{
+			pthread_join(data->thread, NULL);
+		}
+		if(data->failed)
+		{
+			crawl_log_(cache->crawl, LOG_ERR, MSG_E_TIERED_REMOTE ": %lu objects could not be stored\n", data->failed);
+		}
+		pthread_cond_destroy(&(data->done));
+		pthread_cond_destroy(&(data->space));
+		pthread_cond_destroy(&(data->work));
+		pthread_mutex_destroy(&(data->lock));
+	}
+	while(data->pending)
+	{
+		p = data->pending;
+		data->pending = p->next;
+		tieredcache_pending_free_(data, p);
+	}
+	while(data->maps)
+	{
+		m = data->maps;
+		data->maps = m->next;
+		data->remote->cache.impl->payload_unmap(&(data->remote->cache), m->ptr, m->len);
+		crawl_free(cache->crawl, m);
+	}
+	tieredcache_context_destroy_(data->local);
+	tieredcache_context_destroy_(data->remote);
+	tieredcache_tier_close_(cache->crawl, data->tier);
+	crawl_free(cache->crawl, data->remoteuri);
+	crawl_free(cache->crawl, data->username);
+	crawl_free(cache->crawl, data->password);
+	crawl_free(cache->crawl, data->endpoint);
+	crawl_free(cache->crawl, data);
+	cache->data = NULL;
+	return 0;
+}
+
+static FILE *
+tieredcache_open_write_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_pending_struct *p;
+	CRAWLCACHE *local;
+	FILE *f;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	local = &(data->local->cache);
+	f = local->impl->payload_open_write(local, key);
+	if(!f)
+	{
+		return NULL;
+	}
+	/* Track the payload so that its sidecar can be held until it's
+	 * committed
+	 */
+	p = (struct tieredcache_pending_struct *) crawl_alloc(cache->crawl, sizeof(struct tieredcache_pending_struct));
+	strcpy(p->key, key);
+	p->f = f;
+	p->next = data->pending;
+	data->pending = p;
+	tieredcache_writing_(data, key, 1);
+	return f;
+}
+
+static FILE *
+tieredcache_open_read_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct tieredcache_data_struct *data;
+	CRAWLCACHE *local, *remote;
+	FILE *f;
+	int r;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	local = &(data->local->cache);
+	remote = &(data->remote->cache);
+	if(tieredcache_present_(data, key))
+	{
+		if((f = local->impl->payload_open_read(local, key)))
+		{
+			return f;
+		}
+		tieredcache_forget_(data, key);
+	}
+	tieredcache_wait_key_(data, key);
+	r = tieredcache_populate_(data, key);
+	if(!r && (f = local->impl->payload_open_read(local, key)))
+	{
+		return f;
+	}
+	if(r > 0)
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+	return remote->impl->payload_open_read(remote, key);
+}
+
+static int
+tieredcache_close_rollback_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_pending_struct *p;
+	CRAWLCACHE *local;
+	int r;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	local = &(data->local->cache);
+	r = local->impl->payload_close_rollback(local, key, f);
+	if((p = tieredcache_pending_(data, key, f, 1)))
+	{
+		/* Any sidecar held for the remote tier is discarded */
+		tieredcache_pending_free_(data, p);
+	}
+	return r;
+}
+
+static int
+tieredcache_close_commit_(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, CRAWLOBJ *obj)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_pending_struct *p;
+	struct tieredcache_job_struct *job;
+	CRAWLCACHE *local;
+	const char *t;
+	int r;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data || !f)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	local = &(data->local->cache);
+	p = tieredcache_pending_(data, key, f, 1);
+	if(local->impl->payload_close_commit(local, key, f, obj))
+	{
+		if(p)
+		{
+			tieredcache_pending_free_(data, p);
+		}
+		return -1;
+	}
+	tieredcache_stored_(data, key);
+	job = (struct tieredcache_job_struct *) crawl_alloc(cache->crawl, sizeof(struct tieredcache_job_struct));
+	strcpy(job->key, key);
+	if(obj && (t = crawl_obj_type(obj)))
+	{
+		job->type = crawl_strdup(cache->crawl, t);
+	}
+	if(obj && (t = crawl_obj_content_location(obj)))
+	{
+		job->location = crawl_strdup(cache->crawl, t);
+	}
+	if(p)
+	{
+		/* Store the sidecar (if it's been written) along with the payload */
+		job->info = p->info;
+		job->infolen = p->infolen;
+		p->info = NULL;
+	}
+	/* The payload is copied from the local tier, where it's kept until
+	 * it's been stored in the remote tier
+	 */
+	job->f = local->impl->payload_open_read(local, key);
+	if(!job->f)
+	{
+		crawl_log_(cache->crawl, LOG_ERR, MSG_E_TIERED_REMOTE ": %s\n", key);
+		tieredcache_job_free_(cache->crawl, job);
+		r = -1;
+	}
+	else
+	{
+		r = tieredcache_submit_(data, job, obj);
+	}
+	if(p)
+	{
+		tieredcache_pending_free_(data, p);
+	}
+	return r;
+}
+
+/* Read a sidecar, in either format, as a JSON dictionary */
+static int
+tieredcache_info_read_(CRAWLCACHE *cache, const CACHEKEY key, json_t **dict)
+{
+	char *buf;
+	size_t len;
+	json_t *json;
+
+	if(tieredcache_info_read_buf_(cache, key, &buf, &len))
+	{
+		return -1;
+	}
+	json = crawl_sidecar_json_(cache->crawl, buf, len);
+	crawl_free(cache->crawl, buf);
+	if(!json)
+	{
+		return -1;
+	}
+	if(*dict)
+	{
+		json_decref(*dict);
+	}
+	*dict = json;
+	return 0;
+}
+
+static int
+tieredcache_info_read_buf_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len)
+{
+	struct tieredcache_data_struct *data;
+	int r;
+
+	*buf = NULL;
+	*len = 0;
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(tieredcache_present_(data, key))
+	{
+		if(!tieredcache_read_info_(&(data->local->cache), key, buf, len))
+		{
+			return 0;
+		}
+	}
+	else
+	{
+		tieredcache_wait_key_(data, key);
+		r = tieredcache_populate_(data, key);
+		if(!r && !tieredcache_read_info_(&(data->local->cache), key, buf, len))
+		{
+			return 0;
+		}
+		if(r > 0)
+		{
+			errno = ENOENT;
+			return -1;
+		}
+	}
+	return tieredcache_read_info_(&(data->remote->cache), key, buf, len);
+}
+
+static int
+tieredcache_info_write_(CRAWLCACHE *cache, const CACHEKEY key, const json_t *dict)
+{
+	char *s;
+	int r;
+
+	s = json_dumps(dict, JSON_PRESERVE_ORDER);
+	if(!s)
+	{
+		return -1;
+	}
+	r = tieredcache_info_write_buf_(cache, key, s, strlen(s));
+	free(s);
+	return r;
+}
+
+/* Write a sidecar to the local tier (unless the object isn't there, and
+ * isn't being written), and then to the remote tier, either along with its
+ * payload, if the payload is open, or immediately
+ */
+static int
+tieredcache_info_write_buf_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_pending_struct *p;
+	struct tieredcache_job_struct *job;
+	char *info;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	p = tieredcache_pending_(data, key, NULL, 0);
+	if(p || tieredcache_present_(data, key))
+	{
+		if(tieredcache_write_info_(&(data->local->cache), key, buf, len))
+		{
+			return -1;
+		}
+	}
+	info = (char *) crawl_alloc(cache->crawl, len + 1);
+	memcpy(info, buf, len);
+	if(p)
+	{
+		crawl_free(cache->crawl, p->info);
+		p->info = info;
+		p->infolen = len;
+		return 0;
+	}
+	job = (struct tieredcache_job_struct *) crawl_alloc(cache->crawl, sizeof(struct tieredcache_job_struct));
+	strcpy(job->key, key);
+	job->info = info;
+	job->infolen = len;
+	return tieredcache_submit_(data, job, NULL);
+}
+
+/* The URI of an object is that of its durable copy */
+static char *
+tieredcache_uri_(CRAWLCACHE *cache, const CACHEKEY key)
+{
+	struct tieredcache_data_struct *data;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	return data->remote->cache.impl->uri(&(data->remote->cache), key);
+}
+
+static int
+tieredcache_set_username_(CRAWLCACHE *cache, const char *username)
+{
+	struct tieredcache_data_struct *data;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(tieredcache_set_config_(data, &(data->username), username))
+	{
+		return -1;
+	}
+	return data->remote->cache.impl->set_username(&(data->remote->cache), username);
+}
+
+static int
+tieredcache_set_password_(CRAWLCACHE *cache, const char *password)
+{
+	struct tieredcache_data_struct *data;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(tieredcache_set_config_(data, &(data->password), password))
+	{
+		return -1;
+	}
+	return data->remote->cache.impl->set_password(&(data->remote->cache), password);
+}
+
+static int
+tieredcache_set_endpoint_(CRAWLCACHE *cache, const char *endpoint)
+{
+	struct tieredcache_data_struct *data;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(tieredcache_set_config_(data, &(data->endpoint), endpoint))
+	{
+		return -1;
+	}
+	return data->remote->cache.impl->set_endpoint(&(data->remote->cache), endpoint);
+}
+
+/* Map a payload from the local tier, reading it through if necessary;
+ * views obtained from the remote tier are recorded so that they can be
+ * released by it
+ */
+static const void *
+tieredcache_payload_map_(CRAWLCACHE *cache, const CACHEKEY key, size_t *len)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_map_struct *m;
+	CRAWLCACHE *local, *remote;
+	const void *p;
+	int r;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	local = &(data->local->cache);
+	remote = &(data->remote->cache);
+	if(tieredcache_present_(data, key))
+	{
+		if((p = local->impl->payload_map(local, key, len)))
+		{
+			return p;
+		}
+		tieredcache_forget_(data, key);
+	}
+	tieredcache_wait_key_(data, key);
+	r = tieredcache_populate_(data, key);
+	if(!r && (p = local->impl->payload_map(local, key, len)))
+	{
+		return p;
+	}
+	if(r > 0)
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+	if(!remote->impl->payload_map)
+	{
+		errno = ENOSYS;
+		return NULL;
+	}
+	p = remote->impl->payload_map(remote, key, len);
+	if(!p)
+	{
+		return NULL;
+	}
+	m = (struct tieredcache_map_struct *) crawl_alloc(cache->crawl, sizeof(struct tieredcache_map_struct));
+	m->ptr = p;
+	m->len = *len;
+	m->next = data->maps;
+	data->maps = m;
+	return p;
+}
+
+static int
+tieredcache_payload_unmap_(CRAWLCACHE *cache, const void *ptr, size_t len)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_map_struct *m, *prev;
+	int r;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	prev = NULL;
+	for(m = data->maps; m; m = m->next)
+	{
+		if(m->ptr == ptr && m->len == len)
+		{
+			if(prev)
+			{
+				prev->next = m->next;
+			}
+			else
+			{
+				data->maps = m->next;
+			}
+			crawl_free(cache->crawl, m);
+			return data->remote->cache.impl->payload_unmap(&(data->remote->cache), ptr, len);
+		}
+		prev = m;
+	}
+	r = data->local->cache.impl->payload_unmap(&(data->local->cache), ptr, len);
+	return r;
+}
+
+/* In write-through mode, wait for the remote tier; in write-behind mode,
+ * wait for the local tier and then for the writer to drain the queue,
+ * reporting whether anything failed to be stored in the remote tier since
+ * the last time this was called. If an object is being retried, the queue
+ * won't drain until the remote tier recovers, so that's reported as a
+ * failure straight away.
+ */
+static int
+tieredcache_sync_(CRAWLCACHE *cache)
+{
+	struct tieredcache_data_struct *data;
+	CRAWLCACHE *tier;
+	int r;
+
+	data = (struct tieredcache_data_struct *) cache->data;
+	if(!data)
+	{
+		return 0;
+	}
+	tier = (data->behind ? &(data->local->cache) : &(data->remote->cache));
+	r = (tier->impl->sync ? tier->impl->sync(tier) : 0);
+	if(data->behind)
+	{
+		pthread_mutex_lock(&(data->lock));
+		while((data->head || data->active || data->flushing) && !data->retrying)
+		{
+			pthread_cond_wait(&(data->done), &(data->lock));
+		}
+		if(data->errors || data->retrying)
+		{
+			errno = EIO;
+			r = -1;
+		}
+		data->errors = 0;
+		pthread_mutex_unlock(&(data->lock));
+	}
+	return r;
+}
+
+static void
+tieredcache_options_(CRAWL *crawl, struct tieredcache_data_struct *data, int *pack, uint64_t *limit)
+{
+	const char *s, *t, *v;
+	char *p;
+	size_t len;
+	unsigned long n;
+
+	if(!crawl->uri || !crawl->uri->query)
+	{
+		return;
+	}
+	for(s = crawl->uri->query; *s; s = (*t ? t + 1 : t))
+	{
+		t = strchr(s, '&');
+		if(!t)
+		{
+			t = s + strlen(s);
+		}
+		v = memchr(s, '=', t - s);
+		if(!v)
+		{
+			continue;
+		}
+		len = v - s;
+		v++;
+		n = strtoul(v, NULL, 10);
+		if(len == 6 && !strncmp(s, "remote", len) && t > v)
+		{
+			/* Percent-decode the URI */
+			crawl_free(crawl, data->remoteuri);
+			data->remoteuri = (char *) crawl_alloc(crawl, t - v + 1);
+			for(p = data->remoteuri; v < t; p++)
+			{
+				if(*v == '%' && t - v >= 3 && isxdigit((unsigned char) v[1]) && isxdigit((unsigned char) v[2]))
+				{
+					*p = (char) ((isdigit((unsigned char) v[1]) ? v[1] - '0' : (tolower((unsigned char) v[1]) - 'a' + 10)) * 16 +
+								 (isdigit((unsigned char) v[2]) ? v[2] - '0' : (tolower((unsigned char) v[2]) - 'a' + 10)));
+					v += 3;
+				}
+				else
+				{
+					*p = *v;
+					v++;
+				}
+			}
+		}
+		else if(len == 5 && !strncmp(s, "local", len))
+		{
+			*pack = ((size_t) (t - v) == 4 && !strncmp(v, "pack", 4));
+		}
+		else if(len == 10 && !strncmp(s, "local-size", len))
+		{
+			*limit = (uint64_t) n * 1048576;
+		}
+		else if(len == 5 && !strncmp(s, "write", len))
+		{
+			data->behind = ((size_t) (t - v) == 6 && !strncmp(v, "behind", 6));
+		}
+		else if(len == 5 && !strncmp(s, "queue", len) && n)
+		{
+			data->queuemax = n;
+		}
+	}
+}
+
+/* Construct the URI of the local tier from the path and query of the
+ * tiered cache's URI, so that any options are passed on to it
+ */
+static char *
+tieredcache_local_uri_(CRAWL *crawl, int pack)
+{
+	const char *query;
+	char *p;
+
+	query = (crawl->uri && crawl->uri->query ? crawl->uri->query : NULL);
+	/* pack: + path + ? + query */
+	p = (char *) crawl_alloc(crawl, 5 + strlen(crawl->cachepath) + 1 + (query ? strlen(query) : 0) + 1);
+	sprintf(p, "%s%s%s%s", (pack ? "pack:" : ""), crawl->cachepath, (query ? "?" : ""), (query ? query : ""));
+	return p;
+}
+
+/* Create the context for one of the tiers */
+static CRAWL *
+tieredcache_context_(CRAWL *crawl, const char *uri)
+{
+	CRAWL *context;
+
+	context = crawl_create();
+	if(!context)
+	{
+		return NULL;
+	}
+	crawl_set_logger(context, crawl->logger);
+	crawl_set_verbose(context, crawl->verbose);
+	if(crawl_set_cache_path(context, uri))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_TIERED_TIER ": <%s>\n", uri);
+		crawl_destroy(context);
+		return NULL;
+	}
+	return context;
+}
+
+static void
+tieredcache_context_destroy_(CRAWL *context)
+{
+	if(context)
+	{
+		/* Ensure that the tier's cache is shut down cleanly */
+		crawl_set_cache(context, NULL);
+		crawl_destroy(context);
+	}
+}
+
+/* Store a copy of a configuration value for the background writer */
+static int
+tieredcache_set_config_(struct tieredcache_data_struct *data, char **dest, const char *value)
+{
+	char *p;
+
+	p = (value ? crawl_strdup(data->crawl, value) : NULL);
+	if(data->behind)
+	{
+		pthread_mutex_lock(&(data->lock));
+	}
+	crawl_free(data->crawl, *dest);
+	*dest = p;
+	if(data->behind)
+	{
+		pthread_mutex_unlock(&(data->lock));
+	}
+	return 0;
+}
+
+/* Obtain a reference to the shared state of a local tier, creating it if
+ * needed; the size limit is that given when it's first created, when the
+ * objects already in the local tier are listed
+ */
+static struct tieredcache_tier_struct *
+tieredcache_tier_open_(CRAWL *crawl, const char *uri, uint64_t limit, CRAWLCACHE *local)
+{
+	struct tieredcache_tier_struct *tier;
+
+	pthread_mutex_lock(&tieredcache_lock);
+	for(tier = tieredcache_tiers; tier; tier = tier->next)
+	{
+		if(!strcmp(tier->uri, uri))
+		{
+			tier->refcount++;
+			pthread_mutex_unlock(&tieredcache_lock);
+			return tier;
+		}
+	}
+	tier = (struct tieredcache_tier_struct *) crawl_alloc(crawl, sizeof(struct tieredcache_tier_struct));
+	tier->uri = crawl_strdup(crawl, uri);
+	tier->refcount = 1;
+	tier->limit = limit;
+	tier->tablesize = TIERED_TABLE_MIN;
+	tier->table = (struct tieredcache_entry_struct **) crawl_alloc(crawl, sizeof(struct tieredcache_entry_struct *) * tier->tablesize);
+	pthread_mutex_init(&(tier->lock), NULL);
+	if(limit && local->impl->payload_list)
+	{
+		/* Other contexts opening the same tier wait until it's been
+		 * listed
+		 */
+		tieredcache_tier_scan_(crawl, tier, local);
+	}
+	tier->next = tieredcache_tiers;
+	tieredcache_tiers = tier;
+	pthread_mutex_unlock(&tieredcache_lock);
+	return tier;
+}
+
+/* Track the objects already in a newly-opened local tier, from the least
+ * to the most recently used
+ */
+static void
+tieredcache_tier_scan_(CRAWL *crawl, struct tieredcache_tier_struct *tier, CRAWLCACHE *local)
+{
+	struct tieredcache_scan_struct scan;
+	struct tieredcache_entry_struct *entry;
+	size_t c;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.crawl = crawl;
+	if(local->impl->payload_list(local, tieredcache_scanned_, &scan))
+	{
+		crawl_log_(crawl, LOG_ERR, MSG_E_TIERED_TIER ": <%s>: failed to list existing objects\n", tier->uri);
+	}
+	if(scan.count)
+	{
+		qsort(scan.list, scan.count, sizeof(struct tieredcache_scanned_struct), tieredcache_scanned_cmp_);
+	}
+	pthread_mutex_lock(&(tier->lock));
+	for(c = 0; c < scan.count; c++)
+	{
+		if(tieredcache_lookup_(tier, scan.list[c].key))
+		{
+			continue;
+		}
+		entry = tieredcache_insert_(crawl, tier, scan.list[c].key);
+		entry->size = scan.list[c].size;
+		tier->size += entry->size;
+	}
+	pthread_mutex_unlock(&(tier->lock));
+	crawl_log_(crawl, LOG_DEBUG, "tiered: found %lu objects (%llu bytes) in the local tier <%s>\n", (unsigned long) scan.count, (unsigned long long) tier->size, tier->uri);
+	crawl_free(crawl, scan.list);
+}
+
+/* Add an object to the list of those found in a local tier */
+static int
+tieredcache_scanned_(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg)
+{
+	struct tieredcache_scan_struct *scan;
+	struct tieredcache_scanned_struct *p;
+
+	scan = (struct tieredcache_scan_struct *) arg;
+	if(scan->count >= scan->size)
+	{
+		p = (struct tieredcache_scanned_struct *) crawl_realloc(scan->crawl, scan->list, sizeof(struct tieredcache_scanned_struct) * (scan->size ? scan->size * 2 : TIERED_TABLE_MIN));
+		if(!p)
+		{
+			return -1;
+		}
+		scan->list = p;
+		scan->size = (scan->size ? scan->size * 2 : TIERED_TABLE_MIN);
+	}
+	p = &(scan->list[scan->count]);
+	strcpy(p->key, key);
+	p->size = size;
+	p->seq = seq;
+	scan->count++;
+	return 0;
+}
+
+static int
+tieredcache_scanned_cmp_(const void *a, const void *b)
+{
+	const struct tieredcache_scanned_struct *sa, *sb;
+
+	sa = (const struct tieredcache_scanned_struct *) a;
+	sb = (const struct tieredcache_scanned_struct *) b;
+	if(sa->seq < sb->seq)
+	{
+		return -1;
+	}
+	return (sa->seq > sb->seq ? 1 : 0);
+}
+
+static void
+tieredcache_tier_close_(CRAWL *crawl, struct tieredcache_tier_struct *tier)
+{
+	struct tieredcache_tier_struct **tp;
+	struct tieredcache_entry_struct *entry;
+	struct tieredcache_writing_struct *w;
+
+	pthread_mutex_lock(&tieredcache_lock);
+	tier->refcount--;
+	if(tier->refcount)
+	{
+		pthread_mutex_unlock(&tieredcache_lock);
+		return;
+	}
+	for(tp = &tieredcache_tiers; *tp; tp = &((*tp)->next))
+	{
+		if(*tp == tier)
+		{
+			*tp = tier->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tieredcache_lock);
+	while(tier->newest)
+	{
+		entry = tier->newest;
+		tier->newest = entry->older;
+		crawl_free(crawl, entry);
+	}
+	while(tier->writing)
+	{
+		w = tier->writing;
+		tier->writing = w->next;
+		crawl_free(crawl, w);
+	}
+	pthread_mutex_destroy(&(tier->lock));
+	crawl_free(crawl, tier->table);
+	crawl_free(crawl, tier->uri);
+	crawl_free(crawl, tier);
+}
+
+/* The following functions must be called with the tier locked */
+
+static struct tieredcache_entry_struct *
+tieredcache_lookup_(struct tieredcache_tier_struct *tier, const CACHEKEY key)
+{
+	struct tieredcache_entry_struct *entry;
+
+	for(entry = tier->table[tieredcache_hash_(key, tier->tablesize)]; entry; entry = entry->next)
+	{
+		if(!strcmp(entry->key, key))
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Add an entry for an object, as the most recently used */
+static struct tieredcache_entry_struct *
+tieredcache_insert_(CRAWL *crawl, struct tieredcache_tier_struct *tier, const CACHEKEY key)
+{
+	struct tieredcache_entry_struct *entry, *next, **table;
+	size_t c, h, size;
+
+	if(tier->count >= tier->tablesize)
+	{
+		size = tier->tablesize * 2;
+		table = (struct tieredcache_entry_struct **) crawl_alloc(crawl, sizeof(struct tieredcache_entry_struct *) * size);
+		for(c = 0; c < tier->tablesize; c++)
+		{
+			for(entry = tier->table[c]; entry; entry = next)
+			{
+				next = entry->next;
+				h = tieredcache_hash_(entry->key, size);
+				entry->next = table[h];
+				table[h] = entry;
+			}
+		}
+		crawl_free(crawl, tier->table);
+		tier->table = table;
+		tier->tablesize = size;
+	}
+	entry = (struct tieredcache_entry_struct *) crawl_alloc(crawl, sizeof(struct tieredcache_entry_struct));
+	strcpy(entry->key, key);
+	h = tieredcache_hash_(key, tier->tablesize);
+	entry->next = tier->table[h];
+	tier->table[h] = entry;
+	entry->older = tier->newest;
+	if(tier->newest)
+	{
+		tier->newest->newer = entry;
+	}
+	else
+	{
+		tier->oldest = entry;
+	}
+	tier->newest = entry;
+	tier->count++;
+	return entry;
+}
+
+/* Remove an entry from the table and the list, and free it */
+static void
+tieredcache_unlink_(CRAWL *crawl, struct tieredcache_tier_struct *tier, struct tieredcache_entry_struct *entry)
+{
+	struct tieredcache_entry_struct **ep;
+
+	for(ep = &(tier->table[tieredcache_hash_(entry->key, tier->tablesize)]); *ep; ep = &((*ep)->next))
+	{
+		if(*ep == entry)
+		{
+			*ep = entry->next;
+			break;
+		}
+	}
+	if(entry->newer)
+	{
+		entry->newer->older = entry->older;
+	}
+	else
+	{
+		tier->newest = entry->older;
+	}
+	if(entry->older)
+	{
+		entry->older->newer = entry->newer;
+	}
+	else
+	{
+		tier->oldest = entry->newer;
+	}
+	tier->size -= entry->size;
+	tier->count--;
+	crawl_free(crawl, entry);
+}
+
+/* Mark an entry as the most recently used */
+static void
+tieredcache_use_(struct tieredcache_tier_struct *tier, struct tieredcache_entry_struct *entry)
+{
+	if(!entry->newer)
+	{
+		return;
+	}
+	entry->newer->older = entry->older;
+	if(entry->older)
+	{
+		entry->older->newer = entry->newer;
+	}
+	else
+	{
+		tier->oldest = entry->newer;
+	}
+	entry->newer = NULL;
+	entry->older = tier->newest;
+	tier->newest->newer = entry;
+	tier->newest = entry;
+}
+
+static size_t
+tieredcache_hash_(const CACHEKEY key, size_t size)
+{
+	size_t h;
+
+	/* The key is already a hash, so its leading digits will do */
+	h = (size_t) strtoul(((char [9]) { key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7], 0 }), NULL, 16);
+	return h & (size - 1);
+}
+
+/* Determine whether an object is in the local tier (marking it as the most
+ * recently used if so); an object which isn't yet known is looked for, so
+ * that objects left by a previous process are used
+ */
+static int
+tieredcache_present_(struct tieredcache_data_struct *data, const CACHEKEY key)
+{
+	struct tieredcache_entry_struct *entry;
+	CRAWLCACHE *local;
+	uint64_t size;
+
+	pthread_mutex_lock(&(data->tier->lock));
+	entry = tieredcache_lookup_(data->tier, key);
+	if(entry)
+	{
+		tieredcache_use_(data->tier, entry);
+	}
+	pthread_mutex_unlock(&(data->tier->lock));
+	if(entry)
+	{
+		return 1;
+	}
+	local = &(data->local->cache);
+	if(local->impl->payload_stat(local, key, &size))
+	{
+		return 0;
+	}
+	tieredcache_stored_(data, key);
+	return 1;
+}
+
+/* Record that an object has been stored in (or found in) the local tier,
+ * evicting others if it's now too large
+ */
+static void
+tieredcache_stored_(struct tieredcache_data_struct *data, const CACHEKEY key)
+{
+	struct tieredcache_entry_struct *entry;
+	CRAWLCACHE *local;
+	uint64_t size;
+
+	local = &(data->local->cache);
+	if(local->impl->payload_stat(local, key, &size))
+	{
+		return;
+	}
+	pthread_mutex_lock(&(data->tier->lock));
+	entry = tieredcache_lookup_(data->tier, key);
+	if(entry)
+	{
+		tieredcache_use_(data->tier, entry);
+		data->tier->size -= entry->size;
+	}
+	else
+	{
+		entry = tieredcache_insert_(data->crawl, data->tier, key);
+	}
+	entry->size = size;
+	data->tier->size += size;
+	tieredcache_evict_(data, entry);
+	pthread_mutex_unlock(&(data->tier->lock));
+}
+
+/* Forget an object which turned out not to be in the local tier */
+static void
+tieredcache_forget_(struct tieredcache_data_struct *data, const CACHEKEY key)
+{
+	struct tieredcache_entry_struct *entry;
+
+	pthread_mutex_lock(&(data->tier->lock));
+	entry = tieredcache_lookup_(data->tier, key);
+	if(entry)
+	{
+		tieredcache_unlink_(data->crawl, data->tier, entry);
+	}
+	pthread_mutex_unlock(&(data->tier->lock));
+}
+
+/* Remove the least-recently used objects from the local tier until it's
+ * within its size limit, other than the one just stored and any which are
+ * being written; must be called with the tier locked
+ */
+static void
+tieredcache_evict_(struct tieredcache_data_struct *data, struct tieredcache_entry_struct *keep)
+{
+	struct tieredcache_tier_struct *tier;
+	struct tieredcache_entry_struct *entry, *newer;
+	struct tieredcache_writing_struct *w;
+	CRAWLCACHE *local;
+
+	tier = data->tier;
+	local = &(data->local->cache);
+	for(entry = tier->oldest; entry && tier->limit && tier->size > tier->limit; entry = newer)
+	{
+		newer = entry->newer;
+		if(entry == keep)
+		{
+			continue;
+		}
+		for(w = tier->writing; w; w = w->next)
+		{
+			if(!strcmp(w->key, entry->key))
+			{
+				break;
+			}
+		}
+		if(w)
+		{
+			continue;
+		}
+		crawl_log_(data->crawl, LOG_DEBUG, "tiered: evicting %s (%llu bytes) from the local tier\n", entry->key, (unsigned long long) entry->size);
+		/* If the object can't be removed, it's no longer tracked either way */
+		local->impl->remove(local, entry->key);
+		tieredcache_unlink_(data->crawl, tier, entry);
+	}
+}
+
+/* Record that a payload is, or is no longer, being written to the local
+ * tier
+ */
+static void
+tieredcache_writing_(struct tieredcache_data_struct *data, const CACHEKEY key, int writing)
+{
+	struct tieredcache_writing_struct *w, **wp;
+
+	pthread_mutex_lock(&(data->tier->lock));
+	if(writing)
+	{
+		w = (struct tieredcache_writing_struct *) crawl_alloc(data->crawl, sizeof(struct tieredcache_writing_struct));
+		strcpy(w->key, key);
+		w->next = data->tier->writing;
+		data->tier->writing = w;
+	}
+	else
+	{
+		for(wp = &(data->tier->writing); *wp; wp = &((*wp)->next))
+		{
+			if(!strcmp((*wp)->key, key))
+			{
+				w = *wp;
+				*wp = w->next;
+				crawl_free(data->crawl, w);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&(data->tier->lock));
+}
+
+/* Copy an object from the remote tier into the local tier; returns 1 if it
+ * isn't in the remote tier either (which the remote tier reports by setting
+ * errno to ENOENT), so that it isn't looked for there a second time
+ */
+static int
+tieredcache_populate_(struct tieredcache_data_struct *data, const CACHEKEY key)
+{
+	struct crawl_object_struct obj;
+	CRAWLCACHE *local, *remote;
+	FILE *src, *dest;
+	char *buf;
+	size_t len;
+	int r;
+
+	local = &(data->local->cache);
+	remote = &(data->remote->cache);
+	if(tieredcache_read_info_(remote, key, &buf, &len))
+	{
+		return (errno == ENOENT ? 1 : -1);
+	}
+	src = remote->impl->payload_open_read(remote, key);
+	if(!src)
+	{
+		crawl_free(data->crawl, buf);
+		return -1;
+	}
+	/* The local tier may use the object's metadata when it's committed */
+	memset(&obj, 0, sizeof(obj));
+	obj.crawl = data->local;
+	strcpy(obj.key, key);
+	crawl_sidecar_decode_(data->crawl, &(obj.meta), buf, len);
+	tieredcache_writing_(data, key, 1);
+	r = -1;
+	dest = local->impl->payload_open_write(local, key);
+	if(dest)
+	{
+		if(tieredcache_copy_(dest, src) ||
+		   tieredcache_write_info_(local, key, buf, len))
+		{
+			local->impl->payload_close_rollback(local, key, dest);
+		}
+		else
+		{
+			r = local->impl->payload_close_commit(local, key, dest, &obj);
+		}
+	}
+	fclose(src);
+	if(r)
+	{
+		crawl_log_(data->crawl, LOG_WARNING, MSG_W_TIERED_LOCAL ": %s\n", key);
+	}
+	else
+	{
+		crawl_log_(data->crawl, LOG_DEBUG, "tiered: copied %s to the local tier\n", key);
+		tieredcache_stored_(data, key);
+	}
+	tieredcache_writing_(data, key, 0);
+	crawl_obj_meta_release_(data->crawl, &(obj.meta));
+	crawl_free(data->crawl, buf);
+	return r;
+}
+
+static int
+tieredcache_copy_(FILE *dest, FILE *src)
+{
+	char *buf;
+	size_t n;
+	int r;
+
+	buf = (char *) crawl_alloc(NULL, TIERED_COPY_BLOCK);
+	r = 0;
+	while((n = fread(buf, 1, TIERED_COPY_BLOCK, src)))
+	{
+		if(fwrite(buf, 1, n, dest) != n)
+		{
+			r = -1;
+			break;
+		}
+	}
+	if(ferror(src) || fflush(dest))
+	{
+		r = -1;
+	}
+	crawl_free(NULL, buf);
+	return r;
+}
+
+/* Read a sidecar from a tier as a buffer, whichever interface it supports */
+static int
+tieredcache_read_info_(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len)
+{
+	json_t *dict;
+
+	if(cache->impl->info_read_buf)
+	{
+		return cache->impl->info_read_buf(cache, key, buf, len);
+	}
+	dict = NULL;
+	if(cache->impl->info_read(cache, key, &dict))
+	{
+		return -1;
+	}
+	*buf = json_dumps(dict, JSON_PRESERVE_ORDER);
+	json_decref(dict);
+	if(!*buf)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	*len = strlen(*buf);
+	return 0;
+}
+
+/* Write a sidecar buffer to a tier, whichever interface it supports */
+static int
+tieredcache_write_info_(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len)
+{
+	json_t *dict;
+	int r;
+
+	if(cache->impl->info_write_buf)
+	{
+		return cache->impl->info_write_buf(cache, key, buf, len);
+	}
+	dict = crawl_sidecar_json_(cache->crawl, buf, len);
+	if(!dict)
+	{
+		return -1;
+	}
+	r = cache->impl->info_write(cache, key, dict);
+	json_decref(dict);
+	return r;
+}
+
+/* Store an object in the remote tier, payload first; if the object itself
+ * isn't available (because this is a write-behind), one is constructed
+ * for the remote tier to obtain the payload's metadata from
+ */
+static int
+tieredcache_job_run_(struct tieredcache_data_struct *data, CRAWL *remote, struct tieredcache_job_struct *job, CRAWLOBJ *obj)
+{
+	struct crawl_object_struct stub;
+	CRAWLCACHE *cache;
+	FILE *f;
+	int r;
+
+	cache = &(remote->cache);
+	if(!job->f)
+	{
+		r = tieredcache_write_info_(cache, job->key, job->info, job->infolen);
+	}
+	else
+	{
+		r = -1;
+		rewind(job->f);
+		f = cache->impl->payload_open_write(cache, job->key);
+		if(f)
+		{
+			if(cache->impl->payload_headers)
+			{
+				cache->impl->payload_headers(cache, job->key, f, (obj ? crawl_obj_type(obj) : job->type), (obj ? crawl_obj_content_location(obj) : job->location));
+			}
+			if(tieredcache_copy_(f, job->f) ||
+			   (job->info && tieredcache_write_info_(cache, job->key, job->info, job->infolen)))
+			{
+				cache->impl->payload_close_rollback(cache, job->key, f);
+			}
+			else
+			{
+				if(!obj)
+				{
+					memset(&stub, 0, sizeof(stub));
+					stub.crawl = remote;
+					strcpy(stub.key, job->key);
+					stub.meta.type = job->type;
+					stub.meta.content_location = job->location;
+					obj = &stub;
+				}
+				r = cache->impl->payload_close_commit(cache, job->key, f, obj);
+			}
+		}
+	}
+	if(r)
+	{
+		crawl_log_(data->crawl, LOG_ERR, MSG_E_TIERED_REMOTE ": %s\n", job->key);
+	}
+	return r;
+}
+
+static void
+tieredcache_job_free_(CRAWL *crawl, struct tieredcache_job_struct *job)
+{
+	if(job->f)
+	{
+		fclose(job->f);
+	}
+	crawl_free(crawl, job->type);
+	crawl_free(crawl, job->location);
+	crawl_free(crawl, job->info);
+	crawl_free(crawl, job);
+}
+
+/* Store an object in the remote tier: in write-behind mode, it's queued for
+ * the writer (blocking while the queue is full), and kept in the local tier
+ * until the writer has stored it; otherwise (or if the writer couldn't be
+ * started) it's stored immediately. The job is freed once the object has
+ * been stored.
+ */
+static int
+tieredcache_submit_(struct tieredcache_data_struct *data, struct tieredcache_job_struct *job, CRAWLOBJ *obj)
+{
+	int r;
+
+	if(data->behind)
+	{
+		tieredcache_writing_(data, job->key, 1);
+		pthread_mutex_lock(&(data->lock));
+		if(!tieredcache_start_(data))
+		{
+			while(data->queued >= data->queuemax)
+			{
+				pthread_cond_wait(&(data->space), &(data->lock));
+			}
+			if(data->tail)
+			{
+				data->tail->next = job;
+			}
+			else
+			{
+				data->head = job;
+			}
+			data->tail = job;
+			data->queued++;
+			pthread_cond_signal(&(data->work));
+			pthread_mutex_unlock(&(data->lock));
+			return 0;
+		}
+		pthread_mutex_unlock(&(data->lock));
+		tieredcache_writing_(data, job->key, 0);
+	}
+	r = tieredcache_job_run_(data, data->remote, job, obj);
+	tieredcache_job_free_(data->crawl, job);
+	return r;
+}
+
+/* Start the writer thread if it hasn't been already; must be called with
+ * the lock held. Returns -1 if it couldn't be started.
+ */
+static int
+tieredcache_start_(struct tieredcache_data_struct *data)
+{
+	int e;
+
+	if(data->started)
+	{
+		return (data->started > 0 ? 0 : -1);
+	}
+	if((e = pthread_create(&(data->thread), NULL, tieredcache_writer_, (void *) data)))
+	{
+		crawl_log_(data->crawl, LOG_ERR, MSG_E_TIERED_WRITER ": %s\n", strerror(e));
+		/* Fall back to writing through */
+		data->started = -1;
+		return -1;
+	}
+	data->started = 1;
+	return 0;
+}
+
+/* The body of the writer thread, which stores objects in the remote tier
+ * using a context of its own; an object which can't be stored is retried,
+ * with an increasing delay, until it has been (or, once the cache is being
+ * closed, until it's been attempted TIERED_SHUTDOWN_ATTEMPTS times)
+ */
+static void *
+tieredcache_writer_(void *arg)
+{
+	struct tieredcache_data_struct *data;
+	struct tieredcache_job_struct *job;
+	CRAWL *remote;
+	int r, n, delay;
+
+	data = (struct tieredcache_data_struct *) arg;
+	remote = NULL;
+	pthread_mutex_lock(&(data->lock));
+	for(;;)
+	{
+		while(!data->head && !data->shutdown)
+		{
+			pthread_cond_wait(&(data->work), &(data->lock));
+		}
+		if(!data->head)
+		{
+			/* Shutting down and the queue has been drained */
+			break;
+		}
+		job = data->head;
+		data->head = job->next;
+		if(!data->head)
+		{
+			data->tail = NULL;
+		}
+		data->queued--;
+		data->active = job;
+		pthread_cond_signal(&(data->space));
+		if(!remote)
+		{
+			remote = tieredcache_writer_context_(data);
+		}
+		pthread_mutex_unlock(&(data->lock));
+		for(n = 0; ; n++)
+		{
+			if(n)
+			{
+				delay = (n > 5 ? TIERED_MAX_RETRY_DELAY : (1 << (n - 1)));
+				crawl_log_(data->crawl, LOG_WARNING, MSG_W_TIERED_RETRY ": %s: retrying in %d seconds\n", job->key, delay);
+				sleep(delay);
+			}
+			r = (remote ? tieredcache_job_run_(data, remote, job, NULL) : -1);
+			pthread_mutex_lock(&(data->lock));
+			if(r)
+			{
+				data->errors++;
+			}
+			if(!r || (data->shutdown && n + 1 >= TIERED_SHUTDOWN_ATTEMPTS))
+			{
+				break;
+			}
+			/* Wake anything waiting in tieredcache_sync_() */
+			data->retrying = 1;
+			pthread_cond_broadcast(&(data->done));
+			if(!remote)
+			{
+				remote = tieredcache_writer_context_(data);
+			}
+			pthread_mutex_unlock(&(data->lock));
+		}
+		if(r)
+		{
+			crawl_log_(data->crawl, LOG_ERR, MSG_E_TIERED_REMOTE ": %s: giving up after %d attempts\n", job->key, n + 1);
+			data->failed++;
+		}
+		data->retrying = 0;
+		data->active = NULL;
+		pthread_mutex_unlock(&(data->lock));
+		/* The object may now be evicted from the local tier */
+		tieredcache_writing_(data, job->key, 0);
+		tieredcache_job_free_(data->crawl, job);
+		pthread_mutex_lock(&(data->lock));
+		if(!data->head && remote && remote->cache.impl->sync)
+		{
+			/* The queue has drained, but the remote tier may still be
+			 * storing objects in the background
+			 */
+			data->flushing = 1;
+			pthread_mutex_unlock(&(data->lock));
+			r = remote->cache.impl->sync(&(remote->cache));
+			pthread_mutex_lock(&(data->lock));
+			data->flushing = 0;
+			if(r)
+			{
+				data->errors++;
+			}
+		}
+		pthread_cond_broadcast(&(data->done));
+	}
+	pthread_mutex_unlock(&(data->lock));
+	/* This waits for anything the remote tier is storing in the
+	 * background
+	 */
+	tieredcache_context_destroy_(remote);
+	return NULL;
+}
+
+/* Create the writer's context for the remote tier; must be called with the
+ * lock held
+ */
+static CRAWL *
+tieredcache_writer_context_(struct tieredcache_data_struct *data)
+{
+	CRAWL *remote;
+
+	remote = tieredcache_context_(data->crawl, data->remoteuri);
+	if(!remote)
+	{
+		return NULL;
+	}
+	if(data->username)
+	{
+		remote->cache.impl->set_username(&(remote->cache), data->username);
+	}
+	if(data->password)
+	{
+		remote->cache.impl->set_password(&(remote->cache), data->password);
+	}
+	if(data->endpoint)
+	{
+		remote->cache.impl->set_endpoint(&(remote->cache), data->endpoint);
+	}
+	return remote;
+}
+
+/* Wait until an object isn't waiting to be written to the remote tier */
+static void
+tieredcache_wait_key_(struct tieredcache_data_struct *data, const CACHEKEY key)
+{
+	struct tieredcache_job_struct *job;
+
+	if(!data->behind)
+	{
+		return;
+	}
+	pthread_mutex_lock(&(data->lock));
+	for(;;)
+	{
+		job = data->active;
+		if(!job || strcmp(job->key, key))
+		{
+			for(job = data->head; job; job = job->next)
+			{
+				if(!strcmp(job->key, key))
+				{
+					break;
+				}
+			}
+		}
+		if(!job)
+		{
+			break;
+		}
+		pthread_cond_wait(&(data->done), &(data->lock));
+	}
+	pthread_mutex_unlock(&(data->lock));
+}
+
+/* Locate a pending payload by key (and, if supplied, file pointer),
+ * optionally removing it from the list
+ */
+static struct tieredcache_pending_struct *
+tieredcache_pending_(struct tieredcache_data_struct *data, const CACHEKEY key, FILE *f, int detach)
+{
+	struct tieredcache_pending_struct *p, *prev;
+
+	prev = NULL;
+	for(p = data->pending; p; p = p->next)
+	{
+		if(!strcmp(p->key, key) && (!f || p->f == f))
+		{
+			if(detach)
+			{
+				if(prev)
+				{
+					prev->next = p->next;
+				}
+				else
+				{
+					data->pending = p->next;
+				}
+				p->next = NULL;
+			}
+			return p;
+		}
+		prev = p;
+	}
+	return NULL;
+}
+
+/* Release a pending payload once it's been removed from the list */
+static void
+tieredcache_pending_free_(struct tieredcache_data_struct *data, struct tieredcache_pending_struct *p)
+{
+	tieredcache_writing_(data, p->key, 0);
+	crawl_free(data->crawl, p->info);
+	crawl_free(data->crawl, p);
+}
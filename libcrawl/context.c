@@ -33,6 +33,7 @@ crawl_create(void)
 	p = (CRAWL *) crawl_alloc(NULL, sizeof(CRAWL));
 	p->ua = crawl_strdup(p, "User-Agent: Mozilla/5.0 (compatible; Anansi; libcrawl; +https://bbcarchdev.github.io/res/)");
 	p->accept = crawl_strdup(p, "Accept: */*");
+	p->concurrency = 1;
 	if(!p->ua || !p->accept)
 	{
 		crawl_destroy(p);
@@ -54,6 +55,11 @@ crawl_destroy(CRAWL *p)
 		{
 			uri_info_destroy(p->uri);
 		}
+		crawl_handle_cleanup_(p);
+		if(p->multi)
+		{
+			curl_multi_cleanup(p->multi);
+		}
 		crawl_free(p, p->cachepath);
 		crawl_free(p, p->cachefile);
 		crawl_free(p, p->cachetmp);
@@ -218,6 +224,7 @@ crawl_set_cache_uri(CRAWL *crawl, URI *uri)
 	crawl->cacheuri = p;
 	crawl->cachepath = s;
 	crawl->uri = info;
+	crawl->sidecar = crawl_sidecar_option_(info->query);
 	return crawl_set_cache(crawl, impl);
 }
 
@@ -302,6 +309,29 @@ crawl_set_prefetch(CRAWL *crawl, crawl_prefetch_cb cb)
 	return 0;
 }
 
+/* Set the payload callback */
+int
+crawl_set_payload(CRAWL *crawl, crawl_payload_cb cb)
+{
+	crawl->payload = cb;
+	return 0;
+}
+
+/* Set the maximum number of concurrent transfers; values greater than
+ * one cause crawl_perform() to use crawl_perform_multi()
+ */
+int
+crawl_set_concurrency(CRAWL *crawl, int concurrency)
+{
+	if(concurrency < 1)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	crawl->concurrency = concurrency;
+	return 0;
+}
+
 int
 crawl_set_logger(CRAWL *crawl, void (*logger)(int, const char *, va_list))
 {
@@ -309,6 +339,14 @@ crawl_set_logger(CRAWL *crawl, void (*logger)(int, const char *, va_list))
 	return 0;
 }
 
+/* Obtain the counters maintained by the context */
+int
+crawl_stats(CRAWL *crawl, CRAWLSTATS *stats)
+{
+	*stats = crawl->stats;
+	return 0;
+}
+
 void
 crawl_log_(CRAWL *crawl, int priority, const char *format, ...)
 {
@@ -25,6 +25,14 @@
 
 #include "p_libcrawl.h"
 
+/* The maximum time (in milliseconds) to wait for activity on any of the
+ * transfers in progress before checking again
+ */
+#define MULTI_WAIT_TIMEOUT             1000
+
+static int crawl_multi_start_(CRAWL *crawl, struct crawl_fetch_data_struct **active, int *ended);
+static int crawl_multi_finish_(CRAWL *crawl, struct crawl_fetch_data_struct **active);
+
 int
 crawl_perform(CRAWL *crawl)
 {
@@ -33,6 +41,10 @@ crawl_perform(CRAWL *crawl)
 	URI *uri;
 	int r;
 	
+	if(crawl->concurrency > 1)
+	{
+		return crawl_perform_multi(crawl);
+	}
 	for(;;)
 	{
 		uri = NULL;
@@ -69,3 +81,190 @@ crawl_perform(CRAWL *crawl)
 	}
 	return 0;
 }
+
+/* Perform a crawling cycle, keeping up to crawl->concurrency transfers in
+ * progress at any one time via a cURL multi handle. Each fetch proceeds
+ * through exactly the same stages (and callbacks) as crawl_fetch_uri(),
+ * but the transfers themselves are interleaved; callbacks are always
+ * invoked on the calling thread.
+ *
+ * As with crawl_perform(), the cycle ends once the 'next' callback
+ * returns no URI and all of the transfers in progress have completed.
+ */
+int
+crawl_perform_multi(CRAWL *crawl)
+{
+	struct crawl_fetch_data_struct *active, *data;
+	int ended, error, running;
+	CURLMcode mc;
+
+	if(!crawl->next)
+	{
+		crawl_log_(crawl, LOG_NOTICE, MSG_N_NONEXT "\n");
+		errno = EINVAL;
+		return -1;
+	}
+	if(!crawl->multi)
+	{
+		crawl->multi = curl_multi_init();
+		if(!crawl->multi)
+		{
+			return -1;
+		}
+	}
+	active = NULL;
+	ended = 0;
+	error = 0;
+	for(;;)
+	{
+		if(!ended && crawl_multi_start_(crawl, &active, &ended))
+		{
+			error = -1;
+		}
+		if(!active)
+		{
+			break;
+		}
+		mc = curl_multi_perform(crawl->multi, &running);
+		if(mc != CURLM_OK && mc != CURLM_CALL_MULTI_PERFORM)
+		{
+			/* Abandon all of the transfers in progress */
+			crawl_log_(crawl, LOG_ERR, MSG_E_MULTI ": %s\n", curl_multi_strerror(mc));
+			while(active)
+			{
+				data = active;
+				active = data->next;
+				curl_multi_remove_handle(crawl->multi, data->ch);
+				crawl_obj_destroy(crawl_fetch_complete_(data, CURLE_RECV_ERROR));
+				crawl_free(crawl, data);
+			}
+			return -1;
+		}
+		if(crawl_multi_finish_(crawl, &active))
+		{
+			/* A fetch failed with no 'failed' callback to notify: stop
+			 * dequeuing, but allow the remaining transfers to complete
+			 */
+			error = -1;
+			ended = 1;
+		}
+		if(running)
+		{
+			curl_multi_wait(crawl->multi, NULL, 0, MULTI_WAIT_TIMEOUT, NULL);
+		}
+	}
+	return error;
+}
+
+/* Dequeue and begin fetching URIs until either the concurrency limit is
+ * reached or the queue is exhausted (in which case *ended is set)
+ */
+static int
+crawl_multi_start_(CRAWL *crawl, struct crawl_fetch_data_struct **active, int *ended)
+{
+	struct crawl_fetch_data_struct *data, *p;
+	CRAWLSTATE state;
+	CRAWLOBJ *obj;
+	URI *uri;
+	int count, r;
+
+	count = 0;
+	for(p = *active; p; p = p->next)
+	{
+		count++;
+	}
+	while(count < crawl->concurrency)
+	{
+		uri = NULL;
+		r = crawl->next(crawl, &uri, &state, crawl->userdata);
+		if(r < 0)
+		{
+			*ended = 1;
+			return -1;
+		}
+		if(!uri)
+		{
+			*ended = 1;
+			break;
+		}
+		data = (struct crawl_fetch_data_struct *) crawl_alloc(crawl, sizeof(struct crawl_fetch_data_struct));
+		r = crawl_fetch_begin_(crawl, uri, state, data);
+		/* The crawl object holds its own copy of the URI */
+		uri_destroy(uri);
+		if(r)
+		{
+			if(r > 0)
+			{
+				crawl_obj_destroy(data->obj);
+			}
+			crawl_free(crawl, data);
+			if(r < 0 && !crawl->failed)
+			{
+				*ended = 1;
+				return -1;
+			}
+			continue;
+		}
+		if(curl_multi_add_handle(crawl->multi, data->ch) != CURLM_OK)
+		{
+			obj = crawl_fetch_complete_(data, CURLE_FAILED_INIT);
+			crawl_free(crawl, data);
+			if(!obj && !crawl->failed)
+			{
+				*ended = 1;
+				return -1;
+			}
+			crawl_obj_destroy(obj);
+			continue;
+		}
+		data->next = *active;
+		*active = data;
+		count++;
+	}
+	return 0;
+}
+
+/* Complete any transfers which have finished, removing them from the list
+ * of those which are active
+ */
+static int
+crawl_multi_finish_(CRAWL *crawl, struct crawl_fetch_data_struct **active)
+{
+	struct crawl_fetch_data_struct *data, **prev;
+	CURLMsg *msg;
+	CURLcode result;
+	CRAWLOBJ *obj;
+	int left, r;
+	char *ptr;
+
+	r = 0;
+	while((msg = curl_multi_info_read(crawl->multi, &left)))
+	{
+		if(msg->msg != CURLMSG_DONE)
+		{
+			continue;
+		}
+		ptr = NULL;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &ptr);
+		data = (struct crawl_fetch_data_struct *) (void *) ptr;
+		result = msg->data.result;
+		/* msg is invalidated by curl_multi_remove_handle() */
+		curl_multi_remove_handle(crawl->multi, data->ch);
+		for(prev = active; *prev; prev = &((*prev)->next))
+		{
+			if(*prev == data)
+			{
+				*prev = data->next;
+				break;
+			}
+		}
+		obj = crawl_fetch_complete_(data, result);
+		if(!obj && !crawl->failed)
+		{
+			r = -1;
+		}
+		crawl_obj_destroy(obj);
+		crawl_free(crawl, data);
+	}
+	return r;
+}
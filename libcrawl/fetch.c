@@ -30,7 +30,9 @@
 static size_t crawl_fetch_header_(char *ptr, size_t size, size_t nmemb, void *userdata);
 static size_t crawl_fetch_payload_(char *ptr, size_t size, size_t nmemb, void *userdata);
 static int crawl_update_info_(struct crawl_fetch_data_struct *data);
-static int crawl_generate_info_(struct crawl_fetch_data_struct *data, json_t *dict);
+static int crawl_generate_info_(struct crawl_fetch_data_struct *data);
+static int crawl_fetch_conditional_(struct crawl_fetch_data_struct *data);
+static int crawl_fetch_digest_(struct crawl_fetch_data_struct *data);
 
 CRAWLOBJ *
 crawl_fetch(CRAWL *crawl, const char *uristr, CRAWLSTATE state)
@@ -52,203 +54,393 @@ CRAWLOBJ *
 crawl_fetch_uri(CRAWL *crawl, URI *uri, CRAWLSTATE state)
 {
 	struct crawl_fetch_data_struct data;
-	struct tm tp;
-	char modified[64];
-	int error;
-	json_t *dict;
-	struct curl_slist *headers;
-	
-	memset(&data, 0, sizeof(data));
-	headers = NULL;
-	dict = NULL;
-	data.now = time(NULL);
-	data.crawl = crawl;
-	data.obj = crawl_obj_create_(crawl, uri);
-	if(!data.obj)
+	CURLcode result;
+	int r;
+
+	r = crawl_fetch_begin_(crawl, uri, state, &data);
+	if(r < 0)
 	{
 		return NULL;
 	}
-	data.ch = curl_easy_init();
-	if(crawl_obj_locate_(data.obj) == 0)
+	if(r > 0)
+	{
+		/* The object was satisfied without a network fetch */
+		return data.obj;
+	}
+	result = curl_easy_perform(data.ch);
+	return crawl_fetch_complete_(&data, result);
+}
+
+/* Prepare a fetch: create the object, check the cache and apply the URI
+ * policy, then configure (but don't perform) the cURL handle and open the
+ * payload for writing.
+ *
+ * Returns 0 if data->ch is ready to be performed, 1 if the object was
+ * satisfied from the cache without a fetch (data->obj is valid and the
+ * 'unchanged' callback has been invoked), or -1 if the fetch could not
+ * proceed (the 'failed' callback, if any, has been invoked and there is
+ * no object).
+ *
+ * data is not required to be initialised by the caller, but must remain
+ * at the same address until crawl_fetch_complete_() has been invoked,
+ * because it is passed to cURL as callback data.
+ */
+int
+crawl_fetch_begin_(CRAWL *crawl, URI *uri, CRAWLSTATE state, struct crawl_fetch_data_struct *data)
+{
+	memset(data, 0, sizeof(struct crawl_fetch_data_struct));
+	SHA256_Init(&(data->digest));
+	data->now = time(NULL);
+	data->crawl = crawl;
+	data->obj = crawl_obj_create_(crawl, uri);
+	if(!data->obj)
+	{
+		return -1;
+	}
+	if(crawl_obj_locate_(data->obj) == 0)
 	{
 		/* Object was located in the cache */
-		data.cachetime = data.obj->updated;
-		if(state != COS_FORCE && data.now - data.cachetime < crawl->cache_min)
+		data->cachetime = data->obj->meta.updated;
+		if(state != COS_FORCE && data->now - data->cachetime < crawl->cache_min)
 		{
 			/* The object hasn't reached its minimum time-to-live */
 			if(crawl->unchanged)
 			{
-				crawl->unchanged(crawl, data.obj, data.cachetime, crawl->userdata);
+				crawl->unchanged(crawl, data->obj, data->cachetime, crawl->userdata);
 			}
-		    return data.obj;
+			return 1;
 		}
-		/* Store a copy of the object dictionary to allow rolling it back without
-		 * re-reading from disk.
-		 */
-		dict = json_deep_copy(data.obj->info);
-		/* Send an If-Modified-Since header */
-		if(state != COS_FORCE)
+		if(state != COS_FORCE && crawl_fetch_conditional_(data))
 		{
-			gmtime_r(&(data.cachetime), &tp);
-			strftime(modified, sizeof(modified), "If-Modified-Since: %a, %d %b %Y %H:%M:%S GMT", &tp);
-			headers = curl_slist_append(headers, modified);
+			curl_slist_free_all(data->reqheaders);
+			crawl_obj_destroy(data->obj);
+			return -1;
 		}
 	}
 	if(crawl->uri_policy)
 	{
-		state = crawl->uri_policy(crawl, data.obj->uri, data.obj->uristr, crawl->userdata);
+		state = crawl->uri_policy(crawl, data->obj->uri, data->obj->uristr, crawl->userdata);
 		if(state != COS_ACCEPTED)
 		{
 			if(crawl->failed)
 			{
-				crawl->failed(crawl, data.obj, data.cachetime, crawl->userdata, state);
-			}		
-			crawl_obj_destroy(data.obj);
-			return NULL;
+				crawl->failed(crawl, data->obj, data->cachetime, crawl->userdata, state);
+			}
+			curl_slist_free_all(data->reqheaders);
+			crawl_obj_destroy(data->obj);
+			return -1;
 		}
 	}
 	/* Set the Accept header */
 	if(crawl->accept)
 	{
-		headers = curl_slist_append(headers, crawl->accept);	
+		data->reqheaders = curl_slist_append(data->reqheaders, crawl->accept);
 	}
 	/* Set the User-Agent header */
 	if(crawl->ua)
 	{
-		curl_slist_append(headers, crawl->ua);
-	}
-	curl_easy_setopt(data.ch, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(data.ch, CURLOPT_URL, data.obj->uristr);
-	curl_easy_setopt(data.ch, CURLOPT_WRITEFUNCTION, crawl_fetch_payload_);
-	curl_easy_setopt(data.ch, CURLOPT_WRITEDATA, (void *) &data);
-	curl_easy_setopt(data.ch, CURLOPT_HEADERFUNCTION, crawl_fetch_header_);
-	curl_easy_setopt(data.ch, CURLOPT_HEADERDATA, (void *) &data);
-	curl_easy_setopt(data.ch, CURLOPT_FOLLOWLOCATION, 0);
-	curl_easy_setopt(data.ch, CURLOPT_VERBOSE, crawl->verbose);
-	curl_easy_setopt(data.ch, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(data.ch, CURLOPT_CONNECTTIMEOUT, 30);
-	curl_easy_setopt(data.ch, CURLOPT_TIMEOUT, 120);
-	error = 0;
-	data.payload = cache_open_payload_write_(crawl, data.obj->key);
-	if(!data.payload)
+		data->reqheaders = curl_slist_append(data->reqheaders, crawl->ua);
+	}
+	data->payload = cache_open_payload_write_(crawl, data->obj->key);
+	if(!data->payload)
 	{
-		json_decref(dict);		
-		crawl_obj_destroy(data.obj);
-		return NULL;
+		curl_slist_free_all(data->reqheaders);
+		crawl_obj_destroy(data->obj);
+		return -1;
 	}
+	data->ch = crawl_handle_acquire_(crawl);
+	if(!data->ch)
+	{
+		cache_close_payload_rollback_(crawl, data->obj->key, data->payload);
+		curl_slist_free_all(data->reqheaders);
+		crawl_obj_destroy(data->obj);
+		return -1;
+	}
+	curl_easy_setopt(data->ch, CURLOPT_HTTPHEADER, data->reqheaders);
+	curl_easy_setopt(data->ch, CURLOPT_URL, data->obj->uristr);
+	curl_easy_setopt(data->ch, CURLOPT_WRITEFUNCTION, crawl_fetch_payload_);
+	curl_easy_setopt(data->ch, CURLOPT_WRITEDATA, (void *) data);
+	curl_easy_setopt(data->ch, CURLOPT_HEADERFUNCTION, crawl_fetch_header_);
+	curl_easy_setopt(data->ch, CURLOPT_HEADERDATA, (void *) data);
+	curl_easy_setopt(data->ch, CURLOPT_PRIVATE, (void *) data);
+	curl_easy_setopt(data->ch, CURLOPT_FOLLOWLOCATION, 0);
+	curl_easy_setopt(data->ch, CURLOPT_VERBOSE, crawl->verbose);
+	curl_easy_setopt(data->ch, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(data->ch, CURLOPT_CONNECTTIMEOUT, 30);
+	curl_easy_setopt(data->ch, CURLOPT_TIMEOUT, 120);
 	if(crawl->prefetch)
 	{
-		crawl->prefetch(crawl, data.obj->uri, data.obj->uristr, crawl->userdata);
+		crawl->prefetch(crawl, data->obj->uri, data->obj->uristr, crawl->userdata);
+	}
+	data->obj->state = COS_NEW;
+	crawl->stats.fetches++;
+	return 0;
+}
+
+/* Add the conditional request headers for revalidating the cached version
+ * of an object: the server's own validators are used where they were
+ * stored, falling back to the time the object was last fetched.
+ */
+static int
+crawl_fetch_conditional_(struct crawl_fetch_data_struct *data)
+{
+	const struct crawl_obj_meta_struct *meta;
+	struct curl_slist *headers;
+	struct tm tp;
+	char modified[64], *p;
+	size_t len;
+
+	meta = &(data->obj->meta);
+	headers = data->reqheaders;
+	if(meta->etag)
+	{
+		len = strlen(meta->etag) + 16;
+		p = (char *) crawl_alloc(data->crawl, len);
+		if(!p)
+		{
+			return -1;
+		}
+		snprintf(p, len, "If-None-Match: %s", meta->etag);
+		headers = curl_slist_append(headers, p);
+		crawl_free(data->crawl, p);
+		if(!headers)
+		{
+			return -1;
+		}
+		data->crawl->stats.etag++;
+	}
+	if(meta->last_modified)
+	{
+		len = strlen(meta->last_modified) + 20;
+		p = (char *) crawl_alloc(data->crawl, len);
+		if(!p)
+		{
+			return -1;
+		}
+		snprintf(p, len, "If-Modified-Since: %s", meta->last_modified);
+		headers = curl_slist_append(headers, p);
+		crawl_free(data->crawl, p);
+	}
+	else
+	{
+		gmtime_r(&(data->cachetime), &tp);
+		strftime(modified, sizeof(modified), "If-Modified-Since: %a, %d %b %Y %H:%M:%S GMT", &tp);
+		headers = curl_slist_append(headers, modified);
+	}
+	if(!headers)
+	{
+		return -1;
 	}
-	data.obj->state = COS_NEW;
-	if(curl_easy_perform(data.ch))
+	data->reqheaders = headers;
+	data->conditional = 1;
+	data->crawl->stats.conditional++;
+	return 0;
+}
+
+/* Record the digest of the payload which has been received, and determine
+ * whether it's identical to that of the cached version
+ */
+static int
+crawl_fetch_digest_(struct crawl_fetch_data_struct *data)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	char *p;
+	size_t c;
+
+	SHA256_Final(md, &(data->digest));
+	p = (char *) crawl_alloc(data->crawl, SHA256_DIGEST_LENGTH * 2 + 1);
+	if(!p)
+	{
+		return -1;
+	}
+	for(c = 0; c < SHA256_DIGEST_LENGTH; c++)
+	{
+		p[c * 2] = hexdigits[md[c] >> 4];
+		p[c * 2 + 1] = hexdigits[md[c] & 15];
+	}
+	crawl_free(data->crawl, data->obj->meta.digest);
+	data->obj->meta.digest = p;
+	if(data->have_prev && data->prev.digest &&
+	   data->prev.status == data->obj->meta.status &&
+	   !strcmp(data->prev.digest, p))
+	{
+		data->identical = 1;
+		data->crawl->stats.identical++;
+	}
+	return 0;
+}
+
+/* Conclude a fetch prepared by crawl_fetch_begin_() once the transfer has
+ * finished (with the supplied cURL result code): commit or roll back the
+ * cache entry, invoke the appropriate callback, and release the resources
+ * held by data (but not data itself).
+ *
+ * Returns the crawl object, or NULL if the fetch failed.
+ */
+CRAWLOBJ *
+crawl_fetch_complete_(struct crawl_fetch_data_struct *data, CURLcode result)
+{
+	CRAWL *crawl;
+	int error;
+
+	crawl = data->crawl;
+	error = 0;
+	if(result != CURLE_OK)
 	{
-		if(!data.status)
+		if(!data->status)
 		{
 			/* Use 504 to indicate a low-level fetch error */
-			data.status = 504;
-			data.obj->state = COS_FAILED;
+			data->status = 504;
+			data->obj->state = COS_FAILED;
 		}
 	}
-	else if(!data.status)
+	else if(!data->status)
 	{
-		/* In the event that there was no payload written, data.status will be
+		/* In the event that there was no payload written, data->status will be
 		 * unset, so ensure that it is
 		 */
-		curl_easy_getinfo(data.ch, CURLINFO_RESPONSE_CODE, &(data.status));
+		curl_easy_getinfo(data->ch, CURLINFO_RESPONSE_CODE, &(data->status));
 	}
-	if(data.cachetime && data.status == 304)
+	if(data->cachetime && data->status == 304)
 	{
 		/* Not modified; rollback with successful return */
-		data.rollback = 1;
+		data->rollback = 1;
+		if(data->conditional)
+		{
+			crawl->stats.not_modified++;
+		}
 	}
-	else if(data.status >= 500)
+	else if(data->status >= 500)
 	{
 		/* rollback if there's already a cached version */
-		if(data.cachetime)
+		if(data->cachetime)
 		{
-			data.rollback = 1;
+			data->rollback = 1;
 		}
 	}
-	if(!data.rollback)
+	if(!data->rollback)
 	{
-		if(crawl_update_info_(&data))
+		if(crawl_update_info_(data))
 		{
-			data.rollback = 1;
+			data->rollback = 1;
+			error = -1;
+			data->obj->state = COS_FAILED;
+		}
+		else if(crawl_fetch_digest_(data))
+		{
+			data->rollback = 1;
 			error = -1;
-			data.obj->state = COS_FAILED;
+			data->obj->state = COS_FAILED;
 		}
 		else
 		{
-			if(cache_info_write_(crawl, data.obj->key, data.obj->info))
+			if(data->identical)
 			{
-				data.rollback = 1;
+				/* The cached payload is byte-for-byte the same as the one
+				 * just received, so keep it rather than replacing it; this
+				 * must happen before the sidecar is written, because some
+				 * cache implementations discard a sidecar along with a
+				 * payload that's rolled back
+				 */
+				cache_close_payload_rollback_(crawl, data->obj->key, data->payload);
+				data->payload = NULL;
+			}
+			/* The sidecar is only serialised at the point it's written */
+			if(crawl_obj_write_info_(data->obj))
+			{
+				data->rollback = 1;
 				error = -1;
-				data.obj->state = COS_FAILED;
+				data->obj->state = COS_FAILED;
 			}
 			else
 			{
-				data.obj->fresh = 1;
+				data->obj->fresh = 1;
 			}
 		}
-		if(data.rollback)
+		if(data->rollback && data->have_prev)
 		{
-			crawl_obj_replace_(data.obj, dict);
+			/* Restore the metadata of the cached version */
+			crawl_obj_links_reset_(data->obj);
+			crawl_obj_meta_release_(crawl, &(data->obj->meta));
+			data->obj->meta = data->prev;
+			data->have_prev = 0;
 		}
 	}
-	free(data.headers);
-	json_decref(dict);
-	dict = NULL;
-	if(data.rollback)
+	if(data->streamed && !data->stream_stop)
 	{
-		cache_close_payload_rollback_(crawl, data.obj->key, data.payload);
+		/* Signal the end of the payload */
+		crawl->payload(crawl, data->obj, NULL, 0, crawl->userdata);
+	}
+	free(data->headers);
+	data->headers = NULL;
+	crawl_free(crawl, data->linkbuf);
+	data->linkbuf = NULL;
+	if(data->have_prev)
+	{
+		crawl_obj_meta_release_(crawl, &(data->prev));
+		data->have_prev = 0;
+	}
+	if(data->rollback)
+	{
+		if(data->payload)
+		{
+			cache_close_payload_rollback_(crawl, data->obj->key, data->payload);
+		}
 	}
 	else
 	{
-		/* At this point, data.obj->state may already have been set to
+		/* At this point, data->obj->state may already have been set to
 		 * COS_SKIPPED_COMMIT, so we shouldn't override that if so
 		 */
-		if(data.obj->state != COS_SKIPPED_COMMIT)
+		if(data->obj->state != COS_SKIPPED_COMMIT)
+		{
+			data->obj->state = COS_ACCEPTED;
+		}
+		if(data->payload)
 		{
-			data.obj->state = COS_ACCEPTED;
+			cache_close_payload_commit_(crawl, data->obj->key, data->payload, data->obj);
 		}
-		cache_close_payload_commit_(crawl, data.obj->key, data.payload, data.obj);
-	}	
-	curl_slist_free_all(headers);
-	curl_easy_cleanup(data.ch);
+	}
+	data->payload = NULL;
+	curl_slist_free_all(data->reqheaders);
+	data->reqheaders = NULL;
+	crawl_handle_release_(crawl, data->ch);
+	data->ch = NULL;
 	/* If we rolled back and there was nothing to roll back to, consider
 	 * it an error */
-	if(data.rollback && !data.cachetime)
+	if(data->rollback && !data->cachetime)
 	{
 		error = -1;
-		data.obj->state = COS_FAILED;
+		data->obj->state = COS_FAILED;
 	}
 	if(error)
 	{
-		if(data.obj->state == COS_NEW)
+		if(data->obj->state == COS_NEW)
 		{
-			data.obj->state = COS_FAILED;
+			data->obj->state = COS_FAILED;
 		}
 		if(crawl->failed)
 		{			
-			crawl->failed(crawl, data.obj, data.cachetime, crawl->userdata, data.obj->state);
+			crawl->failed(crawl, data->obj, data->cachetime, crawl->userdata, data->obj->state);
 		}
-		crawl_obj_destroy(data.obj);
+		crawl_obj_destroy(data->obj);
+		data->obj = NULL;
 		return NULL;
 	}
-	if(!data.obj->fresh)
+	if(!data->obj->fresh || data->identical)
 	{
 		if(crawl->unchanged)
 		{
-			crawl->unchanged(crawl, data.obj, data.cachetime, crawl->userdata);
+			crawl->unchanged(crawl, data->obj, data->cachetime, crawl->userdata);
 		}
-		return data.obj;
+		return data->obj;
 	}
 	if(crawl->updated)
 	{
-		crawl->updated(crawl, data.obj, data.cachetime, crawl->userdata);
+		crawl->updated(crawl, data->obj, data->cachetime, crawl->userdata);
 	}
-	return data.obj;
+	return data->obj;
 }
 
 static size_t
@@ -303,43 +495,67 @@ crawl_fetch_payload_(char *ptr, size_t size, size_t nmemb, void *userdata)
 	{
 		data->have_size = 1;
 		data->size = 0;
+		/* The headers are known before any of the payload is written */
+		cache_payload_headers_(data->crawl, data->obj->key, data->payload, data->obj);
 	}
 	if(fwrite(ptr, size, nmemb, data->payload) != nmemb)
 	{
 		return 0;
 	}
 	size *= nmemb;
+	SHA256_Update(&(data->digest), ptr, size);
 	data->size += size;
+	if(data->crawl->payload && !data->stream_stop)
+	{
+		data->streamed = 1;
+		if(data->crawl->payload(data->crawl, data->obj, ptr, size, data->crawl->userdata))
+		{
+			data->stream_stop = 1;
+		}
+	}
 	return size;
 }
 
-/* Create or update the object's dictionary */
+/* Create or update the object's metadata */
 static int
 crawl_update_info_(struct crawl_fetch_data_struct *data)
 {
-	json_t *infoblock;
 	int status;
 	CRAWLSTATE state;
 
 	if(!data->generated_info)
 	{
-		infoblock = json_object();
-
 		curl_easy_getinfo(data->ch, CURLINFO_RESPONSE_CODE, &(data->status));
-		crawl_generate_info_(data, infoblock);
-		crawl_obj_replace_(data->obj, infoblock);
-		json_decref(infoblock);
+		/* Retain the metadata of any cached version (without copying it)
+		 * so that it can be restored if the fetch is rolled back
+		 */
+		crawl_obj_links_reset_(data->obj);
+		if(data->cachetime)
+		{
+			data->prev = data->obj->meta;
+			data->have_prev = 1;
+			memset(&(data->obj->meta), 0, sizeof(struct crawl_obj_meta_struct));
+		}
+		else
+		{
+			crawl_obj_meta_release_(data->crawl, &(data->obj->meta));
+		}
+		if(crawl_generate_info_(data))
+		{
+			return -1;
+		}
+		if(data->linkbuf)
+		{
+			crawl_obj_set_links_(data->obj, data->linkbuf, data->linklen);
+			data->linkbuf = NULL;
+			data->linklen = 0;
+		}
 		data->generated_info = 1;
 	}
-	if(data->obj->status != data->status)
-	{
-		json_object_set_new(data->obj->info, "status", json_integer(data->status));
-		data->obj->status = data->status;
-	}
+	data->obj->meta.status = data->status;
 	if(data->have_size)
 	{
-		json_object_set_new(data->obj->info, "size", json_integer(data->size));
-		data->obj->size = data->size;
+		data->obj->meta.size = data->size;
 	}
 	/* XXX this block ought to be refactored out into a separate function */
 	if(!data->checkpoint_invoked && data->crawl->checkpoint)
@@ -353,13 +569,13 @@ crawl_update_info_(struct crawl_fetch_data_struct *data)
 			 * object, instead allow processing to proceed (such as
 			 * following redirects in response headers).
 			 */
-			data->status = data->obj->status = status;
+			data->status = data->obj->meta.status = status;
 			data->obj->state = state;
 		}
 		else if(state != COS_ACCEPTED)
 		{
 			/* Any other non-ACCEPTED state results in a rollback */
-			data->status = data->obj->status = status;
+			data->status = data->obj->meta.status = status;
 			data->obj->state = state;
 			data->rollback = 1;
 			return 0;
@@ -412,11 +628,11 @@ is_same_origin(URI_INFO *a, URI_INFO *b)
 	return 1;
 }
 
-/* Add the canonical form of a URL (provided as a string) to a JSON object,
- * possibly applying a same-origin check
+/* Store the canonical form of a URL (provided as a string) in a metadata
+ * member, possibly applying a same-origin check
  */
 static int
-set_dict_url(CRAWLOBJ *obj, json_t *dict, const char *key, const char *location, int same_origin)
+set_meta_url(CRAWLOBJ *obj, char **dest, const char *location, int same_origin)
 {
 	URI *uri;
 	URI_INFO *a, *b;
@@ -442,59 +658,82 @@ set_dict_url(CRAWLOBJ *obj, json_t *dict, const char *key, const char *location,
 		}
 	}
 	p = uri_stralloc(uri);
-	json_object_set_new(dict, key, json_string(p));
-	free(p);
 	uri_destroy(uri);
+	if(!p)
+	{
+		return -1;
+	}
+	crawl_free(obj->crawl, *dest);
+	*dest = crawl_strdup(obj->crawl, p);
+	free(p);
+	return (*dest ? 0 : -1);
+}
+
+/* Replace a metadata string member with a copy of a value */
+static int
+set_meta_str(CRAWLOBJ *obj, char **dest, const char *value, size_t len)
+{
+	char *p;
+
+	p = (char *) crawl_alloc(obj->crawl, len + 1);
+	if(!p)
+	{
+		return -1;
+	}
+	memcpy(p, value, len);
+	p[len] = 0;
+	crawl_free(obj->crawl, *dest);
+	*dest = p;
 	return 0;
 }
 
-/* Populate a JSON object contaning information about the request
- * that was preformed.
+/* Populate the object's metadata from the response to the request that
+ * was performed
  */
 static int
-crawl_generate_info_(struct crawl_fetch_data_struct *data, json_t *dict)
+crawl_generate_info_(struct crawl_fetch_data_struct *data)
 {
+	struct crawl_obj_meta_struct *meta;
 	json_t *headers, *values;
 	char *ptr, *s, *p;
 	const char *t;
 
-	json_object_set_new(dict, "status", json_integer(data->status));
+	meta = &(data->obj->meta);
+	meta->status = data->status;
 	if(data->have_size)
 	{
-		json_object_set_new(dict, "status", json_integer(data->size));
+		meta->size = data->size;
 	}
-	json_object_set_new(dict, "updated", json_integer(data->now));
+	meta->updated = data->now;
 	ptr = NULL;
 	curl_easy_getinfo(data->ch, CURLINFO_EFFECTIVE_URL, &ptr);
 	if(ptr)
 	{
+		/* If there's a fragment, store only the characters prior to it
+		 * (because fragments are a facet of user-agent behaviour, they
+		 * don't make any sense in Location or Content-Location headers)
+		 */
 		t = strchr(ptr, '#');
-		if(t)
-		{
-			/* Older versions of libjansson don't include json_stringn() */
-			s = strdup(ptr);
-			s[t - ptr] = 0;
-			/* If there's a fragment, store only the characters prior to it
-			 * (because fragments are a facet of user-agent behaviour, they
-			 * don't make any sense in Location or Content-Location headers)
-			 */
-			json_object_set_new(dict, "location", json_string(s));
-			json_object_set_new(dict, "content_location", json_string(s));
-			free(s);
-		}
-		else
-		{		   
-			json_object_set_new(dict, "location", json_string(ptr));
-			json_object_set_new(dict, "content_location", json_string(ptr));
+		if(set_meta_str(data->obj, &(meta->location), ptr, t ? (size_t) (t - ptr) : strlen(ptr)) ||
+		   set_meta_str(data->obj, &(meta->content_location), ptr, t ? (size_t) (t - ptr) : strlen(ptr)))
+		{
+			return -1;
 		}
 	}
 	ptr = NULL;
 	curl_easy_getinfo(data->ch, CURLINFO_CONTENT_TYPE, &ptr);
 	if(ptr)
 	{
-		json_object_set_new(dict, "type", json_string(ptr));
+		if(set_meta_str(data->obj, &(meta->type), ptr, strlen(ptr)))
+		{
+			return -1;
+		}
 	}
 	headers = json_object();
+	if(!headers)
+	{
+		return -1;
+	}
 	for(s = data->headers; s; )
 	{
 		p = strchr(s, '\n');
@@ -534,11 +773,23 @@ crawl_generate_info_(struct crawl_fetch_data_struct *data, json_t *dict)
 		}
 		if(!strcasecmp(s, "location"))
 		{			
-			set_dict_url(data->obj, dict, "redirect", ptr, 0);
+			set_meta_url(data->obj, &(meta->redirect), ptr, 0);
+		}
+		else if(!strcasecmp(s, "content-location"))
+		{
+			set_meta_url(data->obj, &(meta->content_location), ptr, 1);
+		}
+		else if(!strcasecmp(s, "link"))
+		{
+			crawl_links_add_(data->crawl, &(data->linkbuf), &(data->linklen), ptr, strlen(ptr));
+		}
+		else if(!strcasecmp(s, "etag"))
+		{
+			set_meta_str(data->obj, &(meta->etag), ptr, strlen(ptr));
 		}
-		if(!strcasecmp(s, "content-location"))
+		else if(!strcasecmp(s, "last-modified"))
 		{
-			set_dict_url(data->obj, dict, "content_location", ptr, 1);
+			set_meta_str(data->obj, &(meta->last_modified), ptr, strlen(ptr));
 		}
 		values = json_object_get(headers, s);
 		if(!values)
@@ -549,6 +800,6 @@ crawl_generate_info_(struct crawl_fetch_data_struct *data, json_t *dict)
 		json_array_append_new(values, json_string(ptr));
 		s = p + 2;
 	}
-	json_object_set_new(dict, "headers", headers);
+	meta->headers = headers;
 	return 0;
 }
@@ -61,6 +61,11 @@ typedef enum
  */
 typedef struct crawl_struct CRAWL;
 
+/* A share object, which allows DNS look-ups and TLS sessions to be re-used
+ * by multiple crawl contexts (which may be in different threads).
+ */
+typedef struct crawl_share_struct CRAWLSHARE;
+
 /* A cache implementation.
  *
  * The populated structure can be passed to crawl_set_cache() to specify the
@@ -78,6 +83,8 @@ typedef char CACHEKEY[CACHE_KEY_LEN+1];
 typedef struct crawl_object_struct CRAWLOBJ;
 
 typedef struct crawl_cache_struct CRAWLCACHE;
+typedef struct crawl_link_struct CRAWLLINK;
+typedef struct crawl_stats_struct CRAWLSTATS;
 typedef struct crawl_cache_impl_struct CRAWLCACHEIMPL;
 
 struct crawl_cache_impl_struct
@@ -95,8 +102,51 @@ struct crawl_cache_impl_struct
 	int (*set_username)(CRAWLCACHE *cache, const char *username);
 	int (*set_password)(CRAWLCACHE *cache, const char *password);
 	int (*set_endpoint)(CRAWLCACHE *cache, const char *endpoint);
+	/* Optional: obtain a read-only view of a payload, released by passing
+	 * the same pointer and length to payload_unmap()
+	 */
+	const void *(*payload_map)(CRAWLCACHE *cache, const CACHEKEY key, size_t *len);
+	int (*payload_unmap)(CRAWLCACHE *cache, const void *ptr, size_t len);
+	/* Optional: read and write a sidecar as an opaque buffer, which may be
+	 * in either format (see crawl_sidecar_convert()); the buffer returned
+	 * by info_read_buf must be freed with crawl_free()
+	 */
+	int (*info_read_buf)(CRAWLCACHE *cache, const CACHEKEY key, char **buf, size_t *len);
+	int (*info_write_buf)(CRAWLCACHE *cache, const CACHEKEY key, const char *buf, size_t len);
+	/* Optional: wait until everything committed so far has been stored
+	 * durably (for implementations which store objects in the background),
+	 * returning -1 if anything could not be
+	 */
+	int (*sync)(CRAWLCACHE *cache);
+	/* Optional: determine whether a payload is present (and its size)
+	 * without treating its absence as an error, and remove an object and
+	 * its sidecar; both are required of the local tier of a tiered cache
+	 */
+	int (*payload_stat)(CRAWLCACHE *cache, const CACHEKEY key, uint64_t *size);
+	int (*remove)(CRAWLCACHE *cache, const CACHEKEY key);
+	/* Optional: supply the Content-Type and Content-Location (either of
+	 * which may be NULL) of a payload being written, once the response
+	 * headers have been received and before any of the payload has been
+	 * written, for implementations which begin storing a payload before
+	 * it's committed
+	 */
+	int (*payload_headers)(CRAWLCACHE *cache, const CACHEKEY key, FILE *f, const char *type, const char *location);
+	/* Optional: call fn for each payload in the cache, with its size and a
+	 * value which is larger the more recently the payload was stored (or
+	 * used, if the implementation knows), but otherwise meaningless; fn
+	 * mustn't use the cache, and listing stops if it returns nonzero.
+	 * Returns -1 if the payloads couldn't be listed.
+	 */
+	int (*payload_list)(CRAWLCACHE *cache, int (*fn)(const CACHEKEY key, uint64_t size, uint64_t seq, void *arg), void *arg);
 };
 
+/* Sidecar formats: the format written is selected with the 'sidecar'
+ * option in the cache URI (e.g., 'sidecar=binary'); sidecars in either
+ * format can always be read.
+ */
+# define CRAWL_SIDECAR_JSON            0
+# define CRAWL_SIDECAR_BINARY          1
+
 struct crawl_cache_struct
 {
 	/* The cache implementation */
@@ -109,6 +159,35 @@ struct crawl_cache_struct
 	void *data;
 };
 
+/* A link parsed from a Link header: the target, rel and anchor are spans
+ * within the header value, and so are not NUL-terminated unless obtained
+ * from crawl_obj_links(); rel and anchor are NULL if not present.
+ */
+struct crawl_link_struct
+{
+	const char *target;
+	size_t targetlen;
+	const char *rel;
+	size_t rellen;
+	const char *anchor;
+	size_t anchorlen;
+};
+
+/* Counters maintained by a crawl context (see crawl_stats()) */
+struct crawl_stats_struct
+{
+	/* Fetches which resulted in a request being made */
+	unsigned long fetches;
+	/* Requests made to revalidate a cached object */
+	unsigned long conditional;
+	/* ...of which included an If-None-Match header */
+	unsigned long etag;
+	/* ...of which were answered with 304 Not Modified */
+	unsigned long not_modified;
+	/* Responses whose payload was identical to the cached version */
+	unsigned long identical;
+};
+
 /* URI policy callback: invoked before a URI is fetched; returns 1 to proceed,
  * 0 to skip, -1 on error.
  */
@@ -130,7 +209,8 @@ typedef int (*crawl_updated_cb)(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, vo
 typedef int (*crawl_failed_cb)(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata, CRAWLSTATE state);
 
 /* Unchanged callback: invoked after a resource was rolled back because there is no
- * newer version of the resource.
+ * newer version of the resource, or when a resource was fetched but its payload
+ * is byte-for-byte identical to the cached version (see crawl_obj_digest()).
  */
 typedef int (*crawl_unchanged_cb)(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata);
 
@@ -145,10 +225,20 @@ typedef int (*crawl_next_cb)(CRAWL *crawl, URI **next, CRAWLSTATE *state, void *
  */
 typedef CRAWLSTATE (*crawl_checkpoint_cb)(CRAWL *crawl, CRAWLOBJ *obj, int *status, void *userdata);
 
+/* Payload callback: invoked with each chunk of the payload as it is received
+ * (after it has been written to the cache), and then once more with a NULL
+ * buffer when the transfer has finished, before the object is committed or
+ * rolled back. If the callback returns nonzero, it won't be invoked again
+ * for that object, but the fetch itself is unaffected.
+ */
+typedef int (*crawl_payload_cb)(CRAWL *crawl, CRAWLOBJ *obj, const char *buf, size_t len, void *userdata);
+
 /* libcrawl-provided cache implementations */
 
 extern const CRAWLCACHEIMPL *diskcache;
 extern const CRAWLCACHEIMPL *s3cache;
+extern const CRAWLCACHEIMPL *packcache;
+extern const CRAWLCACHEIMPL *tieredcache;
 
 /* Create a crawl context */
 CRAWL *crawl_create(void);
@@ -158,6 +248,8 @@ void crawl_destroy(CRAWL *p);
 const CRAWLCACHEIMPL *crawl_cache_scheme(CRAWL *crawl, const char *scheme);
 /* Set the cache implementation that will be used by this context */
 int crawl_set_cache(CRAWL *crawl, const CRAWLCACHEIMPL *cache);
+/* Wait until all of the objects committed to the cache have been stored */
+int crawl_cache_sync(CRAWL *crawl);
 /* Set the Accept header sent in subsequent requests */
 int crawl_set_accept(CRAWL *crawl, const char *accept);
 /* Set the User-Agent header sent in subsequent requests */
@@ -192,12 +284,39 @@ int crawl_set_checkpoint(CRAWL *crawl, crawl_checkpoint_cb cb);
 int crawl_set_unchanged(CRAWL *crawl, crawl_unchanged_cb cb);
 /* Set the callback function invoked before an object is fetched */
 int crawl_set_prefetch(CRAWL *crawl, crawl_prefetch_cb cb);
+/* Set the callback function invoked as each chunk of a payload is received */
+int crawl_set_payload(CRAWL *crawl, crawl_payload_cb cb);
 /* Set the logging function used by the crawler */
 int crawl_set_logger(CRAWL *crawl, void (*logger)(int, const char *, va_list));
+/* Set the maximum number of concurrent transfers used by crawl_perform() */
+int crawl_set_concurrency(CRAWL *crawl, int concurrency);
+/* Set the share object used by this context (which must outlive it) */
+int crawl_set_share(CRAWL *crawl, CRAWLSHARE *share);
+
+/* Create a share object */
+CRAWLSHARE *crawl_share_create(void);
+/* Destroy a share object which is no longer used by any context */
+int crawl_share_destroy(CRAWLSHARE *share);
 
 /* Open the payload file for a crawl object */
 FILE *crawl_obj_open(CRAWLOBJ *obj);
-/* Destroy an (in-memory) crawl object */
+/* Obtain a read-only in-memory view of the payload of a crawl object */
+const void *crawl_obj_map(CRAWLOBJ *obj, size_t *len);
+/* Release a view obtained by crawl_obj_map() */
+int crawl_obj_unmap(CRAWLOBJ *obj);
+/* Obtain the links from the Link headers of a crawl object */
+const CRAWLLINK *crawl_obj_links(CRAWLOBJ *obj, size_t *count);
+/* Parse the next link from a Link header value without allocating */
+int crawl_link_next(const char **value, CRAWLLINK *link);
+/* Attach private data to a crawl object, released along with the object */
+int crawl_obj_set_private(CRAWLOBJ *obj, void *data, void (*release)(void *data));
+/* Obtain the private data attached to a crawl object */
+void *crawl_obj_private(CRAWLOBJ *obj);
+/* Retain a crawl object beyond the callback it was passed to; each call
+ * must be balanced by a call to crawl_obj_destroy()
+ */
+CRAWLOBJ *crawl_obj_retain(CRAWLOBJ *obj);
+/* Destroy an (in-memory) crawl object, or release a retained reference */
 int crawl_obj_destroy(CRAWLOBJ *obj);
 /* Obtain the cache key for a crawl object */
 const char *crawl_obj_key(CRAWLOBJ *obj);
@@ -223,6 +342,8 @@ const char *crawl_obj_redirect(CRAWLOBJ *obj);
 const char *crawl_obj_content_location(CRAWLOBJ *obj);
 /* Has this object been freshly-fetched? */
 int crawl_obj_fresh(CRAWLOBJ *obj);
+/* Obtain the hexadecimal SHA-256 digest of the payload, if known */
+const char *crawl_obj_digest(CRAWLOBJ *obj);
 
 /* Determine the cache key for a resource */
 int crawl_cache_key(CRAWL *restrict crawl, const char *restrict uri, char *restrict buf, size_t buflen);
@@ -241,6 +362,16 @@ CRAWLOBJ *crawl_locate_uri(CRAWL *crawl, URI *uri);
 
 /* Perform a crawling cycle */
 int crawl_perform(CRAWL *crawl);
+/* Perform a crawling cycle with multiple concurrent transfers */
+int crawl_perform_multi(CRAWL *crawl);
+
+/* Obtain the counters maintained by the context */
+int crawl_stats(CRAWL *crawl, CRAWLSTATS *stats);
+
+/* Convert a sidecar (in either format) to the specified format
+ * (CRAWL_SIDECAR_xxx); the result must be freed with crawl_free()
+ */
+int crawl_sidecar_convert(CRAWL *crawl, const char *buf, size_t len, int format, char **out, size_t *outlen);
 
 /* Memory allocation helpers */
 
@@ -0,0 +1,341 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_libcrawl.h"
+
+/* Parsing of HTTP Link headers (RFC 5988) */
+
+#define LINK_ALLOC_BLOCK               8
+
+static int crawl_obj_links_parse_(CRAWLOBJ *obj);
+static int crawl_obj_links_json_(CRAWLOBJ *obj);
+
+/* Parse the next link from a Link header value, advancing *value past it.
+ *
+ * The members of link are set to point into the header value, and are not
+ * NUL-terminated; rel and anchor are NULL if the link has no such
+ * parameter. Nothing is allocated.
+ *
+ * Returns 1 if a link was parsed, 0 if there are no more links, or -1 if
+ * the header value is malformed.
+ */
+int
+crawl_link_next(const char **value, CRAWLLINK *link)
+{
+	const char *p, *name, *vstart, *vend;
+	size_t namelen;
+
+	memset(link, 0, sizeof(CRAWLLINK));
+	p = *value;
+	while(*p == ' ' || *p == '\t' || *p == ',')
+	{
+		p++;
+	}
+	*value = p;
+	if(!*p)
+	{
+		return 0;
+	}
+	if(*p != '<')
+	{
+		return -1;
+	}
+	p++;
+	link->target = p;
+	while(*p && *p != '>')
+	{
+		p++;
+	}
+	if(!*p)
+	{
+		return -1;
+	}
+	link->targetlen = p - link->target;
+	p++;
+	for(;;)
+	{
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+		if(!*p || *p == ',')
+		{
+			break;
+		}
+		if(*p != ';')
+		{
+			return -1;
+		}
+		p++;
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+		name = p;
+		while(*p && *p != '=' && *p != ';' && *p != ',' && *p != ' ' && *p != '\t')
+		{
+			p++;
+		}
+		namelen = p - name;
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+		if(*p != '=')
+		{
+			/* A parameter without a value */
+			continue;
+		}
+		p++;
+		while(*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+		if(*p == '"')
+		{
+			p++;
+			vstart = p;
+			while(*p && *p != '"')
+			{
+				if(*p == '\\' && p[1])
+				{
+					p++;
+				}
+				p++;
+			}
+			if(!*p)
+			{
+				return -1;
+			}
+			vend = p;
+			p++;
+		}
+		else
+		{
+			vstart = p;
+			while(*p && *p != ';' && *p != ',' && *p != ' ' && *p != '\t')
+			{
+				p++;
+			}
+			vend = p;
+		}
+		if(vend == vstart)
+		{
+			continue;
+		}
+		if(!link->rel && namelen == 3 && !strncasecmp(name, "rel", 3))
+		{
+			link->rel = vstart;
+			link->rellen = vend - vstart;
+		}
+		else if(!link->anchor && namelen == 6 && !strncasecmp(name, "anchor", 6))
+		{
+			link->anchor = vstart;
+			link->anchorlen = vend - vstart;
+		}
+	}
+	*value = p;
+	return 1;
+}
+
+/* Obtain the links from the Link headers of the response. The links are
+ * parsed once, on demand, and remain valid until the object is destroyed
+ * or replaced; unlike links obtained from crawl_link_next(), their members
+ * are NUL-terminated.
+ */
+const CRAWLLINK *
+crawl_obj_links(CRAWLOBJ *obj, size_t *count)
+{
+	if(!obj->links_parsed)
+	{
+		if(crawl_obj_links_parse_(obj))
+		{
+			crawl_obj_links_reset_(obj);
+			*count = 0;
+			return NULL;
+		}
+	}
+	*count = obj->nlinks;
+	return obj->links;
+}
+
+/* INTERNAL: attach the Link header values collected during a fetch (as a
+ * sequence of NUL-terminated strings) to an object, which takes ownership
+ * of the buffer
+ */
+int
+crawl_obj_set_links_(CRAWLOBJ *obj, char *buf, size_t len)
+{
+	crawl_obj_links_reset_(obj);
+	obj->linkbuf = buf;
+	obj->linklen = len;
+	obj->links_collected = 1;
+	return 0;
+}
+
+/* INTERNAL: discard any links associated with an object */
+void
+crawl_obj_links_reset_(CRAWLOBJ *obj)
+{
+	crawl_free(obj->crawl, obj->linkbuf);
+	obj->linkbuf = NULL;
+	obj->linklen = 0;
+	crawl_free(obj->crawl, obj->links);
+	obj->links = NULL;
+	obj->nlinks = 0;
+	obj->links_collected = 0;
+	obj->links_parsed = 0;
+}
+
+/* INTERNAL: append a Link header value to a buffer being collected for
+ * crawl_obj_set_links_()
+ */
+int
+crawl_links_add_(CRAWL *crawl, char **buf, size_t *len, const char *value, size_t valuelen)
+{
+	char *p;
+
+	p = (char *) crawl_realloc(crawl, *buf, *len + valuelen + 1);
+	if(!p)
+	{
+		return -1;
+	}
+	memcpy(&(p[*len]), value, valuelen);
+	p[*len + valuelen] = 0;
+	*buf = p;
+	*len += valuelen + 1;
+	return 0;
+}
+
+/* Collect the Link header values from the object's stored headers, for
+ * objects which were located in the cache rather than fetched
+ */
+static int
+crawl_obj_links_json_(CRAWLOBJ *obj)
+{
+	json_t *headers, *values, *value;
+	const char *key, *s, *p, *end;
+	size_t c, keylen, len;
+	int r;
+
+	if(!obj->meta.headers && obj->meta.rawheaders)
+	{
+		/* Scan the string table from a binary sidecar in place */
+		p = obj->meta.rawheaders;
+		end = p + obj->meta.rawheaderslen;
+		while((r = crawl_sidecar_header_next_(&p, end, &key, &keylen, &s, &len)) > 0)
+		{
+			if(keylen == 4 && !strncasecmp(key, "link", 4) &&
+			   crawl_links_add_(obj->crawl, &(obj->linkbuf), &(obj->linklen), s, len))
+			{
+				return -1;
+			}
+		}
+		if(r < 0)
+		{
+			return -1;
+		}
+		obj->links_collected = 1;
+		return 0;
+	}
+	headers = obj->meta.headers;
+	json_object_foreach(headers, key, values)
+	{
+		if(strcasecmp(key, "link"))
+		{
+			continue;
+		}
+		for(c = 0; c < json_array_size(values); c++)
+		{
+			value = json_array_get(values, c);
+			s = json_string_value(value);
+			if(s && crawl_links_add_(obj->crawl, &(obj->linkbuf), &(obj->linklen), s, strlen(s)))
+			{
+				return -1;
+			}
+		}
+	}
+	obj->links_collected = 1;
+	return 0;
+}
+
+static int
+crawl_obj_links_parse_(CRAWLOBJ *obj)
+{
+	const char *value, *end;
+	CRAWLLINK *p;
+	size_t size, c;
+	int r;
+
+	if(!obj->links_collected && crawl_obj_links_json_(obj))
+	{
+		return -1;
+	}
+	size = 0;
+	value = obj->linkbuf;
+	end = obj->linkbuf + obj->linklen;
+	while(value && value < end)
+	{
+		for(;;)
+		{
+			if(obj->nlinks + 1 > size)
+			{
+				p = (CRAWLLINK *) crawl_realloc(obj->crawl, obj->links, sizeof(CRAWLLINK) * (size + LINK_ALLOC_BLOCK));
+				if(!p)
+				{
+					return -1;
+				}
+				obj->links = p;
+				size += LINK_ALLOC_BLOCK;
+			}
+			r = crawl_link_next(&value, &(obj->links[obj->nlinks]));
+			if(r < 0)
+			{
+				crawl_log_(obj->crawl, LOG_INFO, MSG_I_MALFORMEDLINK " ('%s')\n", value);
+				break;
+			}
+			if(!r)
+			{
+				break;
+			}
+			obj->nlinks++;
+		}
+		value = strchr(value, 0) + 1;
+	}
+	/* Now that parsing is complete, the links can be NUL-terminated in
+	 * place: each is followed by a delimiter which is no longer needed
+	 */
+	for(c = 0; c < obj->nlinks; c++)
+	{
+		p = &(obj->links[c]);
+		((char *) p->target)[p->targetlen] = 0;
+		if(p->rel)
+		{
+			((char *) p->rel)[p->rellen] = 0;
+		}
+		if(p->anchor)
+		{
+			((char *) p->anchor)[p->anchorlen] = 0;
+		}
+	}
+	obj->links_parsed = 1;
+	return 0;
+}
@@ -25,7 +25,8 @@
 
 #include "p_libcrawl.h"
 
-static int crawl_obj_update_(CRAWLOBJ *obj);
+static int crawl_obj_meta_str_(CRAWL *crawl, char **dest, const json_t *dict, const char *key);
+static int crawl_obj_info_str_(json_t *dict, const char *key, const char *value);
 
 CRAWLOBJ *
 crawl_obj_create_(CRAWL *crawl, URI *uri)
@@ -39,6 +40,7 @@ crawl_obj_create_(CRAWL *crawl, URI *uri)
 		return NULL;
 	}
 	p->crawl = crawl;
+	p->refcount = 1;
 	p->uri = uri_create_uri(uri, NULL);
 	if(!p->uri)
 	{
@@ -63,23 +65,99 @@ crawl_obj_create_(CRAWL *crawl, URI *uri)
 	return p;
 }
 
-/* Open a JSON sidecar and read the information from it */
+/* Open a sidecar and read the information from it */
 int
 crawl_obj_locate_(CRAWLOBJ *obj)
 {
+	const CRAWLCACHEIMPL *impl;
+	json_t *info;
+	char *buf;
+	size_t len;
+	int r;
+
 	if(!obj->crawl->cache.impl)
 	{
-		if(!crawl_cache_init_(obj->crawl))
+		if(crawl_cache_init_(obj->crawl))
+		{
+			return -1;
+		}
+	}
+	impl = obj->crawl->cache.impl;
+	crawl_obj_links_reset_(obj);
+	crawl_obj_meta_release_(obj->crawl, &(obj->meta));
+	if(impl->info_read_buf)
+	{
+		/* Decode the sidecar directly, whichever format it's in */
+		buf = NULL;
+		len = 0;
+		if(impl->info_read_buf(&(obj->crawl->cache), obj->key, &buf, &len))
 		{
 			return -1;
 		}
+		r = crawl_sidecar_decode_(obj->crawl, &(obj->meta), buf, len);
+		crawl_free(obj->crawl, buf);
+		return r;
 	}
-	if(obj->crawl->cache.impl->info_read(&(obj->crawl->cache), obj->key, &(obj->info)))
+	info = NULL;
+	if(impl->info_read(&(obj->crawl->cache), obj->key, &info))
 	{
 		return -1;
 	}
-	crawl_obj_update_(obj);
-	return 0;
+	r = crawl_obj_meta_set_json_(obj->crawl, &(obj->meta), info);
+	json_decref(info);
+	return r;
+}
+
+/* Write the sidecar for an object, in the format selected for the cache */
+int
+crawl_obj_write_info_(CRAWLOBJ *obj)
+{
+	const CRAWLCACHEIMPL *impl;
+	json_t *info;
+	char *buf;
+	size_t len;
+	int r;
+
+	if(!obj->crawl->cache.impl)
+	{
+		if(crawl_cache_init_(obj->crawl))
+		{
+			return -1;
+		}
+	}
+	impl = obj->crawl->cache.impl;
+	if(obj->crawl->sidecar == CRAWL_SIDECAR_BINARY && impl->info_write_buf)
+	{
+		if(crawl_sidecar_encode_(obj->crawl, &(obj->meta), &buf, &len))
+		{
+			return -1;
+		}
+		r = impl->info_write_buf(&(obj->crawl->cache), obj->key, buf, len);
+		crawl_free(obj->crawl, buf);
+		return r;
+	}
+	info = crawl_obj_meta_json_(obj->crawl, &(obj->meta));
+	if(!info)
+	{
+		return -1;
+	}
+	r = impl->info_write(&(obj->crawl->cache), obj->key, info);
+	json_decref(info);
+	return r;
+}
+
+/* Retain an object so that it survives past the callback it was passed
+ * to; objects belong to a single CRAWL, and so to a single thread, which
+ * means the count doesn't need to be protected by a lock
+ */
+CRAWLOBJ *
+crawl_obj_retain(CRAWLOBJ *obj)
+{
+	if(obj)
+	{
+		obj->refcount++;
+	}
+	return obj;
 }
 
 int
@@ -87,21 +165,51 @@ crawl_obj_destroy(CRAWLOBJ *obj)
 {
 	if(obj)
 	{
+		if(obj->refcount > 1)
+		{
+			obj->refcount--;
+			return 0;
+		}
+		crawl_obj_unmap(obj);
+		if(obj->priv_release)
+		{
+			obj->priv_release(obj->priv);
+		}
+		crawl_obj_links_reset_(obj);
 		if(obj->uri)
 		{
 			uri_destroy(obj->uri);
 		}
 		crawl_free(obj->crawl, obj->uristr);
 		crawl_free(obj->crawl, obj->payload);
-		if(obj->info)
-		{
-			json_decref(obj->info);
-		}
+		crawl_obj_meta_release_(obj->crawl, &(obj->meta));
 		crawl_free(obj->crawl, obj);
 	}
 	return 0;
 }
 
+/* Attach private data to an object, replacing (and releasing) any which
+ * was previously attached; release, if not NULL, will be invoked when
+ * the object is destroyed
+ */
+int
+crawl_obj_set_private(CRAWLOBJ *obj, void *data, void (*release)(void *data))
+{
+	if(obj->priv_release && obj->priv != data)
+	{
+		obj->priv_release(obj->priv);
+	}
+	obj->priv = data;
+	obj->priv_release = release;
+	return 0;
+}
+
+void *
+crawl_obj_private(CRAWLOBJ *obj)
+{
+	return obj->priv;
+}
+
 const char *
 crawl_obj_key(CRAWLOBJ *obj)
 {
@@ -117,19 +225,19 @@ crawl_obj_payload(CRAWLOBJ *obj)
 int
 crawl_obj_status(CRAWLOBJ *obj)
 {
-	return obj->status;
+	return obj->meta.status;
 }
 
 time_t
 crawl_obj_updated(CRAWLOBJ *obj)
 {
-	return obj->updated;
+	return obj->meta.updated;
 }
 
 uint64_t
 crawl_obj_size(CRAWLOBJ *obj)
 {
-	return obj->size;
+	return obj->meta.size;
 }
 
 /* Return either a reference to the headers in the crawl object, or a deep
@@ -141,11 +249,7 @@ crawl_obj_headers(CRAWLOBJ *obj, int clone)
 {
 	json_t *headers;
 	
-	if(!obj->info)
-	{
-		return NULL;
-	}
-	headers = json_object_get(obj->info, "headers");
+	headers = crawl_obj_meta_headers_(obj->crawl, &(obj->meta));
 	if(!headers)
 	{
 		return NULL;
@@ -175,52 +279,26 @@ crawl_obj_uristr(CRAWLOBJ *obj)
 const char *
 crawl_obj_type(CRAWLOBJ *obj)
 {
-	json_t *str;
-	
-	if(!obj->info)
-	{
-		return NULL;
-	}
-	str = json_object_get(obj->info, "type");
-	if(str)
-	{
-		return json_string_value(str);
-	}
-	return NULL;
+	return obj->meta.type;
 }
 
 const char *
 crawl_obj_redirect(CRAWLOBJ *obj)
 {
-	json_t *str;
-	
-	if(!obj->info)
-	{
-		return NULL;
-	}
-	str = json_object_get(obj->info, "redirect");
-	if(str)
-	{
-		return json_string_value(str);
-	}
-	return NULL;
+	return obj->meta.redirect;
 }
 
 const char *
 crawl_obj_content_location(CRAWLOBJ *obj)
 {
-	json_t *str;
-	
-	if(!obj->info)
-	{
-		return NULL;
-	}
-	str = json_object_get(obj->info, "content_location");
-	if(str)
-	{
-		return json_string_value(str);
-	}
-	return NULL;
+	return obj->meta.content_location;
+}
+
+/* Obtain the hexadecimal SHA-256 digest of the payload, if known */
+const char *
+crawl_obj_digest(CRAWLOBJ *obj)
+{
+	return obj->meta.digest;
 }
 
 /* Has this object been freshly-fetched? */
@@ -230,54 +308,129 @@ crawl_obj_fresh(CRAWLOBJ *obj)
 	return obj->fresh;
 }
 
-/* Replace the information in a crawl object with data from a new JSON
- * object
+/* Populate a (released) metadata structure from a JSON dictionary read
+ * from a sidecar
  */
 int
-crawl_obj_replace_(CRAWLOBJ *obj, const json_t *dict)
+crawl_obj_meta_set_json_(CRAWL *crawl, struct crawl_obj_meta_struct *meta, const json_t *dict)
 {
 	json_t *p;
 
-	p = json_deep_copy(dict);
-	if(!p)
+	if(!dict)
 	{
 		return -1;
 	}
-	if(obj->info)
+	p = json_object_get(dict, "updated");
+	if(p)
 	{
-		json_decref(obj->info);
+		meta->updated = json_integer_value(p);
 	}
-	obj->info = p;
-	return crawl_obj_update_(obj);
+	p = json_object_get(dict, "status");
+	if(p)
+	{
+		meta->status = json_integer_value(p);
+	}
+	p = json_object_get(dict, "size");
+	if(p)
+	{
+		meta->size = json_integer_value(p);
+	}
+	if(crawl_obj_meta_str_(crawl, &(meta->type), dict, "type") ||
+	   crawl_obj_meta_str_(crawl, &(meta->location), dict, "location") ||
+	   crawl_obj_meta_str_(crawl, &(meta->content_location), dict, "content_location") ||
+	   crawl_obj_meta_str_(crawl, &(meta->redirect), dict, "redirect") ||
+	   crawl_obj_meta_str_(crawl, &(meta->etag), dict, "etag") ||
+	   crawl_obj_meta_str_(crawl, &(meta->last_modified), dict, "last_modified") ||
+	   crawl_obj_meta_str_(crawl, &(meta->digest), dict, "digest"))
+	{
+		return -1;
+	}
+	p = json_object_get(dict, "headers");
+	if(p && json_is_object(p))
+	{
+		json_incref(p);
+		meta->headers = p;
+	}
+	return 0;
 }
 
-/* Update internal members of the structured based on the info jd_var */
-static int
-crawl_obj_update_(CRAWLOBJ *obj)
+/* Serialise a metadata structure as a new JSON dictionary for writing to a
+ * sidecar; the caller must json_decref() the result
+ */
+json_t *
+crawl_obj_meta_json_(CRAWL *crawl, struct crawl_obj_meta_struct *meta)
 {
-	json_t *p;
-	
-	obj->updated = 0;
-	if(!obj->info)
+	json_t *dict, *headers;
+
+	headers = crawl_obj_meta_headers_(crawl, meta);
+	if(!headers && meta->rawheaders)
 	{
-		return -1;
+		return NULL;
 	}
-	p = json_object_get(obj->info, "updated");
-	if(p)
+	dict = json_object();
+	if(!dict)
 	{
-		obj->updated = json_integer_value(p);
+		return NULL;
 	}
-	p = json_object_get(obj->info, "status");
-	if(p)
+	if(json_object_set_new(dict, "status", json_integer(meta->status)) ||
+	   json_object_set_new(dict, "size", json_integer(meta->size)) ||
+	   json_object_set_new(dict, "updated", json_integer(meta->updated)) ||
+	   crawl_obj_info_str_(dict, "type", meta->type) ||
+	   crawl_obj_info_str_(dict, "location", meta->location) ||
+	   crawl_obj_info_str_(dict, "content_location", meta->content_location) ||
+	   crawl_obj_info_str_(dict, "redirect", meta->redirect) ||
+	   crawl_obj_info_str_(dict, "etag", meta->etag) ||
+	   crawl_obj_info_str_(dict, "last_modified", meta->last_modified) ||
+	   crawl_obj_info_str_(dict, "digest", meta->digest) ||
+	   (headers && json_object_set(dict, "headers", headers)))
 	{
-		obj->status = json_integer_value(p);
+		json_decref(dict);
+		return NULL;
 	}
-	p = json_object_get(obj->info, "size");
-	if(p)
+	return dict;
+}
+
+/* Release the members of a metadata structure */
+void
+crawl_obj_meta_release_(CRAWL *crawl, struct crawl_obj_meta_struct *meta)
+{
+	crawl_free(crawl, meta->type);
+	crawl_free(crawl, meta->location);
+	crawl_free(crawl, meta->content_location);
+	crawl_free(crawl, meta->redirect);
+	crawl_free(crawl, meta->etag);
+	crawl_free(crawl, meta->last_modified);
+	crawl_free(crawl, meta->digest);
+	crawl_free(crawl, meta->rawheaders);
+	if(meta->headers)
 	{
-		obj->size = json_integer_value(p);
+		json_decref(meta->headers);
 	}
-	return 0;
+	memset(meta, 0, sizeof(struct crawl_obj_meta_struct));
+}
+
+static int
+crawl_obj_meta_str_(CRAWL *crawl, char **dest, const json_t *dict, const char *key)
+{
+	const char *str;
+
+	str = json_string_value(json_object_get(dict, key));
+	if(!str)
+	{
+		return 0;
+	}
+	*dest = crawl_strdup(crawl, str);
+	return (*dest ? 0 : -1);
+}
+
+static int
+crawl_obj_info_str_(json_t *dict, const char *key, const char *value)
+{
+	if(!value)
+	{
+		return 0;
+	}
+	return json_object_set_new(dict, key, json_string(value));
 }
 
 /* Open the payload file for a crawl object */
@@ -286,3 +439,106 @@ crawl_obj_open(CRAWLOBJ *obj)
 {
 	return obj->crawl->cache.impl->payload_open_read(&(obj->crawl->cache), obj->key);
 }
+
+/* Obtain a read-only view of the payload of a crawl object, which remains
+ * valid until crawl_obj_unmap() or crawl_obj_destroy() is called. If the
+ * cache implementation can't provide one directly, the payload is read
+ * into memory instead.
+ */
+const void *
+crawl_obj_map(CRAWLOBJ *obj, size_t *len)
+{
+	const CRAWLCACHEIMPL *impl;
+	FILE *f;
+	char *buf, *p;
+	size_t size, n;
+
+	if(obj->map)
+	{
+		*len = obj->maplen;
+		return obj->map;
+	}
+	impl = obj->crawl->cache.impl;
+	if(impl->payload_map)
+	{
+		obj->map = impl->payload_map(&(obj->crawl->cache), obj->key, &(obj->maplen));
+		if(!obj->map)
+		{
+			return NULL;
+		}
+		obj->mapimpl = 1;
+		*len = obj->maplen;
+		return obj->map;
+	}
+	f = crawl_obj_open(obj);
+	if(!f)
+	{
+		return NULL;
+	}
+	/* Use the stored size as a hint, but don't rely upon it */
+	size = (obj->meta.size ? obj->meta.size + 1 : OBJ_READ_BLOCK);
+	buf = (char *) crawl_alloc(obj->crawl, size);
+	if(!buf)
+	{
+		fclose(f);
+		return NULL;
+	}
+	n = 0;
+	for(;;)
+	{
+		if(n == size)
+		{
+			p = (char *) crawl_realloc(obj->crawl, buf, size + OBJ_READ_BLOCK);
+			if(!p)
+			{
+				crawl_free(obj->crawl, buf);
+				fclose(f);
+				return NULL;
+			}
+			buf = p;
+			size += OBJ_READ_BLOCK;
+		}
+		n += fread(&(buf[n]), 1, size - n, f);
+		if(n < size)
+		{
+			break;
+		}
+	}
+	if(ferror(f))
+	{
+		crawl_free(obj->crawl, buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	obj->map = buf;
+	obj->maplen = n;
+	obj->mapimpl = 0;
+	*len = n;
+	return buf;
+}
+
+/* Release the view of the payload obtained by crawl_obj_map() */
+int
+crawl_obj_unmap(CRAWLOBJ *obj)
+{
+	int r;
+
+	if(!obj->map)
+	{
+		return 0;
+	}
+	r = 0;
+	if(obj->mapimpl)
+	{
+		r = obj->crawl->cache.impl->payload_unmap(&(obj->crawl->cache), obj->map, obj->maplen);
+	}
+	else
+	{
+		crawl_free(obj->crawl, (void *) obj->map);
+	}
+	obj->map = NULL;
+	obj->maplen = 0;
+	obj->mapimpl = 0;
+	return r;
+}
@@ -32,6 +32,7 @@
 # include <fcntl.h>
 # include <unistd.h>
 # include <syslog.h>
+# include <pthread.h>
 
 # include <curl/curl.h>
 
@@ -50,8 +51,14 @@
  *
  * 'updated':       Unix timestamp of last fetch
  * 'status':        HTTP status code
+ * 'size':          size of the payload, in bytes
+ * 'location':      the URL that was retrieved
+ * 'content_location': received Content-Location header (or the URL retrieved)
  * 'redirect':      received Location header in the case of a redirect, if any
  * 'type':          received Content-Type header, if any
+ * 'etag':          received ETag header, if any
+ * 'last_modified': received Last-Modified header, if any
+ * 'digest':        SHA-256 digest of the payload, in hexadecimal
  * 'headers':{ }    parsed HTTP headers (the status line has a key of ':';
  *                  all other values are arrays containing at least one value)
  * 
@@ -84,6 +91,8 @@
 # define MSG_C_NOMEM                    "%%ANANSI-C-1000: Memory allocation failure"
 # define MSG_N_NONEXT                   "%%ANANSI-N-1001: crawl_perform(): no 'next resource' handler has been registered"
 # define MSG_E_PARSEURI                 "%%ANANSI-E-1002: failed to parse URI"
+# define MSG_E_MULTI                    "%%ANANSI-E-1003: concurrent transfer failed"
+# define MSG_I_MALFORMEDLINK            "%%ANANSI-I-1004: ignoring malformed Link header in response"
 
 /* disk cache */
 # define MSG_E_DISK_PAYLOADREAD         "%%ANANSI-E-4000: disk: failed to open payload for reading"
@@ -95,10 +104,38 @@
 # define MSG_E_DISK_PAYLOADWRITE        "%%ANANSI-E-4006: disk: failed to open temporary payload file for writing"
 # define MSG_E_DISK_MKDIR               "%%ANANSI-E-4007: disk: failed to create cache directory"
 # define MSG_E_DISK_DIRSTAT             "%%ANANSI-E-4008: disk: failed to stat cache directory"
+# define MSG_E_DISK_REMOVE              "%%ANANSI-E-4009: disk: failed to remove object from cache"
+# define MSG_E_DISK_LIST                "%%ANANSI-E-4010: disk: failed to list cache directory"
 
 /* S3 cache */
 # define MSG_E_S3_TMPFILE               "%%ANANSI-E-4100: S3: failed to create temporary file"
 # define MSG_E_S3_HTTP                  "%%ANANSI-E-4101: S3: failed to retrieve object from cache"
+# define MSG_E_S3_UPLOAD                "%%ANANSI-E-4102: S3: failed to upload object to cache"
+# define MSG_W_S3_RETRY                 "%%ANANSI-W-4103: S3: upload failed"
+# define MSG_E_S3_UPLOADER              "%%ANANSI-E-4104: S3: failed to start background uploader thread"
+# define MSG_E_S3_META                  "%%ANANSI-E-4105: S3: object has an invalid sidecar header"
+# define MSG_W_S3_MULTIPART             "%%ANANSI-W-4106: S3: multipart upload failed; payload will be uploaded in one piece"
+# define MSG_E_S3_CHANGED               "%%ANANSI-E-4107: S3: object was replaced while it was being read"
+# define MSG_W_S3_NOMULTIPART           "%%ANANSI-W-4108: S3: multipart upload refused; multipart uploads have been disabled"
+
+/* Packed cache */
+# define MSG_E_PACK_TMPFILE             "%%ANANSI-E-4200: pack: failed to create temporary file"
+# define MSG_E_PACK_PAYLOADREAD         "%%ANANSI-E-4201: pack: failed to read payload"
+# define MSG_E_PACK_INFOREAD            "%%ANANSI-E-4202: pack: failed to read sidecar"
+# define MSG_E_PACK_COMMIT              "%%ANANSI-E-4203: pack: failed to append record to segment"
+# define MSG_E_PACK_MKDIR               "%%ANANSI-E-4204: pack: failed to create cache directory"
+# define MSG_E_PACK_LOCK                "%%ANANSI-E-4205: pack: failed to lock cache (is it in use by another process?)"
+# define MSG_E_PACK_SEGMENT             "%%ANANSI-E-4206: pack: segment file error"
+# define MSG_E_PACK_INDEX               "%%ANANSI-E-4207: pack: index file error"
+# define MSG_E_PACK_COMPACTOR           "%%ANANSI-E-4208: pack: failed to start compactor thread"
+
+/* Tiered cache */
+# define MSG_E_TIERED_CONFIG            "%%ANANSI-E-4300: tiered: invalid cache configuration"
+# define MSG_E_TIERED_TIER              "%%ANANSI-E-4301: tiered: failed to initialise cache tier"
+# define MSG_E_TIERED_REMOTE            "%%ANANSI-E-4302: tiered: failed to store object in remote tier"
+# define MSG_W_TIERED_LOCAL             "%%ANANSI-W-4303: tiered: failed to copy object to local tier"
+# define MSG_E_TIERED_WRITER            "%%ANANSI-E-4304: tiered: failed to start background writer thread"
+# define MSG_W_TIERED_RETRY             "%%ANANSI-W-4305: tiered: object not yet stored in remote tier"
 
 struct crawl_struct
 {
@@ -121,22 +158,93 @@ struct crawl_struct
 	crawl_checkpoint_cb checkpoint;
 	crawl_unchanged_cb unchanged;
 	crawl_prefetch_cb prefetch;
+	crawl_payload_cb payload;
 	void (*logger)(int priority, const char *format, va_list ap);
+	/* Maximum number of concurrent transfers in crawl_perform_multi() */
+	int concurrency;
+	/* The multi handle used by crawl_perform_multi(), created on demand */
+	CURLM *multi;
+	/* Idle easy handles available for re-use */
+	CURL **handles;
+	size_t nhandles;
+	size_t handles_size;
+	/* Share object (not owned by the context), if any */
+	CRAWLSHARE *share;
+	/* The sidecar format to write (CRAWL_SIDECAR_xxx), selected by the
+	 * 'sidecar' option in the cache URI
+	 */
+	int sidecar;
+	/* Counters returned by crawl_stats() */
+	CRAWLSTATS stats;
+};
+
+struct crawl_share_struct
+{
+	CURLSH *sh;
+	pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+};
+
+/* The metadata describing a crawled object; this is populated directly
+ * from the response when an object is fetched, and is only encoded or
+ * decoded when the sidecar is written or read by the cache implementation
+ * (see crawl_obj_write_info_() and crawl_obj_locate_())
+ */
+struct crawl_obj_meta_struct
+{
+	time_t updated;
+	int status;
+	uint64_t size;
+	char *type;
+	char *location;
+	char *content_location;
+	char *redirect;
+	char *etag;
+	char *last_modified;
+	/* Hexadecimal SHA-256 digest of the payload */
+	char *digest;
+	/* The response headers, as a dictionary of arrays of strings; this is
+	 * never modified once created, and so is shared rather than copied
+	 */
+	json_t *headers;
+	/* The headers string table read from a binary sidecar, if the headers
+	 * haven't yet been converted to a dictionary (see
+	 * crawl_obj_meta_headers_())
+	 */
+	char *rawheaders;
+	size_t rawheaderslen;
 };
 
 struct crawl_object_struct
 {
 	CRAWL *crawl;
+	/* The number of references held, see crawl_obj_retain() */
+	unsigned long refcount;
 	CACHEKEY key;
 	int fresh;
-	time_t updated;
-	int status;
-	json_t *info;
+	struct crawl_obj_meta_struct meta;
 	URI *uri;
 	char *uristr;
 	char *payload;
-	uint64_t size;
 	CRAWLSTATE state;
+	/* The payload view returned by crawl_obj_map(), if any */
+	const void *map;
+	size_t maplen;
+	/* Whether the view was provided by the cache implementation (rather
+	 * than read into a buffer owned by the object)
+	 */
+	int mapimpl;
+	/* Private data attached by crawl_obj_set_private() */
+	void *priv;
+	void (*priv_release)(void *data);
+	/* The Link header values, as consecutive NUL-terminated strings, and
+	 * the links parsed from them by crawl_obj_links()
+	 */
+	char *linkbuf;
+	size_t linklen;
+	int links_collected;
+	CRAWLLINK *links;
+	size_t nlinks;
+	int links_parsed;
 };
 
 struct crawl_fetch_data_struct
@@ -157,18 +265,63 @@ struct crawl_fetch_data_struct
 	uint64_t size;
 	int generated_info;
 	int checkpoint_invoked;
+	/* Whether the payload callback has been passed any chunks, and whether
+	 * it has asked not to be passed any more
+	 */
+	int streamed;
+	int stream_stop;
+	/* Link header values collected while generating the info dictionary */
+	char *linkbuf;
+	size_t linklen;
+	struct curl_slist *reqheaders;
+	/* The object's previous metadata, retained until the fetch has
+	 * completed so that it can be restored if necessary
+	 */
+	struct crawl_obj_meta_struct prev;
+	int have_prev;
+	/* Whether conditional request headers were sent */
+	int conditional;
+	/* The running digest of the payload, and whether it turned out to be
+	 * identical to that of the cached version
+	 */
+	SHA256_CTX digest;
+	int identical;
+	/* The next transfer in progress (used by crawl_perform_multi()) */
+	struct crawl_fetch_data_struct *next;
 };
 
 void crawl_log_(CRAWL *obj, int priority, const char *format, ...);
 
 CRAWLOBJ *crawl_obj_create_(CRAWL *crawl, URI *uri);
 int crawl_obj_locate_(CRAWLOBJ *obj);
-int crawl_obj_replace_(CRAWLOBJ *obj, const json_t *dict);
+int crawl_obj_write_info_(CRAWLOBJ *obj);
+int crawl_obj_meta_set_json_(CRAWL *crawl, struct crawl_obj_meta_struct *meta, const json_t *dict);
+json_t *crawl_obj_meta_json_(CRAWL *crawl, struct crawl_obj_meta_struct *meta);
+json_t *crawl_obj_meta_headers_(CRAWL *crawl, struct crawl_obj_meta_struct *meta);
+void crawl_obj_meta_release_(CRAWL *crawl, struct crawl_obj_meta_struct *meta);
+int crawl_obj_set_links_(CRAWLOBJ *obj, char *buf, size_t len);
+void crawl_obj_links_reset_(CRAWLOBJ *obj);
+int crawl_links_add_(CRAWL *crawl, char **buf, size_t *len, const char *value, size_t valuelen);
+
+int crawl_sidecar_option_(const char *query);
+int crawl_sidecar_binary_(const char *buf, size_t len);
+int crawl_sidecar_encode_(CRAWL *crawl, const struct crawl_obj_meta_struct *meta, char **out, size_t *outlen);
+int crawl_sidecar_decode_(CRAWL *crawl, struct crawl_obj_meta_struct *meta, const char *buf, size_t len);
+json_t *crawl_sidecar_json_(CRAWL *crawl, const char *buf, size_t len);
+int crawl_sidecar_header_next_(const char **p, const char *end, const char **name, size_t *namelen, const char **value, size_t *valuelen);
+
+int crawl_fetch_begin_(CRAWL *crawl, URI *uri, CRAWLSTATE state, struct crawl_fetch_data_struct *data);
+CRAWLOBJ *crawl_fetch_complete_(struct crawl_fetch_data_struct *data, CURLcode result);
+
+CURL *crawl_handle_acquire_(CRAWL *crawl);
+int crawl_handle_release_(CRAWL *crawl, CURL *ch);
+int crawl_handle_cleanup_(CRAWL *crawl);
 
 int crawl_cache_init_(CRAWL *crawl);
 int crawl_cache_key_(CRAWL *crawl, CACHEKEY dest, const char *uri);
 char *cache_uri_(CRAWL *crawl, const CACHEKEY key);
 FILE *cache_open_payload_write_(CRAWL *crawl, const CACHEKEY key);
+int cache_payload_headers_(CRAWL *crawl, const CACHEKEY key, FILE *f, CRAWLOBJ *obj);
 int cache_close_payload_rollback_(CRAWL *crawl, const CACHEKEY key, FILE *f);
 int cache_close_payload_commit_(CRAWL *crawl, const CACHEKEY key, FILE *f, CRAWLOBJ *obj);
 
@@ -0,0 +1,200 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_libcrawl.h"
+
+/* Connection re-use: each crawl context keeps a small pool of idle cURL
+ * easy handles, so that keep-alive connections and DNS results survive
+ * from one fetch to the next. A CRAWLSHARE additionally allows the DNS and
+ * TLS session caches to be shared between crawl contexts, including those
+ * used by other threads. The connection cache isn't shared, because cURL
+ * doesn't support sharing it between threads which use it concurrently;
+ * connections are re-used within each context instead.
+ */
+
+static void crawl_share_lock_(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+static void crawl_share_unlock_(CURL *handle, curl_lock_data data, void *userptr);
+
+/* Create a new share object */
+CRAWLSHARE *
+crawl_share_create(void)
+{
+	CRAWLSHARE *p;
+	size_t c;
+
+	p = (CRAWLSHARE *) crawl_alloc(NULL, sizeof(CRAWLSHARE));
+	p->sh = curl_share_init();
+	if(!p->sh)
+	{
+		crawl_free(NULL, p);
+		return NULL;
+	}
+	for(c = 0; c < CURL_LOCK_DATA_LAST; c++)
+	{
+		pthread_mutex_init(&(p->locks[c]), NULL);
+	}
+	curl_share_setopt(p->sh, CURLSHOPT_LOCKFUNC, crawl_share_lock_);
+	curl_share_setopt(p->sh, CURLSHOPT_UNLOCKFUNC, crawl_share_unlock_);
+	curl_share_setopt(p->sh, CURLSHOPT_USERDATA, (void *) p);
+	curl_share_setopt(p->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(p->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	return p;
+}
+
+/* Destroy a share object; it must not be in use by any crawl context */
+int
+crawl_share_destroy(CRAWLSHARE *share)
+{
+	size_t c;
+
+	if(share)
+	{
+		if(curl_share_cleanup(share->sh) != CURLSHE_OK)
+		{
+			errno = EBUSY;
+			return -1;
+		}
+		for(c = 0; c < CURL_LOCK_DATA_LAST; c++)
+		{
+			pthread_mutex_destroy(&(share->locks[c]));
+		}
+		crawl_free(NULL, share);
+	}
+	return 0;
+}
+
+/* Set (or, if share is NULL, remove) the share object used by a crawl
+ * context; the share object must outlive the context.
+ */
+int
+crawl_set_share(CRAWL *crawl, CRAWLSHARE *share)
+{
+	size_t c;
+
+	/* Idle handles may still refer to the previous share */
+	for(c = 0; c < crawl->nhandles; c++)
+	{
+		curl_easy_cleanup(crawl->handles[c]);
+	}
+	crawl->nhandles = 0;
+	crawl->share = share;
+	return 0;
+}
+
+/* INTERNAL: obtain an easy handle (either idle, or newly-created) */
+CURL *
+crawl_handle_acquire_(CRAWL *crawl)
+{
+	CURL *ch;
+
+	if(crawl->nhandles)
+	{
+		crawl->nhandles--;
+		ch = crawl->handles[crawl->nhandles];
+	}
+	else
+	{
+		ch = curl_easy_init();
+		if(!ch)
+		{
+			return NULL;
+		}
+	}
+	if(crawl->share)
+	{
+		curl_easy_setopt(ch, CURLOPT_SHARE, crawl->share->sh);
+	}
+	return ch;
+}
+
+/* INTERNAL: return an easy handle to the idle pool once a transfer has
+ * completed (and the handle has been removed from any multi handle)
+ */
+int
+crawl_handle_release_(CRAWL *crawl, CURL *ch)
+{
+	CURL **p;
+	size_t limit;
+
+	if(!ch)
+	{
+		return 0;
+	}
+	limit = (crawl->concurrency > 1 ? (size_t) crawl->concurrency : 1);
+	if(crawl->nhandles >= limit)
+	{
+		curl_easy_cleanup(ch);
+		return 0;
+	}
+	if(crawl->nhandles >= crawl->handles_size)
+	{
+		p = (CURL **) crawl_realloc(crawl, crawl->handles, sizeof(CURL *) * limit);
+		crawl->handles = p;
+		crawl->handles_size = limit;
+	}
+	/* Discard all per-request options, but retain the connection, DNS and
+	 * TLS session caches
+	 */
+	curl_easy_reset(ch);
+	crawl->handles[crawl->nhandles] = ch;
+	crawl->nhandles++;
+	return 0;
+}
+
+/* INTERNAL: destroy all idle handles */
+int
+crawl_handle_cleanup_(CRAWL *crawl)
+{
+	size_t c;
+
+	for(c = 0; c < crawl->nhandles; c++)
+	{
+		curl_easy_cleanup(crawl->handles[c]);
+	}
+	crawl_free(crawl, crawl->handles);
+	crawl->handles = NULL;
+	crawl->nhandles = 0;
+	crawl->handles_size = 0;
+	return 0;
+}
+
+static void
+crawl_share_lock_(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	CRAWLSHARE *share;
+
+	(void) handle;
+	(void) access;
+
+	share = (CRAWLSHARE *) userptr;
+	pthread_mutex_lock(&(share->locks[data]));
+}
+
+static void
+crawl_share_unlock_(CURL *handle, curl_lock_data data, void *userptr)
+{
+	CRAWLSHARE *share;
+
+	(void) handle;
+
+	share = (CRAWLSHARE *) userptr;
+	pthread_mutex_unlock(&(share->locks[data]));
+}
@@ -0,0 +1,635 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_libcrawl.h"
+
+/* Encoding and decoding of cache sidecars.
+ *
+ * A sidecar is either a JSON dictionary (the original format), or a
+ * compact binary encoding, which begins with SIDECAR_MAGIC (a JSON
+ * document can never begin with a NUL byte) followed by a version byte,
+ * and then a sequence of fields, each of which is:
+ *
+ *   tag     (1 byte)
+ *   length  (32-bit, little-endian)
+ *   value   (length bytes)
+ *
+ * Integer fields are 64-bit little-endian; string fields are not
+ * NUL-terminated. Fields with unrecognised tags are skipped, so that new
+ * fields can be added without changing the version.
+ *
+ * The headers field is a string table, whose entries are:
+ *
+ *   name length  (16-bit, little-endian)
+ *   name
+ *   value length (32-bit, little-endian)
+ *   value
+ *
+ * A header with multiple values has one entry per value, in order; the
+ * status line is stored with the name ":". When a binary sidecar is read,
+ * the string table is retained as-is and only converted into a JSON
+ * dictionary if something asks for the headers.
+ */
+
+#define SIDECAR_MAGIC                  "\0ANS"
+#define SIDECAR_MAGIC_LEN              4
+#define SIDECAR_VERSION                1
+#define SIDECAR_HEADER_LEN             (SIDECAR_MAGIC_LEN + 1)
+#define SIDECAR_FIELD_LEN              5
+
+#define SIDECAR_UPDATED                1
+#define SIDECAR_STATUS                 2
+#define SIDECAR_SIZE                   3
+#define SIDECAR_TYPE                   4
+#define SIDECAR_LOCATION               5
+#define SIDECAR_CONTENT_LOCATION       6
+#define SIDECAR_REDIRECT               7
+#define SIDECAR_ETAG                   8
+#define SIDECAR_LAST_MODIFIED          9
+#define SIDECAR_HEADERS                10
+#define SIDECAR_DIGEST                 11
+
+struct sidecar_buf_struct
+{
+	CRAWL *crawl;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static int crawl_sidecar_put_(struct sidecar_buf_struct *buf, const void *data, size_t len);
+static int crawl_sidecar_field_(struct sidecar_buf_struct *buf, int tag, const void *data, size_t len);
+static int crawl_sidecar_int_(struct sidecar_buf_struct *buf, int tag, int64_t value);
+static int crawl_sidecar_str_(struct sidecar_buf_struct *buf, int tag, const char *str);
+static int crawl_sidecar_headers_(struct sidecar_buf_struct *buf, const struct crawl_obj_meta_struct *meta);
+static int crawl_sidecar_entry_(struct sidecar_buf_struct *buf, const char *name, const char *value);
+static int crawl_sidecar_decode_binary_(CRAWL *crawl, struct crawl_obj_meta_struct *meta, const unsigned char *buf, size_t len);
+static char *crawl_sidecar_strndup_(CRAWL *crawl, const unsigned char *s, size_t len);
+static void crawl_sidecar_le_(unsigned char *dest, uint64_t value, size_t nbytes);
+static uint64_t crawl_sidecar_get_(const unsigned char *src, size_t nbytes);
+
+/* Determine the sidecar format to write from the 'sidecar' option in the
+ * query string of a cache URI
+ */
+int
+crawl_sidecar_option_(const char *query)
+{
+	const char *s, *t, *v;
+
+	if(!query)
+	{
+		return CRAWL_SIDECAR_JSON;
+	}
+	for(s = query; *s; s = (*t ? t + 1 : t))
+	{
+		t = strchr(s, '&');
+		if(!t)
+		{
+			t = s + strlen(s);
+		}
+		v = memchr(s, '=', t - s);
+		if(!v || v - s != 7 || strncmp(s, "sidecar", 7))
+		{
+			continue;
+		}
+		v++;
+		if(t - v == 6 && !strncmp(v, "binary", 6))
+		{
+			return CRAWL_SIDECAR_BINARY;
+		}
+		return CRAWL_SIDECAR_JSON;
+	}
+	return CRAWL_SIDECAR_JSON;
+}
+
+/* Return nonzero if buf contains a binary sidecar */
+int
+crawl_sidecar_binary_(const char *buf, size_t len)
+{
+	return (len >= SIDECAR_HEADER_LEN && !memcmp(buf, SIDECAR_MAGIC, SIDECAR_MAGIC_LEN));
+}
+
+/* Encode metadata as a binary sidecar; the caller must crawl_free() the
+ * result
+ */
+int
+crawl_sidecar_encode_(CRAWL *crawl, const struct crawl_obj_meta_struct *meta, char **out, size_t *outlen)
+{
+	struct sidecar_buf_struct buf;
+	unsigned char version;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.crawl = crawl;
+	version = SIDECAR_VERSION;
+	if(crawl_sidecar_put_(&buf, SIDECAR_MAGIC, SIDECAR_MAGIC_LEN) ||
+	   crawl_sidecar_put_(&buf, &version, 1) ||
+	   crawl_sidecar_int_(&buf, SIDECAR_STATUS, meta->status) ||
+	   crawl_sidecar_int_(&buf, SIDECAR_SIZE, (int64_t) meta->size) ||
+	   crawl_sidecar_int_(&buf, SIDECAR_UPDATED, meta->updated) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_TYPE, meta->type) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_LOCATION, meta->location) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_CONTENT_LOCATION, meta->content_location) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_REDIRECT, meta->redirect) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_ETAG, meta->etag) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_LAST_MODIFIED, meta->last_modified) ||
+	   crawl_sidecar_str_(&buf, SIDECAR_DIGEST, meta->digest) ||
+	   crawl_sidecar_headers_(&buf, meta))
+	{
+		crawl_free(crawl, buf.buf);
+		return -1;
+	}
+	*out = buf.buf;
+	*outlen = buf.len;
+	return 0;
+}
+
+/* Decode a sidecar in either format into a (released) metadata
+ * structure
+ */
+int
+crawl_sidecar_decode_(CRAWL *crawl, struct crawl_obj_meta_struct *meta, const char *buf, size_t len)
+{
+	json_t *dict;
+	int r;
+
+	if(crawl_sidecar_binary_(buf, len))
+	{
+		r = crawl_sidecar_decode_binary_(crawl, meta, (const unsigned char *) buf, len);
+	}
+	else
+	{
+		dict = json_loadb(buf, len, 0, NULL);
+		if(!dict)
+		{
+			return -1;
+		}
+		r = crawl_obj_meta_set_json_(crawl, meta, dict);
+		json_decref(dict);
+	}
+	if(r)
+	{
+		crawl_obj_meta_release_(crawl, meta);
+	}
+	return r;
+}
+
+/* Decode a sidecar in either format into a JSON dictionary */
+json_t *
+crawl_sidecar_json_(CRAWL *crawl, const char *buf, size_t len)
+{
+	struct crawl_obj_meta_struct meta;
+	json_t *dict;
+
+	if(!crawl_sidecar_binary_(buf, len))
+	{
+		return json_loadb(buf, len, 0, NULL);
+	}
+	memset(&meta, 0, sizeof(meta));
+	if(crawl_sidecar_decode_(crawl, &meta, buf, len))
+	{
+		return NULL;
+	}
+	dict = crawl_obj_meta_json_(crawl, &meta);
+	crawl_obj_meta_release_(crawl, &meta);
+	return dict;
+}
+
+/* Convert a sidecar in either format into the requested format; the
+ * caller must crawl_free() the result
+ */
+int
+crawl_sidecar_convert(CRAWL *crawl, const char *buf, size_t len, int format, char **out, size_t *outlen)
+{
+	struct crawl_obj_meta_struct meta;
+	json_t *dict;
+	char *s;
+	int r;
+
+	*out = NULL;
+	*outlen = 0;
+	memset(&meta, 0, sizeof(meta));
+	if(crawl_sidecar_decode_(crawl, &meta, buf, len))
+	{
+		return -1;
+	}
+	if(format == CRAWL_SIDECAR_BINARY)
+	{
+		r = crawl_sidecar_encode_(crawl, &meta, out, outlen);
+		crawl_obj_meta_release_(crawl, &meta);
+		return r;
+	}
+	dict = crawl_obj_meta_json_(crawl, &meta);
+	crawl_obj_meta_release_(crawl, &meta);
+	if(!dict)
+	{
+		return -1;
+	}
+	s = json_dumps(dict, JSON_PRESERVE_ORDER);
+	json_decref(dict);
+	if(!s)
+	{
+		return -1;
+	}
+	*out = crawl_strdup(crawl, s);
+	free(s);
+	if(!*out)
+	{
+		return -1;
+	}
+	*outlen = strlen(*out);
+	return 0;
+}
+
+/* Obtain the next entry from a binary headers string table, advancing *p
+ * past it; returns 1 if an entry was obtained, 0 at the end of the table,
+ * or -1 if the table is malformed.
+ */
+int
+crawl_sidecar_header_next_(const char **p, const char *end, const char **name, size_t *namelen, const char **value, size_t *valuelen)
+{
+	const unsigned char *s;
+	size_t avail;
+
+	if(*p >= end)
+	{
+		return 0;
+	}
+	s = (const unsigned char *) *p;
+	avail = end - *p;
+	if(avail < 2)
+	{
+		return -1;
+	}
+	*namelen = (size_t) crawl_sidecar_get_(s, 2);
+	if(avail - 2 < *namelen + 4)
+	{
+		return -1;
+	}
+	*name = (const char *) s + 2;
+	s += 2 + *namelen;
+	avail -= 2 + *namelen;
+	*valuelen = (size_t) crawl_sidecar_get_(s, 4);
+	if(avail - 4 < *valuelen)
+	{
+		return -1;
+	}
+	*value = (const char *) s + 4;
+	*p = *value + *valuelen;
+	return 1;
+}
+
+/* Return the headers of a metadata structure as a JSON dictionary,
+ * converting them from the binary string table first if needed; the
+ * result is owned by the metadata structure
+ */
+json_t *
+crawl_obj_meta_headers_(CRAWL *crawl, struct crawl_obj_meta_struct *meta)
+{
+	json_t *headers, *values, *str;
+	const char *p, *name, *value;
+	size_t namelen, valuelen;
+	char *key, *v;
+	int r;
+
+	if(meta->headers || !meta->rawheaders)
+	{
+		return meta->headers;
+	}
+	headers = json_object();
+	if(!headers)
+	{
+		return NULL;
+	}
+	p = meta->rawheaders;
+	while((r = crawl_sidecar_header_next_(&p, meta->rawheaders + meta->rawheaderslen, &name, &namelen, &value, &valuelen)) > 0)
+	{
+		key = crawl_sidecar_strndup_(crawl, (const unsigned char *) name, namelen);
+		v = crawl_sidecar_strndup_(crawl, (const unsigned char *) value, valuelen);
+		str = (v ? json_string(v) : NULL);
+		crawl_free(crawl, v);
+		if(!key || !str)
+		{
+			crawl_free(crawl, key);
+			if(str)
+			{
+				json_decref(str);
+			}
+			json_decref(headers);
+			return NULL;
+		}
+		if(!strcmp(key, ":"))
+		{
+			json_object_set_new(headers, key, str);
+			crawl_free(crawl, key);
+			continue;
+		}
+		values = json_object_get(headers, key);
+		if(!values)
+		{
+			values = json_array();
+			json_object_set_new(headers, key, values);
+		}
+		json_array_append_new(values, str);
+		crawl_free(crawl, key);
+	}
+	if(r < 0)
+	{
+		json_decref(headers);
+		return NULL;
+	}
+	crawl_free(crawl, meta->rawheaders);
+	meta->rawheaders = NULL;
+	meta->rawheaderslen = 0;
+	meta->headers = headers;
+	return headers;
+}
+
+static int
+crawl_sidecar_decode_binary_(CRAWL *crawl, struct crawl_obj_meta_struct *meta, const unsigned char *buf, size_t len)
+{
+	const unsigned char *p, *end;
+	char **dest;
+	size_t flen;
+	int tag;
+
+	if(buf[SIDECAR_MAGIC_LEN] != SIDECAR_VERSION)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	end = buf + len;
+	for(p = buf + SIDECAR_HEADER_LEN; p < end; p += flen)
+	{
+		if((size_t) (end - p) < SIDECAR_FIELD_LEN)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		tag = p[0];
+		flen = (size_t) crawl_sidecar_get_(p + 1, 4);
+		p += SIDECAR_FIELD_LEN;
+		if((size_t) (end - p) < flen)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		dest = NULL;
+		switch(tag)
+		{
+		case SIDECAR_UPDATED:
+			meta->updated = (time_t) (int64_t) crawl_sidecar_get_(p, (flen < 8 ? flen : 8));
+			break;
+		case SIDECAR_STATUS:
+			meta->status = (int) (int64_t) crawl_sidecar_get_(p, (flen < 8 ? flen : 8));
+			break;
+		case SIDECAR_SIZE:
+			meta->size = crawl_sidecar_get_(p, (flen < 8 ? flen : 8));
+			break;
+		case SIDECAR_TYPE:
+			dest = &(meta->type);
+			break;
+		case SIDECAR_LOCATION:
+			dest = &(meta->location);
+			break;
+		case SIDECAR_CONTENT_LOCATION:
+			dest = &(meta->content_location);
+			break;
+		case SIDECAR_REDIRECT:
+			dest = &(meta->redirect);
+			break;
+		case SIDECAR_ETAG:
+			dest = &(meta->etag);
+			break;
+		case SIDECAR_LAST_MODIFIED:
+			dest = &(meta->last_modified);
+			break;
+		case SIDECAR_DIGEST:
+			dest = &(meta->digest);
+			break;
+		case SIDECAR_HEADERS:
+			if(meta->rawheaders || meta->headers)
+			{
+				break;
+			}
+			meta->rawheaders = (char *) crawl_alloc(crawl, flen ? flen : 1);
+			if(!meta->rawheaders)
+			{
+				return -1;
+			}
+			memcpy(meta->rawheaders, p, flen);
+			meta->rawheaderslen = flen;
+			break;
+		}
+		if(dest && !*dest)
+		{
+			*dest = crawl_sidecar_strndup_(crawl, p, flen);
+			if(!*dest)
+			{
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int
+crawl_sidecar_put_(struct sidecar_buf_struct *buf, const void *data, size_t len)
+{
+	char *p;
+	size_t size;
+
+	if(buf->len + len > buf->size)
+	{
+		for(size = (buf->size ? buf->size : 512); size < buf->len + len; size *= 2);
+		p = (char *) crawl_realloc(buf->crawl, buf->buf, size);
+		if(!p)
+		{
+			return -1;
+		}
+		buf->buf = p;
+		buf->size = size;
+	}
+	memcpy(&(buf->buf[buf->len]), data, len);
+	buf->len += len;
+	return 0;
+}
+
+static int
+crawl_sidecar_field_(struct sidecar_buf_struct *buf, int tag, const void *data, size_t len)
+{
+	unsigned char hdr[SIDECAR_FIELD_LEN];
+
+	if(len > UINT32_MAX)
+	{
+		errno = E2BIG;
+		return -1;
+	}
+	hdr[0] = (unsigned char) tag;
+	crawl_sidecar_le_(&(hdr[1]), len, 4);
+	if(crawl_sidecar_put_(buf, hdr, sizeof(hdr)))
+	{
+		return -1;
+	}
+	return crawl_sidecar_put_(buf, data, len);
+}
+
+static int
+crawl_sidecar_int_(struct sidecar_buf_struct *buf, int tag, int64_t value)
+{
+	unsigned char v[8];
+
+	crawl_sidecar_le_(v, (uint64_t) value, 8);
+	return crawl_sidecar_field_(buf, tag, v, sizeof(v));
+}
+
+static int
+crawl_sidecar_str_(struct sidecar_buf_struct *buf, int tag, const char *str)
+{
+	if(!str)
+	{
+		return 0;
+	}
+	return crawl_sidecar_field_(buf, tag, str, strlen(str));
+}
+
+/* Write the headers field, either by copying the string table read from
+ * a binary sidecar, or by building one from the JSON dictionary
+ */
+static int
+crawl_sidecar_headers_(struct sidecar_buf_struct *buf, const struct crawl_obj_meta_struct *meta)
+{
+	unsigned char hdr[SIDECAR_FIELD_LEN];
+	const char *name, *s;
+	json_t *values;
+	size_t start, c;
+
+	if(meta->rawheaders)
+	{
+		return crawl_sidecar_field_(buf, SIDECAR_HEADERS, meta->rawheaders, meta->rawheaderslen);
+	}
+	if(!meta->headers)
+	{
+		return 0;
+	}
+	/* The length is filled in once the table has been written */
+	memset(hdr, 0, sizeof(hdr));
+	hdr[0] = SIDECAR_HEADERS;
+	start = buf->len;
+	if(crawl_sidecar_put_(buf, hdr, sizeof(hdr)))
+	{
+		return -1;
+	}
+	s = json_string_value(json_object_get(meta->headers, ":"));
+	if(s && crawl_sidecar_entry_(buf, ":", s))
+	{
+		return -1;
+	}
+	json_object_foreach(meta->headers, name, values)
+	{
+		if(!json_is_array(values))
+		{
+			continue;
+		}
+		for(c = 0; c < json_array_size(values); c++)
+		{
+			s = json_string_value(json_array_get(values, c));
+			if(s && crawl_sidecar_entry_(buf, name, s))
+			{
+				return -1;
+			}
+		}
+	}
+	if(buf->len - start - SIDECAR_FIELD_LEN > UINT32_MAX)
+	{
+		errno = E2BIG;
+		return -1;
+	}
+	crawl_sidecar_le_((unsigned char *) &(buf->buf[start + 1]), buf->len - start - SIDECAR_FIELD_LEN, 4);
+	return 0;
+}
+
+static int
+crawl_sidecar_entry_(struct sidecar_buf_struct *buf, const char *name, const char *value)
+{
+	unsigned char len[4];
+	size_t namelen, valuelen;
+
+	namelen = strlen(name);
+	valuelen = strlen(value);
+	if(namelen > UINT16_MAX || valuelen > UINT32_MAX)
+	{
+		errno = E2BIG;
+		return -1;
+	}
+	crawl_sidecar_le_(len, namelen, 2);
+	if(crawl_sidecar_put_(buf, len, 2) ||
+	   crawl_sidecar_put_(buf, name, namelen))
+	{
+		return -1;
+	}
+	crawl_sidecar_le_(len, valuelen, 4);
+	if(crawl_sidecar_put_(buf, len, 4) ||
+	   crawl_sidecar_put_(buf, value, valuelen))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+static char *
+crawl_sidecar_strndup_(CRAWL *crawl, const unsigned char *s, size_t len)
+{
+	char *p;
+
+	p = (char *) crawl_alloc(crawl, len + 1);
+	if(!p)
+	{
+		return NULL;
+	}
+	memcpy(p, s, len);
+	p[len] = 0;
+	return p;
+}
+
+static void
+crawl_sidecar_le_(unsigned char *dest, uint64_t value, size_t nbytes)
+{
+	size_t c;
+
+	for(c = 0; c < nbytes; c++)
+	{
+		dest[c] = (unsigned char) (value >> (c * 8));
+	}
+}
+
+static uint64_t
+crawl_sidecar_get_(const unsigned char *src, size_t nbytes)
+{
+	uint64_t value;
+	size_t c;
+
+	value = 0;
+	for(c = 0; c < nbytes; c++)
+	{
+		value |= ((uint64_t) src[c]) << (c * 8);
+	}
+	return value;
+}
@@ -0,0 +1,359 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/stat.h>
+
+#include "libcrawl.h"
+
+/* Convert the sidecars in a disk cache tree to a different format, using
+ * several threads. Each sidecar is rewritten via a temporary file which is
+ * renamed over the original, so a tree can be converted while readers are
+ * using it, but not while anything else is writing to it.
+ */
+
+#define SIDECAR_SUFFIX                 ".json"
+#define SIDECAR_DEFAULT_JOBS           4
+#define SIDECAR_MAX_JOBS               256
+
+static const char *progname;
+static int format = CRAWL_SIDECAR_BINARY;
+static char **paths;
+static size_t npaths, pathsize;
+static size_t next, converted, skipped, failed;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(void);
+static int collect(const char *path, const struct stat *sbuf, int type, struct FTW *ftw);
+static void *worker(void *arg);
+static int convert(CRAWL *crawl, const char *path);
+static char *readfile(const char *path, size_t *len);
+static int writefile(const char *path, const char *buf, size_t len);
+static void logger(int level, const char *fmt, va_list ap);
+
+int
+main(int argc, char **argv)
+{
+	pthread_t threads[SIDECAR_MAX_JOBS];
+	int c, jobs, n;
+
+	if((progname = strrchr(argv[0], '/')))
+	{
+		progname++;
+	}
+	else
+	{
+		progname = argv[0];
+	}
+	jobs = SIDECAR_DEFAULT_JOBS;
+	while((c = getopt(argc, argv, "hj:f:")) != -1)
+	{
+		switch(c)
+		{
+		case 'h':
+			usage();
+			exit(EXIT_SUCCESS);
+		case 'j':
+			jobs = atoi(optarg);
+			if(jobs < 1 || jobs > SIDECAR_MAX_JOBS)
+			{
+				fprintf(stderr, "%s: the number of jobs must be between 1 and %d\n", progname, SIDECAR_MAX_JOBS);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			if(!strcmp(optarg, "binary"))
+			{
+				format = CRAWL_SIDECAR_BINARY;
+			}
+			else if(!strcmp(optarg, "json"))
+			{
+				format = CRAWL_SIDECAR_JSON;
+			}
+			else
+			{
+				fprintf(stderr, "%s: unsupported sidecar format '%s'\n", progname, optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(argc - optind != 1)
+	{
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if(nftw(argv[optind], collect, 32, FTW_PHYS))
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, argv[optind], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if((size_t) jobs > npaths)
+	{
+		jobs = (npaths ? (int) npaths : 1);
+	}
+	for(n = 0; n < jobs; n++)
+	{
+		if((c = pthread_create(&(threads[n]), NULL, worker, NULL)))
+		{
+			fprintf(stderr, "%s: failed to create thread: %s\n", progname, strerror(c));
+			break;
+		}
+	}
+	if(!n)
+	{
+		exit(EXIT_FAILURE);
+	}
+	for(c = 0; c < n; c++)
+	{
+		pthread_join(threads[c], NULL);
+	}
+	printf("%lu converted, %lu already in the requested format, %lu failed\n", (unsigned long) converted, (unsigned long) skipped, (unsigned long) failed);
+	return (failed ? 1 : 0);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: %s [-j JOBS] [-f binary|json] DIRECTORY\n"
+			"\n"
+			"Converts the sidecars in a disk cache to the specified format (binary\n"
+			"by default), using JOBS threads (default %d).\n",
+			progname, SIDECAR_DEFAULT_JOBS);
+}
+
+/* Record the path of each sidecar in the tree */
+static int
+collect(const char *path, const struct stat *sbuf, int type, struct FTW *ftw)
+{
+	size_t len;
+	char **p;
+
+	(void) sbuf;
+	(void) ftw;
+
+	if(type != FTW_F)
+	{
+		return 0;
+	}
+	len = strlen(path);
+	if(len <= strlen(SIDECAR_SUFFIX) || strcmp(path + len - strlen(SIDECAR_SUFFIX), SIDECAR_SUFFIX))
+	{
+		return 0;
+	}
+	if(npaths + 1 > pathsize)
+	{
+		p = (char **) crawl_realloc(NULL, paths, sizeof(char *) * (pathsize + 4096));
+		if(!p)
+		{
+			return -1;
+		}
+		paths = p;
+		pathsize += 4096;
+	}
+	paths[npaths] = crawl_strdup(NULL, path);
+	if(!paths[npaths])
+	{
+		return -1;
+	}
+	npaths++;
+	return 0;
+}
+
+static void *
+worker(void *arg)
+{
+	CRAWL *crawl;
+	const char *path;
+	int r;
+
+	(void) arg;
+
+	crawl = crawl_create();
+	if(!crawl)
+	{
+		return NULL;
+	}
+	crawl_set_logger(crawl, logger);
+	for(;;)
+	{
+		pthread_mutex_lock(&lock);
+		path = (next < npaths ? paths[next++] : NULL);
+		pthread_mutex_unlock(&lock);
+		if(!path)
+		{
+			break;
+		}
+		r = convert(crawl, path);
+		pthread_mutex_lock(&lock);
+		if(r < 0)
+		{
+			failed++;
+		}
+		else if(r)
+		{
+			converted++;
+		}
+		else
+		{
+			skipped++;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	crawl_destroy(crawl);
+	return NULL;
+}
+
+/* Convert a single sidecar; returns 1 if it was converted, 0 if it was
+ * already in the requested format, or -1 on error
+ */
+static int
+convert(CRAWL *crawl, const char *path)
+{
+	char *buf, *out;
+	size_t len, outlen;
+	int binary, r;
+
+	buf = readfile(path, &len);
+	if(!buf)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+		return -1;
+	}
+	binary = (len && !buf[0]);
+	if(binary == (format == CRAWL_SIDECAR_BINARY))
+	{
+		crawl_free(crawl, buf);
+		return 0;
+	}
+	if(crawl_sidecar_convert(crawl, buf, len, format, &out, &outlen))
+	{
+		fprintf(stderr, "%s: %s: failed to decode sidecar\n", progname, path);
+		crawl_free(crawl, buf);
+		return -1;
+	}
+	crawl_free(crawl, buf);
+	r = writefile(path, out, outlen);
+	crawl_free(crawl, out);
+	if(r)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+		return -1;
+	}
+	return 1;
+}
+
+static char *
+readfile(const char *path, size_t *len)
+{
+	FILE *f;
+	struct stat sbuf;
+	char *buf;
+
+	f = fopen(path, "rb");
+	if(!f)
+	{
+		return NULL;
+	}
+	if(fstat(fileno(f), &sbuf))
+	{
+		fclose(f);
+		return NULL;
+	}
+	buf = (char *) crawl_alloc(NULL, sbuf.st_size + 1);
+	if(!buf)
+	{
+		fclose(f);
+		return NULL;
+	}
+	*len = fread(buf, 1, sbuf.st_size, f);
+	if(ferror(f))
+	{
+		crawl_free(NULL, buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+/* Replace the contents of a file via a temporary file */
+static int
+writefile(const char *path, const char *buf, size_t len)
+{
+	FILE *f;
+	char *tmp;
+	int r;
+
+	tmp = (char *) crawl_alloc(NULL, strlen(path) + 5);
+	if(!tmp)
+	{
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+	f = fopen(tmp, "wb");
+	if(!f)
+	{
+		crawl_free(NULL, tmp);
+		return -1;
+	}
+	r = 0;
+	if(fwrite(buf, 1, len, f) != len)
+	{
+		r = -1;
+	}
+	if(fclose(f))
+	{
+		r = -1;
+	}
+	if(!r && rename(tmp, path))
+	{
+		r = -1;
+	}
+	if(r)
+	{
+		unlink(tmp);
+	}
+	crawl_free(NULL, tmp);
+	return r;
+}
+
+static void
+logger(int level, const char *fmt, va_list ap)
+{
+	if(level <= LOG_NOTICE)
+	{
+		fprintf(stderr, "%s: ", progname);
+		vfprintf(stderr, fmt, ap);
+	}
+}
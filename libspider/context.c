@@ -190,6 +190,10 @@ spider_release_(SPIDER *me)
 	{
 		return r;
 	}
+	if(me->queue)
+	{
+		spider_processor_flush_(me, 1);
+	}
 	if(me->processor)
 	{
 		me->processor->api->release(me->processor);
@@ -662,6 +666,8 @@ spider_perform_(SPIDER *me)
 	if(r >= 0)
 	{
 		r = crawl_perform(me->crawl);
+		/* Don't leave any queue updates deferred once the cycle has ended */
+		spider_processor_flush_(me, 1);
 	}
 	return r;
 }
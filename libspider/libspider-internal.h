@@ -39,6 +39,7 @@ int queue_init_context(SPIDER *data);
 
 int queue_updated_uri(CRAWL *crawl, URI *uri, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
 int queue_updated_uristr(CRAWL *crawl, const char *uristr, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+int queue_updated_obj(CRAWL *crawl, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
 int queue_unchanged_uri(CRAWL *crawl, URI *uri, int error);
 int queue_unchanged_uristr(CRAWL *crawl, const char *uristr, int error);
 
@@ -144,6 +144,10 @@ struct queue_api_struct
 	int (*set_caches)(QUEUE *me, int count);
 	int (*set_crawler)(QUEUE *me, int id);
 	int (*set_cache)(QUEUE *me, int id);
+	/* Optional: mark a fetched object as updated, making use of the
+	 * information (such as the cache key) that it already holds
+	 */
+	int (*updated_obj)(QUEUE *me, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
 };
 
 #ifndef PROCESSOR_STRUCT_DEFINED
@@ -159,6 +163,11 @@ struct processor_api_struct
 	unsigned long (*addref)(PROCESSOR *me);
 	unsigned long (*release)(PROCESSOR *me);
 	CRAWLSTATE (*process)(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type);
+	/* Optional: invoked with each chunk of a payload as it is received,
+	 * and with a NULL buffer once it has been received in full, prior
+	 * to process() being invoked (see crawl_payload_cb)
+	 */
+	int (*payload)(PROCESSOR *me, CRAWLOBJ *obj, const char *buf, size_t len);
 };
 
 #ifndef SPIDER_POLICY_STRUCT_DEFINED
@@ -237,6 +246,8 @@ struct spider_policy_api_struct
 # define MSG_N_CRAWL_TERMINATING        "%%ANANSI-N-2034: crawl thread terminating"
 # define MSG_C_CRAWL_CLUSTERSTATE       "%%ANANSI-C-2035: failed to obtain current cluster state"
 # define MSG_C_CRAWL_NOTATTACHED        "%%ANANSI-C-2036: cannot perform a crawl pass when not attached to a thread"
+# define MSG_N_CRAWL_REVALIDATION       "%%ANANSI-N-2037: crawl thread revalidation statistics"
+# define MSG_E_CRAWL_CACHESYNC          "%%ANANSI-E-2038: failed to store object in the cache"
 
 /* RDBMS queue */
 # define MSG_C_DB_CONNECT               "%%ANANSI-C-5000: failed to connect to database"
@@ -264,6 +275,7 @@ SPIDERPOLICY *spider_policy_create_name(SPIDER *spider, const char *name);
 
 # ifndef SPIDER_DEPRECATED_APIS
 int queue_add_uristr(CRAWL *crawler, const char *str);
+int queue_add_uristrs(CRAWL *crawler, const char *const *strs, size_t count);
 int queue_add_uri(CRAWL *crawler, URI *uri);
 # endif
 
@@ -39,6 +39,12 @@
  * spider.
  */
 # define SPIDER_MAX_POLICIES           8
+/* The maximum number of objects whose queue updates may be deferred until
+ * they have been stored, and the maximum time (in seconds) for which any
+ * of them is deferred
+ */
+# define SPIDER_MAX_PENDING            32
+# define SPIDER_PENDING_INTERVAL       5
 
 # include "libcrawl.h"
 # include "libspider-internal.h"
@@ -51,6 +57,15 @@
  * this is the approach employed by queues, processors and policy handlers,
  * and so spiders have been structured consistently.
  */
+/* A queue update which has been deferred until the object is stored */
+struct spider_pending_struct
+{
+	CRAWLOBJ *obj;
+	int unchanged;
+	time_t ttl;
+	CRAWLSTATE state;
+};
+
 struct spider_struct
 {
 	struct spider_api_struct *api;
@@ -74,16 +89,24 @@ struct spider_struct
 	SPIDERCALLBACKS cb;
 	SPIDERPOLICY *policies[SPIDER_MAX_POLICIES];
 	size_t npolicies;
+	/* Objects which have been processed, but whose queue updates must wait
+	 * until the cache has stored them; see spider_processor_flush_()
+	 */
+	struct spider_pending_struct pending[SPIDER_MAX_PENDING];
+	size_t npending;
+	time_t pending_since;
 };
 
 /* Processors */
 int spider_processor_attach_(SPIDER *spider, PROCESSOR *processor);
 PROCESSOR *spider_processor_rdf_create_(SPIDER *spider);
 PROCESSOR *spider_processor_lod_create_(SPIDER *spider);
+int spider_processor_flush_(SPIDER *spider, int force);
 
 /* Queue handling */
 int spider_queue_attach_(SPIDER *spider, QUEUE *queue);
 QUEUE *spider_queue_db_create_(SPIDER *ctx, URI *uri);
+QUEUE *spider_queue_mem_create_(SPIDER *ctx, URI *uri);
 
 /* Policies */
 int spider_policy_attach_(SPIDER *spider, SPIDERPOLICY *policy);
@@ -32,6 +32,8 @@
 static int processor_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata);
 static int processor_unchanged_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata);
 static int processor_failed_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata, CRAWLSTATE state);
+static int processor_payload_handler_(CRAWL *crawl, CRAWLOBJ *obj, const char *buf, size_t len, void *userdata);
+static int processor_defer_(SPIDER *me, CRAWLOBJ *obj, int unchanged, time_t ttl, CRAWLSTATE state);
 
 static PROCESSOR *(*constructor)(CRAWL *crawler);
 
@@ -77,6 +79,7 @@ spider_processor_attach_(SPIDER *spider, PROCESSOR *processor)
 	crawl_set_updated(spider->crawl, processor_handler_);
 	crawl_set_unchanged(spider->crawl, processor_unchanged_handler_);
 	crawl_set_failed(spider->crawl, processor_failed_handler_);	
+	crawl_set_payload(spider->crawl, (processor && processor->api->payload) ? processor_payload_handler_ : NULL);
 	return 0;
 }
 
@@ -159,7 +162,8 @@ processor_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata)
 	SPIDER *me;
 	PROCESSOR *processor;
 	const char *content_type, *uri, *location;
-	int r, status, ttl;
+	int r, status;
+	time_t ttl;
 	CRAWLSTATE state;
 
 	(void) prevtime;
@@ -212,31 +216,30 @@ processor_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata)
 	}		
 	if(state == COS_ACCEPTED)
 	{
-		me->api->log(me, LOG_INFO, MSG_I_CRAWL_ACCEPTED " <%s>\n", uri);
 		ttl = 86400;
 	}
 	else
 	{
 		ttl = 604800;
 	}
-	queue_updated_uristr(crawl, uri, crawl_obj_updated(obj), crawl_obj_updated(obj), crawl_obj_status(obj), ttl, state);
+	/* Don't update the queue until the object has been stored */
+	processor_defer_(me, obj, 0, ttl, state);
 	return r;
 }
 
 static int
 processor_unchanged_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata)
 {
-	const char *uri;
 	SPIDER *me;
 
-	(void) obj;
+	(void) crawl;
 	(void) prevtime;
 
 	me = (SPIDER *) userdata;
-	uri = crawl_obj_uristr(obj);
 
 	me->api->log(me, LOG_DEBUG, "processor_unchanged_handler: object has not been updated\n");
-	return queue_unchanged_uristr(crawl, uri, 0);
+	/* A refreshed sidecar may still be being stored */
+	return processor_defer_(me, obj, 1, 86400, COS_ACCEPTED);
 }
 
 /* processor_failed_handler_() is installed as the CRAWL object's 'failed'
@@ -247,8 +250,6 @@ processor_unchanged_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void
 static int
 processor_failed_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *userdata, CRAWLSTATE state)
 {
-	const char *uri;
-	
 	(void) prevtime;
 	(void) userdata;
 
@@ -256,6 +257,122 @@ processor_failed_handler_(CRAWL *crawl, CRAWLOBJ *obj, time_t prevtime, void *us
 	{
 		state = COS_FAILED;
 	}
-	uri = crawl_obj_uristr(obj);
-	return queue_updated_uristr(crawl, uri, crawl_obj_updated(obj), crawl_obj_updated(obj), crawl_obj_status(obj), 86400, state);
+	return queue_updated_obj(crawl, obj, crawl_obj_updated(obj), crawl_obj_updated(obj), crawl_obj_status(obj), 86400, state);
+}
+
+/* processor_payload_handler_() is installed as the CRAWL object's 'payload'
+ * handler if the processor is able to process payloads incrementally, and
+ * passes each chunk on to the processor as it is received.
+ */
+static int
+processor_payload_handler_(CRAWL *crawl, CRAWLOBJ *obj, const char *buf, size_t len, void *userdata)
+{
+	SPIDER *me;
+
+	(void) crawl;
+
+	me = (SPIDER *) userdata;
+	if(!me->processor || !me->processor->api->payload)
+	{
+		return -1;
+	}
+	return me->processor->api->payload(me->processor, obj, buf, len);
+}
+
+/* Defer the queue update for an object which has been processed until the
+ * cache has stored it: waiting for each object in turn would stall the
+ * crawl for as long as each upload takes, and so the objects are retained
+ * and the cache is synchronised once for a batch of them.
+ */
+static int
+processor_defer_(SPIDER *me, CRAWLOBJ *obj, int unchanged, time_t ttl, CRAWLSTATE state)
+{
+	struct spider_pending_struct *p;
+
+	if(me->npending >= SPIDER_MAX_PENDING)
+	{
+		spider_processor_flush_(me, 1);
+	}
+	/* Processing has finished, so nothing beyond what's needed to update the
+	 * queue has to be kept
+	 */
+	crawl_obj_unmap(obj);
+	crawl_obj_set_private(obj, NULL, NULL);
+	if(!me->npending)
+	{
+		me->pending_since = time(NULL);
+	}
+	p = &(me->pending[me->npending]);
+	p->obj = crawl_obj_retain(obj);
+	p->unchanged = unchanged;
+	p->ttl = ttl;
+	p->state = state;
+	me->npending++;
+	return spider_processor_flush_(me, 0);
+}
+
+/* INTERNAL: Wait for the cache to store the objects whose queue updates
+ * have been deferred, and then update the queue; unless force is set,
+ * nothing happens until the batch is full or its oldest entry has waited
+ * for SPIDER_PENDING_INTERVAL seconds. If the cache couldn't store them,
+ * all of the objects in the batch are marked as failed.
+ *
+ * Returns -1 if any of the queue updates failed, 0 otherwise.
+ */
+int
+spider_processor_flush_(SPIDER *spider, int force)
+{
+	struct spider_pending_struct *p;
+	CRAWL *crawl;
+	const char *uri;
+	size_t c;
+	int r, failed;
+
+	if(!spider->npending)
+	{
+		return 0;
+	}
+	if(!force && spider->npending < SPIDER_MAX_PENDING &&
+	   time(NULL) - spider->pending_since < SPIDER_PENDING_INTERVAL)
+	{
+		return 0;
+	}
+	crawl = spider->crawl;
+	r = 0;
+	failed = crawl_cache_sync(crawl) ? 1 : 0;
+	for(c = 0; c < spider->npending; c++)
+	{
+		p = &(spider->pending[c]);
+		uri = crawl_obj_uristr(p->obj);
+		if(failed)
+		{
+			spider->api->log(spider, LOG_ERR, MSG_E_CRAWL_CACHESYNC " <%s>\n", uri);
+			if(queue_updated_obj(crawl, p->obj, crawl_obj_updated(p->obj), crawl_obj_updated(p->obj), crawl_obj_status(p->obj), (p->unchanged ? 86400 : 604800), COS_FAILED) < 0)
+			{
+				r = -1;
+			}
+		}
+		else if(p->unchanged)
+		{
+			if(queue_unchanged_uristr(crawl, uri, 0) < 0)
+			{
+				r = -1;
+			}
+		}
+		else
+		{
+			if(p->state == COS_ACCEPTED)
+			{
+				spider->api->log(spider, LOG_INFO, MSG_I_CRAWL_ACCEPTED " <%s>\n", uri);
+			}
+			if(queue_updated_obj(crawl, p->obj, crawl_obj_updated(p->obj), crawl_obj_updated(p->obj), crawl_obj_status(p->obj), p->ttl, p->state) < 0)
+			{
+				r = -1;
+			}
+		}
+		crawl_obj_destroy(p->obj);
+		p->obj = NULL;
+	}
+	spider->npending = 0;
+	return r;
 }
@@ -0,0 +1,197 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* A set of the distinct URIs discovered while processing a single object.
+ *
+ * The URIs are copied into an arena which is released in one go once the
+ * object has been processed, and are located via an open-addressing hash
+ * table. They're also recorded, in the order they were found, in a
+ * contiguous array suitable for passing to queue_add_uristrs().
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_processors.h"
+
+#define LINKSET_ARENA_BLOCK            65536
+#define LINKSET_TABLE_MIN              256
+
+struct linkset_arena_struct
+{
+	struct linkset_arena_struct *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct linkset_slot_struct
+{
+	uint32_t hash;
+	uint32_t len;
+	const char *uri;
+};
+
+static char *linkset_alloc_(LINKSET *set, size_t len);
+static int linkset_grow_(LINKSET *set);
+static uint32_t linkset_hash_(const char *s, size_t len);
+
+void
+linkset_init(LINKSET *set, CRAWL *crawl)
+{
+	memset(set, 0, sizeof(LINKSET));
+	set->crawl = crawl;
+}
+
+void
+linkset_done(LINKSET *set)
+{
+	struct linkset_arena_struct *p;
+
+	while(set->arena)
+	{
+		p = set->arena;
+		set->arena = p->next;
+		crawl_free(set->crawl, p);
+	}
+	crawl_free(set->crawl, set->table);
+	crawl_free(set->crawl, set->list);
+	memset(set, 0, sizeof(LINKSET));
+}
+
+/* Add a URI of the given length (which need not be NUL-terminated) to the
+ * set; returns 1 if it was added, 0 if it was already present, or -1 on
+ * error
+ */
+int
+linkset_add(LINKSET *set, const char *uri, size_t len)
+{
+	struct linkset_slot_struct *slot;
+	const char **list;
+	uint32_t hash;
+	size_t c, mask;
+	char *p;
+
+	if((set->count + 1) * 4 > set->tablesize * 3)
+	{
+		if(linkset_grow_(set))
+		{
+			return -1;
+		}
+	}
+	hash = linkset_hash_(uri, len);
+	mask = set->tablesize - 1;
+	for(c = hash & mask; set->table[c].uri; c = (c + 1) & mask)
+	{
+		slot = &(set->table[c]);
+		if(slot->hash == hash && slot->len == len && !memcmp(slot->uri, uri, len))
+		{
+			return 0;
+		}
+	}
+	if(set->count + 1 > set->listsize)
+	{
+		list = (const char **) crawl_realloc(set->crawl, set->list, sizeof(const char *) * set->tablesize);
+		if(!list)
+		{
+			return -1;
+		}
+		set->list = list;
+		set->listsize = set->tablesize;
+	}
+	p = linkset_alloc_(set, len + 1);
+	if(!p)
+	{
+		return -1;
+	}
+	memcpy(p, uri, len);
+	p[len] = 0;
+	slot = &(set->table[c]);
+	slot->hash = hash;
+	slot->len = (uint32_t) len;
+	slot->uri = p;
+	set->list[set->count] = p;
+	set->count++;
+	return 1;
+}
+
+static char *
+linkset_alloc_(LINKSET *set, size_t len)
+{
+	struct linkset_arena_struct *p;
+	size_t size;
+
+	if(!set->arena || set->arena->size - set->arena->used < len)
+	{
+		size = (len > LINKSET_ARENA_BLOCK ? len : LINKSET_ARENA_BLOCK);
+		p = (struct linkset_arena_struct *) crawl_alloc(set->crawl, sizeof(struct linkset_arena_struct) + size);
+		if(!p)
+		{
+			return NULL;
+		}
+		p->size = size;
+		p->next = set->arena;
+		set->arena = p;
+	}
+	p = set->arena;
+	p->used += len;
+	return &(p->data[p->used - len]);
+}
+
+/* Double the size of the hash table */
+static int
+linkset_grow_(LINKSET *set)
+{
+	struct linkset_slot_struct *table;
+	size_t c, n, size, mask;
+
+	size = (set->tablesize ? set->tablesize * 2 : LINKSET_TABLE_MIN);
+	table = (struct linkset_slot_struct *) crawl_alloc(set->crawl, sizeof(struct linkset_slot_struct) * size);
+	if(!table)
+	{
+		return -1;
+	}
+	mask = size - 1;
+	for(n = 0; n < set->tablesize; n++)
+	{
+		if(!set->table[n].uri)
+		{
+			continue;
+		}
+		for(c = set->table[n].hash & mask; table[c].uri; c = (c + 1) & mask);
+		table[c] = set->table[n];
+	}
+	crawl_free(set->crawl, set->table);
+	set->table = table;
+	set->tablesize = size;
+	return 0;
+}
+
+/* FNV-1a */
+static uint32_t
+linkset_hash_(const char *s, size_t len)
+{
+	uint32_t h;
+	size_t c;
+
+	for(h = 2166136261U, c = 0; c < len; c++)
+	{
+		h = (h ^ (unsigned char) s[c]) * 16777619U;
+	}
+	return h;
+}
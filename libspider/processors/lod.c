@@ -24,10 +24,14 @@
 #include "p_processors.h"
 
 static int lod_rdf_filter(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_model *model);
-static int lod_check_licenses(PROCESSOR *me, librdf_model *model, const char *subject);
+static int lod_rdf_statement(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_statement *st);
+static int lod_rdf_triple(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *subject, size_t slen, const char *predicate, size_t plen, const char *object, size_t olen);
+static int lod_check_license(PROCESSOR *me, const char *predicate, size_t plen, const char *object, size_t olen);
 static int lod_init_list(PROCESSOR *me, char ***list, const char *section, const char *key);
 static int lod_list_cb(const char *key, const char *value, void *userdata);
-static int lod_valid_license(PROCESSOR *me, const char *uri);
+static int lod_valid_license(PROCESSOR *me, const char *uri, size_t len);
+static int lod_match(const char *str, const char *s, size_t len);
+static const char *lod_node_uri(librdf_node *node, size_t *len);
 
 struct list_data_struct
 {
@@ -48,42 +52,83 @@ spider_processor_lod_create_(SPIDER *spider)
 		return NULL;
 	}
 	rdf_set_filter(p, lod_rdf_filter);
+	rdf_set_statement_handler(p, lod_rdf_statement);
+	rdf_set_triple_handler(p, lod_rdf_triple);
 	lod_init_list(p, &(p->license_whitelist), "lod:licenses", "whitelist");
 	lod_init_list(p, &(p->license_blacklist), "lod:licenses", "blacklist");
 	lod_init_list(p, &(p->license_predicates), "lod:licenses", "predicate");
 	return p;
 }
 
+/* Invoked once the payload has been parsed: the licensing triples will
+ * have been looked for by lod_rdf_triple() as each statement was parsed
+ */
 static int
 lod_rdf_filter(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_model *model)
 {
-	int found;
-	const char *cl;
+	(void) obj;
+	(void) model;
 
 	log_printf(LOG_DEBUG, "LOD: processing <%s>\n", uri);
-	found = 0;
-	if(!found && lod_check_licenses(me, model, uri))
+	if(!me->license_predicates)
+	{
+		log_printf(LOG_DEBUG, "LOD: no licensing predicates configured, will not check licensing\n");
+	}
+	if(!me->filter_state)
+	{
+		log_printf(LOG_INFO, MSG_I_LOD_REJECTED " <%s>: (LOD: no suitable licensing triple)\n", uri);
+		return COS_REJECTED;
+	}
+	log_printf(LOG_DEBUG, "LOD: suitable licensing triple located\n");
+	return COS_ACCEPTED;
+}
+
+/* Convert a librdf statement for lod_rdf_triple() */
+static int
+lod_rdf_statement(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_statement *st)
+{
+	const char *subject, *predicate, *object;
+	size_t slen, plen, olen;
+
+	if(me->filter_state || !me->license_predicates)
+	{
+		return 0;
+	}
+	subject = lod_node_uri(librdf_statement_get_subject(st), &slen);
+	predicate = lod_node_uri(librdf_statement_get_predicate(st), &plen);
+	object = lod_node_uri(librdf_statement_get_object(st), &olen);
+	if(!subject || !predicate)
+	{
+		return 0;
+	}
+	return lod_rdf_triple(me, obj, uri, subject, slen, predicate, plen, object, olen);
+}
+
+/* Check whether a triple is a suitable licensing triple whose subject is
+ * either the request URI or the Content-Location
+ */
+static int
+lod_rdf_triple(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *subject, size_t slen, const char *predicate, size_t plen, const char *object, size_t olen)
+{
+	const char *cl;
+
+	if(me->filter_state || !me->license_predicates || !subject)
 	{
-		found = 1;
+		return 0;
 	}
-	if(!found)
+	if(!lod_match(uri, subject, slen))
 	{
 		cl = crawl_obj_content_location(obj);
-		if(cl && strcmp(cl, uri))
+		if(!cl || !lod_match(cl, subject, slen))
 		{
-			if(lod_check_licenses(me, model, cl))
-			{
-				found = 1;
-			}
+			return 0;
 		}
 	}
-	if(!found)
+	if(lod_check_license(me, predicate, plen, object, olen))
 	{
-		log_printf(LOG_INFO, MSG_I_LOD_REJECTED " <%s>: (LOD: no suitable licensing triple)\n", uri);
-		return COS_REJECTED;
+		me->filter_state = 1;
 	}
-	log_printf(LOG_DEBUG, "LOD: suitable licensing triple located\n");
-	return COS_ACCEPTED;
+	return 0;
 }
 
 static int
@@ -137,68 +182,32 @@ lod_list_cb(const char *key, const char *value, void *userdata)
 }
 
 static int
-lod_check_licenses(PROCESSOR *me, librdf_model *model, const char *subject)
+lod_check_license(PROCESSOR *me, const char *predicate, size_t plen, const char *object, size_t olen)
 {
 	size_t c;
-	librdf_world *world;
-	librdf_stream *stream;
-	librdf_statement *query, *st;
-	librdf_node *pnode, *onode;
-	librdf_uri *puri, *ouri;
-	const char *predicate, *object;
 
-	if(!me->license_predicates)
+	for(c = 0; me->license_predicates[c]; c++)
 	{
-		log_printf(LOG_DEBUG, "LOD: no licensing predicates configured, will not check licensing\n");
-		return 0;
-	}
-	log_printf(LOG_DEBUG, "LOD: examining <%s> for licensing triples\n", subject);
-	world = rdf_world(me);
-	query = librdf_new_statement(world);
-	pnode = librdf_new_node_from_uri_string(world, (const unsigned char *) subject);
-	librdf_statement_set_subject(query, pnode);
-	stream = librdf_model_find_statements(model, query);
-
-	while(!librdf_stream_end(stream))
-	{
-		st = librdf_stream_get_object(stream);
-		pnode = librdf_statement_get_predicate(st);
-		if(librdf_node_is_resource(pnode) &&
-		   (puri = librdf_node_get_uri(pnode)) &&
-		   (predicate = (const char *) librdf_uri_as_string(puri)))
+		if(lod_match(me->license_predicates[c], predicate, plen))
 		{
-			for(c = 0; me->license_predicates[c]; c++)
+			log_printf(LOG_DEBUG, "LOD: found predicate <%.*s>\n", (int) plen, predicate);
+			if(!object)
 			{
-				if(!strcmp(me->license_predicates[c], predicate))
-				{
-					log_printf(LOG_DEBUG, "LOD: found predicate <%s>\n", predicate);
-					onode = librdf_statement_get_object(st);
-					if(librdf_node_is_resource(onode) &&
-					   (ouri = librdf_node_get_uri(onode)) &&
-					   (object = (const char *) librdf_uri_as_string(ouri)))
-					{
-						if(lod_valid_license(me, object))
-						{
-								log_printf(LOG_DEBUG, "LOD: found license <%s>\n", object);
-								librdf_free_stream(stream);
-								librdf_free_statement(query);
-								return 1;
-						}
-						log_printf(LOG_DEBUG, "LOD: license <%s> is not acceptable\n", object);
-					}
-				}
+				continue;
 			}
+			if(lod_valid_license(me, object, olen))
+			{
+				log_printf(LOG_DEBUG, "LOD: found license <%.*s>\n", (int) olen, object);
+				return 1;
+			}
+			log_printf(LOG_DEBUG, "LOD: license <%.*s> is not acceptable\n", (int) olen, object);
 		}
-		librdf_stream_next(stream);
 	}
-
-	librdf_free_stream(stream);
-	librdf_free_statement(query);
 	return 0;
 }
 
 static int
-lod_valid_license(PROCESSOR *me, const char *uri)
+lod_valid_license(PROCESSOR *me, const char *uri, size_t len)
 {
 	size_t c;
 
@@ -206,7 +215,7 @@ lod_valid_license(PROCESSOR *me, const char *uri)
 	{
 		for(c = 0; me->license_blacklist[c]; c++)
 		{
-			if(!strcmp(me->license_blacklist[c], uri))
+			if(lod_match(me->license_blacklist[c], uri, len))
 			{
 				/* License is blacklisted */
 				return 0;
@@ -217,7 +226,7 @@ lod_valid_license(PROCESSOR *me, const char *uri)
 	{
 		for(c = 0; me->license_whitelist[c]; c++)
 		{
-			if(!strcmp(me->license_whitelist[c], uri))
+			if(lod_match(me->license_whitelist[c], uri, len))
 			{
 				/* License is whitelisted */
 				return 1;
@@ -229,3 +238,23 @@ lod_valid_license(PROCESSOR *me, const char *uri)
 	/* License is not blacklisted, and there is no whitelist */
 	return 1;
 }
+
+/* Compare a NUL-terminated string with one of a given length */
+static int
+lod_match(const char *str, const char *s, size_t len)
+{
+	return (strlen(str) == len && !memcmp(str, s, len));
+}
+
+/* Return the URI of a node, if it's a resource */
+static const char *
+lod_node_uri(librdf_node *node, size_t *len)
+{
+	librdf_uri *uri;
+
+	if(!node || !librdf_node_is_resource(node) || !(uri = librdf_node_get_uri(node)))
+	{
+		return NULL;
+	}
+	return (const char *) librdf_uri_as_counted_string(uri, len);
+}
@@ -0,0 +1,417 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* A fast scanner for N-Triples and N-Quads which extracts the IRIs from
+ * each statement without constructing nodes or statements via librdf.
+ *
+ * The scanner accepts only the subset of the grammar which can be handled
+ * without unescaping or resolution: any IRI which contains an escape
+ * sequence or which isn't absolute, or any construct which doesn't parse,
+ * causes the scan to fail so that the caller can fall back to librdf.
+ *
+ * The callback receives the subject, predicate and object IRIs of each
+ * statement (the subject and object are NULL if they are blank nodes or,
+ * in the case of the object, a literal). The IRIs are not NUL-terminated.
+ *
+ * The inner loops which search for the end of an IRI or literal use SSE2
+ * or AVX2 where the compiler has been told that they are available.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_processors.h"
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+static const char *ntriples_iri_end_(const char *p, const char *end);
+static const char *ntriples_literal_end_(const char *p, const char *end);
+static const char *ntriples_ws_(const char *p, const char *end);
+static const char *ntriples_iri_(const char *p, const char *end, const char **iri, size_t *len);
+static const char *ntriples_bnode_(const char *p, const char *end);
+static const char *ntriples_literal_(const char *p, const char *end);
+static int ntriples_iri_special_(unsigned char c);
+
+int
+ntriples_scan(const char *buf, size_t len, int quads, ntriples_cb cb, void *data)
+{
+	const char *p, *end, *s, *pr, *o, *g, *t;
+	size_t slen, plen, olen, glen;
+
+	p = buf;
+	end = buf + len;
+	while(p < end)
+	{
+		p = ntriples_ws_(p, end);
+		if(p >= end)
+		{
+			break;
+		}
+		if(*p == '#' || *p == '\n' || *p == '\r')
+		{
+			/* Comment or blank line */
+			t = memchr(p, '\n', end - p);
+			p = (t ? t + 1 : end);
+			continue;
+		}
+		/* Subject */
+		s = NULL;
+		slen = 0;
+		if(*p == '<')
+		{
+			p = ntriples_iri_(p, end, &s, &slen);
+		}
+		else
+		{
+			p = ntriples_bnode_(p, end);
+		}
+		if(!p)
+		{
+			return -1;
+		}
+		/* Predicate */
+		p = ntriples_ws_(p, end);
+		if(p >= end || *p != '<' || !(p = ntriples_iri_(p, end, &pr, &plen)))
+		{
+			return -1;
+		}
+		/* Object */
+		p = ntriples_ws_(p, end);
+		if(p >= end)
+		{
+			return -1;
+		}
+		o = NULL;
+		olen = 0;
+		if(*p == '<')
+		{
+			p = ntriples_iri_(p, end, &o, &olen);
+		}
+		else if(*p == '"')
+		{
+			p = ntriples_literal_(p, end);
+		}
+		else
+		{
+			p = ntriples_bnode_(p, end);
+		}
+		if(!p)
+		{
+			return -1;
+		}
+		p = ntriples_ws_(p, end);
+		if(p >= end)
+		{
+			return -1;
+		}
+		/* Graph label (N-Quads only) */
+		if(quads && *p != '.')
+		{
+			if(*p == '<')
+			{
+				p = ntriples_iri_(p, end, &g, &glen);
+			}
+			else
+			{
+				p = ntriples_bnode_(p, end);
+			}
+			if(!p)
+			{
+				return -1;
+			}
+			p = ntriples_ws_(p, end);
+		}
+		if(p >= end || *p != '.')
+		{
+			return -1;
+		}
+		p = ntriples_ws_(p + 1, end);
+		if(p < end && *p == '#')
+		{
+			t = memchr(p, '\n', end - p);
+			p = (t ? t : end);
+		}
+		if(p < end && *p == '\r')
+		{
+			p++;
+		}
+		if(p < end)
+		{
+			if(*p != '\n')
+			{
+				return -1;
+			}
+			p++;
+		}
+		if(cb(data, s, slen, pr, plen, o, olen))
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Skip spaces and tabs */
+static const char *
+ntriples_ws_(const char *p, const char *end)
+{
+	while(p < end && (*p == ' ' || *p == '\t'))
+	{
+		p++;
+	}
+	return p;
+}
+
+/* Parse an IRI starting at the opening '<', returning a pointer to the
+ * character following the closing '>'
+ */
+static const char *
+ntriples_iri_(const char *p, const char *end, const char **iri, size_t *len)
+{
+	const char *start, *t;
+
+	start = p + 1;
+	p = ntriples_iri_end_(start, end);
+	if(p >= end || *p != '>')
+	{
+		/* Unterminated, or contains an escape or invalid character */
+		return NULL;
+	}
+	/* The IRI must be absolute: scheme ":" ... */
+	if(p == start || !isalpha((unsigned char) *start))
+	{
+		return NULL;
+	}
+	for(t = start + 1; t < p; t++)
+	{
+		if(*t == ':')
+		{
+			break;
+		}
+		if(!isalnum((unsigned char) *t) && *t != '+' && *t != '-' && *t != '.')
+		{
+			return NULL;
+		}
+	}
+	if(t >= p)
+	{
+		return NULL;
+	}
+	*iri = start;
+	*len = p - start;
+	return p + 1;
+}
+
+/* Skip a blank node label */
+static const char *
+ntriples_bnode_(const char *p, const char *end)
+{
+	if(end - p < 3 || p[0] != '_' || p[1] != ':')
+	{
+		return NULL;
+	}
+	p += 2;
+	while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '<' && *p != '"')
+	{
+		p++;
+	}
+	/* A label cannot end with a '.', so it must be the statement's end */
+	if(p[-1] == '.')
+	{
+		p--;
+	}
+	if(p[-1] == ':')
+	{
+		return NULL;
+	}
+	return p;
+}
+
+/* Skip a literal, including any language tag or datatype */
+static const char *
+ntriples_literal_(const char *p, const char *end)
+{
+	const char *iri;
+	size_t len;
+
+	p++;
+	for(;;)
+	{
+		p = ntriples_literal_end_(p, end);
+		if(p >= end || *p == '\n' || *p == '\r')
+		{
+			return NULL;
+		}
+		if(*p == '"')
+		{
+			break;
+		}
+		/* Backslash: skip the escaped character */
+		p += 2;
+	}
+	p++;
+	if(p < end && *p == '@')
+	{
+		p++;
+		if(p >= end || !isalpha((unsigned char) *p))
+		{
+			return NULL;
+		}
+		while(p < end && (isalnum((unsigned char) *p) || *p == '-'))
+		{
+			p++;
+		}
+	}
+	else if(end - p >= 3 && p[0] == '^' && p[1] == '^' && p[2] == '<')
+	{
+		p = ntriples_iri_(p + 2, end, &iri, &len);
+	}
+	return p;
+}
+
+/* Characters which terminate (or invalidate) an IRI */
+static int
+ntriples_iri_special_(unsigned char c)
+{
+	return (c <= 0x20 || c == '>' || c == '<' || c == '"' || c == '\\' ||
+			c == '{' || c == '}' || c == '|' || c == '^' || c == '`');
+}
+
+/* Return a pointer to the first character which terminates an IRI */
+static const char *
+ntriples_iri_end_(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+	const __m256i space = _mm256_set1_epi8(0x20), gt = _mm256_set1_epi8('>'),
+		lt = _mm256_set1_epi8('<'), quot = _mm256_set1_epi8('"'),
+		bs = _mm256_set1_epi8('\\'), lbrace = _mm256_set1_epi8('{'),
+		rbrace = _mm256_set1_epi8('}'), bar = _mm256_set1_epi8('|'),
+		caret = _mm256_set1_epi8('^'), tick = _mm256_set1_epi8('`');
+	__m256i v, m;
+	unsigned int mask;
+
+	while(end - p >= 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *) p);
+		/* Unsigned v <= 0x20 is equivalent to min(v, 0x20) == v */
+		m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v);
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, gt));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quot));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bs));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lbrace));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, rbrace));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bar));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, caret));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, tick));
+		mask = (unsigned int) _mm256_movemask_epi8(m);
+		if(mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 32;
+	}
+#elif defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(0x20), gt = _mm_set1_epi8('>'),
+		lt = _mm_set1_epi8('<'), quot = _mm_set1_epi8('"'),
+		bs = _mm_set1_epi8('\\'), lbrace = _mm_set1_epi8('{'),
+		rbrace = _mm_set1_epi8('}'), bar = _mm_set1_epi8('|'),
+		caret = _mm_set1_epi8('^'), tick = _mm_set1_epi8('`');
+	__m128i v, m;
+	unsigned int mask;
+
+	while(end - p >= 16)
+	{
+		v = _mm_loadu_si128((const __m128i *) p);
+		/* Unsigned v <= 0x20 is equivalent to min(v, 0x20) == v */
+		m = _mm_cmpeq_epi8(_mm_min_epu8(v, space), v);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, gt));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lt));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quot));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bs));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lbrace));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, rbrace));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bar));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, caret));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, tick));
+		mask = (unsigned int) _mm_movemask_epi8(m);
+		if(mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while(p < end && !ntriples_iri_special_((unsigned char) *p))
+	{
+		p++;
+	}
+	return p;
+}
+
+/* Return a pointer to the first '"', '\\', CR or LF within a literal */
+static const char *
+ntriples_literal_end_(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+	const __m256i quot = _mm256_set1_epi8('"'), bs = _mm256_set1_epi8('\\'),
+		cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+	__m256i v, m;
+	unsigned int mask;
+
+	while(end - p >= 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *) p);
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quot), _mm256_cmpeq_epi8(v, bs));
+		m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+		mask = (unsigned int) _mm256_movemask_epi8(m);
+		if(mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 32;
+	}
+#elif defined(__SSE2__)
+	const __m128i quot = _mm_set1_epi8('"'), bs = _mm_set1_epi8('\\'),
+		cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+	__m128i v, m;
+	unsigned int mask;
+
+	while(end - p >= 16)
+	{
+		v = _mm_loadu_si128((const __m128i *) p);
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, bs));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		mask = (unsigned int) _mm_movemask_epi8(m);
+		if(mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while(p < end && *p != '"' && *p != '\\' && *p != '\r' && *p != '\n')
+	{
+		p++;
+	}
+	return p;
+}
@@ -21,6 +21,7 @@
 # include <stdio.h>
 # include <stdlib.h>
 # include <string.h>
+# include <stdint.h>
 # include <errno.h>
 # include <ctype.h>
 # include <unistd.h>
@@ -43,15 +44,52 @@
 # define MSG_I_RDF_REJECTED_TYPE        "%%ANANSI-I-3003: REJECTED (unsupported content type)"
 # define MSG_E_RDF_ERROR_PAYLOAD        "%%ANANSI-E-3004: ERROR (cannot open payload for processing)"
 # define MSG_I_RDF_FAILED_PARSE         "%%ANANSI-I-3005: FAILED (unable to parse payload)"
-# define MSG_I_RDF_MALFORMEDLINK        "%%ANANSI-I-3006: ignoring malford Link header in response"
-# define MSG_I_RDF_MALFORMEDLINKPARAM   "%%ANANSI-I-3007: ignoring Link header in response with malformed parameters"
 
 /* LOD (3100-3199) */
 
 # define MSG_I_LOD_REJECTED             "%%ANANSI-I-3100: REJECTED"
 
 
+/* The number of distinct parser types for which parsers are retained */
+# define RDF_MAX_PARSERS                8
+
+/* The largest model which will be emptied for reuse rather than discarded */
+# define RDF_MODEL_REUSE_MAX            1024
+
+/* The size of the blocks in which a payload is fed to the parser in
+ * streaming mode
+ */
+# define RDF_STREAM_BLOCK               65536
+
+typedef struct linkset_struct LINKSET;
+
+/* The distinct URIs discovered while processing an object (see linkset.c) */
+struct linkset_struct
+{
+	CRAWL *crawl;
+	struct linkset_arena_struct *arena;
+	struct linkset_slot_struct *table;
+	size_t tablesize;
+	/* The URIs, in the order in which they were added */
+	const char **list;
+	size_t count;
+	size_t listsize;
+};
+
 typedef CRAWLSTATE (*rdf_filter_cb)(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_model *model);
+typedef int (*rdf_statement_cb)(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_statement *statement);
+typedef int (*rdf_triple_cb)(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *subject, size_t slen, const char *predicate, size_t plen, const char *object, size_t olen);
+typedef int (*ntriples_cb)(void *data, const char *subject, size_t slen, const char *predicate, size_t plen, const char *object, size_t olen);
+
+/* Parsers retained by a processor for a particular parser type */
+struct rdf_parser_entry_struct
+{
+	const char *name;
+	/* Used to parse complete payloads */
+	librdf_parser *parser;
+	/* An idle parser for incremental or streaming parsing, if any */
+	raptor_parser *chunk;
+};
 
 struct processor_struct
 {
@@ -64,17 +102,28 @@ struct processor_struct
 	librdf_uri *uri;
 	char *content_type;
 	const char *parser_type;
-	FILE *fobj;
 	rdf_filter_cb filter;
+	rdf_statement_cb statement;
+	rdf_triple_cb triple;
+	/* Per-object state for use by the filter, reset before each object */
+	int filter_state;
 	char **license_predicates;
 	char **license_whitelist;
 	char **license_blacklist;
+	struct rdf_parser_entry_struct parsers[RDF_MAX_PARSERS];
 };
 
 extern PROCESSOR *spider_processor_rdf_create_(SPIDER *spider);
 extern PROCESSOR *spider_processor_lod_create_(SPIDER *spider);
 
 extern librdf_world *rdf_world(PROCESSOR *me);
+
+extern void linkset_init(LINKSET *set, CRAWL *crawl);
+extern int linkset_add(LINKSET *set, const char *uri, size_t len);
+extern void linkset_done(LINKSET *set);
+extern int ntriples_scan(const char *buf, size_t len, int quads, ntriples_cb cb, void *data);
 extern int rdf_set_filter(PROCESSOR *me, rdf_filter_cb filter);
+extern int rdf_set_statement_handler(PROCESSOR *me, rdf_statement_cb handler);
+extern int rdf_set_triple_handler(PROCESSOR *me, rdf_triple_cb handler);
 
 #endif /*!P_PROCESSORS_H_*/
@@ -30,18 +30,70 @@
 static unsigned long rdf_addref(PROCESSOR *me);
 static unsigned long rdf_release(PROCESSOR *me);
 static CRAWLSTATE rdf_process(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type);
-static int rdf_process_headers(PROCESSOR *me, CRAWLOBJ *obj);
-static int rdf_process_link(PROCESSOR *me, CRAWLOBJ *obj, const char *value, librdf_uri *resource);
+static int rdf_process_headers(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, LINKSET *links);
+static int rdf_process_link(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const CRAWLLINK *link, librdf_uri *resource, LINKSET *links);
 static CRAWLSTATE rdf_preprocess(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type);
 static int rdf_postprocess(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type);
-static CRAWLSTATE rdf_process_obj(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type, struct curl_slist **subjects);
-static int rdf_process_node(PROCESSOR *me, CRAWLOBJ *obj, librdf_node *node, struct curl_slist **subjects);
+static CRAWLSTATE rdf_process_obj(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type, LINKSET *links);
+static CRAWLSTATE rdf_process_model(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_parser *parser, const unsigned char *payload, size_t len, LINKSET *links);
+static CRAWLSTATE rdf_process_stream(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const unsigned char *payload, size_t len, LINKSET *links);
+static void rdf_stream_statement(void *data, raptor_statement *statement);
+static int rdf_process_statement(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_statement *st, LINKSET *links);
+static int rdf_process_node(PROCESSOR *me, CRAWLOBJ *obj, librdf_node *node, LINKSET *links);
+static int rdf_process_ntriples(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *payload, size_t len, LINKSET *links);
+static int rdf_ntriples_cb(void *data, const char *subject, size_t slen, const char *predicate, size_t plen, const char *object, size_t olen);
+static int rdf_add_link(LINKSET *links, const char *s, size_t len);
+static int rdf_payload(PROCESSOR *me, CRAWLOBJ *obj, const char *buf, size_t len);
+static struct rdf_chunk_struct *rdf_chunk_begin(PROCESSOR *me, CRAWLOBJ *obj);
+static void rdf_chunk_statement(void *data, raptor_statement *statement);
+static void rdf_chunk_release(void *data);
+static CRAWLSTATE rdf_chunk_process(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, struct rdf_chunk_struct *chunk);
+static const char *rdf_parser_type(const char *content_type);
+static const char *rdf_term_uri(raptor_term *term, size_t *len);
+static struct rdf_parser_entry_struct *rdf_parser_entry(PROCESSOR *me, const char *name);
+static librdf_parser *rdf_parser(PROCESSOR *me, const char *name);
+static raptor_parser *rdf_chunk_parser_acquire(PROCESSOR *me, const char *name);
+static void rdf_chunk_parser_release(PROCESSOR *me, const char *name, raptor_parser *parser);
+static int rdf_model_reset(PROCESSOR *me);
+
+struct rdf_ntriples_data_struct
+{
+	PROCESSOR *me;
+	CRAWLOBJ *obj;
+	const char *uri;
+	LINKSET *links;
+};
+
+/* The state of a payload being parsed in streaming mode */
+struct rdf_stream_struct
+{
+	PROCESSOR *me;
+	CRAWLOBJ *obj;
+	const char *uri;
+	LINKSET *links;
+};
+
+/* The state of an object whose payload is being parsed as it's received */
+struct rdf_chunk_struct
+{
+	PROCESSOR *me;
+	CRAWLOBJ *obj;
+	const char *parser_type;
+	raptor_parser *parser;
+	raptor_uri *base;
+	LINKSET links;
+	int filter_state;
+	/* Set once the whole payload has been parsed successfully */
+	int complete;
+	int failed;
+};
 
 static struct processor_api_struct rdf_api = {
 	NULL,
 	rdf_addref,
 	rdf_release,
-	rdf_process
+	rdf_process,
+	rdf_payload
 };
 
 PROCESSOR *
@@ -87,6 +139,21 @@ rdf_release(PROCESSOR *me)
 	me->refcount--;
 	if(!me->refcount)
 	{
+		for(c = 0; c < RDF_MAX_PARSERS && me->parsers[c].name; c++)
+		{
+			if(me->parsers[c].parser)
+			{
+				librdf_free_parser(me->parsers[c].parser);
+			}
+			if(me->parsers[c].chunk)
+			{
+				raptor_free_parser(me->parsers[c].chunk);
+			}
+		}
+		if(me->model)
+		{
+			librdf_free_model(me->model);
+		}
 		if(me->storage)
 		{
 			librdf_free_storage(me->storage);
@@ -130,22 +197,26 @@ static CRAWLSTATE
 rdf_process(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type)
 {
 	CRAWLSTATE r;
-	struct curl_slist *subjects, *p;
+	LINKSET links;
+	struct rdf_chunk_struct *chunk;
 	
-	subjects = NULL;
+	linkset_init(&links, me->crawl);
 	r = rdf_preprocess(me, obj, uri, content_type);
-	if(r == COS_ACCEPTED)
+	chunk = (struct rdf_chunk_struct *) crawl_obj_private(obj);
+	if(r == COS_ACCEPTED && chunk && chunk->me == me && chunk->complete)
 	{
-		r = rdf_process_obj(me, obj, uri, content_type, &subjects);
-		if(r == COS_ACCEPTED)
+		/* The payload was parsed as it was received */
+		r = rdf_chunk_process(me, obj, uri, chunk);
+	}
+	else if(r == COS_ACCEPTED)
+	{
+		r = rdf_process_obj(me, obj, uri, content_type, &links);
+		if(r == COS_ACCEPTED && links.count)
 		{
-			for(p = subjects; p; p = p->next)
-			{
-				queue_add_uristr(me->crawl, p->data);
-			}
+			queue_add_uristrs(me->crawl, links.list, links.count);
 		}
-		curl_slist_free_all(subjects);
 	}
+	linkset_done(&links);
 	rdf_postprocess(me, obj, uri, content_type);
 	return r;
 }
@@ -195,69 +266,211 @@ rdf_preprocess(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *conten
 			t--;
 		}
 	}
-	me->model = librdf_new_model(me->world, me->storage, NULL);
-	if(!me->model)
+	me->filter_state = 0;
+	if(me->filter && !me->statement)
 	{
-		return COS_ERR;
+		/* The filter needs random access to the statements, so the payload
+		 * must be parsed into a model rather than processed as a stream;
+		 * the model is retained between objects where possible
+		 */
+		if(!me->model)
+		{
+			me->model = librdf_new_model(me->world, me->storage, NULL);
+		}
+		if(!me->model)
+		{
+			return COS_ERR;
+		}
 	}
-	me->uri = librdf_new_uri(me->world, (const unsigned char *) uri);
-	if(!me->uri)
+	me->parser_type = rdf_parser_type(me->content_type);
+	log_printf(LOG_DEBUG, "rdf_preprocess: content_type='%s', parser_type='%s'\n", me->content_type, me->parser_type);
+	if(!me->parser_type)
 	{
-		return COS_ERR;
+		
+		log_printf(LOG_INFO, MSG_I_RDF_REJECTED_TYPE " <%s> (RDF: no parser found for '%s')\n", uri, me->content_type);
+		return COS_SKIPPED;
+	}
+	return COS_ACCEPTED;
+}
+
+/* Locate (or allocate) the cache entry for a parser type */
+static struct rdf_parser_entry_struct *
+rdf_parser_entry(PROCESSOR *me, const char *name)
+{
+	size_t c;
+
+	for(c = 0; c < RDF_MAX_PARSERS; c++)
+	{
+		if(!me->parsers[c].name)
+		{
+			me->parsers[c].name = name;
+			return &(me->parsers[c]);
+		}
+		if(!strcmp(me->parsers[c].name, name))
+		{
+			return &(me->parsers[c]);
+		}
+	}
+	return NULL;
+}
+
+/* Obtain a parser for a complete payload; parsers are created on demand and
+ * retained for reuse by subsequent objects of the same type
+ */
+static librdf_parser *
+rdf_parser(PROCESSOR *me, const char *name)
+{
+	struct rdf_parser_entry_struct *entry;
+
+	entry = rdf_parser_entry(me, name);
+	if(!entry)
+	{
+		log_printf(LOG_ERR, "RDF: no space to retain a '%s' parser\n", name);
+		return NULL;
 	}
-	me->parser_type = NULL;
-	if(!strcmp(me->content_type, "text/turtle"))
+	if(!entry->parser)
 	{
-		me->parser_type = "turtle";
+		entry->parser = librdf_new_parser(me->world, name, NULL, NULL);
 	}
-	else if(!strcmp(me->content_type, "application/rdf+xml"))
+	return entry->parser;
+}
+
+/* Obtain a raptor parser for incremental or streaming parsing: because
+ * several payloads may be in the process of being received at once, the
+ * retained parser is handed out only if it's idle, otherwise a new one is
+ * created
+ */
+static raptor_parser *
+rdf_chunk_parser_acquire(PROCESSOR *me, const char *name)
+{
+	struct rdf_parser_entry_struct *entry;
+	raptor_parser *parser;
+
+	entry = rdf_parser_entry(me, name);
+	if(entry && entry->chunk)
 	{
-		me->parser_type = "rdfxml";
+		parser = entry->chunk;
+		entry->chunk = NULL;
+		return parser;
 	}
-	else if(!strcmp(me->content_type, "text/n3"))
+	return raptor_new_parser(librdf_world_get_raptor(me->world), name);
+}
+
+/* Return a raptor parser which has successfully completed a parse, so that
+ * it can be reused
+ */
+static void
+rdf_chunk_parser_release(PROCESSOR *me, const char *name, raptor_parser *parser)
+{
+	struct rdf_parser_entry_struct *entry;
+
+	entry = rdf_parser_entry(me, name);
+	if(entry && !entry->chunk)
 	{
-		me->parser_type = "turtle";
+		entry->chunk = parser;
+		return;
 	}
-	else if(!strcmp(me->content_type, "text/plain"))
+	raptor_free_parser(parser);
+}
+
+/* Empty the model so that it can be reused for the next object; returns -1
+ * if the model should be discarded instead
+ */
+static int
+rdf_model_reset(PROCESSOR *me)
+{
+	librdf_stream *stream;
+	librdf_statement **list;
+	size_t count, c;
+	int size;
+
+	size = librdf_model_size(me->model);
+	if(size < 0 || size > RDF_MODEL_REUSE_MAX)
 	{
-		me->parser_type = "ntriples";
+		/* Removing statements one at a time from a large in-memory model
+		 * costs more than creating a new one
+		 */
+		return -1;
 	}
-	else if(!strcmp(me->content_type, "application/n-triples"))
+	if(!size)
 	{
-		me->parser_type = "ntriples";
+		return 0;
 	}
-	else if(!strcmp(me->content_type, "text/x-nquads") || !strcmp(me->content_type, "application/n-quads"))
+	list = (librdf_statement **) crawl_alloc(me->crawl, sizeof(librdf_statement *) * size);
+	if(!list)
 	{
-		me->parser_type = "nquads";
+		return -1;
 	}
-	log_printf(LOG_DEBUG, "rdf_preprocess: content_type='%s', parser_type='%s'\n", me->content_type, me->parser_type);
-	if(!me->parser_type)
+	count = 0;
+	stream = librdf_model_as_stream(me->model);
+	if(!stream)
 	{
-		
-		log_printf(LOG_INFO, MSG_I_RDF_REJECTED_TYPE " <%s> (RDF: no parser found for '%s')\n", uri, me->content_type);
-		return COS_SKIPPED;
+		crawl_free(me->crawl, list);
+		return -1;
 	}
-	return COS_ACCEPTED;
+	while(!librdf_stream_end(stream) && count < (size_t) size)
+	{
+		list[count] = librdf_new_statement_from_statement(librdf_stream_get_object(stream));
+		if(list[count])
+		{
+			count++;
+		}
+		librdf_stream_next(stream);
+	}
+	librdf_free_stream(stream);
+	for(c = 0; c < count; c++)
+	{
+		librdf_model_remove_statement(me->model, list[c]);
+		librdf_free_statement(list[c]);
+	}
+	crawl_free(me->crawl, list);
+	return (librdf_model_size(me->model) ? -1 : 0);
+}
+
+/* Map a MIME type (without parameters) to a parser name */
+static const char *
+rdf_parser_type(const char *content_type)
+{
+	if(!strcmp(content_type, "text/turtle"))
+	{
+		return "turtle";
+	}
+	if(!strcmp(content_type, "application/rdf+xml"))
+	{
+		return "rdfxml";
+	}
+	if(!strcmp(content_type, "text/n3"))
+	{
+		return "turtle";
+	}
+	if(!strcmp(content_type, "text/plain"))
+	{
+		return "ntriples";
+	}
+	if(!strcmp(content_type, "application/n-triples"))
+	{
+		return "ntriples";
+	}
+	if(!strcmp(content_type, "text/x-nquads") || !strcmp(content_type, "application/n-quads"))
+	{
+		return "nquads";
+	}
+	return NULL;
 }
 
 static int
 rdf_postprocess(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type)
 {
-	(void) obj;
 	(void) uri;
 	(void) content_type;
 	
-	if(me->fobj)
-	{
-		fclose(me->fobj);
-		me->fobj = NULL;
-	}
+	crawl_obj_unmap(obj);
 	if(me->uri)
 	{
 		librdf_free_uri(me->uri);
 		me->uri = NULL;
 	}
-	if(me->model)
+	if(me->model && rdf_model_reset(me))
 	{
 		librdf_free_model(me->model);
 		me->model = NULL;
@@ -268,37 +481,78 @@ rdf_postprocess(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *conte
 }
 
 static CRAWLSTATE
-rdf_process_obj(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type, struct curl_slist **subjects)
+rdf_process_obj(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *content_type, LINKSET *links)
 {
 	librdf_parser *parser;
-	librdf_stream *stream;
-	librdf_statement *st;
+	const void *payload;
+	size_t len;
 	CRAWLSTATE r;
 
-	(void) uri;
 	(void) content_type;
 
 	log_printf(LOG_DEBUG, "RDF: processing <%s>\n", uri);
-	parser = librdf_new_parser(me->world, me->parser_type, NULL, NULL);
+	payload = crawl_obj_map(obj, &len);
+	if(!payload)
+	{
+		log_printf(LOG_ERR, MSG_E_RDF_ERROR_PAYLOAD " <%s>\n", uri);
+		return COS_ERR;
+	}
+	if(!me->model && (!me->filter || me->triple) &&
+	   (!strcmp(me->parser_type, "ntriples") || !strcmp(me->parser_type, "nquads")))
+	{
+		if(!rdf_process_ntriples(me, obj, uri, (const char *) payload, len, links))
+		{
+			rdf_process_headers(me, obj, uri, links);
+			if(me->filter)
+			{
+				r = me->filter(me, obj, uri, NULL);
+				if(r != COS_ACCEPTED)
+				{
+					log_printf(LOG_DEBUG, "RDF: filter declined further processing of this resource\n");
+					return r;
+				}
+			}
+			return COS_ACCEPTED;
+		}
+		log_printf(LOG_DEBUG, "RDF: falling back to librdf to parse <%s>\n", uri);
+	}
+	if(!me->model)
+	{
+		return rdf_process_stream(me, obj, uri, (const unsigned char *) payload, len, links);
+	}
+	parser = rdf_parser(me, me->parser_type);
 	if(!parser)
 	{
 		return COS_ERR;
 	}
-	me->fobj = crawl_obj_open(obj);
-	if(!me->fobj)
+	r = rdf_process_model(me, obj, uri, parser, (const unsigned char *) payload, len, links);
+	return r;
+}
+
+/* Parse the payload into a model, which is passed to the filter, and then
+ * process each of the statements in the model
+ */
+static CRAWLSTATE
+rdf_process_model(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_parser *parser, const unsigned char *payload, size_t len, LINKSET *links)
+{
+	librdf_stream *stream;
+	librdf_statement *st;
+	CRAWLSTATE r;
+
+	/* Only librdf needs the base URI as a librdf_uri; because it's different
+	 * for each object, it's created here rather than for every object
+	 */
+	me->uri = librdf_new_uri(me->world, (const unsigned char *) uri);
+	if(!me->uri)
 	{
-		log_printf(LOG_ERR, MSG_E_RDF_ERROR_PAYLOAD " <%s>\n", uri);
-		librdf_free_parser(parser);
 		return COS_ERR;
 	}
-	if(librdf_parser_parse_file_handle_into_model(parser, me->fobj, 0, me->uri, me->model))
+	if(librdf_parser_parse_counted_string_into_model(parser, payload, len, me->uri, me->model))
 	{
-		log_printf(LOG_INFO, MSG_I_RDF_FAILED_PARSE " <%s> (RDF: failed to parse '%s' as '%s')\n", uri, content_type, me->parser_type);
-		librdf_free_parser(parser);
+		log_printf(LOG_INFO, MSG_I_RDF_FAILED_PARSE " <%s> (RDF: failed to parse '%s' as '%s')\n", uri, me->content_type, me->parser_type);
 		return COS_ERR;
 	}
-	librdf_free_parser(parser);
-	rdf_process_headers(me, obj);
+	rdf_process_headers(me, obj, uri, links);
 	if(me->filter)
 	{
 		r = me->filter(me, obj, uri, me->model);
@@ -317,9 +571,9 @@ rdf_process_obj(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *conte
 	{
 		st = librdf_stream_get_object(stream);
 		
-		rdf_process_node(me, obj, librdf_statement_get_subject(st), subjects);
-		rdf_process_node(me, obj, librdf_statement_get_predicate(st), subjects);
-		rdf_process_node(me, obj, librdf_statement_get_object(st), subjects);
+		rdf_process_node(me, obj, librdf_statement_get_subject(st), links);
+		rdf_process_node(me, obj, librdf_statement_get_predicate(st), links);
+		rdf_process_node(me, obj, librdf_statement_get_object(st), links);
 		
 		librdf_stream_next(stream);
 	}
@@ -327,283 +581,488 @@ rdf_process_obj(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *conte
 	return COS_ACCEPTED;
 }
 
-/* Debian Wheezy ships with libjansson 2.3, which doesn't include
- * json_array_foreach()
+/* Process each statement as it is parsed, without retaining it: the
+ * payload is fed to a raptor parser a block at a time, and its statement
+ * handler processes each statement as soon as it has been parsed, so that
+ * memory use depends upon the number of distinct links rather than the
+ * number of statements. The filter (if any) is invoked with a NULL model
+ * once parsing has finished, having been given the opportunity to examine
+ * each statement as it was encountered.
  */
-#ifndef json_array_foreach
-# define json_array_foreach(array, index, value) \
-	for(index = 0; index < json_array_size(array) && (value = json_array_get(array, index)); index++)
-#endif
+static CRAWLSTATE
+rdf_process_stream(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const unsigned char *payload, size_t len, LINKSET *links)
+{
+	struct rdf_stream_struct data;
+	raptor_parser *parser;
+	raptor_uri *base;
+	size_t pos, n;
+	CRAWLSTATE r;
+	int e;
+
+	rdf_process_headers(me, obj, uri, links);
+	parser = rdf_chunk_parser_acquire(me, me->parser_type);
+	if(!parser)
+	{
+		return COS_ERR;
+	}
+	base = raptor_new_uri(librdf_world_get_raptor(me->world), (const unsigned char *) uri);
+	if(!base)
+	{
+		raptor_free_parser(parser);
+		return COS_ERR;
+	}
+	data.me = me;
+	data.obj = obj;
+	data.uri = uri;
+	data.links = links;
+	raptor_parser_set_statement_handler(parser, &data, rdf_stream_statement);
+	e = raptor_parser_parse_start(parser, base);
+	for(pos = 0; !e; pos += n)
+	{
+		n = (len - pos > RDF_STREAM_BLOCK ? RDF_STREAM_BLOCK : len - pos);
+		e = raptor_parser_parse_chunk(parser, payload + pos, n, (pos + n == len));
+		if(pos + n == len)
+		{
+			break;
+		}
+	}
+	raptor_free_uri(base);
+	if(e)
+	{
+		raptor_free_parser(parser);
+		log_printf(LOG_INFO, MSG_I_RDF_FAILED_PARSE " <%s> (RDF: failed to parse '%s' as '%s')\n", uri, me->content_type, me->parser_type);
+		return COS_ERR;
+	}
+	rdf_chunk_parser_release(me, me->parser_type, parser);
+	if(me->filter)
+	{
+		r = me->filter(me, obj, uri, NULL);
+		if(r != COS_ACCEPTED)
+		{
+			log_printf(LOG_DEBUG, "RDF: filter declined further processing of this resource\n");
+			return r;
+		}
+	}
+	return COS_ACCEPTED;
+}
+
+/* The raptor statement handler used in streaming mode; librdf statements
+ * are raptor statements, so each can be processed as it stands
+ */
+static void
+rdf_stream_statement(void *data, raptor_statement *statement)
+{
+	struct rdf_stream_struct *d;
+
+	d = (struct rdf_stream_struct *) data;
+	rdf_process_statement(d->me, d->obj, d->uri, (librdf_statement *) statement, d->links);
+}
+
+/* Process a single statement in streaming mode */
+static int
+rdf_process_statement(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, librdf_statement *st, LINKSET *links)
+{
+	if(me->statement)
+	{
+		me->statement(me, obj, uri, st);
+	}
+	rdf_process_node(me, obj, librdf_statement_get_subject(st), links);
+	rdf_process_node(me, obj, librdf_statement_get_predicate(st), links);
+	rdf_process_node(me, obj, librdf_statement_get_object(st), links);
+	return 0;
+}
+
+/* Scan an N-Triples or N-Quads payload directly, without involving
+ * librdf; if the payload contains anything which the scanner can't handle,
+ * any state accumulated so far is discarded and -1 is returned so that the
+ * caller can parse it with librdf instead.
+ */
+static int
+rdf_process_ntriples(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, const char *payload, size_t len, LINKSET *links)
+{
+	struct rdf_ntriples_data_struct data;
+
+	data.me = me;
+	data.obj = obj;
+	data.uri = uri;
+	data.links = links;
+	if(ntriples_scan(payload, len, !strcmp(me->parser_type, "nquads"), rdf_ntriples_cb, &data))
+	{
+		linkset_done(links);
+		linkset_init(links, me->crawl);
+		me->filter_state = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int
+rdf_ntriples_cb(void *data, const char *subject, size_t slen, const char *predicate, size_t plen, const char *object, size_t olen)
+{
+	struct rdf_ntriples_data_struct *d;
+
+	d = (struct rdf_ntriples_data_struct *) data;
+	if(d->me->triple)
+	{
+		d->me->triple(d->me, d->obj, d->uri, subject, slen, predicate, plen, object, olen);
+	}
+	if((subject && rdf_add_link(d->links, subject, slen)) ||
+	   rdf_add_link(d->links, predicate, plen) ||
+	   (object && rdf_add_link(d->links, object, olen)))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/* Invoked by libcrawl with each chunk of a payload as it's received: where
+ * possible, the chunks are passed to a raptor parser so that parsing
+ * overlaps the transfer. If this isn't possible (because the payload isn't
+ * something we can parse, because the filter needs the whole model, or
+ * because it's N-Triples or N-Quads, which are scanned more cheaply once
+ * complete), or parsing fails, -1 is returned and rdf_process() will parse
+ * the payload from the cache as usual.
+ */
+static int
+rdf_payload(PROCESSOR *me, CRAWLOBJ *obj, const char *buf, size_t len)
+{
+	struct rdf_chunk_struct *chunk;
+	int r, saved;
+
+	chunk = (struct rdf_chunk_struct *) crawl_obj_private(obj);
+	if(!chunk)
+	{
+		if(!buf)
+		{
+			return 0;
+		}
+		chunk = rdf_chunk_begin(me, obj);
+		if(!chunk)
+		{
+			return -1;
+		}
+	}
+	if(chunk->me != me || chunk->failed || chunk->complete)
+	{
+		return -1;
+	}
+	/* The triple handler records its state in me->filter_state, but there
+	 * may be several objects in flight at once
+	 */
+	saved = me->filter_state;
+	me->filter_state = chunk->filter_state;
+	r = raptor_parser_parse_chunk(chunk->parser, (const unsigned char *) buf, len, (buf ? 0 : 1));
+	chunk->filter_state = me->filter_state;
+	me->filter_state = saved;
+	if(r || chunk->failed)
+	{
+		log_printf(LOG_DEBUG, "RDF: incremental parse of <%s> failed\n", crawl_obj_uristr(obj));
+		chunk->failed = 1;
+		return -1;
+	}
+	if(!buf)
+	{
+		chunk->complete = 1;
+		rdf_chunk_parser_release(me, chunk->parser_type, chunk->parser);
+		chunk->parser = NULL;
+	}
+	return 0;
+}
+
+/* Prepare to parse an object's payload incrementally */
+static struct rdf_chunk_struct *
+rdf_chunk_begin(PROCESSOR *me, CRAWLOBJ *obj)
+{
+	struct rdf_chunk_struct *chunk;
+	raptor_world *world;
+	const char *type;
+	char mime[128];
+	size_t n;
+	int status;
+
+	if(me->filter && !me->triple)
+	{
+		return NULL;
+	}
+	status = crawl_obj_status(obj);
+	if(status < 200 || status > 299)
+	{
+		return NULL;
+	}
+	type = crawl_obj_type(obj);
+	if(!type)
+	{
+		return NULL;
+	}
+	for(n = 0; type[n] && type[n] != ';' && n + 1 < sizeof(mime); n++)
+	{
+		mime[n] = type[n];
+	}
+	while(n && isspace((unsigned char) mime[n - 1]))
+	{
+		n--;
+	}
+	mime[n] = 0;
+	type = rdf_parser_type(mime);
+	if(!type)
+	{
+		return NULL;
+	}
+	if((!me->filter || me->statement) && (!strcmp(type, "ntriples") || !strcmp(type, "nquads")))
+	{
+		/* Unless the filter needs a model, the complete payload will be
+		 * scanned by ntriples_scan(), which is considerably faster than
+		 * raptor, once it's been received
+		 */
+		return NULL;
+	}
+	world = librdf_world_get_raptor(me->world);
+	if(!world)
+	{
+		return NULL;
+	}
+	chunk = (struct rdf_chunk_struct *) crawl_alloc(me->crawl, sizeof(struct rdf_chunk_struct));
+	if(!chunk)
+	{
+		return NULL;
+	}
+	chunk->me = me;
+	chunk->obj = obj;
+	chunk->parser_type = type;
+	linkset_init(&(chunk->links), me->crawl);
+	chunk->parser = rdf_chunk_parser_acquire(me, type);
+	chunk->base = raptor_new_uri(world, (const unsigned char *) crawl_obj_uristr(obj));
+	if(!chunk->parser || !chunk->base)
+	{
+		rdf_chunk_release(chunk);
+		return NULL;
+	}
+	raptor_parser_set_statement_handler(chunk->parser, chunk, rdf_chunk_statement);
+	if(raptor_parser_parse_start(chunk->parser, chunk->base))
+	{
+		rdf_chunk_release(chunk);
+		return NULL;
+	}
+	crawl_obj_set_private(obj, chunk, rdf_chunk_release);
+	return chunk;
+}
+
+static void
+rdf_chunk_statement(void *data, raptor_statement *statement)
+{
+	struct rdf_chunk_struct *chunk;
+	const char *subject, *predicate, *object;
+	size_t slen, plen, olen;
+
+	chunk = (struct rdf_chunk_struct *) data;
+	if(chunk->failed)
+	{
+		return;
+	}
+	subject = rdf_term_uri(statement->subject, &slen);
+	predicate = rdf_term_uri(statement->predicate, &plen);
+	object = rdf_term_uri(statement->object, &olen);
+	if(!predicate)
+	{
+		return;
+	}
+	if(chunk->me->triple)
+	{
+		chunk->me->triple(chunk->me, chunk->obj, crawl_obj_uristr(chunk->obj), subject, slen, predicate, plen, object, olen);
+	}
+	if((subject && rdf_add_link(&(chunk->links), subject, slen)) ||
+	   rdf_add_link(&(chunk->links), predicate, plen) ||
+	   (object && rdf_add_link(&(chunk->links), object, olen)))
+	{
+		chunk->failed = 1;
+	}
+}
+
+static const char *
+rdf_term_uri(raptor_term *term, size_t *len)
+{
+	if(!term || term->type != RAPTOR_TERM_TYPE_URI)
+	{
+		*len = 0;
+		return NULL;
+	}
+	return (const char *) raptor_uri_as_counted_string(term->value.uri, len);
+}
+
+static void
+rdf_chunk_release(void *data)
+{
+	struct rdf_chunk_struct *chunk;
+
+	chunk = (struct rdf_chunk_struct *) data;
+	if(chunk->parser)
+	{
+		raptor_free_parser(chunk->parser);
+	}
+	if(chunk->base)
+	{
+		raptor_free_uri(chunk->base);
+	}
+	linkset_done(&(chunk->links));
+	crawl_free(chunk->me->crawl, chunk);
+}
+
+/* Complete the processing of a payload which was parsed as it was received:
+ * the Link headers are processed, the filter invoked, and if accepted, the
+ * discovered links added to the queue
+ */
+static CRAWLSTATE
+rdf_chunk_process(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, struct rdf_chunk_struct *chunk)
+{
+	CRAWLSTATE r;
+
+	log_printf(LOG_DEBUG, "RDF: <%s> was parsed as it was received\n", uri);
+	me->filter_state = chunk->filter_state;
+	rdf_process_headers(me, obj, uri, &(chunk->links));
+	if(me->filter)
+	{
+		r = me->filter(me, obj, uri, NULL);
+		if(r != COS_ACCEPTED)
+		{
+			log_printf(LOG_DEBUG, "RDF: filter declined further processing of this resource\n");
+			return r;
+		}
+	}
+	if(chunk->links.count)
+	{
+		queue_add_uristrs(me->crawl, chunk->links.list, chunk->links.count);
+	}
+	return COS_ACCEPTED;
+}
 
 static int
-rdf_process_headers(PROCESSOR *me, CRAWLOBJ *obj)
+rdf_process_headers(PROCESSOR *me, CRAWLOBJ *obj, const char *uri, LINKSET *links)
 {
-	json_t *headers, *values, *header;
-	size_t d;
-	const char *value, *loc, *key;
+	const CRAWLLINK *link;
+	size_t count, c;
+	const char *loc;
 	librdf_uri *resource;
 
+	link = crawl_obj_links(obj, &count);
+	if(!count)
+	{
+		return 0;
+	}
 	loc = crawl_obj_content_location(obj);
 	if(!loc)
 	{
 		loc = crawl_obj_uristr(obj);
 	}
 	log_printf(LOG_DEBUG, "RDF: Content-Location is <%s>\n", loc);
-	resource = librdf_new_uri(me->world, (const unsigned char *) loc);	
-	headers = crawl_obj_headers(obj, 0);
-	json_object_foreach(headers, key, values)
+	resource = librdf_new_uri(me->world, (const unsigned char *) loc);
+	if(!resource)
 	{
-		if(!strcasecmp(key, "link"))
-		{
-			log_printf(LOG_DEBUG, "RDF: Found header \"%s\"\n", key);
-			json_array_foreach(values, d, header)
-			{
-				value = json_string_value(header);
-				if(value)
-				{
-					rdf_process_link(me, obj, value, resource);
-				}
-			}
-		}
+		return -1;
+	}
+	for(c = 0; c < count; c++)
+	{
+		rdf_process_link(me, obj, uri, &(link[c]), resource, links);
 	}
-	json_decref(headers);
 	librdf_free_uri(resource);
 	return 0;
 }
 
 static int
-rdf_process_link(PROCESSOR *me, CRAWLOBJ *obj, const char *value, librdf_uri *resource)
+rdf_process_link(PROCESSOR *me, CRAWLOBJ *obj, const char *objuri, const CRAWLLINK *link, librdf_uri *resource, LINKSET *links)
 {
 	static const char *relbase = "http://www.w3.org/1999/xhtml/vocab#";
-	const char *t, *pend, *vstart, *s;
-	char *anchorstr, *uristr, *relstr, *p;
+	char relbuf[256], *relstr;
+	size_t needed;
 	librdf_uri *anchor, *uri, *rel;
-	int q, abs;
 	librdf_node *subject, *predicate, *object;
 	librdf_statement *st;
 
-	(void) obj;
-
-	rel = NULL;
-	while(*value)
+	/* Only process links which actually have a relation */
+	if(!link->rel)
 	{
-		anchorstr = NULL;
-		uristr = NULL;
-		relstr = NULL;
-		t = value;
-		while(*t && isspace(*t))
-		{
-			t++;
-		}
-		if(*t != '<')
-		{
-			log_printf(LOG_INFO, MSG_I_RDF_MALFORMEDLINK " ('%s')\n", value);
-			return -1;
-		}
-		value = t + 1;
-		while(*t && *t != '>')
-		{
-			t++;
-		}
-		if(!*t)
-		{
-			log_printf(LOG_INFO, MSG_I_RDF_MALFORMEDLINK " ('%s')\n", value);
-			return -1;
-		}
-		uristr = (char *) crawl_alloc(me->crawl, t - value + 1);
-		if(!uristr)
+		return 0;
+	}
+	/* If the relation is not something that looks like a URI, create one
+	 * by concatenating it to relbase; otherwise, just parse the relation
+	 * as a URI.
+	 */
+	relstr = (char *) link->rel;
+	if(!memchr(link->rel, ':', link->rellen) && !memchr(link->rel, '/', link->rellen))
+	{
+		needed = strlen(relbase) + link->rellen + 1;
+		relstr = (needed <= sizeof(relbuf) ? relbuf : (char *) crawl_alloc(me->crawl, needed));
+		if(!relstr)
 		{
-			log_printf(LOG_ERR, "RDF: failed to allocate memory for Link URI\n");
 			return -1;
 		}
-		strncpy(uristr, value, t - value);
-		uristr[t - value] = 0;
-		value = t + 1;		
-		while(*value && *value != ',')
+		strcpy(relstr, relbase);
+		strcat(relstr, link->rel);
+	}
+	if(link->anchor)
+	{
+		anchor = librdf_new_uri_relative_to_base(resource, (const unsigned char *) link->anchor);
+	}
+	else
+	{
+		anchor = resource;
+	}
+	uri = NULL;
+	rel = NULL;
+	if(anchor)
+	{
+		uri = librdf_new_uri_relative_to_base(anchor, (const unsigned char *) link->target);
+		rel = librdf_new_uri(me->world, (const unsigned char *) relstr);
+	}
+	if(uri && rel)
+	{
+		log_printf(LOG_DEBUG, "RDF: Link <%s> <%s> <%s>\n",
+				   (const char *) librdf_uri_as_string(anchor),
+				   (const char *) librdf_uri_as_string(rel),
+				   (const char *) librdf_uri_as_string(uri));
+		/* Create a new triple (content-location, relation, target) */
+		subject = librdf_new_node_from_uri(me->world, anchor);
+		predicate = librdf_new_node_from_uri(me->world, rel);
+		object = librdf_new_node_from_uri(me->world, uri);
+		st = librdf_new_statement_from_nodes(me->world, subject, predicate, object);
+		if(st)
 		{
-			vstart = NULL;
-			q = 0;
-			while(*value == ' ' || *value == '\t')
-			{
-				value++;
-			}
-			if(!*value)
-			{
-				break;
-			}
-			t = value;
-			/* Parse a single parameter */
-			while(*t)
-			{
-				if(*t == '=' || *t == ';')
-				{
-					break;
-				}
-				if(*t == ' ' || *t == '\t')
-				{
-					log_printf(LOG_NOTICE, MSG_I_RDF_MALFORMEDLINKPARAM " ('%s')\n", value);
-					return -1;
-				}
-				t++;
-			}
-			if(!*t || *t == ',')
-			{
-				break;
-			}
-			if(*t == ';')
-			{
-				t++;
-				value = t;
-				continue;
-			}
-			pend = t;
-			t++;
-			while(*t == ' ' || *t == '\t')
-			{
-				t++;
-			}
-			vstart = t;
-			while(*t)
-			{
-				if(q)
-				{
-					if(*t == q)
-					{
-						q = 0;
-					}
-					t++;
-					continue;				
-				}
-				if(*t == '"')
-				{
-					q = *t;
-					t++;
-					continue;
-				}
-				if(*t == ';')
-				{
-					break;
-				}
-				if(*t == ',')
-				{
-					break;
-				}
-				t++;
-			}		
-			/* Parse a 'rel' parameter */
-			if(!relstr && pend - value == 3 && !strncmp(value, "rel", 3))
-			{
-				/* If the relation is not something that looks like a URI,
-				 * create one by concatenating it to relbase; otherwise,
-				 * just parse the relation as a URI.
-				 */
-				relstr = (char *) crawl_alloc(me->crawl, t - vstart + strlen(relbase) + 1);
-				p = relstr;
-				abs = 0;
-				for(s = vstart; s < t; s++)
-				{
-					if(*s == ':' || *s == '/')
-					{
-						abs = 1;
-						break;
-					}
-				}
-				if(!abs)
-				{
-					strcpy(relstr, relbase);
-					p = strchr(relstr, 0);
-				}
-				for(s = vstart; s < t; s++)
-				{
-					if(*s == '"')
-					{
-						continue;
-					}
-					*p = *s;
-					p++;
-				}
-				*p = 0;
-			}
-			else if(!anchorstr && pend - value == 6 && !strncmp(value, "anchor", 6))
+			if(me->model)
 			{
-				anchorstr = (char *) crawl_alloc(me->crawl, t - vstart + 1);
-				p = anchorstr;
-				for(s = vstart; s < t; s++)
-				{
-					if(*s == '"')
-					{
-						continue;
-					}
-					*p = *s;
-					p++;
-				}
-				*p = 0;
+				/* Add the triple to the model */
+				librdf_model_add_statement(me->model, st);
 			}
-			value = t;
-			if(!*value || *value == ',')
+			else
 			{
-				break;
+				rdf_process_statement(me, obj, objuri, st, links);
 			}
-			value++;
-		}
-		/* We have now parsed all parameters */
-		anchor = NULL;
-		rel = NULL;
-		uri = NULL;
-		if(anchorstr)
-		{
-			anchor = librdf_new_uri_relative_to_base(resource, (const unsigned char *) anchorstr);
-		}
-		else
-		{
-			anchor = resource;
-		}
-		if(relstr)
-		{
-			uri = librdf_new_uri_relative_to_base(anchor, (const unsigned char *) uristr);
-			
-			/* Only process links which actually have a relation */
-			rel = librdf_new_uri(me->world, (const unsigned char *) relstr);
-			log_printf(LOG_DEBUG, "RDF: Link <%s> <%s> <%s>\n",
-					   (const char *) librdf_uri_to_string(anchor),
-					   (const char *) librdf_uri_to_string(rel),
-					   (const char *) librdf_uri_to_string(uri));
-			/* Create a new triple (content-location, relation, target) */
-			subject = librdf_new_node_from_uri(me->world, anchor);
-			predicate = librdf_new_node_from_uri(me->world, rel);
-			object = librdf_new_node_from_uri(me->world, uri);
-			st = librdf_new_statement_from_nodes(me->world, subject, predicate, object);
-			/* Add the triple to the model */
-			librdf_model_add_statement(me->model, st);
 			librdf_free_statement(st);
-			librdf_free_uri(rel);
-			librdf_free_uri(uri);
 		}
-		if(anchor && anchor != resource)
-		{
-			librdf_free_uri(anchor);
-		}
-		crawl_free(me->crawl, anchorstr);
-		anchorstr = NULL;
+	}
+	if(rel)
+	{
+		librdf_free_uri(rel);
+	}
+	if(uri)
+	{
+		librdf_free_uri(uri);
+	}
+	if(anchor && anchor != resource)
+	{
+		librdf_free_uri(anchor);
+	}
+	if(relstr != link->rel && relstr != relbuf)
+	{
 		crawl_free(me->crawl, relstr);
-		relstr = NULL;
-		crawl_free(me->crawl, uristr);
-		uristr = NULL;
-		
-		if(*value)
-		{
-			value++;
-		}
 	}
 	return 0;
 }
 
 static int
-rdf_process_node(PROCESSOR *me, CRAWLOBJ *obj, librdf_node *node, struct curl_slist **subjects)
+rdf_process_node(PROCESSOR *me, CRAWLOBJ *obj, librdf_node *node, LINKSET *links)
 {
 	librdf_uri *uri;
-	struct curl_slist *p;
 	const char *s;
+	size_t len;
 
 	(void) me;
 	(void) obj;
@@ -617,20 +1076,25 @@ rdf_process_node(PROCESSOR *me, CRAWLOBJ *obj, librdf_node *node, struct curl_sl
 	{
 		return -1;
 	}
-	s = (const char *) librdf_uri_as_string(uri);
+	s = (const char *) librdf_uri_as_counted_string(uri, &len);
 	if(!s)
 	{
 		return -1;
 	}
-	for(p = *subjects; p; p = p->next)
+	return rdf_add_link(links, s, len);
+}
+
+static int
+rdf_add_link(LINKSET *links, const char *s, size_t len)
+{
+	switch(linkset_add(links, s, len))
 	{
-		if(!strcmp(s, p->data))
-		{
-			return 0;
-		}
+	case -1:
+		return -1;
+	case 1:
+		log_printf(LOG_DEBUG, "RDF: adding <%.*s>\n", (int) len, s);
+		break;
 	}
-	log_printf(LOG_DEBUG, "RDF: adding <%s>\n", s);
-	*subjects = curl_slist_append(*subjects, s);
 	return 0;
 }
 
@@ -642,6 +1106,32 @@ rdf_set_filter(PROCESSOR *me, rdf_filter_cb filter)
 	return 0;
 }
 
+/* Set a handler to be invoked for each statement as it is parsed; if a
+ * filter is set along with a statement handler, the payload is processed
+ * as a stream and the filter is invoked with a NULL model.
+ */
+int
+rdf_set_statement_handler(PROCESSOR *me, rdf_statement_cb handler)
+{
+	me->statement = handler;
+
+	return 0;
+}
+
+/* Set a handler to be invoked for each triple located by the fast
+ * N-Triples/N-Quads scanner, which doesn't construct librdf statements; the
+ * subject and object are NULL if they're not IRIs, and none of the strings
+ * are NUL-terminated. A filter is only bypassed in favour of the scanner if
+ * a triple handler has been set.
+ */
+int
+rdf_set_triple_handler(PROCESSOR *me, rdf_triple_cb handler)
+{
+	me->triple = handler;
+
+	return 0;
+}
+
 librdf_world *
 rdf_world(PROCESSOR *me)
 {
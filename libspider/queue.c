@@ -53,6 +53,11 @@ spider_queue_create_uri(SPIDER *spider, URI *uri)
 	{
 		/* No scheme at all */
 	}
+	else if(!strcmp(info->scheme, "mem") || !strcmp(info->scheme, "log"))
+	{
+		/* In-memory queue, optionally journalled to disk */
+		p = spider_queue_mem_create_(spider, uri);
+	}
 #if WITH_LIBSQL
 	else if(sql_scheme_exists(info->scheme))
 	{
@@ -196,6 +201,26 @@ queue_add_uristr(CRAWL *crawl, const char *uristr)
 	return r;
 }
 
+/* Add a set of URIs to the crawl queue; returns -1 if any of them could not
+ * be added, although the remainder will still have been.
+ */
+int
+queue_add_uristrs(CRAWL *crawl, const char *const *uristrs, size_t count)
+{
+	size_t c;
+	int r;
+
+	r = 0;
+	for(c = 0; c < count; c++)
+	{
+		if(queue_add_uristr(crawl, uristrs[c]) < 0)
+		{
+			r = -1;
+		}
+	}
+	return r;
+}
+
 /* Add a URI to the crawl queue */
 int
 queue_add_uri(CRAWL *crawl, URI *uri)
@@ -252,6 +277,20 @@ queue_updated_uri(CRAWL *crawl, URI *uri, time_t updated, time_t last_modified,
 	return data->queue->api->updated_uri(data->queue, uri, updated, last_modified, status, ttl, state);
 }
 
+/* Mark a fetched object as updated */
+int
+queue_updated_obj(CRAWL *crawl, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	CONTEXT *data;
+	
+	data = crawl_userdata(crawl);
+	if(data->queue->api->updated_obj)
+	{
+		return data->queue->api->updated_obj(data->queue, obj, updated, last_modified, status, ttl, state);
+	}
+	return data->queue->api->updated_uristr(data->queue, crawl_obj_uristr(obj), updated, last_modified, status, ttl, state);
+}
+
 /* Mark a URI as unchanged */
 int
 queue_unchanged_uristr(CRAWL *crawl, const char *uristr, int error)
@@ -284,6 +323,10 @@ queue_handler_(CRAWL *crawl, URI **next, CRAWLSTATE *state, void *userdata)
 	
 	spider = (SPIDER *) userdata;
 
+	/* Update the queue for any processed objects which have been waiting
+	 * for long enough to be stored
+	 */
+	spider_processor_flush_(spider, 0);
 	/* If the spider has already been terminated, return immediately */
 	if(spider->api->terminated(spider))
 	{
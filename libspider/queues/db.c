@@ -36,11 +36,19 @@
  * crawl_resource.next_fetch AND crawl_root.earliest_update. If either is
  * the future, then the resource will not be dequeued.
  *
+ * Resources are claimed in batches (of up to queue:batch-size resources,
+ * each from a different root) by setting crawl_resource.crawl_instance and
+ * crawl_resource.lease_expires, and are then returned by successive calls
+ * to db_next(). Claimed resources are not dequeued again until either the
+ * resource has been updated or the lease has expired.
+ *
  * Once a fetch has been completed, crawl_resource.state will be set to
  * one of FAILED, REJECTED, SKIPPED, or ACCEPTED. Other applications can use
  * this status to feed fetched resources into other processing tools, and are
  * free to use the COMPLETE status to indicate that their own processing on
- * a queued resource has concluded.
+ * a queued resource has concluded. If a resource is re-fetched and its
+ * payload is identical to the previous one (crawl_resource.digest), its
+ * state is left unchanged.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -49,6 +57,14 @@
 
 #define QUEUE_STRUCT_DEFINED           1
 #define TXN_MAX_RETRIES                10
+#define DEFAULT_BATCH_SIZE             16
+#define DEFAULT_LEASE                  900
+/* The number of candidate rows selected for each URI in a batch, so that
+ * a batch can be filled with resources from distinct roots
+ */
+#define BATCH_OVERSELECT               4
+#define DEFAULT_ADD_BUFFER             256
+#define DEFAULT_ADD_FLUSH              5
 
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +72,7 @@
 #include <errno.h>
 
 #include "libspider.h"
+#include "p_queues.h"
 
 #include <libsql.h>
 
@@ -74,6 +91,7 @@ static int db_add(QUEUE *me, URI *uri, const char *uristr);
 static int db_force_add(QUEUE *me, URI *uri, const char *uristr);
 static int db_updated_uri(QUEUE *me, URI *uri, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
 static int db_updated_uristr(QUEUE *me, const char *uri, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+static int db_updated_obj(QUEUE *me, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
 static int db_unchanged_uri(QUEUE *me, URI *uri, int error);
 static int db_unchanged_uristr(QUEUE *me, const char *uristr, int error);
 static int db_set_crawlers(QUEUE *db, int count);
@@ -84,11 +102,15 @@ static int db_set_cache(QUEUE *db, int id);
 /* Utilities */
 static int db_insert_resource(QUEUE *me, const char *cachekey, uint32_t shortkey, const char *uri, const char *rootkey, int force);
 static int db_insert_root(QUEUE *me, const char *rootkey, const char *uri);
+static int db_pending_add(QUEUE *me, const char *cachekey, uint32_t shortkey, char *uri, const char *rootkey, char *root);
+static int db_pending_flush(QUEUE *me);
 
 /* Database transaction implementation callbacks */
 static int db_insert_resource_txn(SQL *db, void *userdata);
 static int db_insert_root_txn(SQL *db, void *userdata);
 static int db_next_txn(SQL *db, void *userdata);
+static int db_updated_txn(SQL *db, void *userdata);
+static int db_pending_flush_txn(SQL *db, void *userdata);
 
 /* Database logging callbacks */
 static int db_log_query(SQL *restrict db, const char *restrict statement);
@@ -96,6 +118,15 @@ static int db_log_error(SQL *restrict db, const char *restrict sqlstate, const c
 
 /* Private */
 static int db_add_(QUEUE *me, URI *uri, const char *uristr, int force);
+static int db_seen_warm_(QUEUE *me);
+static int db_updated_key_(QUEUE *me, const char *cachekey, const char *digest, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+static CRAWLSTATE db_parse_state_(const char *statestr);
+static size_t db_claims_list_(QUEUE *me, char *buf, size_t bufsize, size_t start, int root, int rate);
+static void db_claims_reset_(QUEUE *me);
+static int db_claims_release_(QUEUE *me);
+static int db_sqlbuf_append_(QUEUE *me, const char *str, size_t len);
+static int db_sqlbuf_str_(QUEUE *me, const char *str);
+static int db_sqlbuf_quote_(QUEUE *me, const char *str);
 
 /* Queue implementation method structure */
 static struct queue_api_struct db_api = {
@@ -112,7 +143,8 @@ static struct queue_api_struct db_api = {
 	db_set_crawlers,
 	db_set_caches,
 	db_set_crawler,
-	db_set_cache
+	db_set_cache,
+	db_updated_obj
 };
 
 /* Private data specific to this queue implementation */
@@ -127,10 +159,47 @@ struct queue_struct
 	int cache_id;
 	int ncrawlers;
 	int ncaches;
-	char *buf;
-	size_t buflen;
 	int oneshot;
 	URI *testuri;
+	/* Resources claimed by the most recent batched dequeue */
+	struct db_claim_struct *claims;
+	size_t nclaims;
+	size_t claimpos;
+	int batchsize;
+	int lease;
+	/* Resources discovered but not yet inserted into the database */
+	struct db_pending_struct *pending;
+	size_t npending;
+	size_t pendingsize;
+	time_t pending_since;
+	int addbuffer;
+	int addflush;
+	/* Nonzero if this queue holds a reference to the seen-set */
+	int seen;
+	/* Buffer used to construct multi-row statements */
+	char *sqlbuf;
+	size_t sqlbuflen;
+	size_t sqlbufsize;
+};
+
+/* A single resource claimed by db_next_txn() */
+struct db_claim_struct
+{
+	char *uristr;
+	CRAWLSTATE state;
+	char hash[36];
+	char root[36];
+	int rate;
+};
+
+/* A resource added via db_add() which is awaiting insertion */
+struct db_pending_struct
+{
+	char cachekey[48];
+	uint32_t shortkey;
+	char *uri;
+	char rootkey[48];
+	char *root;
 };
 
 /* Internal state passed to and from db_insert_resource_txn() */
@@ -152,12 +221,26 @@ struct db_insert_root_struct
 	const char *uri;
 };
 
+/* Internal state passed to and from db_updated_txn() */
+struct db_updated_struct
+{
+	QUEUE *me;
+	const char *cachekey;
+	const char *digest;
+	const char *statestr;
+	int status;
+	char updatedstr[32];
+	char lastmodstr[32];
+	char nextfetchstr[32];
+	char nowstr[32];
+	char earlieststr[32];
+};
+
 /* Internal state passed to and from db_next_txn() */
 struct db_next_struct
 {
 	QUEUE *me;
-	char *uristr;
-	CRAWLSTATE state;
+	const char *leasestr;
 };
 
 
@@ -167,6 +250,7 @@ spider_queue_db_create_(SPIDER *spider, URI *uri)
 	QUEUE *p;
 	CRAWL *crawl;
 	char *t, *dburi;
+	int r;
 
 	crawl = spider->api->crawler(spider);
 	p = (QUEUE *) crawl_alloc(crawl, sizeof(QUEUE));
@@ -182,12 +266,35 @@ spider_queue_db_create_(SPIDER *spider, URI *uri)
 	p->cache_id = spider->api->crawler_id(spider);
 	p->ncrawlers = spider->api->threads(spider);
 	p->ncaches = spider->api->threads(spider);
+	p->batchsize = spider->api->config_get_int(spider, "queue:batch-size", DEFAULT_BATCH_SIZE);
+	if(p->batchsize < 1)
+	{
+		p->batchsize = 1;
+	}
+	p->lease = spider->api->config_get_int(spider, "queue:lease", DEFAULT_LEASE);
+	if(p->lease < 1)
+	{
+		p->lease = DEFAULT_LEASE;
+	}
+	p->addbuffer = spider->api->config_get_int(spider, "queue:add-buffer", DEFAULT_ADD_BUFFER);
+	if(p->addbuffer < 1)
+	{
+		p->addbuffer = 1;
+	}
+	p->addflush = spider->api->config_get_int(spider, "queue:add-flush", DEFAULT_ADD_FLUSH);
+	p->claims = (struct db_claim_struct *) crawl_alloc(crawl, sizeof(struct db_claim_struct) * p->batchsize);
+	if(!p->claims)
+	{
+		crawl_free(crawl, p);
+		return NULL;
+	}
 	dburi = uri_stralloc(uri);
 	spider->api->log(spider, LOG_DEBUG, "DB: connecting to queue URI <%s>\n", dburi);
 	p->db = sql_connect(dburi);
 	if(!p->db)
 	{
 		spider->api->log(spider, LOG_CRIT, MSG_C_DB_CONNECT " <%s>\n", dburi);
+		crawl_free(crawl, p->claims);
 		crawl_free(crawl, p);
 		crawl_free(crawl, dburi);
 		return NULL;
@@ -207,6 +314,7 @@ spider_queue_db_create_(SPIDER *spider, URI *uri)
 	{
 		spider->api->log(spider, LOG_CRIT, MSG_C_DB_MIGRATE "\n");
 		sql_disconnect(p->db);
+		crawl_free(crawl, p->claims);
 		crawl_free(crawl, p);
 		return NULL;
 	}
@@ -227,6 +335,7 @@ spider_queue_db_create_(SPIDER *spider, URI *uri)
 			{
 				spider->api->log(spider, LOG_CRIT, MSG_C_DB_URIPARSE " <%s>\n", t);
 				sql_disconnect(p->db);
+				crawl_free(crawl, p->claims);
 				crawl_free(crawl, p);
 				crawl_free(crawl, t);
 				return NULL;
@@ -236,6 +345,16 @@ spider_queue_db_create_(SPIDER *spider, URI *uri)
 		}
 		crawl_free(crawl, t);
 	}
+	if(!p->oneshot)
+	{
+		r = queue_seen_attach_(spider);
+		if(r == 1)
+		{
+			/* This is the first queue to use the seen-set, populate it */
+			db_seen_warm_(p);
+		}
+		p->seen = (r >= 0);
+	}
 	return p;
 }
 
@@ -279,7 +398,7 @@ db_migrate(SQL *restrict sql, const char *identifier, int newversion, void *rest
 	if(newversion == 0)
 	{
 		/* Return target version */
-		return 9;
+		return 11;
 	}
 	log_printf(LOG_NOTICE, MSG_N_DB_MIGRATING " to version %d\n", newversion);
 	if(newversion == 1)
@@ -577,6 +696,53 @@ db_migrate(SQL *restrict sql, const char *identifier, int newversion, void *rest
 		}   
 		return 0;
 	}
+	if(newversion == 10)
+	{
+		/* crawl_resource.crawl_instance is set when a crawler claims a
+		 * resource; the claim is only honoured until lease_expires, after
+		 * which the resource can be dequeued again (e.g., if the crawler
+		 * exited without completing it)
+		 */
+		switch(variant)
+		{
+		case SQL_VARIANT_MYSQL:
+			ddl = "ALTER TABLE \"crawl_resource\" "
+				"ADD COLUMN \"lease_expires\" DATETIME DEFAULT NULL COMMENT 'Time that the active crawler instance claim expires' AFTER \"crawl_instance\"";
+			break;
+		case SQL_VARIANT_POSTGRES:
+		case SQL_VARIANT_SQLITE:
+			ddl = "ALTER TABLE \"crawl_resource\" ADD COLUMN \"lease_expires\" TIMESTAMP DEFAULT NULL";
+			break;
+		}
+		if(sql_execute(sql, ddl))
+		{
+			return -1;
+		}
+		return 0;
+	}
+	if(newversion == 11)
+	{
+		/* crawl_resource.digest is the SHA-256 digest of the payload most
+		 * recently fetched, which allows byte-identical payloads to be
+		 * recognised
+		 */
+		switch(variant)
+		{
+		case SQL_VARIANT_MYSQL:
+			ddl = "ALTER TABLE \"crawl_resource\" "
+				"ADD COLUMN \"digest\" CHAR(64) DEFAULT NULL COMMENT 'SHA-256 digest of the most recently-fetched payload' AFTER \"status\"";
+			break;
+		case SQL_VARIANT_POSTGRES:
+		case SQL_VARIANT_SQLITE:
+			ddl = "ALTER TABLE \"crawl_resource\" ADD COLUMN \"digest\" CHAR(64) DEFAULT NULL";
+			break;
+		}
+		if(sql_execute(sql, ddl))
+		{
+			return -1;
+		}
+		return 0;
+	}
 	return -1;
 }
 
@@ -600,9 +766,18 @@ db_release(QUEUE *me)
 	crawl = me->crawl;
 	if(me->db)
 	{
+		db_pending_flush(me);
+		db_claims_release_(me);
 		sql_disconnect(me->db);
 	}
-	crawl_free(crawl, me->buf);
+	if(me->seen)
+	{
+		queue_seen_detach_(me->spider);
+	}
+	db_claims_reset_(me);
+	crawl_free(crawl, me->claims);
+	crawl_free(crawl, me->pending);
+	crawl_free(crawl, me->sqlbuf);
 	crawl_free(crawl, me);
 	return 0;
 }
@@ -611,6 +786,10 @@ static int
 db_next(QUEUE *me, URI **next, CRAWLSTATE *state)
 {
 	struct db_next_struct data;
+	struct db_claim_struct *claim;
+	char leasestr[32];
+	time_t lease;
+	struct tm tm;
 	
 	*state = COS_NEW;
 	*next = NULL;
@@ -626,31 +805,46 @@ db_next(QUEUE *me, URI **next, CRAWLSTATE *state)
 	{
 		return 0;
 	}
-	memset(&data, 0, sizeof(data));
-	data.me = me;
-	/* Perform the actual fetch within a transaction to prevent a race
-	 * between other threads and instances; we fetch the first item from the
-	 * top of the queue and then update the earliest_update field on the
-	 * corresponding root according to its rate; this will invalidate any
-	 * other competing transactions and cause them to retry.
-	 */
-	if(sql_perform(me->db, db_next_txn, &data, TXN_MAX_RETRIES, SQL_TXN_DEFAULT))
-	{
-		log_printf(LOG_CRIT, MSG_C_DB_SQL ": %s\n", sql_error(me->db));
-		return -1;
-	}
-	if(!data.uristr)
-	{
-		/* log_printf(LOG_DEBUG, "db_next: queue query returned no results\n"); */
-		return 0;
+	db_pending_flush(me);
+	if(me->claimpos >= me->nclaims)
+	{
+		/* The previous batch has been exhausted, claim another */
+		db_claims_reset_(me);
+		lease = time(NULL) + me->lease;
+		gmtime_r(&lease, &tm);
+		strftime(leasestr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+		memset(&data, 0, sizeof(data));
+		data.me = me;
+		data.leasestr = leasestr;
+		/* Perform the actual claim within a transaction to prevent a race
+		 * between other threads and instances; we select a batch of items
+		 * from the top of the queue, each from a distinct root, stamp them
+		 * with our crawler ID and lease expiry, and then update the
+		 * earliest_update field on the corresponding roots according to
+		 * their rates; this will invalidate any other competing transactions
+		 * and cause them to retry.
+		 */
+		if(sql_perform(me->db, db_next_txn, &data, TXN_MAX_RETRIES, SQL_TXN_DEFAULT))
+		{
+			log_printf(LOG_CRIT, MSG_C_DB_SQL ": %s\n", sql_error(me->db));
+			db_claims_reset_(me);
+			return -1;
+		}
+		if(!me->nclaims)
+		{
+			/* log_printf(LOG_DEBUG, "db_next: queue query returned no results\n"); */
+			return 0;
+		}
 	}
-	*state = data.state;
-	/* log_printf(LOG_DEBUG, "db_next: Crawling next uristr %s\n", data.uristr); */
-	*next = uri_create_str(data.uristr, NULL);	
+	claim = &(me->claims[me->claimpos]);
+	me->claimpos++;
+	*state = claim->state;
+	/* log_printf(LOG_DEBUG, "db_next: Crawling next uristr %s\n", claim->uristr); */
+	*next = uri_create_str(claim->uristr, NULL);	
 	if(!*next)
 	{
 		log_printf(LOG_CRIT, MSG_C_DB_SQL ": failed to parse URI <%s> in dequeue: %s\n",
-				   data.uristr, strerror(errno));
+				   claim->uristr, strerror(errno));
 		return -1;
 	}
 	return 0;
@@ -660,26 +854,27 @@ static int
 db_next_txn(SQL *db, void *userdata)
 {
 	struct db_next_struct *data;
+	struct db_claim_struct *claim;
 	QUEUE *me;
 	SQL_STATEMENT *rs;
-	size_t needed;
-	char *p;
+	size_t needed, c, bufsize, len;
+	char *buf;
 	char statebuf[32];
-	char root_hash[36];
 	char timestr[32];
-	int root_rate;
 	time_t now;
 	struct tm tm;
 
 	data = (struct db_next_struct *) userdata;
 	me = data->me;
-	data->uristr = NULL;
+	/* Discard anything claimed by a previous attempt at this transaction */
+	db_claims_reset_(me);
 
-	/* Query for the next valid resource, fetching its URI, state, and
-	 * associated root hash and fetch rate
+	/* Query for the next valid resources which aren't already claimed by
+	 * a crawler (or whose claim has expired), fetching their hashes, URIs,
+	 * states, and associated root hashes and fetch rates
 	 */
 	rs = sql_queryf(db,
-					"SELECT \"res\".\"uri\", \"res\".\"state\", \"root\".\"hash\", \"root\".\"rate\" "
+					"SELECT \"res\".\"hash\", \"res\".\"uri\", \"res\".\"state\", \"root\".\"hash\", \"root\".\"rate\" "
 					" FROM "
 					" \"crawl_resource\" \"res\", \"crawl_root\" \"root\" "
 					" WHERE "
@@ -687,111 +882,243 @@ db_next_txn(SQL *db, void *userdata)
 					" \"res\".\"tinyhash\" %% %d = %d AND "
 					" \"root\".\"hash\" = \"res\".\"root\" AND "
 					" \"root\".\"earliest_update\" < NOW() AND "
-					" \"res\".\"next_fetch\" < NOW() "
-					" ORDER BY \"res\".\"state\" = 'NEW' DESC, \"root\".\"earliest_update\" ASC, \"res\".\"next_fetch\" ASC, \"root\".\"rate\" ASC",
-					me->ncrawlers, me->crawler_id);
+					" \"res\".\"next_fetch\" < NOW() AND "
+					" (\"res\".\"crawl_instance\" IS NULL OR \"res\".\"lease_expires\" IS NULL OR \"res\".\"lease_expires\" < NOW()) "
+					" ORDER BY \"res\".\"state\" = 'NEW' DESC, \"root\".\"earliest_update\" ASC, \"res\".\"next_fetch\" ASC, \"root\".\"rate\" ASC "
+					" LIMIT %d",
+					me->ncrawlers, me->crawler_id, me->batchsize * BATCH_OVERSELECT);
 	if(!rs)
 	{
 		me->spider->api->log(me->spider, LOG_CRIT, MSG_C_DB_SQL ": %s\n", sql_error(me->db));
 		return SQL_TXN_ABORT;
 	}
-	if(sql_stmt_eof(rs))
+	for(; !sql_stmt_eof(rs) && me->nclaims < (size_t) me->batchsize; sql_stmt_next(rs))
 	{
-		return SQL_TXN_ROLLBACK;
+		claim = &(me->claims[me->nclaims]);
+		memset(claim, 0, sizeof(struct db_claim_struct));
+		sql_stmt_value(rs, 3, claim->root, sizeof(claim->root));
+		/* Only one resource from any given root is claimed in a batch, so
+		 * that the root's fetch rate is still observed
+		 */
+		for(c = 0; c < me->nclaims; c++)
+		{
+			if(!strcmp(me->claims[c].root, claim->root))
+			{
+				break;
+			}
+		}
+		if(c < me->nclaims)
+		{
+			continue;
+		}
+		sql_stmt_value(rs, 0, claim->hash, sizeof(claim->hash));
+		/* The hashes are interpolated directly into the claim statements */
+		if(!claim->hash[0] || strspn(claim->hash, "0123456789abcdefABCDEF") != strlen(claim->hash) ||
+		   !claim->root[0] || strspn(claim->root, "0123456789abcdefABCDEF") != strlen(claim->root))
+		{
+			continue;
+		}
+		memset(statebuf, 0, sizeof(statebuf));
+		sql_stmt_value(rs, 2, statebuf, sizeof(statebuf));
+		claim->state = db_parse_state_(statebuf);
+		/* Obtain the resource URI string */
+		needed = sql_stmt_value(rs, 1, NULL, 0);
+		claim->uristr = (char *) crawl_alloc(me->crawl, needed + 1);
+		if(!claim->uristr)
+		{
+			sql_stmt_destroy(rs);
+			return SQL_TXN_ABORT;
+		}
+		if(sql_stmt_value(rs, 1, claim->uristr, needed + 1) != needed)
+		{
+			sql_stmt_destroy(rs);
+			return SQL_TXN_ABORT;
+		}
+		/* Within the database, crawl_root.rate is specified in milliseconds;
+		 * currently we only care about granularity to within a second. This
+		 * could be rounded rather than divided, but nothing actually sets any
+		 * value other than 1000 in any case.
+		 */
+		claim->rate = (int) (sql_stmt_long(rs, 4) / 1000);
+		if(claim->rate < 1)
+		{
+			claim->rate = 1;
+		}
+		me->nclaims++;
 	}
-	if(sql_stmt_eof(rs))
+	sql_stmt_destroy(rs);
+	if(!me->nclaims)
 	{
 /*		log_printf(LOG_DEBUG, "db_next: queue query returned no results\n"); */
-		sql_stmt_destroy(rs);
-		return 0;
+		return SQL_TXN_ROLLBACK;
 	}
-	memset(statebuf, 0, sizeof(statebuf));
-	sql_stmt_value(rs, 1, statebuf, sizeof(statebuf));
-	/* Parse the crawl state of the resource into data->state */
-	if(!strcmp(statebuf, "NEW"))
+	bufsize = 256 + (me->nclaims * (sizeof(claim->hash) + 3));
+	buf = (char *) crawl_alloc(me->crawl, bufsize);
+	if(!buf)
 	{
-		data->state = COS_NEW;
+		return SQL_TXN_ABORT;
 	}
-	else if(!strcmp(statebuf, "FAILED"))
+	/* Stamp the claimed resources with our crawler ID and lease expiry */
+	len = snprintf(buf, bufsize, "UPDATE \"crawl_resource\" SET \"crawl_instance\" = %d, \"lease_expires\" = '%s' WHERE \"hash\" IN (",
+				   me->crawler_id, data->leasestr);
+	db_claims_list_(me, buf + len, bufsize - len, 0, 0, 0);
+	if(sql_execute(db, buf))
 	{
-		data->state = COS_FAILED;
+		crawl_free(me->crawl, buf);
+		if(sql_deadlocked(db))
+		{
+			return SQL_TXN_RETRY;
+		}
+		return SQL_TXN_ABORT;
 	}
-	else if(!strcmp(statebuf, "REJECTED"))
+	/* To prevent race-conditions (#41), update crawl_root.earliest_update
+	 * for each of the roots immediately, by adding the root's rate (in
+	 * seconds) to the current time; one statement is issued for each
+	 * distinct rate.
+	 */
+	for(c = 0; c < me->nclaims; c++)
 	{
-		data->state = COS_REJECTED;
+		for(needed = 0; needed < c; needed++)
+		{
+			if(me->claims[needed].rate == me->claims[c].rate)
+			{
+				break;
+			}
+		}
+		if(needed < c)
+		{
+			continue;
+		}
+		now = time(NULL) + me->claims[c].rate;
+		gmtime_r(&now, &tm);
+		strftime(timestr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+		len = snprintf(buf, bufsize, "UPDATE \"crawl_root\" SET \"earliest_update\" = '%s' WHERE \"earliest_update\" < '%s' AND \"hash\" IN (",
+					   timestr, timestr);
+		db_claims_list_(me, buf + len, bufsize - len, c, 1, me->claims[c].rate);
+		if(sql_execute(db, buf))
+		{
+			/* log_printf(LOG_ERR, "db_next_txn: txn fail\n"); */
+			crawl_free(me->crawl, buf);
+			return SQL_TXN_RETRY;
+		}
+	}
+	crawl_free(me->crawl, buf);
+	/* log_printf(LOG_INFO, "db_next_txn: txn commit\n"); */
+	return SQL_TXN_COMMIT;
+}
+
+/* Parse the crawl state of a resource */
+static CRAWLSTATE
+db_parse_state_(const char *statestr)
+{
+	if(!strcmp(statestr, "FAILED"))
+	{
+		return COS_FAILED;
 	}
-	else if(!strcmp(statebuf, "ACCEPTED"))
+	if(!strcmp(statestr, "REJECTED"))
 	{
-		data->state = COS_ACCEPTED;
+		return COS_REJECTED;
 	}
-	else if(!strcmp(statebuf, "COMPLETE"))
+	if(!strcmp(statestr, "ACCEPTED"))
 	{
-		data->state = COS_COMPLETE;
+		return COS_ACCEPTED;
 	}
-	else if(!strcmp(statebuf, "FORCE"))
+	if(!strcmp(statestr, "COMPLETE"))
 	{
-		data->state = COS_FORCE;
+		return COS_COMPLETE;
 	}
-	else if(!strcmp(statebuf, "SKIPPED"))
+	if(!strcmp(statestr, "FORCE"))
 	{
-		data->state = COS_SKIPPED;
+		return COS_FORCE;
 	}
-	/* Obtain the resource URI string */
-	needed = sql_stmt_value(rs, 0, NULL, 0);
-	if(needed > me->buflen)
+	if(!strcmp(statestr, "SKIPPED"))
 	{
-		p = (char *) crawl_realloc(me->crawl, me->buf, needed + 1);
-		if(!p)
+		return COS_SKIPPED;
+	}
+	return COS_NEW;
+}
+
+/* Write a parenthesised, quoted, comma-separated list of the resource (or,
+ * if root is nonzero, root) hashes of the claims from index 'start' onwards
+ * to buf; if root is nonzero, only claims with the specified rate are
+ * included. Returns the number of hashes written.
+ */
+static size_t
+db_claims_list_(QUEUE *me, char *buf, size_t bufsize, size_t start, int root, int rate)
+{
+	size_t c, count, len;
+	const char *hash;
+
+	count = 0;
+	len = 0;
+	for(c = start; c < me->nclaims; c++)
+	{
+		if(root && me->claims[c].rate != rate)
 		{
-			sql_stmt_destroy(rs);
-			return SQL_TXN_ABORT;
+			continue;
+		}
+		hash = (root ? me->claims[c].root : me->claims[c].hash);
+		if(len + strlen(hash) + 5 >= bufsize)
+		{
+			break;
 		}
-		me->buf = p;
-		me->buflen = needed + 1;
+		len += snprintf(buf + len, bufsize - len, "%s'%s'", (count ? "," : ""), hash);
+		count++;
 	}
-	if(sql_stmt_value(rs, 0, me->buf, me->buflen) != needed)
+	snprintf(buf + len, bufsize - len, ")");
+	return count;
+}
+
+/* Discard the current batch of claims */
+static void
+db_claims_reset_(QUEUE *me)
+{
+	size_t c;
+
+	for(c = 0; c < me->nclaims; c++)
 	{
-		sql_stmt_destroy(rs);
-		return SQL_TXN_ABORT;
+		crawl_free(me->crawl, me->claims[c].uristr);
 	}
-	data->uristr = me->buf;
-	/* Obtain the root's hash key and fetch rate */
-	sql_stmt_value(rs, 2, root_hash, sizeof(root_hash));
-	root_rate = (int) sql_stmt_long(rs, 3);	
-	sql_stmt_destroy(rs);
-	/* To prevent race-conditions (#41), update crawl_root.earliest_update
-	 * immediately.
-	 *
-	 * Within the database, crawl_root.rate is specified in milliseconds;
-	 * currently we only care about granularity to within a second. This could
-	 * be rounded rather than divided, but nothing actually sets any value
-	 * other than 1000 in
-	 * any case.
-	 */
-	root_rate /= 1000;
-	if(root_rate < 1)
+	me->nclaims = 0;
+	me->claimpos = 0;
+}
+
+/* Relinquish our claim on any resources which have been claimed but not yet
+ * dequeued, so that they can be crawled straight away rather than once
+ * their leases expire
+ */
+static int
+db_claims_release_(QUEUE *me)
+{
+	char *buf;
+	size_t bufsize, len;
+	int r;
+
+	if(me->claimpos >= me->nclaims)
 	{
-		root_rate = 1;
+		return 0;
 	}
-	/* Add the root_rate (in seconds) to the current time and set it as
-	 * the earliest_update time on the crawl_root
-	 */
-	now = time(NULL) + root_rate;
-	gmtime_r(&now, &tm);
-	strftime(timestr, 32, "%Y-%m-%d %H:%M:%S", &tm);
-/*	log_printf(LOG_INFO, "db_next_txn: set earliest_update=%s where hash=%s \n", timestr, root_hash); */
-	if(sql_executef(db, "UPDATE \"crawl_root\" SET \"earliest_update\" = %Q WHERE \"hash\" = %Q AND \"earliest_update\" < %Q",
-					timestr, root_hash, timestr) < 0)
+	bufsize = 256 + ((me->nclaims - me->claimpos) * (sizeof(me->claims[0].hash) + 3));
+	buf = (char *) crawl_alloc(me->crawl, bufsize);
+	if(!buf)
 	{
-		/* log_printf(LOG_ERR, "db_next_txn: txn fail\n"); */
-		return SQL_TXN_RETRY;
+		return -1;
 	}
-	/* log_printf(LOG_INFO, "db_next_txn: txn commit\n"); */
-	return SQL_TXN_COMMIT;
+	len = snprintf(buf, bufsize, "UPDATE \"crawl_resource\" SET \"crawl_instance\" = NULL, \"lease_expires\" = NULL WHERE \"crawl_instance\" = %d AND \"hash\" IN (",
+				   me->crawler_id);
+	db_claims_list_(me, buf + len, bufsize - len, me->claimpos, 0, 0);
+	r = sql_execute(me->db, buf);
+	crawl_free(me->crawl, buf);
+	me->claimpos = me->nclaims;
+	return (r ? -1 : 0);
 }
 
+/* Derive the canonical form, cache key and root of a URI; if checkseen is
+ * nonzero and the resource is present in the seen-set, 1 is returned
+ * before the root is derived
+ */
 static int
-db_uristr_key_root(QUEUE *me, const char *uristr, char **uri, char *urikey, uint32_t *shortkey, char **root, char *rootkey)
+db_uristr_key_root(QUEUE *me, const char *uristr, char **uri, char *urikey, uint32_t *shortkey, char **root, char *rootkey, int checkseen)
 {
 	URI *u_resource, *u_root;
 	char *str, *t;
@@ -836,6 +1163,16 @@ db_uristr_key_root(QUEUE *me, const char *uristr, char **uri, char *urikey, uint
 	strncpy(skey, urikey, 8);
 	skey[8] = 0;
 	*shortkey = (uint32_t) strtoul(skey, NULL, 16);
+	if(checkseen && queue_seen_check_(urikey))
+	{
+		uri_destroy(u_resource);
+		crawl_free(me->crawl, str);
+		if(uri)
+		{
+			*uri = NULL;
+		}
+		return 1;
+	}
 	
 	u_root = uri_create_str("/", u_resource);
 	if(!u_root)
@@ -909,13 +1246,27 @@ db_add_(QUEUE *me, URI *uri, const char *uristr, int force)
 	char *canonical, *root;
 	char cachekey[48], rootkey[48];
 	uint32_t shortkey;
+	int r;
 
 	(void) uri;
 
-	if(db_uristr_key_root(me, uristr, &canonical, cachekey, &shortkey, &root, rootkey))
+	r = db_uristr_key_root(me, uristr, &canonical, cachekey, &shortkey, &root, rootkey, !force);
+	if(r < 0)
 	{
 		return -1;
 	}
+	if(r > 0)
+	{
+		/* Already present in the queue */
+		return 0;
+	}
+	if(!force)
+	{
+		/* Ordinary additions are buffered and inserted in bulk */
+		return db_pending_add(me, cachekey, shortkey, canonical, rootkey, root);
+	}
+	/* Ensure anything added previously is present before forcing */
+	db_pending_flush(me);
 
 	db_insert_resource(me, cachekey, shortkey, canonical, rootkey, force);
 	db_insert_root(me, rootkey, root);
@@ -945,20 +1296,49 @@ static int
 db_updated_uristr(QUEUE *me, const char *uristr, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
 {
 	char *canonical, *root;
-	char cachekey[48], rootkey[48], updatedstr[32], lastmodstr[32], nextfetchstr[32];
+	char cachekey[48], rootkey[48];
 	uint32_t shortkey;
-	struct tm tm;
-	time_t now;
-	const char *statestr;
 	
-	if(db_uristr_key_root(me, uristr, &canonical, cachekey, &shortkey, &root, rootkey))
+	/* Processing of the object has finished, so flush any URIs which were
+	 * discovered during it
+	 */
+	db_pending_flush(me);
+	if(db_uristr_key_root(me, uristr, &canonical, cachekey, &shortkey, &root, rootkey, 0))
 	{
 		return -1;
 	}
+	crawl_free(me->crawl, root);
+	crawl_free(me->crawl, canonical);
+	return db_updated_key_(me, cachekey, NULL, updated, last_modified, status, ttl, state);
+}
+
+static int
+db_updated_obj(QUEUE *me, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	db_pending_flush(me);
+	/* The object's cache key is the same as the resource's hash, and so
+	 * the URI doesn't need to be parsed again
+	 */
+	return db_updated_key_(me, crawl_obj_key(obj), crawl_obj_digest(obj), updated, last_modified, status, ttl, state);
+}
+
+/* Update a resource, and its root, following a fetch */
+static int
+db_updated_key_(QUEUE *me, const char *cachekey, const char *digest, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	struct db_updated_struct data;
+	struct tm tm;
+	time_t now;
+	
+	memset(&data, 0, sizeof(data));
+	data.me = me;
+	data.cachekey = cachekey;
+	data.digest = digest;
+	data.status = status;
 	gmtime_r(&updated, &tm);
-	strftime(updatedstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	strftime(data.updatedstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
 	gmtime_r(&last_modified, &tm);
-	strftime(lastmodstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	strftime(data.lastmodstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
 	if(status != 200)
 	{
 		if(ttl < 86400)
@@ -975,87 +1355,83 @@ db_updated_uristr(QUEUE *me, const char *uristr, time_t updated, time_t last_mod
 	}
 	ttl += time(NULL);
 	gmtime_r(&ttl, &tm);
-	strftime(nextfetchstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	strftime(data.nextfetchstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	now = time(NULL);
+	gmtime_r(&now, &tm);
+	strftime(data.nowstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	now += 2;
+	gmtime_r(&now, &tm);
+	strftime(data.earlieststr, 32, "%Y-%m-%d %H:%M:%S", &tm);
 	switch(state)
 	{
-	case COS_NEW:
-		statestr = "NEW";
-		break;
 	case COS_ERR:
 	case COS_FAILED:
-		statestr = "FAILED";
+		data.statestr = "FAILED";
 		break;
 	case COS_REJECTED:
-		statestr = "REJECTED";
+		data.statestr = "REJECTED";
 		break;
 	case COS_ACCEPTED:
-		statestr = "ACCEPTED";
+		data.statestr = "ACCEPTED";
 		break;
 	case COS_COMPLETE:
-		statestr = "COMPLETE";
+		data.statestr = "COMPLETE";
 		break;
 	case COS_FORCE:
-		statestr = "FORCE";
+		data.statestr = "FORCE";
 		break;
 	case COS_SKIPPED:
 	case COS_SKIPPED_COMMIT:
-		statestr = "SKIPPED";
+		data.statestr = "SKIPPED";
+		break;
+	default:
+		data.statestr = "NEW";
 		break;
 	}
-	if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"updated\" = %Q, \"last_modified\" = %Q, \"status\" = %d, \"crawl_instance\" = NULL, \"state\" = %Q WHERE \"hash\" = %Q",
-					updatedstr, lastmodstr, status, statestr, cachekey))
-	{
-		log_printf(LOG_CRIT, MSG_C_DB_SQL ": %s\n", sql_error(me->db));
-		exit(1);
-	}
-	if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"next_fetch\" = %Q WHERE \"hash\" = %Q AND \"next_fetch\" < %Q",
-					nextfetchstr, cachekey, nextfetchstr))
-	{
-		log_printf(LOG_CRIT, MSG_C_DB_SQL ": %s\n", sql_error(me->db));
-		exit(1);
-	}
-	now = time(NULL);
-	gmtime_r(&now, &tm);
-	strftime(lastmodstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
-	now += 2;
-	strftime(nextfetchstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
-	if(sql_executef(me->db, "UPDATE \"crawl_root\" SET \"last_updated\" = %Q WHERE \"hash\" = %Q", lastmodstr, rootkey))
-	{
-		log_printf(LOG_CRIT, MSG_C_DB_SQL ": %s\n", sql_error(me->db));
-		exit(1);
-	}
-	if(sql_executef(me->db, "UPDATE \"crawl_root\" SET \"earliest_update\" = %Q WHERE \"hash\" = %Q AND \"earliest_update\" < %Q", nextfetchstr, rootkey, nextfetchstr))
+	if(sql_perform(me->db, db_updated_txn, &data, TXN_MAX_RETRIES, SQL_TXN_CONSISTENT))
 	{
-		log_printf(LOG_CRIT, MSG_C_DB_SQL "%s\n", sql_error(me->db));
-		exit(1);
+		me->spider->api->log(me->spider, LOG_ERR, MSG_E_DB_SQL ": failed to update resource %s: %s\n", cachekey, sql_error(me->db));
+		return -1;
 	}
-	if(status >= 400 && status < 499)
+	return 0;
+}
+
+static int
+db_updated_txn(SQL *db, void *userdata)
+{
+	struct db_updated_struct *data;
+
+	data = (struct db_updated_struct *) userdata;
+	/* Client errors (4xx) increment the hard error count, server errors
+	 * (5xx) reset it and increment the soft error count, and anything else
+	 * resets both; next_fetch is never moved earlier, and the digest is
+	 * only replaced if one was supplied.
+	 */
+	if(sql_executef(db, "UPDATE \"crawl_resource\" SET "
+					"\"updated\" = %Q, \"last_modified\" = %Q, \"status\" = %d, \"crawl_instance\" = NULL, \"lease_expires\" = NULL, \"state\" = %Q, "
+					"\"next_fetch\" = CASE WHEN \"next_fetch\" < %Q THEN %Q ELSE \"next_fetch\" END, "
+					"\"error_count\" = CASE WHEN %d >= 400 AND %d < 499 THEN \"error_count\" + 1 ELSE 0 END, "
+					"\"soft_error_count\" = CASE WHEN %d >= 500 AND %d < 599 THEN \"soft_error_count\" + 1 WHEN %d >= 400 AND %d < 499 THEN \"soft_error_count\" ELSE 0 END, "
+					"\"digest\" = COALESCE(%Q, \"digest\") "
+					"WHERE \"hash\" = %Q",
+					data->updatedstr, data->lastmodstr, data->status, data->statestr,
+					data->nextfetchstr, data->nextfetchstr,
+					data->status, data->status,
+					data->status, data->status, data->status, data->status,
+					data->digest,
+					data->cachekey))
 	{
-		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"error_count\" = \"error_count\" + 1 WHERE \"hash\" = %Q", cachekey))
-		{
-			log_printf(LOG_CRIT, MSG_C_DB_SQL "%s\n", sql_error(me->db));
-			exit(1);
-		}
+		return SQL_TXN_RETRY;
 	}
-	else if(status >= 500 && status < 599)
+	if(sql_executef(db, "UPDATE \"crawl_root\" SET "
+					"\"last_updated\" = %Q, "
+					"\"earliest_update\" = CASE WHEN \"earliest_update\" < %Q THEN %Q ELSE \"earliest_update\" END "
+					"WHERE \"hash\" = (SELECT \"root\" FROM \"crawl_resource\" WHERE \"hash\" = %Q)",
+					data->nowstr, data->earlieststr, data->earlieststr, data->cachekey))
 	{
-		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"error_count\" = 0, \"soft_error_count\" = \"soft_error_count\" + 1 WHERE \"hash\" = %Q", cachekey))
-		{
-			log_printf(LOG_CRIT, MSG_C_DB_SQL "%s\n", sql_error(me->db));
-			exit(1);
-		}
+		return SQL_TXN_RETRY;
 	}
-	else
-	{
-		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"error_count\" = 0, \"soft_error_count\" = 0 WHERE \"hash\" = %Q", cachekey))
-		{
-			log_printf(LOG_CRIT, MSG_C_DB_SQL "%s\n", sql_error(me->db));
-			exit(1);
-		}	
-	}	
-	crawl_free(me->crawl, root);
-	crawl_free(me->crawl, canonical);
-	return 0;
+	return SQL_TXN_COMMIT;
 }
 
 static int
@@ -1083,7 +1459,8 @@ db_unchanged_uristr(QUEUE *me, const char *uristr, int error)
 	struct tm tm;
 	time_t now, ttl;
 	
-	if(db_uristr_key_root(me, uristr, &canonical, cachekey, &shortkey, &root, rootkey))
+	db_pending_flush(me);
+	if(db_uristr_key_root(me, uristr, &canonical, cachekey, &shortkey, &root, rootkey, 0))
 	{
 		return -1;
 	}	
@@ -1103,7 +1480,7 @@ db_unchanged_uristr(QUEUE *me, const char *uristr, int error)
 		ttl = (86400 * 7) + now;
 		gmtime_r(&ttl, &tm);
 		strftime(nextfetchstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
-		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"updated\" = %Q, \"next_fetch\" = %Q, \"crawl_instance\" = NULL, \"error_count\" = \"error_count\" + 1 WHERE \"hash\" = %Q",
+		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"updated\" = %Q, \"next_fetch\" = %Q, \"crawl_instance\" = NULL, \"lease_expires\" = NULL, \"error_count\" = \"error_count\" + 1 WHERE \"hash\" = %Q",
 			updatedstr, nextfetchstr, cachekey))
 		{
 			log_printf(LOG_CRIT, MSG_C_DB_SQL "%s\n", sql_error(me->db));
@@ -1115,7 +1492,7 @@ db_unchanged_uristr(QUEUE *me, const char *uristr, int error)
 		ttl = (3600 * 2) + now;
 		gmtime_r(&ttl, &tm);
 		strftime(nextfetchstr, 32, "%Y-%m-%d %H:%M:%S", &tm);
-		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"updated\" = %Q, \"next_fetch\" = %Q, \"crawl_instance\" = NULL, \"error_count\" = 0 WHERE \"hash\" = %Q",
+		if(sql_executef(me->db, "UPDATE \"crawl_resource\" SET \"updated\" = %Q, \"next_fetch\" = %Q, \"crawl_instance\" = NULL, \"lease_expires\" = NULL, \"error_count\" = 0 WHERE \"hash\" = %Q",
 			updatedstr, nextfetchstr, cachekey))
 		{
 			log_printf(LOG_CRIT, MSG_C_DB_SQL "%s\n", sql_error(me->db));
@@ -1128,6 +1505,11 @@ db_unchanged_uristr(QUEUE *me, const char *uristr, int error)
 static int
 db_set_crawlers(QUEUE *me, int count)
 {
+	if(count != me->ncrawlers)
+	{
+		/* Claims made under the previous partitioning are relinquished */
+		db_claims_release_(me);
+	}
 	me->ncrawlers = count;
 	return 0;
 }
@@ -1142,6 +1524,10 @@ db_set_caches(QUEUE *me, int count)
 static int
 db_set_crawler(QUEUE *me, int id)
 {
+	if(id != me->crawler_id)
+	{
+		db_claims_release_(me);
+	}
 	me->crawler_id = id;
 	return 0;
 }
@@ -1292,3 +1678,274 @@ db_insert_root_txn(SQL *db, void *userdata)
 	}
 	return SQL_TXN_COMMIT;
 }
+
+/* Add a resource to the set awaiting insertion, taking ownership of the
+ * uri and root strings; the set is flushed once it is full, or once the
+ * oldest entry has been waiting for longer than queue:add-flush seconds
+ */
+static int
+db_pending_add(QUEUE *me, const char *cachekey, uint32_t shortkey, char *uri, const char *rootkey, char *root)
+{
+	struct db_pending_struct *p;
+	size_t c;
+
+	if(!rootkey || strlen(rootkey) != 32)
+	{
+		me->spider->api->log(me->spider, LOG_ERR, MSG_C_DB_INVALIDROOT " '%s'\n", rootkey);
+		crawl_free(me->crawl, uri);
+		crawl_free(me->crawl, root);
+		return -1;
+	}
+	for(c = 0; c < me->npending; c++)
+	{
+		if(!strcmp(me->pending[c].cachekey, cachekey))
+		{
+			/* Already pending */
+			crawl_free(me->crawl, uri);
+			crawl_free(me->crawl, root);
+			return 0;
+		}
+	}
+	if(me->npending >= me->pendingsize)
+	{
+		p = (struct db_pending_struct *) crawl_realloc(me->crawl, me->pending, sizeof(struct db_pending_struct) * me->addbuffer);
+		if(!p)
+		{
+			crawl_free(me->crawl, uri);
+			crawl_free(me->crawl, root);
+			return -1;
+		}
+		me->pending = p;
+		me->pendingsize = me->addbuffer;
+	}
+	p = &(me->pending[me->npending]);
+	strcpy(p->cachekey, cachekey);
+	p->shortkey = shortkey;
+	p->uri = uri;
+	strcpy(p->rootkey, rootkey);
+	p->root = root;
+	if(!me->npending)
+	{
+		me->pending_since = time(NULL);
+	}
+	me->npending++;
+	if(me->npending >= (size_t) me->addbuffer ||
+	   (me->addflush >= 0 && time(NULL) - me->pending_since >= me->addflush))
+	{
+		return db_pending_flush(me);
+	}
+	return 0;
+}
+
+/* Insert all of the pending resources and their roots in a single
+ * transaction
+ */
+static int
+db_pending_flush(QUEUE *me)
+{
+	size_t c;
+	int r;
+
+	if(!me->npending)
+	{
+		return 0;
+	}
+	r = 0;
+	if(sql_perform(me->db, db_pending_flush_txn, me, TXN_MAX_RETRIES, SQL_TXN_CONSISTENT))
+	{
+		me->spider->api->log(me->spider, LOG_ERR, MSG_E_DB_SQL ": failed to add %lu resources to the queue: %s\n", (unsigned long) me->npending, sql_error(me->db));
+		r = -1;
+	}
+	for(c = 0; c < me->npending; c++)
+	{
+		if(!r)
+		{
+			queue_seen_add_(me->pending[c].cachekey);
+		}
+		crawl_free(me->crawl, me->pending[c].uri);
+		crawl_free(me->crawl, me->pending[c].root);
+	}
+	me->npending = 0;
+	return r;
+}
+
+static int
+db_pending_flush_txn(SQL *db, void *userdata)
+{
+	QUEUE *me;
+	SQL_VARIANT variant;
+	struct db_pending_struct *p;
+	size_t c, d;
+	int crawl_bucket, cache_bucket, r;
+	char numbuf[96];
+
+	me = (QUEUE *) userdata;
+	variant = sql_variant(db);
+	/* Roots first; rows which are already present are ignored */
+	me->sqlbuflen = 0;
+	r = db_sqlbuf_str_(me, (variant == SQL_VARIANT_MYSQL ? "INSERT IGNORE INTO" : "INSERT INTO"));
+	r |= db_sqlbuf_str_(me, " \"crawl_root\" (\"hash\", \"uri\", \"added\", \"earliest_update\", \"rate\") VALUES ");
+	for(c = 0; c < me->npending; c++)
+	{
+		p = &(me->pending[c]);
+		for(d = 0; d < c; d++)
+		{
+			if(!strcmp(me->pending[d].rootkey, p->rootkey))
+			{
+				break;
+			}
+		}
+		if(d < c)
+		{
+			continue;
+		}
+		r |= db_sqlbuf_str_(me, (c ? ", (" : "("));
+		r |= db_sqlbuf_quote_(me, p->rootkey);
+		r |= db_sqlbuf_str_(me, ", ");
+		r |= db_sqlbuf_quote_(me, p->root);
+		r |= db_sqlbuf_str_(me, ", NOW(), NOW(), 1000)");
+	}
+	if(variant != SQL_VARIANT_MYSQL)
+	{
+		r |= db_sqlbuf_str_(me, " ON CONFLICT DO NOTHING");
+	}
+	if(r)
+	{
+		return SQL_TXN_ABORT;
+	}
+	if(sql_execute(db, me->sqlbuf))
+	{
+		if(sql_deadlocked(db))
+		{
+			return SQL_TXN_RETRY;
+		}
+		return SQL_TXN_ABORT;
+	}
+	/* Then the resources themselves */
+	me->sqlbuflen = 0;
+	r = db_sqlbuf_str_(me, (variant == SQL_VARIANT_MYSQL ? "INSERT IGNORE INTO" : "INSERT INTO"));
+	r |= db_sqlbuf_str_(me, " \"crawl_resource\" (\"hash\", \"shorthash\", \"tinyhash\", \"crawl_bucket\", \"cache_bucket\", \"root\", \"uri\", \"added\", \"next_fetch\", \"state\") VALUES ");
+	for(c = 0; c < me->npending; c++)
+	{
+		p = &(me->pending[c]);
+		crawl_bucket = (me->ncrawlers ? p->shortkey % me->ncrawlers : 0);
+		cache_bucket = (me->ncaches ? p->shortkey % me->ncaches : 0);
+		r |= db_sqlbuf_str_(me, (c ? ", (" : "("));
+		r |= db_sqlbuf_quote_(me, p->cachekey);
+		snprintf(numbuf, sizeof(numbuf), ", %lu, %d, %d, %d, ", (unsigned long) p->shortkey, (int) (p->shortkey % 256), crawl_bucket, cache_bucket);
+		r |= db_sqlbuf_str_(me, numbuf);
+		r |= db_sqlbuf_quote_(me, p->rootkey);
+		r |= db_sqlbuf_str_(me, ", ");
+		r |= db_sqlbuf_quote_(me, p->uri);
+		r |= db_sqlbuf_str_(me, ", NOW(), NOW(), 'NEW')");
+	}
+	if(variant != SQL_VARIANT_MYSQL)
+	{
+		r |= db_sqlbuf_str_(me, " ON CONFLICT DO NOTHING");
+	}
+	if(r)
+	{
+		return SQL_TXN_ABORT;
+	}
+	if(sql_execute(db, me->sqlbuf))
+	{
+		if(sql_deadlocked(db))
+		{
+			return SQL_TXN_RETRY;
+		}
+		return SQL_TXN_ABORT;
+	}
+	return SQL_TXN_COMMIT;
+}
+
+/* Append len bytes of str to the statement buffer */
+static int
+db_sqlbuf_append_(QUEUE *me, const char *str, size_t len)
+{
+	char *p;
+
+	if(me->sqlbuflen + len + 1 > me->sqlbufsize)
+	{
+		p = (char *) crawl_realloc(me->crawl, me->sqlbuf, me->sqlbufsize + len + 4096);
+		if(!p)
+		{
+			return -1;
+		}
+		me->sqlbuf = p;
+		me->sqlbufsize += len + 4096;
+	}
+	memcpy(&(me->sqlbuf[me->sqlbuflen]), str, len);
+	me->sqlbuflen += len;
+	me->sqlbuf[me->sqlbuflen] = 0;
+	return 0;
+}
+
+/* Append a string to the statement buffer */
+static int
+db_sqlbuf_str_(QUEUE *me, const char *str)
+{
+	return db_sqlbuf_append_(me, str, strlen(str));
+}
+
+/* Append a string to the statement buffer as a quoted literal */
+static int
+db_sqlbuf_quote_(QUEUE *me, const char *str)
+{
+	const char *special;
+	size_t len;
+	int r;
+
+	/* MySQL treats backslash as an escape character within literals unless
+	 * NO_BACKSLASH_ESCAPES is set
+	 */
+	special = (sql_variant(me->db) == SQL_VARIANT_MYSQL ? "'\\" : "'");
+	r = db_sqlbuf_append_(me, "'", 1);
+	while(*str && !r)
+	{
+		len = strcspn(str, special);
+		if(len)
+		{
+			r = db_sqlbuf_append_(me, str, len);
+			str += len;
+			continue;
+		}
+		/* Escape the character by doubling it */
+		r = db_sqlbuf_append_(me, str, 1);
+		r |= db_sqlbuf_append_(me, str, 1);
+		str++;
+	}
+	r |= db_sqlbuf_append_(me, "'", 1);
+	return r;
+}
+
+/* Populate the seen-set with the keys of all of the resources which are
+ * already present in the queue
+ */
+static int
+db_seen_warm_(QUEUE *me)
+{
+	SQL_STATEMENT *rs;
+	char hash[48];
+	unsigned long count;
+
+	me->spider->api->log(me->spider, LOG_INFO, "DB: populating seen-set from queue\n");
+	rs = sql_query(me->db, "SELECT \"hash\" FROM \"crawl_resource\"");
+	if(!rs)
+	{
+		me->spider->api->log(me->spider, LOG_ERR, MSG_E_DB_SQL ": %s\n", sql_error(me->db));
+		return -1;
+	}
+	for(count = 0; !sql_stmt_eof(rs); sql_stmt_next(rs))
+	{
+		memset(hash, 0, sizeof(hash));
+		sql_stmt_value(rs, 0, hash, sizeof(hash));
+		if(strlen(hash) == 32)
+		{
+			queue_seen_add_(hash);
+			count++;
+		}
+	}
+	sql_stmt_destroy(rs);
+	me->spider->api->log(me->spider, LOG_INFO, "DB: seen-set populated with %lu resources\n", count);
+	return 0;
+}
@@ -0,0 +1,891 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* An in-memory crawl frontier, used by the queue implementations which
+ * don't rely upon a database.
+ *
+ * Resources and roots are indexed by their cache keys in a pair of hash
+ * tables. Each root has a min-heap of its unclaimed resources (NEW
+ * resources first, then by next_fetch), and the roots themselves are
+ * arranged into two min-heaps ordered by the time at which they're next
+ * ready to be fetched from: one for roots whose first resource is NEW, and
+ * one for everything else. This mirrors the ordering applied by the
+ * database queue's dequeue query.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "p_queues.h"
+
+#define FRONTIER_MIN_BUCKETS           1024
+#define DEFAULT_ROOT_RATE              1000
+
+struct frontier_struct
+{
+	FRONTIERRES **resources;
+	size_t nresbuckets;
+	size_t nresources;
+	FRONTIERROOT **roots;
+	size_t nrootbuckets;
+	size_t nroots;
+	/* Root heaps: [0] is NEW resources, [1] is everything else */
+	FRONTIERROOT **ready[2];
+	size_t nready[2];
+	size_t readysize[2];
+};
+
+static size_t frontier_hash_(const char *key);
+static int frontier_grow_(void ***buckets, size_t *nbuckets, size_t count, int roots);
+static FRONTIERROOT *frontier_root_(FRONTIER *frontier, const char *key);
+static FRONTIERROOT *frontier_root_add_(FRONTIER *frontier, const char *key, const char *uri, time_t now);
+static FRONTIERRES *frontier_resource_add_(FRONTIER *frontier, const char *key, uint32_t shortkey, const char *uri, FRONTIERROOT *root);
+static void frontier_root_place_(FRONTIER *frontier, FRONTIERROOT *root);
+static void frontier_ready_remove_(FRONTIER *frontier, FRONTIERROOT *root);
+static void frontier_ready_up_(FRONTIER *frontier, int which, size_t index);
+static void frontier_ready_down_(FRONTIER *frontier, int which, size_t index);
+static int frontier_res_insert_(FRONTIERROOT *root, FRONTIERRES *res);
+static void frontier_res_remove_(FRONTIERROOT *root, FRONTIERRES *res);
+static void frontier_res_up_(FRONTIERROOT *root, size_t index);
+static void frontier_res_down_(FRONTIERROOT *root, size_t index);
+
+FRONTIER *
+frontier_create(void)
+{
+	FRONTIER *p;
+
+	p = (FRONTIER *) crawl_alloc(NULL, sizeof(FRONTIER));
+	if(!p)
+	{
+		return NULL;
+	}
+	p->nresbuckets = FRONTIER_MIN_BUCKETS;
+	p->resources = (FRONTIERRES **) crawl_alloc(NULL, sizeof(FRONTIERRES *) * p->nresbuckets);
+	p->nrootbuckets = FRONTIER_MIN_BUCKETS;
+	p->roots = (FRONTIERROOT **) crawl_alloc(NULL, sizeof(FRONTIERROOT *) * p->nrootbuckets);
+	if(!p->resources || !p->roots)
+	{
+		frontier_destroy(p);
+		return NULL;
+	}
+	return p;
+}
+
+void
+frontier_destroy(FRONTIER *frontier)
+{
+	FRONTIERRES *res, *rnext;
+	FRONTIERROOT *root, *tnext;
+	size_t c;
+
+	if(!frontier)
+	{
+		return;
+	}
+	for(c = 0; frontier->resources && c < frontier->nresbuckets; c++)
+	{
+		for(res = frontier->resources[c]; res; res = rnext)
+		{
+			rnext = res->next;
+			crawl_free(NULL, res->uri);
+			crawl_free(NULL, res);
+		}
+	}
+	for(c = 0; frontier->roots && c < frontier->nrootbuckets; c++)
+	{
+		for(root = frontier->roots[c]; root; root = tnext)
+		{
+			tnext = root->next;
+			crawl_free(NULL, root->heap);
+			crawl_free(NULL, root->uri);
+			crawl_free(NULL, root);
+		}
+	}
+	crawl_free(NULL, frontier->ready[0]);
+	crawl_free(NULL, frontier->ready[1]);
+	crawl_free(NULL, frontier->resources);
+	crawl_free(NULL, frontier->roots);
+	crawl_free(NULL, frontier);
+}
+
+int
+frontier_add(FRONTIER *frontier, const char *key, uint32_t shortkey, const char *uri, const char *rootkey, const char *rooturi, int force, time_t now)
+{
+	FRONTIERRES *res;
+	FRONTIERROOT *root;
+
+	res = frontier_resource(frontier, key);
+	if(res)
+	{
+		if(!force)
+		{
+			return 0;
+		}
+		res->state = COS_FORCE;
+		res->next_fetch = now;
+		if(!res->claimed)
+		{
+			frontier_res_remove_(res->root, res);
+			frontier_res_insert_(res->root, res);
+			frontier_root_place_(frontier, res->root);
+		}
+		return 1;
+	}
+	root = frontier_root_(frontier, rootkey);
+	if(!root)
+	{
+		root = frontier_root_add_(frontier, rootkey, rooturi, now);
+		if(!root)
+		{
+			return -1;
+		}
+	}
+	res = frontier_resource_add_(frontier, key, shortkey, uri, root);
+	if(!res)
+	{
+		return -1;
+	}
+	res->state = (force ? COS_FORCE : COS_NEW);
+	res->next_fetch = now;
+	if(frontier_res_insert_(root, res))
+	{
+		return -1;
+	}
+	frontier_root_place_(frontier, root);
+	return 1;
+}
+
+FRONTIERRES *
+frontier_next(FRONTIER *frontier, time_t now)
+{
+	FRONTIERROOT *root;
+	FRONTIERRES *res;
+	int rate, which;
+
+	root = NULL;
+	/* If the first NEW root isn't ready then no NEW root is */
+	for(which = 0; which < 2; which++)
+	{
+		if(frontier->nready[which] && frontier->ready[which][0]->ready <= now)
+		{
+			root = frontier->ready[which][0];
+			break;
+		}
+	}
+	if(!root)
+	{
+		return NULL;
+	}
+	res = root->heap[0];
+	frontier_res_remove_(root, res);
+	res->claimed = 1;
+	/* Prevent anything else being fetched from this root until its rate
+	 * allows; the rate is specified in milliseconds, but the granularity is
+	 * one second
+	 */
+	rate = root->rate / 1000;
+	if(rate < 1)
+	{
+		rate = 1;
+	}
+	root->earliest_update = now + rate;
+	frontier_root_place_(frontier, root);
+	return res;
+}
+
+int
+frontier_updated(FRONTIER *frontier, const char *key, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state, time_t now)
+{
+	FRONTIERRES *res;
+	FRONTIERROOT *root;
+
+	res = frontier_resource(frontier, key);
+	if(!res)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	root = res->root;
+	if(!res->claimed)
+	{
+		frontier_res_remove_(root, res);
+	}
+	res->claimed = 0;
+	res->updated = updated;
+	res->last_modified = last_modified;
+	res->status = status;
+	if(state == COS_ERR)
+	{
+		state = COS_FAILED;
+	}
+	else if(state == COS_SKIPPED_COMMIT)
+	{
+		state = COS_SKIPPED;
+	}
+	res->state = state;
+	if(status != 200)
+	{
+		if(ttl < 86400)
+		{
+			ttl = 86400;
+		}
+	}
+	else if(ttl < 3600)
+	{
+		ttl = 3600;
+	}
+	if(res->next_fetch < now + ttl)
+	{
+		res->next_fetch = now + ttl;
+	}
+	if(status >= 400 && status < 499)
+	{
+		res->error_count++;
+	}
+	else if(status >= 500 && status < 599)
+	{
+		res->error_count = 0;
+		res->soft_error_count++;
+	}
+	else
+	{
+		res->error_count = 0;
+		res->soft_error_count = 0;
+	}
+	root->last_updated = now;
+	if(root->earliest_update < now + 2)
+	{
+		root->earliest_update = now + 2;
+	}
+	frontier_res_insert_(root, res);
+	frontier_root_place_(frontier, root);
+	return 0;
+}
+
+int
+frontier_unchanged(FRONTIER *frontier, const char *key, int error, time_t now)
+{
+	FRONTIERRES *res;
+	FRONTIERROOT *root;
+
+	res = frontier_resource(frontier, key);
+	if(!res)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	root = res->root;
+	if(!res->claimed)
+	{
+		frontier_res_remove_(root, res);
+	}
+	res->claimed = 0;
+	res->updated = now;
+	if(error)
+	{
+		res->next_fetch = now + 2 + (86400 * 7);
+		res->error_count++;
+	}
+	else
+	{
+		res->next_fetch = now + 2 + (3600 * 2);
+		res->error_count = 0;
+	}
+	root->last_updated = now;
+	root->earliest_update = now + 2;
+	frontier_res_insert_(root, res);
+	frontier_root_place_(frontier, root);
+	return 0;
+}
+
+int
+frontier_release_all(FRONTIER *frontier)
+{
+	FRONTIERRES *res;
+	size_t c;
+
+	for(c = 0; c < frontier->nresbuckets; c++)
+	{
+		for(res = frontier->resources[c]; res; res = res->next)
+		{
+			if(res->claimed)
+			{
+				res->claimed = 0;
+				frontier_res_insert_(res->root, res);
+				frontier_root_place_(frontier, res->root);
+			}
+		}
+	}
+	return 0;
+}
+
+FRONTIERRES *
+frontier_resource(FRONTIER *frontier, const char *key)
+{
+	FRONTIERRES *res;
+
+	for(res = frontier->resources[frontier_hash_(key) % frontier->nresbuckets]; res; res = res->next)
+	{
+		if(!strcmp(res->key, key))
+		{
+			return res;
+		}
+	}
+	return NULL;
+}
+
+size_t
+frontier_count(FRONTIER *frontier)
+{
+	return frontier->nresources;
+}
+
+/* The snapshot format is line-oriented and tab-separated: roots are
+ * written (as 'R' lines) before the resources ('U' lines) which refer to
+ * them. Canonical URIs never contain tabs or newlines.
+ */
+int
+frontier_save(FRONTIER *frontier, FILE *f)
+{
+	FRONTIERROOT *root;
+	FRONTIERRES *res;
+	size_t c;
+
+	for(c = 0; c < frontier->nrootbuckets; c++)
+	{
+		for(root = frontier->roots[c]; root; root = root->next)
+		{
+			fprintf(f, "R\t%s\t%d\t%ld\t%ld\t%s\n", root->key, root->rate,
+					(long) root->earliest_update, (long) root->last_updated, root->uri);
+		}
+	}
+	for(c = 0; c < frontier->nresbuckets; c++)
+	{
+		for(res = frontier->resources[c]; res; res = res->next)
+		{
+			fprintf(f, "U\t%s\t%lu\t%s\t%d\t%ld\t%ld\t%ld\t%d\t%d\t%d\t%s\n", res->key, (unsigned long) res->shortkey,
+					res->root->key, (int) res->state, (long) res->next_fetch, (long) res->updated,
+					(long) res->last_modified, res->status, res->error_count, res->soft_error_count, res->uri);
+		}
+	}
+	if(fflush(f) || ferror(f))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+int
+frontier_load(FRONTIER *frontier, FILE *f)
+{
+	FRONTIERROOT *root;
+	FRONTIERRES *res;
+	char *line, *fields[12], *t;
+	size_t linesize, n;
+	ssize_t len;
+	int r;
+
+	line = NULL;
+	linesize = 0;
+	r = 0;
+	while((len = getline(&line, &linesize, f)) > 0)
+	{
+		if(line[len - 1] == '\n')
+		{
+			line[len - 1] = 0;
+		}
+		for(n = 0, t = line; n < 12 && t; n++)
+		{
+			fields[n] = t;
+			t = strchr(t, '\t');
+			if(t)
+			{
+				*t = 0;
+				t++;
+			}
+		}
+		if(n == 6 && !strcmp(fields[0], "R") && strlen(fields[1]) < sizeof(root->key))
+		{
+			root = frontier_root_(frontier, fields[1]);
+			if(!root)
+			{
+				root = frontier_root_add_(frontier, fields[1], fields[5], 0);
+				if(!root)
+				{
+					r = -1;
+					break;
+				}
+			}
+			root->rate = atoi(fields[2]);
+			root->earliest_update = (time_t) strtol(fields[3], NULL, 10);
+			root->last_updated = (time_t) strtol(fields[4], NULL, 10);
+			frontier_root_place_(frontier, root);
+		}
+		else if(n == 12 && !strcmp(fields[0], "U") && strlen(fields[1]) < sizeof(res->key))
+		{
+			root = frontier_root_(frontier, fields[3]);
+			if(!root || frontier_resource(frontier, fields[1]))
+			{
+				continue;
+			}
+			res = frontier_resource_add_(frontier, fields[1], (uint32_t) strtoul(fields[2], NULL, 10), fields[11], root);
+			if(!res)
+			{
+				r = -1;
+				break;
+			}
+			res->state = (CRAWLSTATE) atoi(fields[4]);
+			res->next_fetch = (time_t) strtol(fields[5], NULL, 10);
+			res->updated = (time_t) strtol(fields[6], NULL, 10);
+			res->last_modified = (time_t) strtol(fields[7], NULL, 10);
+			res->status = atoi(fields[8]);
+			res->error_count = atoi(fields[9]);
+			res->soft_error_count = atoi(fields[10]);
+			frontier_res_insert_(root, res);
+			frontier_root_place_(frontier, root);
+		}
+	}
+	free(line);
+	if(ferror(f))
+	{
+		r = -1;
+	}
+	return r;
+}
+
+/* Derive the canonical form, cache key, and root URI and key of a URI; the
+ * strings returned via uri and root must be freed by the caller
+ */
+int
+queue_uristr_keys_(CRAWL *crawl, const char *uristr, char **uri, char *urikey, uint32_t *shortkey, char **root, char *rootkey)
+{
+	URI *u_resource, *u_root;
+	char *str, *t;
+	char skey[9];
+
+	*uri = NULL;
+	*root = NULL;
+	str = crawl_strdup(crawl, uristr);
+	if(!str)
+	{
+		return -1;
+	}
+	t = strchr(str, '#');
+	if(t)
+	{
+		*t = 0;
+	}
+	u_resource = uri_create_str(str, NULL);
+	crawl_free(crawl, str);
+	if(!u_resource)
+	{
+		return -1;
+	}
+	/* Ensure we have the canonical form of the URI */
+	str = uri_stralloc(u_resource);
+	u_root = uri_create_str("/", u_resource);
+	uri_destroy(u_resource);
+	if(!str || !u_root || crawl_cache_key(crawl, str, urikey, 48) || crawl_cache_key_uri(crawl, u_root, rootkey, 48))
+	{
+		if(u_root)
+		{
+			uri_destroy(u_root);
+		}
+		crawl_free(crawl, str);
+		return -1;
+	}
+	strncpy(skey, urikey, 8);
+	skey[8] = 0;
+	*shortkey = (uint32_t) strtoul(skey, NULL, 16);
+	*root = uri_stralloc(u_root);
+	uri_destroy(u_root);
+	if(!*root)
+	{
+		crawl_free(crawl, str);
+		return -1;
+	}
+	*uri = str;
+	return 0;
+}
+
+/* FNV-1a */
+static size_t
+frontier_hash_(const char *key)
+{
+	uint32_t h;
+
+	for(h = 2166136261U; *key; key++)
+	{
+		h = (h ^ (unsigned char) *key) * 16777619U;
+	}
+	return (size_t) h;
+}
+
+/* Double the size of a hash table once its load factor reaches one */
+static int
+frontier_grow_(void ***buckets, size_t *nbuckets, size_t count, int roots)
+{
+	void **newbuckets;
+	FRONTIERRES *res, *rnext;
+	FRONTIERROOT *root, *tnext;
+	size_t c, n, h;
+
+	if(count < *nbuckets)
+	{
+		return 0;
+	}
+	n = *nbuckets * 2;
+	newbuckets = (void **) crawl_alloc(NULL, sizeof(void *) * n);
+	if(!newbuckets)
+	{
+		return -1;
+	}
+	for(c = 0; c < *nbuckets; c++)
+	{
+		if(roots)
+		{
+			for(root = (FRONTIERROOT *) (*buckets)[c]; root; root = tnext)
+			{
+				tnext = root->next;
+				h = frontier_hash_(root->key) % n;
+				root->next = (FRONTIERROOT *) newbuckets[h];
+				newbuckets[h] = root;
+			}
+		}
+		else
+		{
+			for(res = (FRONTIERRES *) (*buckets)[c]; res; res = rnext)
+			{
+				rnext = res->next;
+				h = frontier_hash_(res->key) % n;
+				res->next = (FRONTIERRES *) newbuckets[h];
+				newbuckets[h] = res;
+			}
+		}
+	}
+	crawl_free(NULL, *buckets);
+	*buckets = newbuckets;
+	*nbuckets = n;
+	return 0;
+}
+
+static FRONTIERROOT *
+frontier_root_(FRONTIER *frontier, const char *key)
+{
+	FRONTIERROOT *root;
+
+	for(root = frontier->roots[frontier_hash_(key) % frontier->nrootbuckets]; root; root = root->next)
+	{
+		if(!strcmp(root->key, key))
+		{
+			return root;
+		}
+	}
+	return NULL;
+}
+
+static FRONTIERROOT *
+frontier_root_add_(FRONTIER *frontier, const char *key, const char *uri, time_t now)
+{
+	FRONTIERROOT *root;
+	size_t h;
+
+	if(strlen(key) >= sizeof(root->key) ||
+	   frontier_grow_((void ***) &(frontier->roots), &(frontier->nrootbuckets), frontier->nroots + 1, 1))
+	{
+		return NULL;
+	}
+	root = (FRONTIERROOT *) crawl_alloc(NULL, sizeof(FRONTIERROOT));
+	if(!root)
+	{
+		return NULL;
+	}
+	root->uri = crawl_strdup(NULL, uri);
+	if(!root->uri)
+	{
+		crawl_free(NULL, root);
+		return NULL;
+	}
+	strcpy(root->key, key);
+	root->earliest_update = now;
+	root->rate = DEFAULT_ROOT_RATE;
+	root->which = -1;
+	h = frontier_hash_(key) % frontier->nrootbuckets;
+	root->next = frontier->roots[h];
+	frontier->roots[h] = root;
+	frontier->nroots++;
+	return root;
+}
+
+static FRONTIERRES *
+frontier_resource_add_(FRONTIER *frontier, const char *key, uint32_t shortkey, const char *uri, FRONTIERROOT *root)
+{
+	FRONTIERRES *res;
+	size_t h;
+
+	if(strlen(key) >= sizeof(res->key) ||
+	   frontier_grow_((void ***) &(frontier->resources), &(frontier->nresbuckets), frontier->nresources + 1, 0))
+	{
+		return NULL;
+	}
+	res = (FRONTIERRES *) crawl_alloc(NULL, sizeof(FRONTIERRES));
+	if(!res)
+	{
+		return NULL;
+	}
+	res->uri = crawl_strdup(NULL, uri);
+	if(!res->uri)
+	{
+		crawl_free(NULL, res);
+		return NULL;
+	}
+	strcpy(res->key, key);
+	res->shortkey = shortkey;
+	res->root = root;
+	h = frontier_hash_(key) % frontier->nresbuckets;
+	res->next = frontier->resources[h];
+	frontier->resources[h] = res;
+	frontier->nresources++;
+	return res;
+}
+
+/* (Re-)position a root within the root heaps following a change to its
+ * earliest_update or to its resource heap
+ */
+static void
+frontier_root_place_(FRONTIER *frontier, FRONTIERROOT *root)
+{
+	FRONTIERROOT **p;
+	FRONTIERRES *first;
+	int which;
+
+	frontier_ready_remove_(frontier, root);
+	if(!root->nheap || root->rate <= 0)
+	{
+		return;
+	}
+	first = root->heap[0];
+	root->ready = root->earliest_update;
+	if(first->next_fetch > root->ready)
+	{
+		root->ready = first->next_fetch;
+	}
+	which = (first->state == COS_NEW ? 0 : 1);
+	if(frontier->nready[which] >= frontier->readysize[which])
+	{
+		p = (FRONTIERROOT **) crawl_realloc(NULL, frontier->ready[which], sizeof(FRONTIERROOT *) * (frontier->readysize[which] + 1024));
+		if(!p)
+		{
+			return;
+		}
+		frontier->ready[which] = p;
+		frontier->readysize[which] += 1024;
+	}
+	root->which = which;
+	root->index = frontier->nready[which];
+	frontier->ready[which][root->index] = root;
+	frontier->nready[which]++;
+	frontier_ready_up_(frontier, which, root->index);
+}
+
+static void
+frontier_ready_remove_(FRONTIER *frontier, FRONTIERROOT *root)
+{
+	FRONTIERROOT **heap;
+	size_t index, last;
+	int which;
+
+	which = root->which;
+	if(which < 0)
+	{
+		return;
+	}
+	heap = frontier->ready[which];
+	index = root->index;
+	last = frontier->nready[which] - 1;
+	root->which = -1;
+	frontier->nready[which]--;
+	if(index == last)
+	{
+		return;
+	}
+	heap[index] = heap[last];
+	heap[index]->index = index;
+	frontier_ready_up_(frontier, which, index);
+	frontier_ready_down_(frontier, which, heap[index]->index);
+}
+
+#define ROOT_BEFORE(a, b) \
+	((a)->ready < (b)->ready || ((a)->ready == (b)->ready && (a)->rate < (b)->rate))
+
+static void
+frontier_ready_up_(FRONTIER *frontier, int which, size_t index)
+{
+	FRONTIERROOT **heap, *t;
+	size_t parent;
+
+	heap = frontier->ready[which];
+	while(index)
+	{
+		parent = (index - 1) / 2;
+		if(!ROOT_BEFORE(heap[index], heap[parent]))
+		{
+			break;
+		}
+		t = heap[parent];
+		heap[parent] = heap[index];
+		heap[index] = t;
+		heap[parent]->index = parent;
+		heap[index]->index = index;
+		index = parent;
+	}
+}
+
+static void
+frontier_ready_down_(FRONTIER *frontier, int which, size_t index)
+{
+	FRONTIERROOT **heap, *t;
+	size_t child, count;
+
+	heap = frontier->ready[which];
+	count = frontier->nready[which];
+	for(;;)
+	{
+		child = (index * 2) + 1;
+		if(child >= count)
+		{
+			break;
+		}
+		if(child + 1 < count && ROOT_BEFORE(heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+		if(!ROOT_BEFORE(heap[child], heap[index]))
+		{
+			break;
+		}
+		t = heap[child];
+		heap[child] = heap[index];
+		heap[index] = t;
+		heap[child]->index = child;
+		heap[index]->index = index;
+		index = child;
+	}
+}
+
+#define RES_BEFORE(a, b) \
+	(((a)->state == COS_NEW && (b)->state != COS_NEW) || \
+	 (((a)->state == COS_NEW) == ((b)->state == COS_NEW) && (a)->next_fetch < (b)->next_fetch))
+
+static int
+frontier_res_insert_(FRONTIERROOT *root, FRONTIERRES *res)
+{
+	FRONTIERRES **p;
+
+	if(root->nheap >= root->heapsize)
+	{
+		p = (FRONTIERRES **) crawl_realloc(NULL, root->heap, sizeof(FRONTIERRES *) * (root->heapsize + 16));
+		if(!p)
+		{
+			return -1;
+		}
+		root->heap = p;
+		root->heapsize += 16;
+	}
+	res->index = root->nheap;
+	root->heap[res->index] = res;
+	root->nheap++;
+	frontier_res_up_(root, res->index);
+	return 0;
+}
+
+static void
+frontier_res_remove_(FRONTIERROOT *root, FRONTIERRES *res)
+{
+	size_t index, last;
+
+	index = res->index;
+	last = root->nheap - 1;
+	root->nheap--;
+	if(index == last)
+	{
+		return;
+	}
+	root->heap[index] = root->heap[last];
+	root->heap[index]->index = index;
+	frontier_res_up_(root, index);
+	frontier_res_down_(root, root->heap[index]->index);
+}
+
+static void
+frontier_res_up_(FRONTIERROOT *root, size_t index)
+{
+	FRONTIERRES **heap, *t;
+	size_t parent;
+
+	heap = root->heap;
+	while(index)
+	{
+		parent = (index - 1) / 2;
+		if(!RES_BEFORE(heap[index], heap[parent]))
+		{
+			break;
+		}
+		t = heap[parent];
+		heap[parent] = heap[index];
+		heap[index] = t;
+		heap[parent]->index = parent;
+		heap[index]->index = index;
+		index = parent;
+	}
+}
+
+static void
+frontier_res_down_(FRONTIERROOT *root, size_t index)
+{
+	FRONTIERRES **heap, *t;
+	size_t child;
+
+	heap = root->heap;
+	for(;;)
+	{
+		child = (index * 2) + 1;
+		if(child >= root->nheap)
+		{
+			break;
+		}
+		if(child + 1 < root->nheap && RES_BEFORE(heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+		if(!RES_BEFORE(heap[child], heap[index]))
+		{
+			break;
+		}
+		t = heap[child];
+		heap[child] = heap[index];
+		heap[index] = t;
+		heap[child]->index = child;
+		heap[index]->index = index;
+		index = child;
+	}
+}
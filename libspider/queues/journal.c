@@ -0,0 +1,661 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* A journal makes a frontier durable: every change to the frontier is
+ * appended to a record log (queue.log) within the journal directory, and
+ * the log is periodically compacted into a snapshot of the whole frontier
+ * (queue.snapshot).
+ *
+ * Compaction happens in the background, so that the threads changing the
+ * frontier aren't held up while the snapshot is written: once the log
+ * reaches queue:compact-size megabytes, it's renamed to queue.log.old and
+ * a new log is started, and a background thread loads the previous
+ * snapshot into a frontier of its own, replays the old log into it, and
+ * writes the result as the new snapshot before removing the old log. This
+ * needs enough memory for a second copy of the frontier while it runs.
+ * When the journal is closed, the frontier itself is written to the
+ * snapshot and both logs are removed.
+ *
+ * Each record and the snapshot carry a sequence number, so that if the
+ * process is interrupted after a snapshot has been written but before the
+ * log it reflects has been removed (or truncated), records already
+ * reflected in the snapshot are skipped when the logs are replayed. A
+ * partially-written final record is discarded.
+ *
+ * Records are single lines of tab-separated fields:
+ *
+ *   A <seq> <time> <force> <key> <shortkey> <rootkey> <uri> <rooturi>
+ *   U <seq> <time> <key> <updated> <last-modified> <status> <ttl> <state>
+ *   N <seq> <time> <key> <error>
+ *
+ * Dequeues are not recorded: following a restart, all resources which were
+ * in-flight become available again.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "p_queues.h"
+
+#define DEFAULT_COMPACT_SIZE           64
+#define JOURNAL_MAX_FIELDS             9
+
+struct journal_struct
+{
+	SPIDER *spider;
+	FRONTIER *frontier;
+	char *dirpath;
+	char *logpath;
+	char *oldpath;
+	char *snappath;
+	int fd;
+	unsigned long long seq;
+	off_t size;
+	off_t compact;
+	/* The size of the log at which compaction is next attempted */
+	off_t next;
+	int sync;
+	char *buf;
+	size_t bufsize;
+	/* The background compactor; running is protected by the lock */
+	pthread_mutex_t lock;
+	pthread_t compactor;
+	int started;
+	int running;
+};
+
+static int journal_load_(JOURNAL *journal, FRONTIER *frontier, unsigned long long *seq);
+static int journal_replay_(JOURNAL *journal, int fd, const char *path, FRONTIER *frontier, unsigned long long snapseq, unsigned long long *seq, int truncate);
+static int journal_apply_(FRONTIER *frontier, char *line, unsigned long long snapseq, unsigned long long *seq);
+static int journal_append_(JOURNAL *journal, const char *fmt, ...);
+static int journal_rotate_(JOURNAL *journal);
+static void *journal_compactor_(void *arg);
+static int journal_merge_(JOURNAL *journal);
+static void journal_join_(JOURNAL *journal);
+static int journal_write_snapshot_(JOURNAL *journal, FRONTIER *frontier, unsigned long long seq);
+static int journal_sync_dir_(JOURNAL *journal);
+static char *journal_path_(const char *dir, const char *name);
+
+JOURNAL *
+journal_open(SPIDER *spider, const char *path, FRONTIER *frontier)
+{
+	JOURNAL *p;
+	unsigned long long snapseq;
+	int fd, r;
+
+	if(mkdir(path, 0777) && errno != EEXIST)
+	{
+		spider->api->log(spider, LOG_CRIT, "LOG: failed to create queue directory %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	p = (JOURNAL *) crawl_alloc(NULL, sizeof(JOURNAL));
+	if(!p)
+	{
+		return NULL;
+	}
+	p->spider = spider;
+	p->frontier = frontier;
+	p->fd = -1;
+	pthread_mutex_init(&(p->lock), NULL);
+	p->sync = spider->api->config_get_bool(spider, "queue:sync", 0);
+	p->compact = (off_t) spider->api->config_get_int(spider, "queue:compact-size", DEFAULT_COMPACT_SIZE) * 1024 * 1024;
+	if(p->compact <= 0)
+	{
+		p->compact = (off_t) DEFAULT_COMPACT_SIZE * 1024 * 1024;
+	}
+	p->next = p->compact;
+	p->dirpath = crawl_strdup(NULL, path);
+	p->logpath = journal_path_(path, "queue.log");
+	p->oldpath = journal_path_(path, "queue.log.old");
+	p->snappath = journal_path_(path, "queue.snapshot");
+	p->fd = open(p->logpath, O_RDWR|O_CREAT|O_APPEND, 0666);
+	if(p->fd == -1)
+	{
+		spider->api->log(spider, LOG_CRIT, "LOG: failed to open %s: %s\n", p->logpath, strerror(errno));
+		journal_close(p);
+		return NULL;
+	}
+	/* Only one process may use a journal at a time */
+	if(flock(p->fd, LOCK_EX|LOCK_NB))
+	{
+		spider->api->log(spider, LOG_CRIT, "LOG: failed to lock %s: %s\n", p->logpath, strerror(errno));
+		close(p->fd);
+		p->fd = -1;
+		journal_close(p);
+		return NULL;
+	}
+	r = journal_load_(p, frontier, &(p->seq));
+	snapseq = p->seq;
+	/* A log which was being compacted when the process stopped is replayed
+	 * before the current one
+	 */
+	fd = -1;
+	if(!r && (fd = open(p->oldpath, O_RDONLY)) == -1 && errno != ENOENT)
+	{
+		spider->api->log(spider, LOG_CRIT, "LOG: failed to open %s: %s\n", p->oldpath, strerror(errno));
+		r = -1;
+	}
+	if(!r && fd != -1)
+	{
+		r = journal_replay_(p, fd, p->oldpath, frontier, snapseq, &(p->seq), 0);
+	}
+	if(!r)
+	{
+		r = journal_replay_(p, p->fd, p->logpath, frontier, snapseq, &(p->seq), 1);
+	}
+	if(fd != -1)
+	{
+		close(fd);
+		/* Finish the interrupted compaction now */
+		if(!r && journal_compact(p))
+		{
+			spider->api->log(spider, LOG_ERR, "LOG: failed to compact %s: %s\n", p->logpath, strerror(errno));
+		}
+	}
+	if(r)
+	{
+		close(p->fd);
+		p->fd = -1;
+		journal_close(p);
+		return NULL;
+	}
+	spider->api->log(spider, LOG_NOTICE, "LOG: recovered %lu resources from %s\n", (unsigned long) frontier_count(frontier), path);
+	return p;
+}
+
+/* Close a journal, compacting it first */
+void
+journal_close(JOURNAL *journal)
+{
+	if(!journal)
+	{
+		return;
+	}
+	if(journal->fd != -1)
+	{
+		if(journal_compact(journal))
+		{
+			journal->spider->api->log(journal->spider, LOG_ERR, "LOG: failed to compact %s: %s\n", journal->logpath, strerror(errno));
+		}
+		close(journal->fd);
+	}
+	journal_join_(journal);
+	pthread_mutex_destroy(&(journal->lock));
+	crawl_free(NULL, journal->buf);
+	crawl_free(NULL, journal->dirpath);
+	crawl_free(NULL, journal->logpath);
+	crawl_free(NULL, journal->oldpath);
+	crawl_free(NULL, journal->snappath);
+	crawl_free(NULL, journal);
+}
+
+int
+journal_add(JOURNAL *journal, const char *key, uint32_t shortkey, const char *uri, const char *rootkey, const char *rooturi, int force, time_t now)
+{
+	return journal_append_(journal, "A\t%llu\t%ld\t%d\t%s\t%lu\t%s\t%s\t%s\n", journal->seq + 1, (long) now, force,
+						   key, (unsigned long) shortkey, rootkey, uri, rooturi);
+}
+
+int
+journal_updated(JOURNAL *journal, const char *key, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state, time_t now)
+{
+	return journal_append_(journal, "U\t%llu\t%ld\t%s\t%ld\t%ld\t%d\t%ld\t%d\n", journal->seq + 1, (long) now, key,
+						   (long) updated, (long) last_modified, status, (long) ttl, (int) state);
+}
+
+int
+journal_unchanged(JOURNAL *journal, const char *key, int error, time_t now)
+{
+	return journal_append_(journal, "N\t%llu\t%ld\t%s\t%d\n", journal->seq + 1, (long) now, key, error);
+}
+
+/* Write the frontier itself to the snapshot, waiting for any background
+ * compaction to finish first, and then remove the old log and truncate
+ * the current one
+ */
+int
+journal_compact(JOURNAL *journal)
+{
+	journal_join_(journal);
+	if(journal_write_snapshot_(journal, journal->frontier, journal->seq))
+	{
+		return -1;
+	}
+	/* The snapshot now reflects every record in both logs */
+	if(unlink(journal->oldpath) && errno != ENOENT)
+	{
+		return -1;
+	}
+	if(ftruncate(journal->fd, 0))
+	{
+		return -1;
+	}
+	journal->size = 0;
+	journal->next = journal->compact;
+	return 0;
+}
+
+/* Load the snapshot into a frontier, if there is one */
+static int
+journal_load_(JOURNAL *journal, FRONTIER *frontier, unsigned long long *seq)
+{
+	FILE *f;
+	int r;
+
+	f = fopen(journal->snappath, "r");
+	if(!f)
+	{
+		if(errno == ENOENT)
+		{
+			return 0;
+		}
+		journal->spider->api->log(journal->spider, LOG_CRIT, "LOG: failed to open %s: %s\n", journal->snappath, strerror(errno));
+		return -1;
+	}
+	r = 0;
+	if(fscanf(f, "S\t%llu\n", seq) != 1 || frontier_load(frontier, f))
+	{
+		journal->spider->api->log(journal->spider, LOG_CRIT, "LOG: failed to load snapshot %s\n", journal->snappath);
+		r = -1;
+	}
+	fclose(f);
+	return r;
+}
+
+/* Replay the records in a log which aren't reflected in the snapshot,
+ * updating seq to the last sequence number seen; a partially-written final
+ * record is truncated from the log if truncate is nonzero
+ */
+static int
+journal_replay_(JOURNAL *journal, int fd, const char *path, FRONTIER *frontier, unsigned long long snapseq, unsigned long long *seq, int truncate)
+{
+	struct stat sbuf;
+	char *map, *start, *end, *line;
+	size_t len, linesize;
+	off_t valid;
+
+	if(fstat(fd, &sbuf))
+	{
+		return -1;
+	}
+	if(!sbuf.st_size)
+	{
+		return 0;
+	}
+	map = (char *) mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		journal->spider->api->log(journal->spider, LOG_CRIT, "LOG: failed to map %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	line = NULL;
+	linesize = 0;
+	valid = 0;
+	for(start = map; start < map + sbuf.st_size; start = end + 1)
+	{
+		end = (char *) memchr(start, '\n', (map + sbuf.st_size) - start);
+		if(!end)
+		{
+			/* Partially-written final record */
+			break;
+		}
+		len = end - start;
+		if(len + 1 > linesize)
+		{
+			linesize = len + 1;
+			line = (char *) crawl_realloc(NULL, line, linesize);
+		}
+		memcpy(line, start, len);
+		line[len] = 0;
+		journal_apply_(frontier, line, snapseq, seq);
+		valid = (end + 1) - map;
+	}
+	crawl_free(NULL, line);
+	munmap(map, sbuf.st_size);
+	if(valid < sbuf.st_size)
+	{
+		journal->spider->api->log(journal->spider, LOG_WARNING, "LOG: discarding %ld bytes of incomplete record from %s\n", (long) (sbuf.st_size - valid), path);
+		if(truncate && ftruncate(fd, valid))
+		{
+			return -1;
+		}
+	}
+	if(truncate)
+	{
+		journal->size = valid;
+	}
+	return 0;
+}
+
+/* Apply a single record to a frontier */
+static int
+journal_apply_(FRONTIER *frontier, char *line, unsigned long long snapseq, unsigned long long *seq)
+{
+	char *fields[JOURNAL_MAX_FIELDS], *t;
+	unsigned long long recseq;
+	time_t now;
+	size_t n;
+
+	for(n = 0, t = line; n < JOURNAL_MAX_FIELDS && t; n++)
+	{
+		fields[n] = t;
+		t = strchr(t, '\t');
+		if(t)
+		{
+			*t = 0;
+			t++;
+		}
+	}
+	if(n < 4)
+	{
+		return -1;
+	}
+	recseq = strtoull(fields[1], NULL, 10);
+	if(recseq > *seq)
+	{
+		*seq = recseq;
+	}
+	if(recseq <= snapseq)
+	{
+		return 0;
+	}
+	now = (time_t) strtol(fields[2], NULL, 10);
+	if(n == 9 && !strcmp(fields[0], "A"))
+	{
+		return frontier_add(frontier, fields[4], (uint32_t) strtoul(fields[5], NULL, 10), fields[7], fields[6], fields[8], atoi(fields[3]), now);
+	}
+	if(n == 9 && !strcmp(fields[0], "U"))
+	{
+		return frontier_updated(frontier, fields[3], (time_t) strtol(fields[4], NULL, 10), (time_t) strtol(fields[5], NULL, 10),
+								atoi(fields[6]), (time_t) strtol(fields[7], NULL, 10), (CRAWLSTATE) atoi(fields[8]), now);
+	}
+	if(n == 5 && !strcmp(fields[0], "N"))
+	{
+		return frontier_unchanged(frontier, fields[3], atoi(fields[4]), now);
+	}
+	return -1;
+}
+
+static int
+journal_append_(JOURNAL *journal, const char *fmt, ...)
+{
+	va_list ap;
+	ssize_t written;
+	size_t needed;
+	int len;
+
+	for(;;)
+	{
+		va_start(ap, fmt);
+		len = vsnprintf(journal->buf, journal->bufsize, fmt, ap);
+		va_end(ap);
+		if(len < 0)
+		{
+			return -1;
+		}
+		needed = (size_t) len + 1;
+		if(needed <= journal->bufsize)
+		{
+			break;
+		}
+		journal->buf = (char *) crawl_realloc(NULL, journal->buf, needed);
+		journal->bufsize = needed;
+	}
+	/* The log is opened with O_APPEND, so each record is written with a
+	 * single write()
+	 */
+	written = write(journal->fd, journal->buf, len);
+	if(written != len)
+	{
+		journal->spider->api->log(journal->spider, LOG_ERR, "LOG: failed to write to %s: %s\n", journal->logpath, strerror(errno));
+		return -1;
+	}
+	journal->seq++;
+	journal->size += len;
+	if(journal->sync)
+	{
+		fdatasync(journal->fd);
+	}
+	if(journal->size >= journal->next)
+	{
+		if(journal_rotate_(journal))
+		{
+			journal->spider->api->log(journal->spider, LOG_ERR, "LOG: failed to compact %s: %s\n", journal->logpath, strerror(errno));
+		}
+	}
+	return 0;
+}
+
+/* Start a new log and compact the old one in the background; this is
+ * called with the frontier locked, and so only renames and creates files.
+ * If the previous compaction is still running, nothing happens until the
+ * next record is appended; if it failed, it's retried using the same old
+ * log, and the current log continues to grow.
+ */
+static int
+journal_rotate_(JOURNAL *journal)
+{
+	int fd, e;
+
+	pthread_mutex_lock(&(journal->lock));
+	if(journal->running)
+	{
+		pthread_mutex_unlock(&(journal->lock));
+		return 0;
+	}
+	pthread_mutex_unlock(&(journal->lock));
+	journal_join_(journal);
+	journal->next = journal->size + journal->compact;
+	if(access(journal->oldpath, F_OK))
+	{
+		if(rename(journal->logpath, journal->oldpath))
+		{
+			return -1;
+		}
+		fd = open(journal->logpath, O_RDWR|O_CREAT|O_APPEND, 0666);
+		if(fd == -1 || flock(fd, LOCK_EX|LOCK_NB) || journal_sync_dir_(journal))
+		{
+			e = errno;
+			if(fd != -1)
+			{
+				close(fd);
+			}
+			rename(journal->oldpath, journal->logpath);
+			errno = e;
+			return -1;
+		}
+		close(journal->fd);
+		journal->fd = fd;
+		journal->size = 0;
+		journal->next = journal->compact;
+	}
+	pthread_mutex_lock(&(journal->lock));
+	journal->running = 1;
+	if((e = pthread_create(&(journal->compactor), NULL, journal_compactor_, (void *) journal)))
+	{
+		journal->running = 0;
+		pthread_mutex_unlock(&(journal->lock));
+		errno = e;
+		return -1;
+	}
+	journal->started = 1;
+	pthread_mutex_unlock(&(journal->lock));
+	return 0;
+}
+
+/* The body of the background compactor thread */
+static void *
+journal_compactor_(void *arg)
+{
+	JOURNAL *journal;
+
+	journal = (JOURNAL *) arg;
+	if(journal_merge_(journal))
+	{
+		journal->spider->api->log(journal->spider, LOG_ERR, "LOG: failed to compact %s: %s\n", journal->oldpath, strerror(errno));
+	}
+	pthread_mutex_lock(&(journal->lock));
+	journal->running = 0;
+	pthread_mutex_unlock(&(journal->lock));
+	return NULL;
+}
+
+/* Write a new snapshot from the current snapshot and the old log, using a
+ * frontier of its own, and then remove the old log
+ */
+static int
+journal_merge_(JOURNAL *journal)
+{
+	FRONTIER *frontier;
+	unsigned long long snapseq, seq;
+	int fd, r;
+
+	frontier = frontier_create();
+	if(!frontier)
+	{
+		return -1;
+	}
+	seq = 0;
+	r = journal_load_(journal, frontier, &seq);
+	snapseq = seq;
+	if(!r)
+	{
+		fd = open(journal->oldpath, O_RDONLY);
+		if(fd == -1)
+		{
+			r = -1;
+		}
+		else
+		{
+			r = journal_replay_(journal, fd, journal->oldpath, frontier, snapseq, &seq, 0);
+			close(fd);
+		}
+	}
+	if(!r)
+	{
+		r = journal_write_snapshot_(journal, frontier, seq);
+	}
+	if(!r && unlink(journal->oldpath))
+	{
+		r = -1;
+	}
+	frontier_destroy(frontier);
+	return r;
+}
+
+/* Wait for the background compactor to exit, if it's been started */
+static void
+journal_join_(JOURNAL *journal)
+{
+	if(journal->started)
+	{
+		pthread_join(journal->compactor, NULL);
+		journal->started = 0;
+	}
+}
+
+/* Write a frontier to the snapshot, via a temporary file; the directory is
+ * synced after the rename, so that the snapshot is durable before any log
+ * it reflects is removed or truncated
+ */
+static int
+journal_write_snapshot_(JOURNAL *journal, FRONTIER *frontier, unsigned long long seq)
+{
+	char *tmp;
+	FILE *f;
+	int r;
+
+	tmp = journal_path_(journal->snappath, NULL);
+	f = fopen(tmp, "w");
+	if(!f)
+	{
+		crawl_free(NULL, tmp);
+		return -1;
+	}
+	fprintf(f, "S\t%llu\n", seq);
+	r = frontier_save(frontier, f);
+	if(!r)
+	{
+		r = fsync(fileno(f));
+	}
+	if(fclose(f))
+	{
+		r = -1;
+	}
+	if(!r)
+	{
+		r = rename(tmp, journal->snappath);
+	}
+	if(r)
+	{
+		unlink(tmp);
+		crawl_free(NULL, tmp);
+		return -1;
+	}
+	crawl_free(NULL, tmp);
+	return journal_sync_dir_(journal);
+}
+
+/* Flush renames and new files in the journal directory to disk */
+static int
+journal_sync_dir_(JOURNAL *journal)
+{
+	int fd, r;
+
+	fd = open(journal->dirpath, O_RDONLY);
+	if(fd == -1)
+	{
+		return -1;
+	}
+	r = fsync(fd);
+	close(fd);
+	return r;
+}
+
+/* Return dir/name, or dir.tmp if name is NULL */
+static char *
+journal_path_(const char *dir, const char *name)
+{
+	char *p;
+
+	p = (char *) crawl_alloc(NULL, strlen(dir) + (name ? strlen(name) : 0) + 6);
+	strcpy(p, dir);
+	if(name)
+	{
+		strcat(p, "/");
+		strcat(p, name);
+	}
+	else
+	{
+		strcat(p, ".tmp");
+	}
+	return p;
+}
@@ -0,0 +1,580 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* This queue implementation keeps the crawl frontier entirely in memory,
+ * and is intended for single-instance crawls which don't need the
+ * persistence or clustering provided by the database queue.
+ *
+ * All of the queue instances in a process which were created with the
+ * same URI (e.g., "mem:") share a single frontier. If queue:snapshot is
+ * set to a path, the frontier is loaded from that file when it's created,
+ * and written back to it every queue:snapshot-interval seconds and when
+ * the last queue instance using it is released.
+ *
+ * Queues created with a "log:" URI (e.g., "log:/var/spool/anansi-queue")
+ * are instead made durable by a journal in the specified directory, which
+ * records every change as it's made.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define QUEUE_STRUCT_DEFINED           1
+#define DEFAULT_SNAPSHOT_INTERVAL      300
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "p_queues.h"
+
+struct mem_frontier_struct;
+
+/* Queue implementation methods */
+static unsigned long mem_addref(QUEUE *me);
+static unsigned long mem_release(QUEUE *me);
+static int mem_next(QUEUE *me, URI **next, CRAWLSTATE *state);
+static int mem_add(QUEUE *me, URI *uri, const char *uristr);
+static int mem_force_add(QUEUE *me, URI *uri, const char *uristr);
+static int mem_updated_uri(QUEUE *me, URI *uri, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+static int mem_updated_uristr(QUEUE *me, const char *uri, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+static int mem_unchanged_uri(QUEUE *me, URI *uri, int error);
+static int mem_unchanged_uristr(QUEUE *me, const char *uristr, int error);
+static int mem_set_crawlers(QUEUE *me, int count);
+static int mem_set_caches(QUEUE *me, int count);
+static int mem_set_crawler(QUEUE *me, int id);
+static int mem_set_cache(QUEUE *me, int id);
+static int mem_updated_obj(QUEUE *me, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+
+/* Private */
+static int mem_add_(QUEUE *me, const char *uristr, int force);
+static int mem_updated_key_(QUEUE *me, const char *cachekey, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state);
+static int mem_unchanged_key_(QUEUE *me, const char *cachekey, int error);
+static int mem_uristr_key_(QUEUE *me, const char *uristr, char *cachekey);
+static int mem_snapshot_(struct mem_frontier_struct *shared);
+
+static struct queue_api_struct mem_api = {
+	NULL,
+	mem_addref,
+	mem_release,
+	mem_next,
+	mem_add,
+	mem_updated_uri,
+	mem_updated_uristr,
+	mem_unchanged_uri,
+	mem_unchanged_uristr,
+	mem_force_add,
+	mem_set_crawlers,
+	mem_set_caches,
+	mem_set_crawler,
+	mem_set_cache,
+	mem_updated_obj
+};
+
+/* A frontier shared by all of the queue instances with the same name */
+struct mem_frontier_struct
+{
+	struct mem_frontier_struct *next;
+	char *name;
+	unsigned long refcount;
+	pthread_mutex_t lock;
+	FRONTIER *frontier;
+	JOURNAL *journal;
+	char *snapshot;
+	int interval;
+	time_t last_snapshot;
+};
+
+struct queue_struct
+{
+	struct queue_api_struct *api;
+	unsigned long refcount;
+	SPIDER *spider;
+	CRAWL *crawl;
+	struct mem_frontier_struct *shared;
+	int oneshot;
+	URI *testuri;
+};
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mem_frontier_struct *mem_frontiers;
+
+QUEUE *
+spider_queue_mem_create_(SPIDER *spider, URI *uri)
+{
+	QUEUE *p;
+	CRAWL *crawl;
+	struct mem_frontier_struct *shared;
+	URI_INFO *info;
+	char *name, *t;
+	FILE *f;
+
+	crawl = spider->api->crawler(spider);
+	name = uri_stralloc(uri);
+	if(!name)
+	{
+		return NULL;
+	}
+	p = (QUEUE *) crawl_alloc(crawl, sizeof(QUEUE));
+	if(!p)
+	{
+		crawl_free(crawl, name);
+		return NULL;
+	}
+	p->api = &mem_api;
+	p->refcount = 1;
+	p->spider = spider;
+	p->crawl = crawl;
+	pthread_mutex_lock(&mem_lock);
+	for(shared = mem_frontiers; shared; shared = shared->next)
+	{
+		if(!strcmp(shared->name, name))
+		{
+			break;
+		}
+	}
+	if(shared)
+	{
+		shared->refcount++;
+		crawl_free(crawl, name);
+	}
+	else
+	{
+		shared = (struct mem_frontier_struct *) crawl_alloc(NULL, sizeof(struct mem_frontier_struct));
+		shared->frontier = frontier_create();
+		if(!shared->frontier)
+		{
+			pthread_mutex_unlock(&mem_lock);
+			crawl_free(NULL, shared);
+			crawl_free(crawl, name);
+			crawl_free(crawl, p);
+			return NULL;
+		}
+		info = uri_info(uri);
+		if(info && info->scheme && !strcmp(info->scheme, "log"))
+		{
+			if(!info->path || !info->path[0])
+			{
+				spider->api->log(spider, LOG_CRIT, "LOG: no queue directory specified in <%s>\n", name);
+			}
+			else
+			{
+				shared->journal = journal_open(spider, info->path, shared->frontier);
+			}
+			if(!shared->journal)
+			{
+				pthread_mutex_unlock(&mem_lock);
+				uri_info_destroy(info);
+				frontier_destroy(shared->frontier);
+				crawl_free(NULL, shared);
+				crawl_free(crawl, name);
+				crawl_free(crawl, p);
+				return NULL;
+			}
+		}
+		if(info)
+		{
+			uri_info_destroy(info);
+		}
+		shared->name = name;
+		shared->refcount = 1;
+		pthread_mutex_init(&(shared->lock), NULL);
+		t = (shared->journal ? NULL : spider->api->config_geta(spider, "queue:snapshot", NULL));
+		if(t && t[0])
+		{
+			shared->snapshot = t;
+			shared->interval = spider->api->config_get_int(spider, "queue:snapshot-interval", DEFAULT_SNAPSHOT_INTERVAL);
+			f = fopen(t, "r");
+			if(f)
+			{
+				if(frontier_load(shared->frontier, f))
+				{
+					spider->api->log(spider, LOG_ERR, "MEM: failed to load snapshot from %s: %s\n", t, strerror(errno));
+				}
+				fclose(f);
+				spider->api->log(spider, LOG_NOTICE, "MEM: loaded %lu resources from %s\n", (unsigned long) frontier_count(shared->frontier), t);
+			}
+			shared->last_snapshot = time(NULL);
+		}
+		else
+		{
+			crawl_free(crawl, t);
+		}
+		shared->next = mem_frontiers;
+		mem_frontiers = shared;
+	}
+	pthread_mutex_unlock(&mem_lock);
+	p->shared = shared;
+	if(spider->api->config_get_bool(spider, "crawler:schema-update", 0))
+	{
+		p->oneshot = 1;
+		return p;
+	}
+	t = spider->api->config_geta(spider, "crawler:test-uri", NULL);
+	if(t && t[0])
+	{
+		spider->api->log(spider, LOG_NOTICE, MSG_N_DB_TESTURI " <%s>\n", t);
+		p->testuri = uri_create_str(t, NULL);
+		if(!p->testuri)
+		{
+			spider->api->log(spider, LOG_CRIT, MSG_C_DB_URIPARSE " <%s>\n", t);
+			crawl_free(crawl, t);
+			mem_release(p);
+			return NULL;
+		}
+		p->oneshot = 1;
+		mem_force_add(p, p->testuri, t);
+	}
+	crawl_free(crawl, t);
+	return p;
+}
+
+static unsigned long
+mem_addref(QUEUE *me)
+{
+	me->refcount++;
+	return me->refcount;
+}
+
+static unsigned long
+mem_release(QUEUE *me)
+{
+	struct mem_frontier_struct *shared, **sp;
+
+	me->refcount--;
+	if(me->refcount)
+	{
+		return me->refcount;
+	}
+	shared = me->shared;
+	pthread_mutex_lock(&mem_lock);
+	shared->refcount--;
+	if(!shared->refcount)
+	{
+		for(sp = &mem_frontiers; *sp; sp = &((*sp)->next))
+		{
+			if(*sp == shared)
+			{
+				*sp = shared->next;
+				break;
+			}
+		}
+		if(shared->journal)
+		{
+			journal_close(shared->journal);
+		}
+		else
+		{
+			mem_snapshot_(shared);
+		}
+		frontier_destroy(shared->frontier);
+		pthread_mutex_destroy(&(shared->lock));
+		crawl_free(NULL, shared->snapshot);
+		crawl_free(NULL, shared->name);
+		crawl_free(NULL, shared);
+	}
+	pthread_mutex_unlock(&mem_lock);
+	crawl_free(me->crawl, me);
+	return 0;
+}
+
+static int
+mem_next(QUEUE *me, URI **next, CRAWLSTATE *state)
+{
+	struct mem_frontier_struct *shared;
+	FRONTIERRES *res;
+	time_t now;
+
+	*state = COS_NEW;
+	*next = NULL;
+	if(me->testuri)
+	{
+		*next = me->testuri;
+		*state = COS_FORCE;
+		me->testuri = NULL;
+		return 0;
+	}
+	if(me->oneshot)
+	{
+		return 0;
+	}
+	shared = me->shared;
+	now = time(NULL);
+	pthread_mutex_lock(&(shared->lock));
+	if(shared->snapshot && shared->interval > 0 && now - shared->last_snapshot >= shared->interval)
+	{
+		if(mem_snapshot_(shared))
+		{
+			me->spider->api->log(me->spider, LOG_ERR, "MEM: failed to write snapshot to %s: %s\n", shared->snapshot, strerror(errno));
+		}
+		shared->last_snapshot = now;
+	}
+	res = frontier_next(shared->frontier, now);
+	if(res)
+	{
+		*state = res->state;
+		*next = uri_create_str(res->uri, NULL);
+		if(!*next)
+		{
+			me->spider->api->log(me->spider, LOG_CRIT, MSG_C_DB_URIPARSE " <%s>\n", res->uri);
+			pthread_mutex_unlock(&(shared->lock));
+			return -1;
+		}
+	}
+	pthread_mutex_unlock(&(shared->lock));
+	return 0;
+}
+
+static int
+mem_add(QUEUE *me, URI *uri, const char *uristr)
+{
+	(void) uri;
+
+	return mem_add_(me, uristr, 0);
+}
+
+static int
+mem_force_add(QUEUE *me, URI *uri, const char *uristr)
+{
+	(void) uri;
+
+	return mem_add_(me, uristr, 1);
+}
+
+static int
+mem_updated_uri(QUEUE *me, URI *uri, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	char *uristr;
+	int r;
+
+	uristr = uri_stralloc(uri);
+	if(!uristr)
+	{
+		return -1;
+	}
+	r = mem_updated_uristr(me, uristr, updated, last_modified, status, ttl, state);
+	crawl_free(me->crawl, uristr);
+	return r;
+}
+
+static int
+mem_updated_uristr(QUEUE *me, const char *uristr, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	char cachekey[48];
+
+	if(mem_uristr_key_(me, uristr, cachekey))
+	{
+		return -1;
+	}
+	return mem_updated_key_(me, cachekey, updated, last_modified, status, ttl, state);
+}
+
+static int
+mem_updated_obj(QUEUE *me, CRAWLOBJ *obj, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	return mem_updated_key_(me, crawl_obj_key(obj), updated, last_modified, status, ttl, state);
+}
+
+static int
+mem_unchanged_uri(QUEUE *me, URI *uri, int error)
+{
+	char *uristr;
+	int r;
+
+	uristr = uri_stralloc(uri);
+	if(!uristr)
+	{
+		return -1;
+	}
+	r = mem_unchanged_uristr(me, uristr, error);
+	crawl_free(me->crawl, uristr);
+	return r;
+}
+
+static int
+mem_unchanged_uristr(QUEUE *me, const char *uristr, int error)
+{
+	char cachekey[48];
+
+	if(mem_uristr_key_(me, uristr, cachekey))
+	{
+		return -1;
+	}
+	return mem_unchanged_key_(me, cachekey, error);
+}
+
+/* The frontier is shared by all threads, so the partitioning of resources
+ * between crawlers and caches doesn't apply
+ */
+static int
+mem_set_crawlers(QUEUE *me, int count)
+{
+	(void) me;
+	(void) count;
+
+	return 0;
+}
+
+static int
+mem_set_caches(QUEUE *me, int count)
+{
+	(void) me;
+	(void) count;
+
+	return 0;
+}
+
+static int
+mem_set_crawler(QUEUE *me, int id)
+{
+	(void) me;
+	(void) id;
+
+	return 0;
+}
+
+static int
+mem_set_cache(QUEUE *me, int id)
+{
+	(void) me;
+	(void) id;
+
+	return 0;
+}
+
+static int
+mem_add_(QUEUE *me, const char *uristr, int force)
+{
+	char *canonical, *root;
+	char cachekey[48], rootkey[48];
+	uint32_t shortkey;
+	time_t now;
+	int r;
+
+	if(queue_uristr_keys_(me->crawl, uristr, &canonical, cachekey, &shortkey, &root, rootkey))
+	{
+		me->spider->api->log(me->spider, LOG_ERR, MSG_E_DB_URIPARSE " <%s>\n", uristr);
+		return -1;
+	}
+	now = time(NULL);
+	pthread_mutex_lock(&(me->shared->lock));
+	r = frontier_add(me->shared->frontier, cachekey, shortkey, canonical, rootkey, root, force, now);
+	/* Only changes to the frontier need to be journalled */
+	if(r > 0 && me->shared->journal)
+	{
+		r = journal_add(me->shared->journal, cachekey, shortkey, canonical, rootkey, root, force, now);
+	}
+	pthread_mutex_unlock(&(me->shared->lock));
+	crawl_free(me->crawl, canonical);
+	crawl_free(me->crawl, root);
+	return (r < 0 ? -1 : 0);
+}
+
+static int
+mem_updated_key_(QUEUE *me, const char *cachekey, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state)
+{
+	time_t now;
+	int r;
+
+	now = time(NULL);
+	pthread_mutex_lock(&(me->shared->lock));
+	r = frontier_updated(me->shared->frontier, cachekey, updated, last_modified, status, ttl, state, now);
+	if(!r && me->shared->journal)
+	{
+		r = journal_updated(me->shared->journal, cachekey, updated, last_modified, status, ttl, state, now);
+	}
+	pthread_mutex_unlock(&(me->shared->lock));
+	return r;
+}
+
+static int
+mem_unchanged_key_(QUEUE *me, const char *cachekey, int error)
+{
+	time_t now;
+	int r;
+
+	now = time(NULL);
+	pthread_mutex_lock(&(me->shared->lock));
+	r = frontier_unchanged(me->shared->frontier, cachekey, error, now);
+	if(!r && me->shared->journal)
+	{
+		r = journal_unchanged(me->shared->journal, cachekey, error, now);
+	}
+	pthread_mutex_unlock(&(me->shared->lock));
+	return r;
+}
+
+static int
+mem_uristr_key_(QUEUE *me, const char *uristr, char *cachekey)
+{
+	char *canonical, *root;
+	char rootkey[48];
+	uint32_t shortkey;
+
+	if(queue_uristr_keys_(me->crawl, uristr, &canonical, cachekey, &shortkey, &root, rootkey))
+	{
+		me->spider->api->log(me->spider, LOG_ERR, MSG_E_DB_URIPARSE " <%s>\n", uristr);
+		return -1;
+	}
+	crawl_free(me->crawl, canonical);
+	crawl_free(me->crawl, root);
+	return 0;
+}
+
+/* Write the frontier to the snapshot file, if one is configured; the
+ * caller must hold either the frontier's lock or the last reference to it
+ */
+static int
+mem_snapshot_(struct mem_frontier_struct *shared)
+{
+	char *tmp;
+	FILE *f;
+	int r;
+
+	if(!shared->snapshot)
+	{
+		return 0;
+	}
+	tmp = (char *) crawl_alloc(NULL, strlen(shared->snapshot) + 5);
+	strcpy(tmp, shared->snapshot);
+	strcat(tmp, ".tmp");
+	f = fopen(tmp, "w");
+	if(!f)
+	{
+		crawl_free(NULL, tmp);
+		return -1;
+	}
+	r = frontier_save(shared->frontier, f);
+	if(fclose(f))
+	{
+		r = -1;
+	}
+	if(!r)
+	{
+		r = rename(tmp, shared->snapshot);
+	}
+	if(r)
+	{
+		unlink(tmp);
+	}
+	crawl_free(NULL, tmp);
+	return r;
+}
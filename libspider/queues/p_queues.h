@@ -0,0 +1,139 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef P_QUEUES_H_
+# define P_QUEUES_H_                   1
+
+# include <stdio.h>
+# include <stdint.h>
+
+# include "libspider.h"
+
+/* The seen-set is a process-wide blocked Bloom filter of the cache keys of
+ * resources known to be in the queue, shared by all of the threads'
+ * queue instances. Lookups and insertions are lock-free; a false positive
+ * causes a new resource to be treated as already-queued, with a
+ * probability configured by queue:seen-fpr.
+ */
+
+/* Obtain a reference to the seen-set, creating it if it doesn't yet exist;
+ * returns 1 if it was created (and should be populated by the caller), 0 if
+ * it already existed or is disabled, or -1 on error
+ */
+int queue_seen_attach_(SPIDER *spider);
+/* Release a reference to the seen-set */
+void queue_seen_detach_(SPIDER *spider);
+/* Returns 1 if the cache key has probably been seen before, 0 otherwise */
+int queue_seen_check_(const char *cachekey);
+/* Add a cache key to the seen-set */
+void queue_seen_add_(const char *cachekey);
+/* Obtain the seen-set statistics */
+void queue_seen_stats_(unsigned long *hits, unsigned long *misses);
+
+/* A frontier is an in-memory index of resources and their roots, which
+ * yields resources in the same order as the database queue does: resources
+ * whose state is NEW first, then by root readiness (the later of the
+ * root's earliest_update and the resource's next_fetch), while ensuring
+ * that each root is fetched from no more often than its rate permits.
+ *
+ * Frontiers are not thread-safe; callers must serialise access to them.
+ */
+typedef struct frontier_struct FRONTIER;
+typedef struct frontier_root_struct FRONTIERROOT;
+typedef struct frontier_resource_struct FRONTIERRES;
+
+struct frontier_root_struct
+{
+	char key[36];
+	char *uri;
+	time_t earliest_update;
+	time_t last_updated;
+	/* Minimum interval between fetches, in milliseconds */
+	int rate;
+	/* Unclaimed resources belonging to this root, as a min-heap */
+	FRONTIERRES **heap;
+	size_t nheap;
+	size_t heapsize;
+	/* The time at which this root can next be fetched from */
+	time_t ready;
+	/* Which of the frontier's root heaps this root is in (or -1) */
+	int which;
+	size_t index;
+	FRONTIERROOT *next;
+};
+
+struct frontier_resource_struct
+{
+	char key[36];
+	uint32_t shortkey;
+	char *uri;
+	FRONTIERROOT *root;
+	CRAWLSTATE state;
+	time_t next_fetch;
+	time_t updated;
+	time_t last_modified;
+	int status;
+	int error_count;
+	int soft_error_count;
+	/* Nonzero if the resource has been dequeued and not yet updated */
+	int claimed;
+	size_t index;
+	FRONTIERRES *next;
+};
+
+FRONTIER *frontier_create(void);
+void frontier_destroy(FRONTIER *frontier);
+/* Add a resource (and its root, if it's not already present); returns 1
+ * if the resource was added (or forced), 0 if it was already present
+ */
+int frontier_add(FRONTIER *frontier, const char *key, uint32_t shortkey, const char *uri, const char *rootkey, const char *rooturi, int force, time_t now);
+/* Claim the next resource which is ready to be fetched, if any */
+FRONTIERRES *frontier_next(FRONTIER *frontier, time_t now);
+/* Record the result of a fetch, releasing any claim on the resource */
+int frontier_updated(FRONTIER *frontier, const char *key, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state, time_t now);
+int frontier_unchanged(FRONTIER *frontier, const char *key, int error, time_t now);
+/* Release all claims on resources, so that they can be dequeued again */
+int frontier_release_all(FRONTIER *frontier);
+FRONTIERRES *frontier_resource(FRONTIER *frontier, const char *key);
+size_t frontier_count(FRONTIER *frontier);
+/* Write all of the roots and resources to a file, or read them back */
+int frontier_save(FRONTIER *frontier, FILE *f);
+int frontier_load(FRONTIER *frontier, FILE *f);
+
+/* A journal records the changes made to a frontier in an append-only log
+ * within a directory, so that the frontier can be recovered following a
+ * restart. Callers must serialise access to journals in the same way as
+ * frontiers.
+ */
+typedef struct journal_struct JOURNAL;
+
+/* Open the journal in a directory and recover its frontier */
+JOURNAL *journal_open(SPIDER *spider, const char *path, FRONTIER *frontier);
+void journal_close(JOURNAL *journal);
+/* Record a change which has been successfully applied to the frontier */
+int journal_add(JOURNAL *journal, const char *key, uint32_t shortkey, const char *uri, const char *rootkey, const char *rooturi, int force, time_t now);
+int journal_updated(JOURNAL *journal, const char *key, time_t updated, time_t last_modified, int status, time_t ttl, CRAWLSTATE state, time_t now);
+int journal_unchanged(JOURNAL *journal, const char *key, int error, time_t now);
+/* Write a snapshot of the frontier and truncate the log, waiting for any
+ * background compaction to finish first
+ */
+int journal_compact(JOURNAL *journal);
+
+/* Derive the canonical form, cache key, and root URI and key of a URI */
+int queue_uristr_keys_(CRAWL *crawl, const char *uristr, char **uri, char *urikey, uint32_t *shortkey, char **root, char *rootkey);
+
+#endif /*!P_QUEUES_H_*/
@@ -0,0 +1,221 @@
+/* Author: agent <agent@local>
+ *
+ * Copyright 2026 agent
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/* A process-wide set of (probably) already-queued resources
+ *
+ * The filter is divided into 512-bit blocks, each the size of a typical
+ * cache line: the first half of a cache key selects a block, and the
+ * second half is used to derive the bits set within that block. Bits are
+ * only ever set, using atomic operations, so that the filter can be shared
+ * between threads without locking.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "p_queues.h"
+
+#define SEEN_BLOCK_WORDS               8
+#define SEEN_BLOCK_BITS                (SEEN_BLOCK_WORDS * 64)
+#define SEEN_MAX_HASHES                16
+#define DEFAULT_SEEN_FPR               "0.01"
+
+static int queue_seen_key_(const char *cachekey, uint64_t *block, uint64_t *bits);
+
+static pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long seen_refcount;
+static uint64_t *seen_filter;
+static uint64_t seen_nblocks;
+static unsigned int seen_nhashes;
+static unsigned long seen_hits, seen_misses;
+
+int
+queue_seen_attach_(SPIDER *spider)
+{
+	unsigned long size;
+	double fpr, p;
+	char *t;
+
+	pthread_mutex_lock(&seen_lock);
+	if(seen_refcount)
+	{
+		seen_refcount++;
+		pthread_mutex_unlock(&seen_lock);
+		return 0;
+	}
+	/* The size of the filter, in megabytes; if zero, the seen-set is
+	 * disabled
+	 */
+	size = (unsigned long) spider->api->config_get_int(spider, "queue:seen-size", 0);
+	if(!size)
+	{
+		pthread_mutex_unlock(&seen_lock);
+		return 0;
+	}
+	t = spider->api->config_geta(spider, "queue:seen-fpr", DEFAULT_SEEN_FPR);
+	fpr = (t ? strtod(t, NULL) : 0);
+	crawl_free(NULL, t);
+	if(fpr <= 0 || fpr >= 1)
+	{
+		fpr = strtod(DEFAULT_SEEN_FPR, NULL);
+	}
+	/* The optimal number of hash functions for a given false-positive rate
+	 * is -log2(fpr)
+	 */
+	for(seen_nhashes = 0, p = 1; p > fpr && seen_nhashes < SEEN_MAX_HASHES; p /= 2)
+	{
+		seen_nhashes++;
+	}
+	seen_nblocks = ((uint64_t) size * 1024 * 1024) / (SEEN_BLOCK_WORDS * sizeof(uint64_t));
+	seen_filter = (uint64_t *) calloc(seen_nblocks, SEEN_BLOCK_WORDS * sizeof(uint64_t));
+	if(!seen_filter)
+	{
+		spider->api->log(spider, LOG_ERR, "DB: failed to allocate %lu MB seen-set: %s\n", size, strerror(errno));
+		pthread_mutex_unlock(&seen_lock);
+		return -1;
+	}
+	seen_hits = 0;
+	seen_misses = 0;
+	seen_refcount = 1;
+	/* Capacity at the configured false-positive rate is m * ln(2) / k */
+	spider->api->log(spider, LOG_INFO, "DB: created %lu MB seen-set with %u hashes per key (capacity approximately %lu resources)\n",
+					 size, seen_nhashes, (unsigned long) ((seen_nblocks * SEEN_BLOCK_BITS * 0.6931) / seen_nhashes));
+	pthread_mutex_unlock(&seen_lock);
+	return 1;
+}
+
+void
+queue_seen_detach_(SPIDER *spider)
+{
+	pthread_mutex_lock(&seen_lock);
+	if(seen_refcount)
+	{
+		seen_refcount--;
+		if(!seen_refcount)
+		{
+			spider->api->log(spider, LOG_INFO, "DB: seen-set discarded after %lu hits, %lu misses\n", seen_hits, seen_misses);
+			free(seen_filter);
+			seen_filter = NULL;
+			seen_nblocks = 0;
+		}
+	}
+	pthread_mutex_unlock(&seen_lock);
+}
+
+int
+queue_seen_check_(const char *cachekey)
+{
+	uint64_t block, bits[SEEN_BLOCK_WORDS], *p;
+	size_t c;
+
+	if(!seen_filter || queue_seen_key_(cachekey, &block, bits))
+	{
+		return 0;
+	}
+	p = &(seen_filter[block * SEEN_BLOCK_WORDS]);
+	for(c = 0; c < SEEN_BLOCK_WORDS; c++)
+	{
+		if((__atomic_load_n(&(p[c]), __ATOMIC_RELAXED) & bits[c]) != bits[c])
+		{
+			__sync_fetch_and_add(&seen_misses, 1);
+			return 0;
+		}
+	}
+	__sync_fetch_and_add(&seen_hits, 1);
+	return 1;
+}
+
+void
+queue_seen_add_(const char *cachekey)
+{
+	uint64_t block, bits[SEEN_BLOCK_WORDS], *p;
+	size_t c;
+
+	if(!seen_filter || queue_seen_key_(cachekey, &block, bits))
+	{
+		return;
+	}
+	p = &(seen_filter[block * SEEN_BLOCK_WORDS]);
+	for(c = 0; c < SEEN_BLOCK_WORDS; c++)
+	{
+		if(bits[c])
+		{
+			__sync_fetch_and_or(&(p[c]), bits[c]);
+		}
+	}
+}
+
+void
+queue_seen_stats_(unsigned long *hits, unsigned long *misses)
+{
+	*hits = seen_hits;
+	*misses = seen_misses;
+}
+
+/* Derive the block index and the bits to be tested or set within it from
+ * a hexadecimal cache key
+ */
+static int
+queue_seen_key_(const char *cachekey, uint64_t *block, uint64_t *bits)
+{
+	uint64_t h[2];
+	uint32_t a, b, bit;
+	unsigned int c;
+	int n;
+	char ch;
+
+	h[0] = h[1] = 0;
+	for(c = 0; c < 32; c++)
+	{
+		ch = cachekey[c];
+		if(ch >= '0' && ch <= '9')
+		{
+			n = ch - '0';
+		}
+		else if(ch >= 'a' && ch <= 'f')
+		{
+			n = ch - 'a' + 10;
+		}
+		else if(ch >= 'A' && ch <= 'F')
+		{
+			n = ch - 'A' + 10;
+		}
+		else
+		{
+			return -1;
+		}
+		h[c / 16] = (h[c / 16] << 4) | (uint64_t) n;
+	}
+	*block = h[0] % seen_nblocks;
+	memset(bits, 0, sizeof(uint64_t) * SEEN_BLOCK_WORDS);
+	/* Double hashing within the block */
+	a = (uint32_t) h[1];
+	b = (uint32_t) (h[1] >> 32) | 1;
+	for(c = 0; c < seen_nhashes; c++)
+	{
+		bit = (a + (c * b)) % SEEN_BLOCK_BITS;
+		bits[bit / 64] |= ((uint64_t) 1) << (bit % 64);
+	}
+	return 0;
+}